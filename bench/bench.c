@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/lexer.h"
+#include "../include/parser.h"
+#include "../include/instruction.h"
+#include "../include/layout.h"
+#include "../include/elf_writer.h"
+
+// Benchmark harness: times each assembler phase over many runs and
+// reports median and p99 throughput per corpus. The parser lexes and
+// encodes as it goes, so the parse figure is parser_parse minus the
+// separately measured lex and encode passes over the same input.
+
+typedef enum {
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_ENCODE,
+    PHASE_LAYOUT,
+    PHASE_WRITE,
+    PHASE_COUNT
+} phase_t;
+
+// Phases faster than this are too noisy to fail the comparison
+#define MIN_COMPARED_SECONDS 0.001
+
+static const char* phase_names[PHASE_COUNT] = {"lex", "parse", "encode", "layout", "write"};
+
+typedef struct {
+    int runs;
+    double threshold;         // Allowed median slowdown, percent
+    const char* baseline;
+    bool save_baseline;
+    const char* output;       // Scratch object file for the write phase
+    arch_type_t arch;
+} bench_options_t;
+
+typedef struct {
+    char name[128];
+    uint64_t bytes;
+    int instructions;
+    double* seconds[PHASE_COUNT];   // One sample per run
+} corpus_result_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Sample at the given quantile of a sorted array (nearest rank)
+static double quantile(const double* sorted, int count, double q) {
+    int index = (int)(q * count + 0.999999) - 1;
+    if (index < 0) index = 0;
+    if (index >= count) index = count - 1;
+    return sorted[index];
+}
+
+static double time_lex(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+    lexer_t* lexer = lexer_create(file);
+
+    double start = now();
+    for (;;) {
+        token_t* token = lexer_next_token(lexer);
+        bool done = !token || token->type == TOKEN_EOF;
+        token_destroy(token);
+        if (done) break;
+    }
+    double elapsed = now() - start;
+
+    lexer_destroy(lexer);
+    fclose(file);
+    return elapsed;
+}
+
+// Re-encode every parsed instruction into a scratch buffer
+static double time_encode(program_t* program, arch_type_t arch) {
+    uint8_t scratch[16];
+
+    double start = now();
+    for (int i = 0; i < program->instruction_count; i++) {
+        encode_instruction(program->instructions[i], arch, scratch, sizeof(scratch));
+    }
+    return now() - start;
+}
+
+// One full run; fills seconds[phase][run]. Instructions come from arena,
+// which is reset afterwards so every run after the first reuses its chunks.
+static int run_once(const char* path, const bench_options_t* options, arena_t* arena,
+                    corpus_result_t* result, int run) {
+    double lex = time_lex(path);
+    if (lex < 0) {
+        fprintf(stderr, "Error: Cannot open '%s'\n", path);
+        return -1;
+    }
+
+    FILE* file = fopen(path, "r");
+    lexer_t* lexer = lexer_create(file);
+    parser_t* parser = parser_create(lexer, options->arch);
+    parser->arena = arena;
+
+    double start = now();
+    program_t* program = parser_parse(parser);
+    double parse = now() - start;
+    if (!program) {
+        fprintf(stderr, "Error: '%s' failed to parse: %s\n", path, parser->error_message);
+        parser_destroy(parser);
+        arena_reset(arena);
+        lexer_destroy(lexer);
+        fclose(file);
+        return -1;
+    }
+
+    double encode = time_encode(program, options->arch);
+
+    layout_options_t layout;
+    layout_options_init(&layout);
+    layout.placement = PLACEMENT_RELOCATABLE;
+    start = now();
+    int status = layout_program(program, options->arch, &layout);
+    double layout_time = now() - start;
+
+    start = now();
+    if (status == 0) {
+        status = elf_write_object(options->output, program, options->arch, path, NULL);
+    }
+    double write = now() - start;
+
+    result->instructions = program->instruction_count;
+    program_destroy(program);
+    parser_destroy(parser);
+    arena_reset(arena);
+    lexer_destroy(lexer);
+    fclose(file);
+    if (status != 0) {
+        fprintf(stderr, "Error: '%s' failed to assemble\n", path);
+        return -1;
+    }
+
+    double net_parse = parse - lex - encode;
+    result->seconds[PHASE_LEX][run] = lex;
+    result->seconds[PHASE_PARSE][run] = net_parse > 1e-9 ? net_parse : 1e-9;
+    result->seconds[PHASE_ENCODE][run] = encode;
+    result->seconds[PHASE_LAYOUT][run] = layout_time;
+    result->seconds[PHASE_WRITE][run] = write;
+    return 0;
+}
+
+static double baseline_lookup(FILE* file, const char* corpus, const char* phase) {
+    char name[128], phase_name[32];
+    double value;
+
+    rewind(file);
+    while (fscanf(file, "%127s %31s %lf", name, phase_name, &value) == 3) {
+        if (strcmp(name, corpus) == 0 && strcmp(phase_name, phase) == 0) {
+            return value;
+        }
+    }
+    return -1;
+}
+
+static void bench_usage(const char* name) {
+    printf("Usage: %s [options] <corpus.asm>...\n", name);
+    printf("  -n, --runs <n>          Runs per corpus (default 10)\n");
+    printf("  -b, --baseline <file>   Baseline medians to compare against\n");
+    printf("  -t, --threshold <pct>   Fail when a phase median is this much slower (default 25)\n");
+    printf("  -s, --save-baseline     Write the measured medians to the baseline file\n");
+    printf("  -o, --output <file>     Scratch object file (default /tmp/bench-<pid>.o)\n");
+}
+
+int main(int argc, char* argv[]) {
+    char default_output[64];
+    bench_options_t options = {10, 25.0, NULL, false, NULL, ARCH_X86_64};
+
+    static struct option long_options[] = {
+        {"runs", required_argument, 0, 'n'},
+        {"baseline", required_argument, 0, 'b'},
+        {"threshold", required_argument, 0, 't'},
+        {"save-baseline", no_argument, 0, 's'},
+        {"output", required_argument, 0, 'o'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:b:t:so:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'n': options.runs = atoi(optarg); break;
+            case 'b': options.baseline = optarg; break;
+            case 't': options.threshold = atof(optarg); break;
+            case 's': options.save_baseline = true; break;
+            case 'o': options.output = optarg; break;
+            case 'h': bench_usage(argv[0]); return 0;
+            default: return 1;
+        }
+    }
+    if (optind >= argc || options.runs < 1) {
+        bench_usage(argv[0]);
+        return 1;
+    }
+    if (!options.output) {
+        snprintf(default_output, sizeof(default_output), "/tmp/bench-%d.o", (int)getpid());
+        options.output = default_output;
+    }
+
+    // Without a stored baseline the first run records one
+    FILE* baseline = NULL;
+    if (options.baseline && !options.save_baseline) {
+        baseline = fopen(options.baseline, "r");
+        if (!baseline) {
+            printf("No baseline at %s, recording one\n", options.baseline);
+            options.save_baseline = true;
+        }
+    }
+    FILE* saved = NULL;
+    if (options.baseline && options.save_baseline) {
+        saved = fopen(options.baseline, "w");
+        if (!saved) {
+            fprintf(stderr, "Error: Cannot write baseline '%s'\n", options.baseline);
+            return 1;
+        }
+    }
+
+    printf("%-16s %-7s %10s %10s %12s %12s %9s\n", "corpus", "phase", "MB/s p50", "MB/s p99",
+           "Minstr/s p50", "Minstr/s p99", "vs base");
+
+    arena_t* arena = arena_create(false);
+    if (!arena) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+
+    int regressions = 0;
+    int status = 0;
+    for (int i = optind; i < argc && status == 0; i++) {
+        corpus_result_t result;
+        struct stat st;
+
+        memset(&result, 0, sizeof(result));
+        const char* base_name = strrchr(argv[i], '/');
+        snprintf(result.name, sizeof(result.name), "%s", base_name ? base_name + 1 : argv[i]);
+        if (stat(argv[i], &st) != 0) {
+            fprintf(stderr, "Error: Cannot open '%s'\n", argv[i]);
+            status = 1;
+            break;
+        }
+        result.bytes = st.st_size;
+
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            result.seconds[p] = calloc(options.runs, sizeof(double));
+        }
+        for (int run = 0; run < options.runs && status == 0; run++) {
+            if (run_once(argv[i], &options, arena, &result, run) != 0) status = 1;
+        }
+
+        for (int p = 0; p < PHASE_COUNT && status == 0; p++) {
+            qsort(result.seconds[p], options.runs, sizeof(double), compare_double);
+            double median = quantile(result.seconds[p], options.runs, 0.5);
+            double p99 = quantile(result.seconds[p], options.runs, 0.99);
+            double mbps = result.bytes / median / 1e6;
+
+            char versus[16] = "-";
+            if (baseline) {
+                double reference = baseline_lookup(baseline, result.name, phase_names[p]);
+                if (reference > 0) {
+                    double change = (mbps / reference - 1.0) * 100.0;
+                    snprintf(versus, sizeof(versus), "%+.1f%%", change);
+                    if (change < -options.threshold && median >= MIN_COMPARED_SECONDS) {
+                        regressions++;
+                        strcat(versus, " !");
+                    }
+                }
+            }
+
+            printf("%-16s %-7s %10.1f %10.1f %12.2f %12.2f %9s\n", result.name, phase_names[p],
+                   mbps, result.bytes / p99 / 1e6,
+                   result.instructions / median / 1e6, result.instructions / p99 / 1e6, versus);
+            if (saved) {
+                fprintf(saved, "%s %s %.3f\n", result.name, phase_names[p], mbps);
+            }
+        }
+
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            free(result.seconds[p]);
+        }
+    }
+
+    arena_destroy(arena);
+    if (baseline) fclose(baseline);
+    if (saved) fclose(saved);
+    remove(options.output);
+    if (status != 0) return status;
+
+    if (regressions) {
+        printf("FAIL: %d phase(s) regressed more than %.0f%% against %s\n", regressions,
+               options.threshold, options.baseline);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <getopt.h>
+
+// Synthetic assembly corpus generator for the benchmark harness. Output
+// is deterministic for a given seed and set of options.
+
+typedef enum {
+    MIX_ALU,
+    MIX_MOV,
+    MIX_MEMORY,
+    MIX_BRANCH,
+    MIX_VECTOR,
+    MIX_MISC,
+    MIX_COUNT
+} mix_class_t;
+
+static const char* mix_names[MIX_COUNT] = {"alu", "mov", "mem", "branch", "vector", "misc"};
+
+typedef struct {
+    uint64_t size;            // Target corpus size in bytes
+    int mix[MIX_COUNT];       // Relative weights
+    double label_density;     // Probability of a label before an instruction
+    double comment_ratio;     // Probability of a trailing or full-line comment
+    uint64_t data_size;       // Bytes of dd tables in .data
+    uint64_t seed;
+    const char* output;
+} corpus_options_t;
+
+static const char* gp64[] = {"rax", "rbx", "rcx", "rdx", "rsi", "rdi", "r8", "r9",
+                             "r10", "r11", "r12", "r13", "r14", "r15"};
+static const char* gp32[] = {"eax", "ebx", "ecx", "edx", "esi", "edi", "r8d", "r9d"};
+static const char* alu_ops[] = {"add", "sub", "and", "or", "xor", "cmp", "test"};
+static const char* jcc_ops[] = {"jmp", "je", "jne", "jl", "jg", "jb", "jae", "jle"};
+static const char* sse_ops[] = {"addps", "mulps", "subpd", "xorps", "paddd", "pxor"};
+static const char* avx_ops[] = {"vaddps", "vmulpd", "vfmadd231ps", "vpxord", "vpaddd", "vsubps"};
+static const char* misc_ops[] = {"nop", "inc rax", "dec rcx", "push rbx", "pop rbx", "shl rdx, 3", "not r8"};
+static const char* comments[] = {"; loop body", "; update the accumulator", "; TODO: unroll",
+                                 "; spill to the stack frame", "; bounds check"};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+// xorshift64*: fast and reproducible across platforms
+static uint64_t rng_state;
+
+static uint64_t next_random(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static unsigned pick(unsigned count) {
+    return (unsigned)(next_random() % count);
+}
+
+static bool chance(double probability) {
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0) < probability;
+}
+
+// 64K, 8M, 1G and plain byte counts
+static uint64_t parse_size(const char* text) {
+    char* end;
+    uint64_t value = strtoull(text, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': return value << 10;
+        case 'm': case 'M': return value << 20;
+        case 'g': case 'G': return value << 30;
+        default: return value;
+    }
+}
+
+// alu=40,mov=30,... ; unnamed classes keep weight 0
+static int parse_mix(const char* text, int* mix) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", text);
+    memset(mix, 0, MIX_COUNT * sizeof(int));
+
+    for (char* item = strtok(buffer, ","); item; item = strtok(NULL, ",")) {
+        char* equals = strchr(item, '=');
+        if (!equals) return -1;
+        *equals = '\0';
+
+        int found = -1;
+        for (int i = 0; i < MIX_COUNT; i++) {
+            if (strcmp(item, mix_names[i]) == 0) found = i;
+        }
+        if (found < 0) return -1;
+        mix[found] = atoi(equals + 1);
+    }
+    return 0;
+}
+
+static mix_class_t pick_class(const int* mix, int total) {
+    int r = (int)pick(total);
+    for (int i = 0; i < MIX_COUNT; i++) {
+        if (r < mix[i]) return (mix_class_t)i;
+        r -= mix[i];
+    }
+    return MIX_MISC;
+}
+
+// One instruction line without the newline; returns its length
+static int format_instruction(char* line, size_t size, mix_class_t cls, uint64_t labels) {
+    switch (cls) {
+        case MIX_ALU:
+            if (chance(0.5)) {
+                return snprintf(line, size, "    %s %s, %s", alu_ops[pick(COUNT(alu_ops))],
+                                gp64[pick(COUNT(gp64))], gp64[pick(COUNT(gp64))]);
+            }
+            return snprintf(line, size, "    %s %s, %u", alu_ops[pick(COUNT(alu_ops) - 1)],
+                            gp32[pick(COUNT(gp32))], pick(100000));
+        case MIX_MOV:
+            if (chance(0.5)) {
+                return snprintf(line, size, "    mov %s, %s", gp64[pick(COUNT(gp64))], gp64[pick(COUNT(gp64))]);
+            }
+            return snprintf(line, size, "    mov %s, 0x%x", gp32[pick(COUNT(gp32))], pick(0x7fffffff));
+        case MIX_MEMORY:
+            if (chance(0.5)) {
+                return snprintf(line, size, "    mov %s, [%s+%s*%d+%u]", gp64[pick(COUNT(gp64))],
+                                gp64[pick(6)], gp64[pick(6)], 1 << pick(4), pick(256) * 8);
+            }
+            return snprintf(line, size, "    mov [%s+%u], %s", gp64[pick(6)], pick(512) * 8,
+                            gp64[pick(COUNT(gp64))]);
+        case MIX_BRANCH:
+            // Backward targets only, so every reference is defined
+            if (labels == 0) return snprintf(line, size, "    nop");
+            return snprintf(line, size, "    %s L%llu", jcc_ops[pick(COUNT(jcc_ops))],
+                            (unsigned long long)(labels - 1 - pick(labels < 16 ? (unsigned)labels : 16)));
+        case MIX_VECTOR:
+            if (chance(0.4)) {
+                unsigned a = pick(16), b = pick(16);
+                return snprintf(line, size, "    %s xmm%u, xmm%u", sse_ops[pick(COUNT(sse_ops))], a, b);
+            }
+            {
+                const char* width = chance(0.5) ? "ymm" : "zmm";
+                return snprintf(line, size, "    %s %s%u, %s%u, %s%u", avx_ops[pick(COUNT(avx_ops))],
+                                width, pick(16), width, pick(16), width, pick(16));
+            }
+        default:
+            return snprintf(line, size, "    %s", misc_ops[pick(COUNT(misc_ops))]);
+    }
+}
+
+static void print_usage(const char* name) {
+    printf("Usage: %s [options]\n", name);
+    printf("  -s, --size <n>            Corpus size (bytes, or with K/M/G suffix; default 1M)\n");
+    printf("  -m, --mix <spec>          Instruction mix weights, e.g. alu=40,mov=20,mem=15,branch=10,vector=10,misc=5\n");
+    printf("  -l, --label-density <p>   Probability of a label before each instruction (default 0.05)\n");
+    printf("  -c, --comment-ratio <p>   Probability of a comment on each line (default 0.1)\n");
+    printf("  -d, --data-size <n>       Bytes of dd tables in .data (default 0)\n");
+    printf("  -r, --seed <n>            Random seed (default 1)\n");
+    printf("  -o, --output <file>       Output file (default stdout)\n");
+}
+
+static int generate(const corpus_options_t* options, FILE* out) {
+    uint64_t written = 0;
+    uint64_t labels = 0;
+    int total = 0;
+    char line[256];
+
+    for (int i = 0; i < MIX_COUNT; i++) total += options->mix[i];
+    if (total <= 0) {
+        fprintf(stderr, "Error: Instruction mix has no weight\n");
+        return -1;
+    }
+
+    written += fprintf(out, "; Synthetic corpus, seed %llu\n", (unsigned long long)options->seed);
+    if (options->data_size) {
+        written += fprintf(out, "section .data\ntable:\n");
+        for (uint64_t bytes = 0; bytes < options->data_size; bytes += 16) {
+            written += fprintf(out, "    dd %u, %u, %u, %u\n", pick(1u << 31), pick(1u << 31),
+                               pick(1u << 31), pick(1u << 31));
+        }
+    }
+    written += fprintf(out, "section .text\nglobal _start\n_start:\n");
+
+    while (written < options->size) {
+        if (chance(options->label_density)) {
+            written += fprintf(out, "L%llu:\n", (unsigned long long)labels++);
+        }
+        if (chance(options->comment_ratio / 2)) {
+            written += fprintf(out, "%s\n", comments[pick(COUNT(comments))]);
+        }
+
+        int length = format_instruction(line, sizeof(line), pick_class(options->mix, total), labels);
+        if (chance(options->comment_ratio / 2)) {
+            length += snprintf(line + length, sizeof(line) - length, " %s", comments[pick(COUNT(comments))]);
+        }
+        line[length++] = '\n';
+        fwrite(line, 1, length, out);
+        written += length;
+    }
+
+    written += fprintf(out, "    ret\n");
+    return ferror(out) ? -1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    corpus_options_t options = {
+        .size = 1 << 20,
+        .mix = {40, 20, 15, 10, 10, 5},
+        .label_density = 0.05,
+        .comment_ratio = 0.1,
+        .data_size = 0,
+        .seed = 1,
+        .output = NULL
+    };
+
+    static struct option long_options[] = {
+        {"size", required_argument, 0, 's'},
+        {"mix", required_argument, 0, 'm'},
+        {"label-density", required_argument, 0, 'l'},
+        {"comment-ratio", required_argument, 0, 'c'},
+        {"data-size", required_argument, 0, 'd'},
+        {"seed", required_argument, 0, 'r'},
+        {"output", required_argument, 0, 'o'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "s:m:l:c:d:r:o:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 's': options.size = parse_size(optarg); break;
+            case 'm':
+                if (parse_mix(optarg, options.mix) != 0) {
+                    fprintf(stderr, "Error: Invalid mix '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l': options.label_density = atof(optarg); break;
+            case 'c': options.comment_ratio = atof(optarg); break;
+            case 'd': options.data_size = parse_size(optarg); break;
+            case 'r': options.seed = strtoull(optarg, NULL, 10); break;
+            case 'o': options.output = optarg; break;
+            case 'h': print_usage(argv[0]); return 0;
+            default: return 1;
+        }
+    }
+
+    if (options.size > (1ULL << 30)) {
+        fprintf(stderr, "Error: Corpus size is limited to 1G\n");
+        return 1;
+    }
+
+    rng_state = options.seed ? options.seed : 1;
+    FILE* out = options.output ? fopen(options.output, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: Cannot create '%s'\n", options.output);
+        return 1;
+    }
+
+    int result = generate(&options, out);
+    if (options.output && fclose(out) != 0) result = -1;
+    if (result != 0) {
+        fprintf(stderr, "Error: Failed to write the corpus\n");
+        return 1;
+    }
+    return 0;
+}
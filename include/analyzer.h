@@ -0,0 +1,13 @@
+#ifndef ANALYZER_H
+#define ANALYZER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "parser.h"
+#include "assembler.h"
+
+// Function declarations
+bool analyzer_supports_uarch(const char* uarch);
+int analyze_program(program_t* program, arch_type_t arch, const char* uarch, FILE* output);
+
+#endif // ANALYZER_H
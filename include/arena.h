@@ -0,0 +1,41 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ARENA_ALIGNMENT 16                  // Every allocation starts on this boundary
+#define ARENA_FIRST_CHUNK (64 * 1024)       // Chunks double from here...
+#define ARENA_MAX_CHUNK (64 * 1024 * 1024)  // ...up to here
+#define ARENA_HUGE_PAGE (2 * 1024 * 1024)   // Chunks this large can use huge pages
+
+typedef struct arena_chunk {
+    struct arena_chunk* next;   // Later chunk, in allocation order
+    size_t size;                // Usable bytes
+    size_t mapped;              // Length of the mmap backing this chunk, 0 if malloc'd
+} arena_chunk_t;
+
+// Region allocator for data that lives until the end of a run. Allocation
+// bumps a pointer through chunks that double in size; nothing is freed
+// individually. arena_reset rewinds to the first chunk and keeps them all,
+// so the next run reuses the memory. Not thread safe.
+typedef struct {
+    arena_chunk_t* chunks;      // First chunk
+    arena_chunk_t* last;        // Most recently added chunk
+    arena_chunk_t* current;     // Chunk being filled
+    size_t used;                // Bytes taken from current
+    size_t next_size;           // Size of the next new chunk
+    bool huge_pages;            // Back large chunks with transparent huge pages
+    uint64_t allocated;         // Bytes handed out since the last reset
+    uint64_t reserved;          // Bytes held in chunks
+} arena_t;
+
+// Function declarations
+arena_t* arena_create(bool huge_pages);
+void arena_destroy(arena_t* arena);
+void arena_reset(arena_t* arena);
+void* arena_alloc(arena_t* arena, size_t size);
+char* arena_strdup(arena_t* arena, const char* text);
+
+#endif // ARENA_H
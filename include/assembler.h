@@ -20,21 +20,52 @@ typedef enum {
 typedef enum {
     FORMAT_ELF,
     FORMAT_PE,
-    FORMAT_BIN
+    FORMAT_BIN,
+    FORMAT_ELF_EXEC
 } output_format_t;
 
+#define ASSEMBLER_MAX_TARGETS 5       // -a takes each architecture at most once
+
 // Main assembler context
 typedef struct {
     arch_type_t architecture;
+    arch_type_t targets[ASSEMBLER_MAX_TARGETS]; // -a a,b,...; the first is architecture
+    const char* target_outputs[ASSEMBLER_MAX_TARGETS]; // Output file of each target
+    int target_count;
     output_format_t output_format;
     const char* input_file;
     const char* output_file;
     bool debug_mode;
+    bool debug_info;            // -g: DWARF line table
+    bool align_branches;
+    const char* analyze_uarch;  // NULL unless --analyze was given
+    bool huge_text;             // elfexec: 2 MB-aligned text segment
+    const char* profile_file;   // --profile: block/edge counts for code layout, or NULL
+    bool run;                   // Load into memory and call the entry point
+    bool perf_map;              // --run: append to /tmp/perf-<pid>.map
+    const char* jitdump_dir;    // --run: directory for jit-<pid>.dump, or NULL
+    int exit_status;            // --run: value returned by the entry point
+    const char* stats_format;   // --stats: "text" or "json", or NULL
+    bool pipeline;              // Lex, parse and encode on separate threads
+    bool stream;                // --stream: free instructions once encoded
+    bool huge_arena;            // --huge-arena: huge pages for the instruction arena
+    bool pack_data;             // --pack-data: reorder .data/.rodata items to cut padding
+    bool merge_constants;       // --merge-constants: dedup identical .rodata constants
+    const char* cache_dir;      // --cache: object cache directory, or NULL
+    uint64_t cache_size;        // --cache-size: eviction threshold in bytes
+    bool cache_hardlink;        // --cache-hardlink: serve hits as hard links
+    const char* const* link_inputs; // --link: sources of one executable, else NULL
+    int link_input_count;
+    const char* const* bench_inputs; // --bench: snippets to time, else NULL
+    int bench_input_count;
+    int bench_runs;             // --bench-runs: timed runs per snippet
+    int bench_unroll;           // --bench-unroll: copies per loop iteration
 } assembler_context_t;
 
 // Function declarations
 int assemble_file(assembler_context_t* ctx);
 void print_usage(const char* program_name);
 int parse_arguments(int argc, char* argv[], assembler_context_t* ctx);
+const char* architecture_name(arch_type_t arch);
 
 #endif // ASSEMBLER_H 
\ No newline at end of file
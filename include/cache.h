@@ -0,0 +1,29 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include "assembler.h"
+
+#define CACHE_DEFAULT_SIZE (1ULL << 30)
+
+// Content-addressed store of finished output files. An entry is keyed on
+// the input bytes and every option that changes the output, and lives at
+// <directory>/<2 hex digits>/<30 hex digits>.
+typedef struct {
+    const char* directory;
+    uint64_t max_size;          // Evict least recently used entries past this
+    bool hardlink;              // Serve hits as hard links instead of copies
+    uint64_t key[2];
+    char entry_path[PATH_MAX];
+} cache_t;
+
+// Function declarations
+int cache_init(cache_t* cache, const assembler_context_t* ctx);
+int cache_fetch(cache_t* cache, const char* output_file);
+int cache_store(cache_t* cache, const char* output_file);
+const char* cache_default_directory(void);
+uint64_t cache_hash(const void* data, size_t length, uint64_t seed);
+
+#endif // CACHE_H
@@ -0,0 +1,48 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "parser.h"
+#include "assembler.h"
+
+// Basic block of .text: from a label, or the instruction after a jump, up
+// to the next jump or label
+typedef struct {
+    int first;                  // Index of the first instruction
+    int last;                   // Index of the last instruction
+    uint64_t start;             // Code offset of the first instruction
+    uint64_t end;               // Start of the next block; bytes in between belong here
+    const char* label;          // A label defined at start, or NULL
+    int fallthrough;            // Block reached by running off the end, or -1
+    int target;                 // Block named by a jmp/jcc at the end, or -1
+    bool conditional;           // Ends in a conditional jump
+    uint64_t count;             // Executions, from the profile
+    uint64_t fallthrough_count; // Profile counts of the two outgoing edges
+    uint64_t target_count;
+} cfg_block_t;
+
+// Control-flow graph of the parsed program, blocks in code order
+typedef struct {
+    program_t* program;
+    cfg_block_t* blocks;
+    int block_count;
+} cfg_t;
+
+// What cfg_reorder changed
+typedef struct {
+    int hot_blocks;
+    int cold_blocks;
+    int inverted_jumps;         // jcc turned around to fall into its old target
+    int added_jumps;            // jmp appended where a fall-through was broken
+    int removed_jumps;          // jmp dropped because its target now follows
+} cfg_layout_stats_t;
+
+// Function declarations
+cfg_t* cfg_build(program_t* program);
+void cfg_destroy(cfg_t* cfg);
+int cfg_read_profile(cfg_t* cfg, const char* path, int* unmatched);
+int cfg_reorder(cfg_t* cfg, arch_type_t arch, cfg_layout_stats_t* stats);
+int cfg_apply_profile(program_t* program, arch_type_t arch, const char* path, bool verbose);
+
+#endif // CFG_H
@@ -0,0 +1,36 @@
+#ifndef DATA_LAYOUT_H
+#define DATA_LAYOUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "parser.h"
+
+#define DATA_NATURAL_ALIGNMENT 16   // Most alignment an item gets from its size alone
+
+// A label-delimited item of .data or .rodata: from a label to the next
+// one, less the padding of an align directive right before that label.
+// Items can be moved as a whole once labels are updated.
+typedef struct {
+    uint64_t start;             // Offset before layout
+    uint64_t length;
+    uint64_t alignment;         // Requested by align at start, else 1
+    bool hot;                   // A label at start was named by .hot
+    uint64_t placed;            // Offset after layout
+} data_item_t;
+
+// --pack-data lays .data out as hot items first, then by falling
+// alignment, each aligned as its size implies or as align asked. Without
+// holes between alignment classes, padding only remains where align asked
+// for more than the items before it fill.
+
+// Function declarations
+int data_items_collect(const program_t* program, int section, uint64_t size, data_item_t** items);
+int data_item_find(const data_item_t* items, int count, uint64_t offset);
+uint64_t data_item_natural_alignment(const data_item_t* item);
+void data_items_sort(data_item_t** order, int count);
+uint64_t data_items_place(data_item_t** order, int count, uint64_t offset);
+bool data_layout_pack(program_t* program);
+int data_reference_crossing(const program_t* program, int section, uint64_t size,
+                            const data_reference_t* references, int count);
+
+#endif // DATA_LAYOUT_H
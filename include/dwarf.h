@@ -0,0 +1,67 @@
+#ifndef DWARF_H
+#define DWARF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "parser.h"
+#include "assembler.h"
+
+// Sections a debug relocation can point into
+typedef enum {
+    DWARF_TARGET_TEXT,
+    DWARF_TARGET_ABBREV,
+    DWARF_TARGET_LINE,
+    DWARF_TARGET_TEXT_COLD
+} dwarf_target_t;
+
+// Debug sections generated for -g
+typedef enum {
+    DWARF_SECTION_ABBREV,
+    DWARF_SECTION_INFO,
+    DWARF_SECTION_LINE,
+    DWARF_SECTION_COUNT
+} dwarf_section_t;
+
+// Address or section offset inside a debug section that the object writer
+// must relocate (or, for executables, fill in)
+typedef struct {
+    dwarf_section_t section;
+    uint64_t offset;
+    int size;
+    dwarf_target_t target;
+    int64_t addend;       // Offset within the target section
+} dwarf_relocation_t;
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} dwarf_buffer_t;
+
+// DWARF 5 line table plus the compile unit that points at it
+typedef struct {
+    int address_size;
+    dwarf_buffer_t sections[DWARF_SECTION_COUNT];
+    dwarf_relocation_t* relocations;
+    int relocation_count;
+    int relocation_capacity;
+    
+    // Line-number state machine registers
+    uint64_t address;
+    int line;
+    int column;
+    bool sequence_started;
+    dwarf_target_t text_target; // Section of the current sequence
+    size_t program_start;   // Offset of the first line-program opcode
+    bool failed;
+} dwarf_t;
+
+// Function declarations
+dwarf_t* dwarf_create(arch_type_t arch, const char* source_name);
+void dwarf_destroy(dwarf_t* dwarf);
+void dwarf_add_row(dwarf_t* dwarf, uint64_t address, int line, int column);
+int dwarf_finish(dwarf_t* dwarf, uint64_t end_address, const char* source_name);
+int dwarf_build_line_table(dwarf_t* dwarf, const program_t* program, const char* source_name);
+
+#endif // DWARF_H
@@ -0,0 +1,17 @@
+#ifndef ELF_WRITER_H
+#define ELF_WRITER_H
+
+#include "parser.h"
+#include "assembler.h"
+#include "layout.h"
+#include "dwarf.h"
+
+// Function declarations
+// debug may be NULL; otherwise its DWARF sections are included
+int elf_write_object(const char* filename, program_t* program, arch_type_t arch, const char* source_name,
+                     dwarf_t* debug);
+int elf_write_executable(const char* filename, program_t* program, arch_type_t arch, const char* source_name,
+                         const layout_options_t* layout, dwarf_t* debug);
+uint64_t elf_default_image_base(arch_type_t arch);
+
+#endif // ELF_WRITER_H
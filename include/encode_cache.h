@@ -0,0 +1,52 @@
+#ifndef ENCODE_CACHE_H
+#define ENCODE_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "instruction.h"
+
+#define ENCODE_CACHE_SLOTS 2048        // Direct-mapped, power of two
+#define ENCODE_CACHE_MNEMONIC 16       // Longer mnemonics are not cached
+#define ENCODE_CACHE_KEY_BYTES 160
+#define ENCODE_CACHE_MAX_BYTES 16      // Longest encoding kept
+#define ENCODE_CACHE_WINDOW 1024       // Lookups per hit-rate sample
+#define ENCODE_CACHE_BYPASS 15         // Windows skipped after a poor sample
+
+// Encoded bytes of one instruction form. The key packs the mnemonic and
+// every operand field the encoders read; label operands contribute only
+// their kind, so a branch to any label shares one template whose
+// placeholder field is described by the fixup fields. The same goes for a
+// label in a memory operand, whose displacement is part of the key.
+typedef struct {
+    uint32_t hash;                     // 0: empty slot
+    uint16_t key_length;
+    uint8_t size;
+    int8_t label_operand;              // Operand named by the fixup, or -1
+    fixup_kind_t fixup_kind;
+    uint8_t fixup_offset;
+    uint8_t fixup_size;
+    int64_t fixup_addend;
+    uint8_t bytes[ENCODE_CACHE_MAX_BYTES];
+    uint8_t key[ENCODE_CACHE_KEY_BYTES];
+} encode_cache_entry_t;
+
+// Memoizes encode_instruction for one target architecture. Not thread
+// safe: owned by whichever thread encodes the program. When a window of
+// lookups hits less than a quarter of the time, the cache costs more than
+// it saves, so it is bypassed for a while before sampling again.
+typedef struct {
+    arch_type_t architecture;
+    uint64_t hits;
+    uint64_t misses;                   // Includes uncacheable and bypassed forms
+    uint32_t window_lookups;
+    uint32_t window_hits;
+    uint32_t bypass;                   // Lookups left to skip
+    encode_cache_entry_t entries[ENCODE_CACHE_SLOTS];
+} encode_cache_t;
+
+// Function declarations
+encode_cache_t* encode_cache_create(arch_type_t arch);
+void encode_cache_destroy(encode_cache_t* cache);
+int encode_cached(encode_cache_t* cache, instruction_t* instr, uint8_t* output, int max_size);
+
+#endif // ENCODE_CACHE_H
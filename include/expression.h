@@ -0,0 +1,24 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "parser.h"
+
+#define EXPRESSION_ABSOLUTE -1
+
+// Value of a constant expression: a plain number, or an offset into one
+// section (from $ or a label). The difference of two offsets in the same
+// section is a plain number again.
+typedef struct {
+    int64_t value;
+    int section;                  // EXPRESSION_ABSOLUTE or a section_type_t
+} expression_value_t;
+
+// Function declarations
+bool expression_starts(parser_t* parser);
+bool parse_expression(parser_t* parser, expression_value_t* result);
+bool parse_constant(parser_t* parser, int64_t* value);
+bool parse_constant_term(parser_t* parser, int64_t* value);
+
+#endif // EXPRESSION_H
@@ -0,0 +1,28 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "pipeline.h"
+
+// -a a,b,...: the source is lexed and parsed once, for the first target.
+// The parser also records its .text items here, in order; every other
+// target is encoded from that record on its own thread, with its own copy
+// of the symbol table, since .text label addresses depend on encoded sizes.
+typedef struct fanout {
+    ir_item_t* items;            // Instructions are owned by the first program
+    int item_count;
+    int item_capacity;
+    int instruction_count;
+    bool text_addresses_read;    // A constant used a .text address, which
+                                 // only holds for the first target
+} fanout_t;
+
+// Function declarations
+void fanout_init(fanout_t* fanout);
+void fanout_free(fanout_t* fanout);
+bool fanout_record_instruction(fanout_t* fanout, instruction_t* instr, uint64_t repeat);
+bool fanout_record_label(fanout_t* fanout, int symbol);
+int fanout_encode(const fanout_t* fanout, const program_t* source,
+                  const arch_type_t* targets, int count, program_t** programs);
+void fanout_program_destroy(program_t* program);
+
+#endif // FANOUT_H
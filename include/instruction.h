@@ -1,9 +1,11 @@
 #ifndef INSTRUCTION_H
 #define INSTRUCTION_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "assembler.h"
+#include "arena.h"
 
 // Operand types
 typedef enum {
@@ -14,12 +16,21 @@ typedef enum {
     OPERAND_LABEL
 } operand_type_t;
 
+// Register flags
+#define REG_FLAG_REX_REQUIRED 0x01  // spl, bpl, sil, dil: only addressable with a REX prefix
+#define REG_FLAG_NO_REX       0x02  // ah, ch, dh, bh: not addressable when a REX prefix is present
+#define REG_FLAG_VECTOR       0x04  // xmm/ymm/zmm register
+#define REG_FLAG_MASK         0x08  // AVX-512 opmask register (k0-k7)
+
 // Register encoding
+// `arch` is the lowest x86 mode in which the register can be encoded
+// (ARCH_X86_16 < ARCH_X86_32 < ARCH_X86_64).
 typedef struct {
     char* name;
     uint8_t encoding;
     int size_bits;
     arch_type_t arch;
+    uint8_t flags;
 } register_info_t;
 
 // Operand structure
@@ -40,34 +51,88 @@ typedef struct {
             int scale;
             int64_t displacement;
             int size_bits;
+            char* label;        // [label + disp]: displacement from this label, or NULL
+            bool relative;      // Written [rel ...]
         } mem;
         struct {
             char* name;
         } label;
     } data;
+    
+    // AVX-512 decorators
+    register_info_t* mask;  // {k1}-{k7} write mask
+    bool zeroing;           // {z}
+    int broadcast;          // {1toN} element count, 0 if none
 } operand_t;
 
+// Label reference left as a placeholder field in the encoded bytes
+typedef enum {
+    FIXUP_NONE,
+    FIXUP_RELATIVE,   // Label - end of instruction (branches, RIP-relative addresses)
+    FIXUP_ABSOLUTE    // Label address
+} fixup_kind_t;
+
+#define INSTRUCTION_MAX_OPERANDS 4  // vshufps xmm0, xmm1, xmm2, imm8
+
 // Instruction structure
 typedef struct {
     char* mnemonic;
-    operand_t operands[3];
+    operand_t operands[INSTRUCTION_MAX_OPERANDS];
     int operand_count;
     int line;
     int column;
+    
+    // Placement in the code section, set by the parser and updated by layout
+    uint64_t address;
+    int size;
+    
+    // Set by encode_instruction when the encoding refers to a label
+    fixup_kind_t fixup_kind;
+    int fixup_offset;         // Offset of the field within the encoding
+    int fixup_size;           // Field width in bytes
+    const char* fixup_label;  // Points at the name in the label or memory operand
+    int64_t fixup_addend;     // Added to the label's address ([label + disp])
+    
+    arena_t* arena;           // Holds the instruction and its strings, or NULL
+                              // when they are malloc'd
 } instruction_t;
 
 // Function declarations
-instruction_t* instruction_create(const char* mnemonic);
+instruction_t* instruction_create(arena_t* arena, const char* mnemonic);
 void instruction_destroy(instruction_t* instr);
 void instruction_add_operand(instruction_t* instr, operand_t* operand);
+bool instruction_add_label(instruction_t* instr, const char* label_name);
+instruction_t* instruction_clone(arena_t* arena, const instruction_t* instr, arch_type_t arch);
+char* instruction_strdup(const instruction_t* instr, const char* text);
+void instruction_free_string(const instruction_t* instr, char* text);
+register_info_t* register_lookup(const char* reg_name, arch_type_t arch);
 operand_t* operand_create_register(const char* reg_name, arch_type_t arch);
 operand_t* operand_create_immediate(uint64_t value, int size_bits);
 operand_t* operand_create_memory(register_info_t* base, register_info_t* index, 
                                 int scale, int64_t displacement, int size_bits);
 operand_t* operand_create_label(const char* label_name);
 void operand_destroy(operand_t* operand);
+int instruction_to_string(const instruction_t* instr, char* buffer, size_t size);
+
+// Encoding errors (negative return values of encode_instruction)
+typedef enum {
+    ENCODE_ERROR_UNSUPPORTED = -1,      // Mnemonic/operand combination not implemented
+    ENCODE_ERROR_BUFFER = -2,           // Output buffer too small
+    ENCODE_ERROR_UNKNOWN_REGISTER = -3, // Register has no encoding for this architecture
+    ENCODE_ERROR_REGISTER_MODE = -4,    // Register not available in the target mode
+    ENCODE_ERROR_OPERAND_SIZE = -5,     // Operand size invalid or mismatched for the target mode
+    ENCODE_ERROR_ADDRESSING = -6,       // Addressing form invalid for the target mode
+    ENCODE_ERROR_IMMEDIATE = -7         // Immediate or displacement out of range
+} encode_error_t;
+
+// Instruction classification
+bool instruction_is_branch(const instruction_t* instr);
+int instruction_condition_code(const instruction_t* instr);
+bool instruction_invert_condition(instruction_t* instr);
+bool instruction_has_encoder(const instruction_t* instr, arch_type_t arch);
 
 // Instruction encoding
+const char* encode_error_string(int error);
 int encode_instruction(instruction_t* instr, arch_type_t arch, uint8_t* output, int max_size);
 
 #endif // INSTRUCTION_H 
\ No newline at end of file
@@ -0,0 +1,26 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "parser.h"
+#include "assembler.h"
+#include "layout.h"
+
+// Program loaded into this process: .text on read-only executable pages,
+// .data and .bss on writable pages after it
+typedef struct {
+    uint8_t* memory;
+    size_t size;
+    uint64_t entry;
+} jit_image_t;
+
+// Function declarations
+bool jit_supports_arch(arch_type_t arch);
+int jit_reserve(jit_image_t* image, const program_t* program, const layout_options_t* layout);
+int jit_load(jit_image_t* image, const program_t* program);
+int jit_call(const jit_image_t* image);
+void jit_release(jit_image_t* image);
+
+#endif // JIT_H
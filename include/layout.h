@@ -0,0 +1,38 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdbool.h>
+#include "parser.h"
+#include "assembler.h"
+
+// Where sections are placed in the address space
+typedef enum {
+    PLACEMENT_FLAT,          // .text at 0, .rodata, .data and .bss follow (raw binary)
+    PLACEMENT_RELOCATABLE,   // Every section at 0, the linker places them
+    PLACEMENT_EXECUTABLE,    // Page-aligned segments from image_base (static executable)
+    PLACEMENT_MEMORY         // .text at image_base, .data on the next page (--run)
+} section_placement_t;
+
+#define LAYOUT_PAGE_SIZE 0x1000
+#define LAYOUT_HUGE_PAGE_SIZE 0x200000
+
+// Layout options
+typedef struct {
+    bool align_branches;     // Keep branches and fused cmp+jcc pairs off 32-byte boundaries
+    int branch_boundary;     // Boundary in bytes (power of two)
+    int max_prefix_padding;  // Most redundant segment prefixes added to one instruction
+    section_placement_t placement;
+    uint64_t image_base;     // PLACEMENT_EXECUTABLE: address of the ELF headers;
+                             // PLACEMENT_MEMORY: address of .text
+    uint64_t text_alignment; // PLACEMENT_EXECUTABLE: alignment of .text (page or huge page)
+} layout_options_t;
+
+// Function declarations
+void layout_options_init(layout_options_t* options);
+int layout_program(program_t* program, arch_type_t arch, const layout_options_t* options);
+int resolve_labels(program_t* program, bool relocatable);
+void layout_place_sections(program_t* program, const layout_options_t* options);
+bool fixup_value_fits(int64_t value, int size, fixup_kind_t kind);
+int layout_check_text_distances(const program_t* program, const char* pass);
+
+#endif // LAYOUT_H
@@ -31,16 +31,33 @@ typedef enum {
     TOKEN_QWORD_PTR,
     TOKEN_BYTE_PTR,
     TOKEN_WORD_PTR,
+    TOKEN_LBRACE,
+    TOKEN_RBRACE,
+    TOKEN_LPAREN,
+    TOKEN_RPAREN,
+    TOKEN_DIVIDE,         // /  (unsigned)
+    TOKEN_SIGNED_DIVIDE,  // //
+    TOKEN_MODULO,         // %  (unsigned)
+    TOKEN_SIGNED_MODULO,  // %%
+    TOKEN_SHIFT_LEFT,     // <<
+    TOKEN_SHIFT_RIGHT,    // >>
+    TOKEN_AND,            // &
+    TOKEN_OR,             // |
+    TOKEN_XOR,            // ^
+    TOKEN_NOT,            // ~
+    TOKEN_DOLLAR,         // $   current location
+    TOKEN_DOUBLE_DOLLAR,  // $$  start of the current section
     TOKEN_UNKNOWN
 } token_type_t;
 
 // Token structure
 typedef struct {
     token_type_t type;
-    char* value;
+    char* value;                  // Points at text, or NULL
     int line;
     int column;
     uint64_t numeric_value;
+    char text[];                  // Stored with the token, one allocation each
 } token_t;
 
 // Lexer state
@@ -0,0 +1,14 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include "assembler.h"
+
+// --link a.asm b.asm ...: every input is assembled in this process and the
+// results are linked into one static executable (ctx->output_file). Global
+// symbols resolve extern references across inputs; locals stay private to
+// their input.
+
+// Function declarations
+int link_files(assembler_context_t* ctx);
+
+#endif // LINK_H
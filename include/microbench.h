@@ -0,0 +1,23 @@
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include "assembler.h"
+
+#define MICROBENCH_DEFAULT_RUNS 50
+#define MICROBENCH_DEFAULT_UNROLL 16
+#define MICROBENCH_MAX_UNROLL 1024
+#define MICROBENCH_SCRATCH_SIZE 4096  // Zeroed memory at r14 for the snippet
+
+// --bench a.asm [b.asm]: each snippet is copied unroll times into a loop
+// harness, assembled into memory and timed on one core. The harness saves
+// and restores the callee-saved registers, counts iterations in r15 and
+// points r14 at a scratch buffer. The snippet must leave r15 alone and,
+// when unrolled, define no symbols. An empty harness is timed alongside
+// every run and subtracted, so the loop itself does not count. Results are
+// cycles per copy with a 95% confidence interval, and for two snippets the
+// difference between them.
+
+// Function declarations
+int microbench_run(assembler_context_t* ctx);
+
+#endif // MICROBENCH_H
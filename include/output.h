@@ -0,0 +1,13 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <sys/uio.h>
+
+// Output files are described as a list of extents written back to back.
+// An extent with a NULL iov_base is a run of zero bytes.
+
+// Function declarations
+int output_write_image(const char* filename, const struct iovec* extents, int count, bool executable);
+
+#endif // OUTPUT_H
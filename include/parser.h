@@ -5,26 +5,70 @@
 #include "instruction.h"
 #include "symbol_table.h"
 #include "assembler.h"
+#include "encode_cache.h"
+
+// Section types
+typedef enum {
+    SECTION_TEXT,
+    SECTION_DATA,
+    SECTION_BSS,
+    SECTION_RODATA,
+    SECTION_COUNT
+} section_type_t;
+
+struct pipeline;
+struct fanout;
+
+// A distance between two .text offsets that an expression folded while
+// parsing. Passes that move code map both ends as they map labels, and
+// layout_check_text_distances reports one that no longer holds.
+typedef struct {
+    uint64_t from;
+    uint64_t to;
+    int64_t distance;             // to - from when it was folded
+    int line;
+} text_distance_t;
+
+// A [label + disp] memory operand. Merging .rodata and --pack-data move
+// the item a label starts, so one that reads outside it keeps the section
+// as written.
+typedef struct {
+    char* label;
+    int64_t displacement;
+    int line;
+} data_reference_t;
 
 // Parser state
 typedef struct {
     lexer_t* lexer;
     token_t* current_token;
+    token_t* peek_token;          // One token of lookahead, see parser_peek
     symbol_table_t* symbol_table;
     arch_type_t architecture;
-    uint64_t current_address;
+    uint64_t current_address;     // Location counter of the current section
     int current_section;
+    uint64_t section_addresses[SECTION_COUNT]; // Saved counters of the other sections
     bool has_error;
     char error_message[256];
+    struct pipeline* pipeline;    // Set by pipeline_parse: tokens come from and
+                                  // instructions go to other threads
+    bool streaming;               // Release instructions once encoded (--stream)
+    struct fanout* fanout;        // Set for -a a,b,...: .text items are also
+                                  // recorded for the other targets
+    arena_t* arena;               // Instructions are allocated here; NULL to
+                                  // malloc them, as --stream frees each one
+    bool pack_data;               // --pack-data: reorder .data and .rodata items
+    bool merge_constants;         // --merge-constants: dedup .rodata constants too
+    bool pinned[SECTION_COUNT];   // An expression measured across labels of the
+                                  // section, so its items must stay where they are
+    text_distance_t* text_distances; // Folded so far; handed to the program
+    int text_distance_count;
+    int text_distance_capacity;
+    data_reference_t* data_references; // [label + disp] operands seen so far
+    int data_reference_count;
+    int data_reference_capacity;
 } parser_t;
 
-// Section types
-typedef enum {
-    SECTION_TEXT,
-    SECTION_DATA,
-    SECTION_BSS
-} section_type_t;
-
 // Data definition types
 typedef enum {
     DATA_BYTE,    // db
@@ -33,53 +77,92 @@ typedef enum {
     DATA_QWORD    // dq
 } data_type_t;
 
-// Data definition structure
+// An align directive in .data, .rodata or .bss
+typedef struct {
+    int section;
+    uint64_t offset;      // Aligned offset the directive padded up to
+    uint64_t alignment;
+    uint64_t padding;     // Zero bytes it inserted
+} data_align_t;
+
+// Unresolved label reference in the code section
 typedef struct {
-    data_type_t type;
-    union {
-        uint8_t byte_value;
-        uint16_t word_value;
-        uint32_t dword_value;
-        uint64_t qword_value;
-        char* string_value;
-    } data;
-    size_t repeat_count;  // for resb, resw, etc.
-} data_definition_t;
+    uint64_t offset;      // Offset of the field in the code section
+    int size;             // Field width in bytes
+    fixup_kind_t kind;
+    int64_t addend;       // disp of [label + disp]; relative fixups also subtract the
+                          // distance from the field to the end of the instruction
+    char* label;
+    int line;
+    bool resolved;        // Patched by layout; unresolved fixups become relocations
+} fixup_t;
 
 // Parsed program structure
 typedef struct {
     instruction_t** instructions;
     int instruction_count;
     int instruction_capacity;
-    data_definition_t** data_definitions;
-    int data_count;
-    int data_capacity;
+    fixup_t* fixups;
+    int fixup_count;
+    int fixup_capacity;
     symbol_table_t* symbols;
     uint8_t* code;
     size_t code_size;
+    size_t code_capacity;
     uint8_t* data_section;
     size_t data_size;
+    size_t data_capacity;
+    uint64_t bss_size;
+    uint8_t* rodata;
+    size_t rodata_size;
+    size_t rodata_capacity;
+    size_t rodata_strings;        // .rodata offset where the merged strings begin
+    size_t rodata_merged;         // .rodata bytes removed by merging
+    size_t data_packed;           // .data bytes removed by --pack-data
+    data_align_t* aligns;         // align directives in source order
+    int align_count;
+    int align_capacity;
+    uint64_t section_alignment[SECTION_COUNT]; // Largest align in each section, 0 if none
+    uint64_t section_base[SECTION_COUNT]; // Load address of each section, set by layout
+    uint64_t cold_start;          // Code offset where .text.cold begins, 0 if not split
+    text_distance_t* text_distances; // .text distances folded while parsing
+    int text_distance_count;
     section_type_t current_section;
+    encode_cache_t* encode_cache; // Memoized encodings while parsing, else NULL
+    bool streaming;               // Instructions are released once encoded and
+                                  // never enter instructions[]
+    bool patch_backward;          // Patch branches to placed .text labels at once
+                                  // instead of recording fixups (serial streaming)
+    uint64_t released_instructions; // Instructions encoded and freed while streaming
+    arena_t* arena;               // Holds the instructions, or NULL if each is
+                                  // malloc'd; owned by the creator of the program
 } program_t;
 
 // Function declarations
 parser_t* parser_create(lexer_t* lexer, arch_type_t arch);
 void parser_destroy(parser_t* parser);
 program_t* parser_parse(parser_t* parser);
+program_t* program_create(arch_type_t arch);
 void program_destroy(program_t* program);
+int program_encode(program_t* program, instruction_t* instr, arch_type_t arch,
+                   char* error, size_t error_size);
+bool program_add_fixup(program_t* program, instruction_t* instr, uint64_t address);
+int program_repeat_code(program_t* program, instruction_t* instr, uint64_t repeat,
+                        char* error, size_t error_size);
 
 // Parsing functions
 instruction_t* parse_instruction(parser_t* parser);
-operand_t* parse_operand(parser_t* parser);
+bool parse_operand(parser_t* parser, instruction_t* instr, operand_t* operand);
 bool parse_label(parser_t* parser);
-bool parse_directive(parser_t* parser);
+bool parse_directive(parser_t* parser, program_t* program);
 bool parse_section_directive(parser_t* parser);
-data_definition_t* parse_data_definition(parser_t* parser);
-void data_definition_destroy(data_definition_t* data_def);
+bool parse_data_definition(parser_t* parser, program_t* program);
+bool parse_symbol_declaration(parser_t* parser);
 
 // Utility functions
 void parser_error(parser_t* parser, const char* message);
 bool parser_expect_token(parser_t* parser, token_type_t expected);
 void parser_advance(parser_t* parser);
+token_t* parser_peek(parser_t* parser);
 
 #endif // PARSER_H 
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef PERF_JIT_H
+#define PERF_JIT_H
+
+#include <stdint.h>
+#include "parser.h"
+#include "assembler.h"
+
+// Open jitdump stream (jit-<pid>.dump) plus the executable mapping of it
+// that tells `perf record` where to find the file
+typedef struct {
+    FILE* file;
+    void* marker;
+    size_t marker_size;
+    uint32_t machine;
+    uint64_t code_index;
+} jitdump_t;
+
+// Function declarations
+int perf_map_write(const program_t* program);
+jitdump_t* jitdump_open(const char* directory, arch_type_t arch);
+int jitdump_write_program(jitdump_t* dump, const program_t* program, const char* source_name);
+void jitdump_close(jitdump_t* dump);
+
+#endif // PERF_JIT_H
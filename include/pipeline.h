@@ -0,0 +1,78 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include "ring.h"
+#include "parser.h"
+
+#define PIPELINE_RING_SLOTS 16       // Blocks in flight per ring
+#define PIPELINE_TOKEN_BLOCK 256     // Tokens per block
+#define PIPELINE_IR_BLOCK 128        // Parsed .text items per block
+
+// Tokens in source order, the last block ends with EOF
+typedef struct {
+    int count;
+    token_t* tokens[PIPELINE_TOKEN_BLOCK];
+} token_block_t;
+
+// Parsed .text item: an instruction, or a label definition when instr is NULL
+typedef struct {
+    instruction_t* instr;
+    uint64_t repeat;             // Copies to emit, from times
+    int symbol;                  // Label: index into the symbol table
+} ir_item_t;
+
+typedef struct {
+    int count;
+    bool last;                   // No blocks follow
+    ir_item_t items[PIPELINE_IR_BLOCK];
+} ir_block_t;
+
+// Text label address assigned by the encoder, applied after it finishes
+typedef struct {
+    int symbol;
+    uint64_t address;
+} label_address_t;
+
+// Three-stage lex -> parse -> encode pipeline. The calling thread parses;
+// the lexer and encoder each run on their own thread, connected to it by
+// bounded SPSC rings.
+typedef struct pipeline {
+    lexer_t* lexer;
+    arch_type_t architecture;
+    program_t* program;
+    ring_t tokens;
+    ring_t ir;
+    pthread_t lexer_thread;
+    pthread_t encoder_thread;
+    bool encoder_running;
+    int stop_lexing;             // Set when the parser needs no more tokens
+    int encoder_failed;
+
+    // Parser side
+    token_block_t* token_block;  // Block being read, or NULL
+    int token_index;
+    bool tokens_done;            // EOF handed out, the lexer thread is finished
+    ir_block_t* ir_block;        // Block being filled, or NULL
+
+    // Encoder side
+    label_address_t* labels;
+    int label_count;
+    int label_capacity;
+    int labels_applied;          // Prefix already written back by pipeline_sync
+    int error_line;
+    char error_message[200];
+} pipeline_t;
+
+// Function declarations
+program_t* pipeline_parse(parser_t* parser);
+
+// Called by the parser while parser->pipeline is set
+token_t* pipeline_next_token(pipeline_t* pipeline);
+bool pipeline_start_encoder(pipeline_t* pipeline, program_t* program);
+bool pipeline_emit_instruction(pipeline_t* pipeline, instruction_t* instr, uint64_t repeat);
+bool pipeline_emit_label(pipeline_t* pipeline, int symbol);
+bool pipeline_sync(pipeline_t* pipeline, parser_t* parser);
+void pipeline_finish_encoder(pipeline_t* pipeline, parser_t* parser);
+
+#endif // PIPELINE_H
@@ -0,0 +1,44 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define RING_CACHE_LINE 64
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Slots have a fixed size and are filled and drained in place, so the
+// memory in flight never grows past capacity * slot_size.
+typedef struct {
+    // Producer side
+    uint32_t head;              // Slots published so far
+    uint32_t cached_tail;       // Last tail seen, saves reloading it per slot
+    char producer_pad[RING_CACHE_LINE - 2 * sizeof(uint32_t)];
+    // Consumer side
+    uint32_t tail;              // Slots released so far
+    uint32_t cached_head;
+    char consumer_pad[RING_CACHE_LINE - 2 * sizeof(uint32_t)];
+
+    uint8_t* slots;
+    size_t slot_size;
+    uint32_t mask;              // Capacity - 1 (power of two)
+    const int* cancel;          // Blocking waits give up once this is nonzero
+} ring_t;
+
+// Function declarations
+bool ring_init(ring_t* ring, uint32_t capacity, size_t slot_size, const int* cancel);
+void ring_free(ring_t* ring);
+
+// Producer: get the next free slot, fill it, then publish it
+void* ring_try_write(ring_t* ring);
+void* ring_write(ring_t* ring);
+void ring_publish(ring_t* ring);
+bool ring_drain(ring_t* ring);
+
+// Consumer: get the oldest published slot, use it, then release it
+void* ring_try_read(ring_t* ring);
+void* ring_read(ring_t* ring);
+void ring_release(ring_t* ring);
+
+#endif // RING_H
@@ -0,0 +1,28 @@
+#ifndef RODATA_H
+#define RODATA_H
+
+#include <stdbool.h>
+#include "parser.h"
+
+#define RODATA_MAX_ALIGNMENT 16     // Constants keep at most this much of their alignment
+
+// .rodata is merged once parsing is done. Every label in it starts an
+// entry (a data_item_t) that runs to the next label, unless a constant
+// runs straight into it: then it stays part of that constant's entry, so
+// tables with labels inside keep their layout. NUL-terminated strings with
+// the same bytes are kept once, and a string that ends another one is
+// folded into its tail; with constants set, other entries with the same
+// bytes are kept once as well. Labels are moved to the copy that survives.
+// Afterwards the constants come first, each still aligned as before, and
+// the strings follow from program->rodata_strings. Code must not read past
+// the end of a string into the next entry through a register. With pack,
+// the constants are ordered as data_layout_pack orders .data.
+//
+// With pinned set (an expression measured across entries, or a
+// [label + disp] that reads outside its label's entry) the layout is left
+// alone and everything counts as a constant.
+
+// Function declarations
+bool rodata_merge(program_t* program, bool pinned, bool pack, bool constants);
+
+#endif // RODATA_H
@@ -0,0 +1,69 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Phases of assemble_file. Lexing and encoding run inside parsing; their
+// time and allocations are taken out of the parse figures.
+typedef enum {
+    STATS_PHASE_NONE,
+    STATS_PHASE_LEX,
+    STATS_PHASE_PARSE,
+    STATS_PHASE_ENCODE,
+    STATS_PHASE_RESOLVE,
+    STATS_PHASE_WRITE,
+    STATS_PHASE_WAIT,            // --pipeline: a stage blocked on a full or empty ring
+    STATS_PHASE_COUNT
+} stats_phase_t;
+
+// Hardware counters from perf_event_open
+typedef enum {
+    STATS_COUNTER_CYCLES,
+    STATS_COUNTER_INSTRUCTIONS,
+    STATS_COUNTER_CACHE_MISSES,
+    STATS_COUNTER_BRANCH_MISSES,
+    STATS_COUNTER_COUNT
+} stats_counter_t;
+
+typedef struct {
+    double seconds;
+    uint64_t malloc_calls;
+    uint64_t malloc_bytes;
+    uint64_t counters[STATS_COUNTER_COUNT];
+    long rss_kb;                 // Peak RSS when the phase last ended
+} stats_phase_data_t;
+
+typedef struct {
+    stats_phase_data_t phases[STATS_PHASE_COUNT];
+    stats_phase_t counter_phase; // Top-level phase the counters accumulate into
+    uint64_t wait_ns;            // Stalls summed over all threads (atomic)
+    
+    uint64_t input_bytes;
+    uint64_t output_bytes;
+    uint64_t tokens;
+    uint64_t instructions;
+    uint64_t encode_cache_hits;   // Encodings replayed from the memo cache
+    uint64_t encode_cache_misses;
+    
+    int counter_fd;              // perf_event group leader, or -1
+    int counter_fds[STATS_COUNTER_COUNT];
+    bool counter_present[STATS_COUNTER_COUNT];
+    uint64_t counter_last[STATS_COUNTER_COUNT];
+    long peak_rss_kb;
+} stats_t;
+
+// Collection target while stats_start..stats_stop is active, else NULL
+extern stats_t* stats_active;
+
+// Function declarations
+void stats_start(stats_t* stats);
+void stats_stop(stats_t* stats);
+stats_phase_t stats_enter(stats_phase_t phase);
+void stats_leave(stats_phase_t previous);
+void stats_thread_begin(stats_phase_t phase);
+void stats_thread_end(void);
+void stats_report(const stats_t* stats, FILE* out, bool json);
+
+#endif // STATS_H
@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
 
 // Symbol types
 typedef enum {
@@ -11,33 +13,62 @@ typedef enum {
     SYMBOL_VARIABLE
 } symbol_type_t;
 
+// Symbol visibility across object files
+typedef enum {
+    SYMBOL_LOCAL,
+    SYMBOL_GLOBAL,    // Defined here, exported (global)
+    SYMBOL_EXTERN     // Defined elsewhere (extern)
+} symbol_binding_t;
+
 // Symbol structure
 typedef struct symbol {
     char* name;
     symbol_type_t type;
+    symbol_binding_t binding;
     uint64_t address;
     bool defined;
+    bool hot;                   // Named by .hot, see --pack-data
     int section;
-    struct symbol* next;
+    uint32_t hash;              // Cached full hash of name
 } symbol_t;
 
-// Symbol table structure
+// Open-addressing index slot; hash 0 marks an empty slot
 typedef struct {
-    symbol_t** buckets;
-    int bucket_count;
+    uint32_t hash;
+    uint32_t index;             // Position in symbols[]
+} symbol_slot_t;
+
+// Symbol table structure: symbols live in one contiguous array in
+// definition order, indexed by a Robin Hood hash table that grows with the
+// load factor. Pointers returned by lookup/define stay valid until the next
+// new symbol is added.
+typedef struct {
+    symbol_t* symbols;
     int symbol_count;
+    int symbol_capacity;
+    symbol_slot_t* slots;
+    uint32_t slot_mask;         // Slot count - 1 (power of two)
+    arena_t* names;             // Interned symbol names
 } symbol_table_t;
 
+// Callback for symbol_table_foreach
+typedef void (*symbol_visitor_t)(symbol_t* symbol, void* context);
+
 // Function declarations
-symbol_table_t* symbol_table_create(int bucket_count);
+symbol_table_t* symbol_table_create(int initial_capacity);
 void symbol_table_destroy(symbol_table_t* table);
+symbol_table_t* symbol_table_clone(const symbol_table_t* table);
 symbol_t* symbol_table_lookup(symbol_table_t* table, const char* name);
 symbol_t* symbol_table_define(symbol_table_t* table, const char* name, 
                              symbol_type_t type, uint64_t address);
+symbol_t* symbol_table_declare(symbol_table_t* table, const char* name,
+                              symbol_binding_t binding);
 bool symbol_table_is_defined(symbol_table_t* table, const char* name);
+void symbol_table_foreach(symbol_table_t* table, symbol_visitor_t visitor, void* context);
 void symbol_table_print(symbol_table_t* table);
 
 // Hash function
 unsigned int hash_string(const char* str);
+uint32_t hash_bytes(const char* data, size_t length);
 
 #endif // SYMBOL_TABLE_H 
\ No newline at end of file
@@ -0,0 +1,2 @@
+.code32
+.intel_syntax noprefix
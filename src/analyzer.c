@@ -0,0 +1,657 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "../include/analyzer.h"
+
+// Static basic-block cost model in the spirit of llvm-mca: every
+// instruction is mapped to an operation class, each class has per-core
+// latency and execution-port usage, and blocks are summarized by their uop
+// count, port pressure, throughput bound and dependency-chain latency.
+
+#define MAX_PORTS 12
+#define MAX_UOP_GROUPS 2
+#define LOOP_ITERATIONS 8
+
+typedef enum {
+    OP_NOP,
+    OP_MOV,
+    OP_ALU,
+    OP_JMP,
+    OP_JCC,
+    OP_CALL,
+    OP_RET,
+    OP_GENERIC,
+    OP_VEC_MOV,
+    OP_VEC_LOGIC,
+    OP_VEC_IADD,
+    OP_VEC_IMUL,
+    OP_VEC_SHUF,
+    OP_VEC_FADD,
+    OP_VEC_FMUL,
+    OP_VEC_FMA,
+    OP_VEC_DIV_PS,
+    OP_VEC_DIV_PD,
+    OP_VEC_SQRT_PS,
+    OP_VEC_SQRT_PD,
+    OP_CLASS_COUNT
+} op_class_t;
+
+// `count` uops that may each issue to any port in `ports`
+typedef struct {
+    uint32_t ports;
+    int count;
+} uop_group_t;
+
+typedef struct {
+    int latency;
+    uop_group_t uops[MAX_UOP_GROUPS];
+    int divider_cycles;   // Occupancy of the non-pipelined divider per 128 bits
+} op_cost_t;
+
+typedef struct {
+    const char* name;
+    const char* port_names[MAX_PORTS];
+    int port_count;
+    int issue_width;
+    int divider_port;
+    uop_group_t load;           // Load uop added for a memory source
+    uop_group_t store[2];       // Store-address and store-data uops
+    int load_latency;
+    int vector_load_latency;
+    uint32_t fp_ports_512;      // Ports that take over 512-bit FP work (0: split into halves)
+    uint32_t fp_ports_512_from; // Port removed from 512-bit FP uops
+    op_cost_t costs[OP_CLASS_COUNT];
+} uarch_t;
+
+#define P(n) (1u << (n))
+
+// Intel Skylake / Skylake-SP: ports 0-7, port 0/1 fuse for 512-bit work
+static const uarch_t uarch_skylake = {
+    "skylake",
+    {"p0", "p1", "p2", "p3", "p4", "p5", "p6", "p7", "div"},
+    9, 4, 8,
+    {P(2) | P(3), 1},
+    {{P(2) | P(3) | P(7), 1}, {P(4), 1}},
+    5, 6,
+    P(0) | P(5), P(1),
+    {
+        [OP_NOP]         = {0, {{0, 1}}, 0},
+        [OP_MOV]         = {1, {{P(0) | P(1) | P(5) | P(6), 1}}, 0},
+        [OP_ALU]         = {1, {{P(0) | P(1) | P(5) | P(6), 1}}, 0},
+        [OP_JMP]         = {0, {{P(6), 1}}, 0},
+        [OP_JCC]         = {0, {{P(0) | P(6), 1}}, 0},
+        [OP_CALL]        = {0, {{P(6), 1}, {P(2) | P(3) | P(7), 1}}, 0},
+        [OP_RET]         = {0, {{P(6), 1}, {P(2) | P(3), 1}}, 0},
+        [OP_GENERIC]     = {1, {{P(0) | P(1) | P(5) | P(6), 1}}, 0},
+        [OP_VEC_MOV]     = {1, {{P(0) | P(1) | P(5), 1}}, 0},
+        [OP_VEC_LOGIC]   = {1, {{P(0) | P(1) | P(5), 1}}, 0},
+        [OP_VEC_IADD]    = {1, {{P(0) | P(1) | P(5), 1}}, 0},
+        [OP_VEC_IMUL]    = {10, {{P(0) | P(1), 2}}, 0},
+        [OP_VEC_SHUF]    = {1, {{P(5), 1}}, 0},
+        [OP_VEC_FADD]    = {4, {{P(0) | P(1), 1}}, 0},
+        [OP_VEC_FMUL]    = {4, {{P(0) | P(1), 1}}, 0},
+        [OP_VEC_FMA]     = {4, {{P(0) | P(1), 1}}, 0},
+        [OP_VEC_DIV_PS]  = {11, {{P(0), 1}}, 3},
+        [OP_VEC_DIV_PD]  = {14, {{P(0), 1}}, 4},
+        [OP_VEC_SQRT_PS] = {12, {{P(0), 1}}, 3},
+        [OP_VEC_SQRT_PD] = {16, {{P(0), 1}}, 6},
+    }
+};
+
+// AMD Zen 2: four ALUs, two load and one store pipe, four FP pipes.
+// There is no AVX-512, so 512-bit operations are costed as two halves.
+static const uarch_t uarch_zen2 = {
+    "zen2",
+    {"alu0", "alu1", "alu2", "alu3", "ld0", "ld1", "st", "fp0", "fp1", "fp2", "fp3", "div"},
+    12, 5, 11,
+    {P(4) | P(5), 1},
+    {{P(6), 1}, {0, 0}},
+    4, 7,
+    0, 0,
+    {
+        [OP_NOP]         = {0, {{0, 1}}, 0},
+        [OP_MOV]         = {1, {{P(0) | P(1) | P(2) | P(3), 1}}, 0},
+        [OP_ALU]         = {1, {{P(0) | P(1) | P(2) | P(3), 1}}, 0},
+        [OP_JMP]         = {0, {{P(0) | P(3), 1}}, 0},
+        [OP_JCC]         = {0, {{P(0) | P(3), 1}}, 0},
+        [OP_CALL]        = {0, {{P(0) | P(3), 1}, {P(6), 1}}, 0},
+        [OP_RET]         = {0, {{P(0) | P(3), 1}, {P(4) | P(5), 1}}, 0},
+        [OP_GENERIC]     = {1, {{P(0) | P(1) | P(2) | P(3), 1}}, 0},
+        [OP_VEC_MOV]     = {1, {{P(7) | P(8) | P(9) | P(10), 1}}, 0},
+        [OP_VEC_LOGIC]   = {1, {{P(7) | P(8) | P(9) | P(10), 1}}, 0},
+        [OP_VEC_IADD]    = {1, {{P(7) | P(8) | P(10), 1}}, 0},
+        [OP_VEC_IMUL]    = {4, {{P(7), 2}}, 0},
+        [OP_VEC_SHUF]    = {1, {{P(8) | P(9), 1}}, 0},
+        [OP_VEC_FADD]    = {3, {{P(9) | P(10), 1}}, 0},
+        [OP_VEC_FMUL]    = {3, {{P(7) | P(8), 1}}, 0},
+        [OP_VEC_FMA]     = {5, {{P(7) | P(8), 1}}, 0},
+        [OP_VEC_DIV_PS]  = {10, {{P(10), 1}}, 3},
+        [OP_VEC_DIV_PD]  = {13, {{P(10), 1}}, 4},
+        [OP_VEC_SQRT_PS] = {14, {{P(10), 1}}, 6},
+        [OP_VEC_SQRT_PD] = {20, {{P(10), 1}}, 9},
+    }
+};
+
+static const uarch_t* uarchs[] = {&uarch_skylake, &uarch_zen2, NULL};
+
+static const uarch_t* find_uarch(const char* name) {
+    for (int i = 0; uarchs[i]; i++) {
+        if (strcasecmp(uarchs[i]->name, name) == 0) return uarchs[i];
+    }
+    return NULL;
+}
+
+bool analyzer_supports_uarch(const char* uarch) {
+    return find_uarch(uarch) != NULL;
+}
+
+// Register identities for dependency tracking: GPRs, vector registers,
+// opmask registers and the flags
+#define REG_ID_VECTOR 16
+#define REG_ID_MASK 48
+#define REG_ID_FLAGS 56
+#define REG_ID_COUNT 57
+
+static int register_id(const register_info_t* reg) {
+    if (reg->flags & REG_FLAG_VECTOR) return REG_ID_VECTOR + reg->encoding;
+    if (reg->flags & REG_FLAG_MASK) return REG_ID_MASK + reg->encoding;
+    if (reg->flags & REG_FLAG_NO_REX) return reg->encoding - 4; // ah/ch/dh/bh
+    return reg->encoding;
+}
+
+// What an instruction costs and which registers it reads and writes
+typedef struct {
+    op_class_t op_class;
+    bool known;               // Mnemonic has a cost model entry
+    bool load;
+    bool store;
+    int vector_bits;
+    int reads[8];
+    int read_count;
+    int address_reads[4];
+    int address_read_count;
+    int writes[2];
+    int write_count;
+    
+    int uops;
+    int latency;              // Including load latency
+    int load_latency;
+    double pressure[MAX_PORTS];
+    double reciprocal_throughput;
+} instruction_cost_t;
+
+static bool mnemonic_is(const char* mnemonic, const char* const* names) {
+    for (int i = 0; names[i]; i++) {
+        if (strcasecmp(mnemonic, names[i]) == 0) return true;
+    }
+    return false;
+}
+
+static bool ends_with(const char* str, const char* suffix) {
+    size_t length = strlen(str);
+    size_t suffix_length = strlen(suffix);
+    return length >= suffix_length && strcasecmp(str + length - suffix_length, suffix) == 0;
+}
+
+static op_class_t classify_vector(const char* name, bool* known) {
+    // `name` is the mnemonic without a leading 'v'
+    static const char* const logic[] = {"andps", "andpd", "orps", "orpd", "xorps", "xorpd",
+                                        "pand", "pandd", "pandq", "por", "pord", "porq",
+                                        "pxor", "pxord", "pxorq", NULL};
+    static const char* const iadd[] = {"paddd", "paddq", "psubd", "psubq", NULL};
+    static const char* const shuffle[] = {"shufps", "pshufd", "broadcastss", "broadcastsd",
+                                          "pbroadcastd", "pbroadcastq", NULL};
+    
+    *known = true;
+    if (strncasecmp(name, "mov", 3) == 0) return OP_VEC_MOV;
+    if (mnemonic_is(name, logic)) return OP_VEC_LOGIC;
+    if (mnemonic_is(name, iadd)) return OP_VEC_IADD;
+    if (strcasecmp(name, "pmulld") == 0) return OP_VEC_IMUL;
+    if (mnemonic_is(name, shuffle)) return OP_VEC_SHUF;
+    if (strncasecmp(name, "fmadd", 5) == 0) return OP_VEC_FMA;
+    if (strncasecmp(name, "add", 3) == 0 || strncasecmp(name, "sub", 3) == 0 ||
+        strncasecmp(name, "min", 3) == 0 || strncasecmp(name, "max", 3) == 0) return OP_VEC_FADD;
+    if (strncasecmp(name, "mul", 3) == 0) return OP_VEC_FMUL;
+    if (strncasecmp(name, "div", 3) == 0) return ends_with(name, "d") ? OP_VEC_DIV_PD : OP_VEC_DIV_PS;
+    if (strncasecmp(name, "sqrt", 4) == 0) return ends_with(name, "d") ? OP_VEC_SQRT_PD : OP_VEC_SQRT_PS;
+    
+    *known = false;
+    return OP_GENERIC;
+}
+
+static bool operand_is_vector(const operand_t* operand) {
+    return operand->type == OPERAND_REGISTER && operand->data.reg.reg_info &&
+           (operand->data.reg.reg_info->flags & REG_FLAG_VECTOR);
+}
+
+static void add_read(instruction_cost_t* cost, const operand_t* operand) {
+    if (operand->type == OPERAND_REGISTER && operand->data.reg.reg_info && cost->read_count < 8) {
+        cost->reads[cost->read_count++] = register_id(operand->data.reg.reg_info);
+    }
+}
+
+static void add_write(instruction_cost_t* cost, int id) {
+    if (cost->write_count < 2) cost->writes[cost->write_count++] = id;
+}
+
+// Register dataflow of an instruction
+static void collect_dependencies(const instruction_t* instr, instruction_cost_t* cost, bool is_vector) {
+    static const char* const compares[] = {"cmp", "test", NULL};
+    static const char* const write_only[] = {"mov", "lea", NULL};
+    static const char* const zero_idioms[] = {"xor", "sub", "xorps", "xorpd", "pxor", "vxorps",
+                                              "vxorpd", "vpxor", "vpxord", "vpxorq", NULL};
+    const char* mnemonic = instr->mnemonic;
+    int count = instr->operand_count;
+    
+    // Trailing immediates are not register sources
+    while (count > 0 && instr->operands[count - 1].type == OPERAND_IMMEDIATE) count--;
+    
+    for (int i = 0; i < instr->operand_count; i++) {
+        const operand_t* operand = &instr->operands[i];
+        if (operand->type != OPERAND_MEMORY) continue;
+        if (i == 0 && count > 1) cost->store = true; else cost->load = true;
+        if (operand->data.mem.base && cost->address_read_count < 4) {
+            cost->address_reads[cost->address_read_count++] = register_id(operand->data.mem.base);
+        }
+        if (operand->data.mem.index && cost->address_read_count < 4) {
+            cost->address_reads[cost->address_read_count++] = register_id(operand->data.mem.index);
+        }
+    }
+    
+    if (instruction_condition_code(instr) >= 0) {
+        cost->reads[cost->read_count++] = REG_ID_FLAGS;
+        return;
+    }
+    if (count == 0) return;
+    
+    const operand_t* dst = &instr->operands[0];
+    
+    // Dependency-breaking zero idioms: xor eax, eax / vpxor xmm0, xmm0, xmm0
+    if (mnemonic_is(mnemonic, zero_idioms) && count >= 2 && dst->type == OPERAND_REGISTER) {
+        bool same = true;
+        for (int i = 1; i < count; i++) {
+            const operand_t* src = &instr->operands[i];
+            if (src->type != OPERAND_REGISTER || src->data.reg.reg_info != dst->data.reg.reg_info) same = false;
+        }
+        if (same && dst->data.reg.reg_info) {
+            add_write(cost, register_id(dst->data.reg.reg_info));
+            if (!is_vector) add_write(cost, REG_ID_FLAGS);
+            return;
+        }
+    }
+    
+    bool compare = mnemonic_is(mnemonic, compares);
+    bool vector_nds = is_vector && (mnemonic[0] == 'v' || mnemonic[0] == 'V') && count == 3;
+    bool fma = strncasecmp(mnemonic, "vfmadd", 6) == 0;
+    bool unary = mnemonic_is(mnemonic, write_only) ||
+                 (is_vector && (cost->op_class == OP_VEC_MOV || cost->op_class == OP_VEC_SHUF ||
+                                cost->op_class == OP_VEC_SQRT_PS || cost->op_class == OP_VEC_SQRT_PD) &&
+                  strncasecmp(mnemonic, "shufps", 6) != 0 && strncasecmp(mnemonic, "vshufps", 7) != 0);
+    bool merge_masked = dst->mask && !dst->zeroing;
+    
+    // The destination is a source unless it is only written
+    bool dst_read = compare || fma || merge_masked || (!unary && !vector_nds);
+    if (dst_read || dst->type != OPERAND_REGISTER) add_read(cost, dst);
+    for (int i = 1; i < count; i++) add_read(cost, &instr->operands[i]);
+    if (dst->mask) cost->reads[cost->read_count++] = register_id(dst->mask);
+    
+    if (!compare && dst->type == OPERAND_REGISTER && dst->data.reg.reg_info) {
+        add_write(cost, register_id(dst->data.reg.reg_info));
+    }
+    if (!is_vector && !mnemonic_is(mnemonic, write_only)) add_write(cost, REG_ID_FLAGS);
+}
+
+static int popcount(uint32_t value) {
+    int count = 0;
+    while (value) {
+        count += value & 1;
+        value >>= 1;
+    }
+    return count;
+}
+
+static void add_uops(instruction_cost_t* cost, uop_group_t group, int multiplier) {
+    int count = group.count * multiplier;
+    if (count == 0) return;
+    
+    cost->uops += count;
+    int ports = popcount(group.ports);
+    if (ports == 0) return;
+    
+    double share = (double)count / ports;
+    for (int p = 0; p < MAX_PORTS; p++) {
+        if (group.ports & P(p)) cost->pressure[p] += share;
+    }
+    if (share > cost->reciprocal_throughput) cost->reciprocal_throughput = share;
+}
+
+static void compute_cost(const uarch_t* uarch, const instruction_t* instr, instruction_cost_t* cost) {
+    static const char* const alu[] = {"add", "sub", "and", "or", "xor", "cmp", "test",
+                                      "inc", "dec", "not", "neg", NULL};
+    const char* mnemonic = instr->mnemonic;
+    
+    memset(cost, 0, sizeof(*cost));
+    cost->known = true;
+    
+    bool is_vector = false;
+    for (int i = 0; i < instr->operand_count; i++) {
+        if (operand_is_vector(&instr->operands[i])) {
+            is_vector = true;
+            int bits = instr->operands[i].data.reg.reg_info->size_bits;
+            if (bits > cost->vector_bits) cost->vector_bits = bits;
+        }
+    }
+    
+    if (is_vector) {
+        bool v_prefix = (mnemonic[0] == 'v' || mnemonic[0] == 'V');
+        cost->op_class = classify_vector(v_prefix ? mnemonic + 1 : mnemonic, &cost->known);
+        if (!cost->known && v_prefix) {
+            cost->op_class = classify_vector(mnemonic, &cost->known);
+        }
+    } else if (strcasecmp(mnemonic, "nop") == 0) {
+        cost->op_class = OP_NOP;
+    } else if (strcasecmp(mnemonic, "mov") == 0) {
+        cost->op_class = OP_MOV;
+    } else if (mnemonic_is(mnemonic, alu)) {
+        cost->op_class = OP_ALU;
+    } else if (strcasecmp(mnemonic, "jmp") == 0) {
+        cost->op_class = OP_JMP;
+    } else if (instruction_condition_code(instr) >= 0) {
+        cost->op_class = OP_JCC;
+    } else if (strcasecmp(mnemonic, "call") == 0) {
+        cost->op_class = OP_CALL;
+    } else if (strcasecmp(mnemonic, "ret") == 0) {
+        cost->op_class = OP_RET;
+    } else {
+        cost->op_class = OP_GENERIC;
+        cost->known = false;
+    }
+    
+    collect_dependencies(instr, cost, is_vector);
+    
+    const op_cost_t* op = &uarch->costs[cost->op_class];
+    bool pure_move = cost->op_class == OP_MOV || cost->op_class == OP_VEC_MOV;
+    int load_latency = is_vector ? uarch->vector_load_latency : uarch->load_latency;
+    
+    // 512-bit FP work either moves to the fused ports or is split in halves
+    int multiplier = 1;
+    uint32_t moved_from = 0;
+    uint32_t moved_to = 0;
+    if (cost->vector_bits == 512) {
+        if (uarch->fp_ports_512) {
+            moved_from = uarch->fp_ports_512_from;
+            moved_to = uarch->fp_ports_512;
+        } else {
+            multiplier = 2;
+        }
+    }
+    
+    // Plain loads and stores only use the memory pipes
+    if (!(pure_move && (cost->load || cost->store))) {
+        for (int g = 0; g < MAX_UOP_GROUPS; g++) {
+            uop_group_t group = op->uops[g];
+            if (is_vector && (group.ports & moved_from)) {
+                group.ports = (group.ports & ~moved_from) | moved_to;
+            }
+            add_uops(cost, group, multiplier);
+        }
+        cost->latency = op->latency;
+    }
+    
+    if (op->divider_cycles) {
+        int scale = cost->vector_bits > 128 ? cost->vector_bits / 128 : 1;
+        double cycles = (double)op->divider_cycles * scale;
+        cost->pressure[uarch->divider_port] += cycles;
+        if (cycles > cost->reciprocal_throughput) cost->reciprocal_throughput = cycles;
+    }
+    
+    if (cost->load) {
+        add_uops(cost, uarch->load, 1);
+        cost->load_latency = load_latency;
+        cost->latency += load_latency;
+    }
+    if (cost->store) {
+        add_uops(cost, uarch->store[0], 1);
+        add_uops(cost, uarch->store[1], 1);
+    }
+}
+
+// Issue one instruction into the dependency model and return its finish time
+static double schedule(const instruction_cost_t* cost, double* ready) {
+    double start = 0;
+    for (int i = 0; i < cost->read_count; i++) {
+        if (ready[cost->reads[i]] > start) start = ready[cost->reads[i]];
+    }
+    
+    double address_ready = 0;
+    for (int i = 0; i < cost->address_read_count; i++) {
+        if (ready[cost->address_reads[i]] > address_ready) address_ready = ready[cost->address_reads[i]];
+    }
+    
+    double finish;
+    if (cost->load) {
+        // The load only waits for its address, register sources join after it
+        double loaded = address_ready + cost->load_latency;
+        if (start > loaded) loaded = start;
+        finish = loaded + (cost->latency - cost->load_latency);
+    } else {
+        finish = start + cost->latency;
+    }
+    
+    for (int i = 0; i < cost->write_count; i++) {
+        ready[cost->writes[i]] = finish;
+    }
+    return finish;
+}
+
+typedef struct {
+    uint64_t address;
+    const char* name;
+} label_entry_t;
+
+typedef struct {
+    label_entry_t* labels;
+    int count;
+    int capacity;
+} label_list_t;
+
+static void collect_label(symbol_t* symbol, void* context) {
+    label_list_t* list = context;
+    
+    if (symbol->type != SYMBOL_LABEL || !symbol->defined || symbol->section != SECTION_TEXT) return;
+    if (list->count >= list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        label_entry_t* labels = realloc(list->labels, capacity * sizeof(label_entry_t));
+        if (!labels) return;
+        list->labels = labels;
+        list->capacity = capacity;
+    }
+    list->labels[list->count].address = symbol->address;
+    list->labels[list->count].name = symbol->name;
+    list->count++;
+}
+
+static int compare_labels(const void* a, const void* b) {
+    const label_entry_t* la = a;
+    const label_entry_t* lb = b;
+    if (la->address != lb->address) return la->address < lb->address ? -1 : 1;
+    return strcmp(la->name, lb->name);
+}
+
+// First label at an address, or NULL
+static const char* label_at(const label_list_t* list, uint64_t address) {
+    int low = 0;
+    int high = list->count - 1;
+    const char* found = NULL;
+    
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (list->labels[mid].address < address) {
+            low = mid + 1;
+        } else {
+            if (list->labels[mid].address == address) found = list->labels[mid].name;
+            high = mid - 1;
+        }
+    }
+    return found;
+}
+
+static void format_ports(const uarch_t* uarch, const instruction_cost_t* cost, char* buffer, size_t size) {
+    size_t length = 0;
+    buffer[0] = '\0';
+    
+    for (int p = 0; p < uarch->port_count && length + 16 < size; p++) {
+        if (cost->pressure[p] > 0) {
+            length += snprintf(buffer + length, size - length, "%s%s:%.2g",
+                               length ? " " : "", uarch->port_names[p], cost->pressure[p]);
+        }
+    }
+}
+
+static void analyze_block(const uarch_t* uarch, program_t* program, const label_list_t* labels,
+                          int first, int last, int block_number, FILE* output) {
+    int count = last - first + 1;
+    instruction_cost_t* costs = calloc(count, sizeof(instruction_cost_t));
+    if (!costs) return;
+    
+    instruction_t* head = program->instructions[first];
+    instruction_t* tail = program->instructions[last];
+    const char* name = label_at(labels, head->address);
+    
+    fprintf(output, "\nBlock %d: %s [0x%04llx-0x%04llx) %d instruction%s\n", block_number,
+            name ? name : "(fall-through)", (unsigned long long)head->address,
+            (unsigned long long)(tail->address + tail->size), count, count == 1 ? "" : "s");
+    fprintf(output, "  %5s  %-8s %4s %4s %6s  %-40s %s\n",
+            "Line", "Address", "Uops", "Lat", "RThru", "Instruction", "Ports");
+    
+    double ready[REG_ID_COUNT] = {0};
+    double latency = 0;
+    int uops = 0;
+    double pressure[MAX_PORTS] = {0};
+    bool approximate = false;
+    
+    for (int i = 0; i < count; i++) {
+        instruction_t* instr = program->instructions[first + i];
+        instruction_cost_t* cost = &costs[i];
+        compute_cost(uarch, instr, cost);
+        
+        double finish = schedule(cost, ready);
+        if (finish > latency) latency = finish;
+        uops += cost->uops;
+        for (int p = 0; p < MAX_PORTS; p++) pressure[p] += cost->pressure[p];
+        if (!cost->known) approximate = true;
+        
+        char text[128];
+        char ports[128];
+        instruction_to_string(instr, text, sizeof(text));
+        format_ports(uarch, cost, ports, sizeof(ports));
+        fprintf(output, "  %5d  0x%06llx %4d %4d %6.2f  %-40s %s%s\n", instr->line,
+                (unsigned long long)instr->address, cost->uops, cost->latency,
+                cost->reciprocal_throughput, text, ports, cost->known ? "" : " (?)");
+    }
+    
+    // Throughput bound: the busiest port, or the front end
+    double port_bound = 0;
+    int busiest = -1;
+    for (int p = 0; p < uarch->port_count; p++) {
+        if (pressure[p] > port_bound) {
+            port_bound = pressure[p];
+            busiest = p;
+        }
+    }
+    double issue_bound = (double)uops / uarch->issue_width;
+    double throughput = port_bound > issue_bound ? port_bound : issue_bound;
+    
+    // A block that branches back to its own start is a loop: simulate a few
+    // iterations to find the loop-carried dependency chain
+    bool is_loop = false;
+    double loop_latency = 0;
+    if (instruction_is_branch(tail) && tail->operand_count == 1 &&
+        tail->operands[0].type == OPERAND_LABEL) {
+        symbol_t* target = symbol_table_lookup(program->symbols, tail->operands[0].data.label.name);
+        is_loop = target && target->defined && target->address == head->address;
+    }
+    if (is_loop) {
+        double loop_ready[REG_ID_COUNT] = {0};
+        double finish_at[LOOP_ITERATIONS + 1] = {0};
+        for (int iteration = 1; iteration <= LOOP_ITERATIONS; iteration++) {
+            double finish = 0;
+            for (int i = 0; i < count; i++) {
+                double f = schedule(&costs[i], loop_ready);
+                if (f > finish) finish = f;
+            }
+            finish_at[iteration] = finish;
+        }
+        int half = LOOP_ITERATIONS / 2;
+        loop_latency = (finish_at[LOOP_ITERATIONS] - finish_at[half]) / (LOOP_ITERATIONS - half);
+    }
+    
+    fprintf(output, "  Uops: %d  Throughput: %.2f cycles  Latency: %.0f cycles", uops, throughput, latency);
+    if (is_loop) {
+        double per_iteration = loop_latency > throughput ? loop_latency : throughput;
+        fprintf(output, "  Loop: %.2f cycles/iteration", per_iteration);
+    }
+    fprintf(output, "\n");
+    
+    const char* bottleneck;
+    char port_bottleneck[32];
+    if (is_loop && loop_latency > throughput) {
+        bottleneck = "loop-carried latency";
+    } else if (issue_bound >= port_bound) {
+        bottleneck = "front-end issue width";
+    } else {
+        snprintf(port_bottleneck, sizeof(port_bottleneck), "port %s", uarch->port_names[busiest]);
+        bottleneck = port_bottleneck;
+    }
+    fprintf(output, "  Bottleneck: %s%s\n", bottleneck,
+            approximate ? " (instructions marked (?) use a generic cost)" : "");
+    
+    fprintf(output, "  Port pressure:");
+    for (int p = 0; p < uarch->port_count; p++) {
+        fprintf(output, " %s=%.2f", uarch->port_names[p], pressure[p]);
+    }
+    fprintf(output, "\n");
+    
+    free(costs);
+}
+
+int analyze_program(program_t* program, arch_type_t arch, const char* uarch_name, FILE* output) {
+    if (arch != ARCH_X86_16 && arch != ARCH_X86_32 && arch != ARCH_X86_64) {
+        fprintf(stderr, "Error: Analysis is only available for x86 targets\n");
+        return -1;
+    }
+    
+    const uarch_t* uarch = find_uarch(uarch_name);
+    if (!uarch) {
+        fprintf(stderr, "Error: Unknown microarchitecture '%s'\n", uarch_name);
+        return -1;
+    }
+    
+    label_list_t labels = {NULL, 0, 0};
+    symbol_table_foreach(program->symbols, collect_label, &labels);
+    if (labels.count > 1) {
+        qsort(labels.labels, labels.count, sizeof(label_entry_t), compare_labels);
+    }
+    
+    fprintf(output, "Static analysis for %s (%d instructions)\n",
+            uarch->name, program->instruction_count);
+    
+    // Basic blocks start at labels and after branches
+    int block_number = 0;
+    int first = 0;
+    for (int i = 0; i < program->instruction_count; i++) {
+        instruction_t* instr = program->instructions[i];
+        bool last = i + 1 == program->instruction_count ||
+                    instruction_is_branch(instr) ||
+                    label_at(&labels, program->instructions[i + 1]->address) != NULL;
+        
+        if (last) {
+            analyze_block(uarch, program, &labels, first, i, ++block_number, output);
+            first = i + 1;
+        }
+    }
+    
+    free(labels.labels);
+    return 0;
+}
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "../include/arena.h"
+
+// Chunk data starts after the header, rounded up to the alignment
+#define CHUNK_HEADER ((sizeof(arena_chunk_t) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static unsigned char* chunk_data(arena_chunk_t* chunk) {
+    return (unsigned char*)chunk + CHUNK_HEADER;
+}
+
+// Large chunks on their own 2 MB-aligned mapping, so the kernel can back
+// them with huge pages. NULL if that is not possible.
+static arena_chunk_t* map_huge_chunk(size_t total) {
+    size_t length = align_up(total, ARENA_HUGE_PAGE);
+    unsigned char* mapping = mmap(NULL, length + ARENA_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) return NULL;
+
+    // Trim to an aligned range
+    unsigned char* start = (unsigned char*)align_up((uintptr_t)mapping, ARENA_HUGE_PAGE);
+    if (start > mapping) {
+        munmap(mapping, start - mapping);
+    }
+    munmap(start + length, mapping + ARENA_HUGE_PAGE - start);
+#ifdef MADV_HUGEPAGE
+    madvise(start, length, MADV_HUGEPAGE);
+#endif
+
+    arena_chunk_t* chunk = (arena_chunk_t*)start;
+    chunk->size = length - CHUNK_HEADER;
+    chunk->mapped = length;
+    return chunk;
+}
+
+static arena_chunk_t* add_chunk(arena_t* arena, size_t size) {
+    if (size < arena->next_size) {
+        size = arena->next_size;
+    }
+    size_t total = CHUNK_HEADER + size;
+
+    arena_chunk_t* chunk = NULL;
+    if (arena->huge_pages && total >= ARENA_HUGE_PAGE) {
+        chunk = map_huge_chunk(total);
+    }
+    if (!chunk) {
+        chunk = malloc(total);
+        if (!chunk) return NULL;
+        chunk->size = size;
+        chunk->mapped = 0;
+    }
+    chunk->next = NULL;
+
+    if (arena->last) {
+        arena->last->next = chunk;
+    } else {
+        arena->chunks = chunk;
+    }
+    arena->last = chunk;
+    arena->reserved += chunk->size;
+    if (arena->next_size < ARENA_MAX_CHUNK) {
+        arena->next_size *= 2;
+    }
+    return chunk;
+}
+
+arena_t* arena_create(bool huge_pages) {
+    arena_t* arena = calloc(1, sizeof(arena_t));
+    if (!arena) return NULL;
+
+    arena->next_size = ARENA_FIRST_CHUNK;
+    arena->huge_pages = huge_pages;
+    return arena;
+}
+
+void arena_destroy(arena_t* arena) {
+    if (!arena) return;
+
+    arena_chunk_t* chunk = arena->chunks;
+    while (chunk) {
+        arena_chunk_t* next = chunk->next;
+        if (chunk->mapped) {
+            munmap(chunk, chunk->mapped);
+        } else {
+            free(chunk);
+        }
+        chunk = next;
+    }
+    free(arena);
+}
+
+// Forget every allocation; the chunks stay for reuse
+void arena_reset(arena_t* arena) {
+    if (!arena) return;
+
+    arena->current = arena->chunks;
+    arena->used = 0;
+    arena->allocated = 0;
+}
+
+// Take size bytes starting on an alignment boundary
+static void* bump(arena_t* arena, size_t size, size_t alignment) {
+    if (size == 0) size = 1;
+
+    // Fill the current chunk, then any kept from before a reset
+    while (arena->current) {
+        size_t offset = align_up(arena->used, alignment);
+        if (offset <= arena->current->size && arena->current->size - offset >= size) {
+            arena->used = offset;
+            break;
+        }
+        arena->current = arena->current->next;
+        arena->used = 0;
+    }
+    if (!arena->current) {
+        arena->current = add_chunk(arena, size);
+        arena->used = 0;
+        if (!arena->current) return NULL;
+    }
+
+    void* pointer = chunk_data(arena->current) + arena->used;
+    arena->used += size;
+    arena->allocated += size;
+    return pointer;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+    return bump(arena, size, ARENA_ALIGNMENT);
+}
+
+// Strings need no alignment, so they pack end to end
+char* arena_strdup(arena_t* arena, const char* text) {
+    size_t length = strlen(text) + 1;
+    char* copy = bump(arena, length, 1);
+    if (copy) {
+        memcpy(copy, text, length);
+    }
+    return copy;
+}
@@ -1,61 +1,273 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include "../include/assembler.h"
 #include "../include/lexer.h"
 #include "../include/parser.h"
 #include "../include/instruction.h"
+#include "../include/layout.h"
+#include "../include/analyzer.h"
+#include "../include/elf_writer.h"
+#include "../include/output.h"
+#include "../include/dwarf.h"
+#include "../include/jit.h"
+#include "../include/perf_jit.h"
+#include "../include/stats.h"
+#include "../include/pipeline.h"
+#include "../include/cache.h"
+#include "../include/cfg.h"
+#include "../include/fanout.h"
+#include "../include/link.h"
+#include "../include/microbench.h"
+#include <sys/stat.h>
+#include <unistd.h>
 
-int write_output_file(const char* filename, uint8_t* code, size_t code_size, 
-                     output_format_t format, arch_type_t arch) {
-    FILE* output_file = fopen(filename, "wb");
-    if (!output_file) {
-        fprintf(stderr, "Error: Cannot open output file '%s'\n", filename);
-        return -1;
-    }
-
-    int result = 0;
-    
+int write_output_file(const char* filename, program_t* program, output_format_t format,
+                      arch_type_t arch, const char* source_name, const layout_options_t* layout,
+                      dwarf_t* debug) {
     switch (format) {
-        case FORMAT_BIN:
-            // Raw binary output
-            if (fwrite(code, 1, code_size, output_file) != code_size) {
-                fprintf(stderr, "Error: Failed to write binary output\n");
-                result = -1;
-            }
-            break;
+        case FORMAT_BIN: {
+            // Raw binary output: .text, then .rodata and .data at their flat
+            // section bases
+            uint64_t rodata_base = program->section_base[SECTION_RODATA];
+            uint64_t rodata_end = rodata_base + program->rodata_size;
+            uint64_t data_base = program->section_base[SECTION_DATA];
+            struct iovec extents[5] = {
+                {program->code, program->code_size},
+                {NULL, rodata_base - program->code_size},
+                {program->rodata, program->rodata_size},
+                {NULL, program->data_size ? data_base - rodata_end : 0},
+                {program->data_section, program->data_size}
+            };
+            return output_write_image(filename, extents, 5, false);
+        }
             
         case FORMAT_ELF:
-            // TODO: Implement ELF format output
-            fprintf(stderr, "Warning: ELF format not yet implemented, writing raw binary\n");
-            if (fwrite(code, 1, code_size, output_file) != code_size) {
-                fprintf(stderr, "Error: Failed to write output\n");
-                result = -1;
-            }
-            break;
+            return elf_write_object(filename, program, arch, source_name, debug);
             
-        case FORMAT_PE:
+        case FORMAT_ELF_EXEC:
+            return elf_write_executable(filename, program, arch, source_name, layout, debug);
+            
+        case FORMAT_PE: {
             // TODO: Implement PE format output  
             fprintf(stderr, "Warning: PE format not yet implemented, writing raw binary\n");
-            if (fwrite(code, 1, code_size, output_file) != code_size) {
-                fprintf(stderr, "Error: Failed to write output\n");
-                result = -1;
-            }
-            break;
+            struct iovec code = {program->code, program->code_size};
+            return output_write_image(filename, &code, 1, false);
+        }
             
         default:
             fprintf(stderr, "Error: Unknown output format\n");
-            result = -1;
-            break;
+            return -1;
+    }
+}
+
+// --run: load the laid-out program, publish its symbols to perf, then call it
+static int run_program(assembler_context_t* ctx, program_t* program, jit_image_t* image) {
+    if (jit_load(image, program) != 0) {
+        return -1;
+    }
+    if (ctx->perf_map && perf_map_write(program) != 0) {
+        return -1;
+    }
+    
+    jitdump_t* dump = NULL;
+    if (ctx->jitdump_dir) {
+        dump = jitdump_open(ctx->jitdump_dir, ctx->architecture);
+        if (!dump || jitdump_write_program(dump, program, ctx->input_file) != 0) {
+            jitdump_close(dump);
+            return -1;
+        }
+    }
+    
+    if (ctx->debug_mode) {
+        printf("Running at 0x%llx\n", (unsigned long long)image->entry);
+    }
+    fflush(stdout);
+    ctx->exit_status = jit_call(image);
+    
+    jitdump_close(dump);
+    return 0;
+}
+
+// Also used by the library side (fan-out errors), so not in main.c
+const char* architecture_name(arch_type_t arch) {
+    switch (arch) {
+        case ARCH_X86_16: return "x86_16";
+        case ARCH_X86_32: return "x86_32";
+        case ARCH_X86_64: return "x86_64";
+        case ARCH_ARM_32: return "arm_32";
+        case ARCH_ARM_64: return "arm_64";
+    }
+    return "unknown";
+}
+
+// Context for target i of ctx, as if it had been the only one
+static assembler_context_t target_context(const assembler_context_t* ctx, int i) {
+    assembler_context_t target = *ctx;
+    target.architecture = ctx->targets[i];
+    target.output_file = ctx->target_outputs[i];
+    target.targets[0] = target.architecture;
+    target.target_outputs[0] = target.output_file;
+    target.target_count = 1;
+    return target;
+}
+
+// Lay out a parsed program for ctx->architecture and write or run it
+static int finish_program(assembler_context_t* ctx, program_t* program) {
+    // Profile-guided block order, before anything depends on code size
+    if (ctx->profile_file) {
+        stats_phase_t previous = stats_enter(STATS_PHASE_RESOLVE);
+        int profile_result = cfg_apply_profile(program, ctx->architecture, ctx->profile_file, ctx->debug_mode);
+        stats_leave(previous);
+        if (profile_result != 0) {
+            return -1;
+        }
+    }
+
+    // Lay out the code and resolve labels
+    layout_options_t layout_options;
+    layout_options_init(&layout_options);
+    layout_options.align_branches = ctx->align_branches;
+    if (ctx->output_format == FORMAT_ELF) {
+        layout_options.placement = PLACEMENT_RELOCATABLE;
+    } else if (ctx->output_format == FORMAT_ELF_EXEC) {
+        layout_options.placement = PLACEMENT_EXECUTABLE;
+        layout_options.image_base = elf_default_image_base(ctx->architecture);
+        layout_options.text_alignment = ctx->huge_text ? LAYOUT_HUGE_PAGE_SIZE : LAYOUT_PAGE_SIZE;
+    }
+    
+    // --run places the program at its final address in this process
+    jit_image_t image = {0};
+    if (ctx->run) {
+        if (jit_reserve(&image, program, &layout_options) != 0) {
+            return -1;
+        }
+        layout_options.placement = PLACEMENT_MEMORY;
+        layout_options.image_base = (uint64_t)(uintptr_t)image.memory;
+    }
+    
+    stats_phase_t previous = stats_enter(STATS_PHASE_RESOLVE);
+    int layout_result = layout_program(program, ctx->architecture, &layout_options);
+    stats_leave(previous);
+    if (stats_active) {
+        stats_active->instructions = program->instruction_count + program->released_instructions;
+        stats_active->output_bytes = program->code_size + program->rodata_size + program->data_size;
+    }
+    
+    if (layout_result != 0) {
+        fprintf(stderr, "Error: Layout failed\n");
+        jit_release(&image);
+        return -1;
+    }
+
+    if (ctx->debug_mode) {
+        printf("Parsed %llu instructions\n",
+               (unsigned long long)(program->instruction_count + program->released_instructions));
+        printf("Code size: %zu bytes\n", program->code_size);
+        printf("Data size: %zu bytes, bss size: %llu bytes\n", program->data_size,
+               (unsigned long long)program->bss_size);
+        if (program->rodata_size) {
+            printf("Rodata size: %zu bytes (%zu saved)\n", program->rodata_size,
+                   program->rodata_merged);
+        }
+        if (ctx->pack_data) {
+            printf("Packed .data: %zu bytes saved\n", program->data_packed);
+        }
+    }
+
+    // Line table for the final addresses, one row per instruction
+    dwarf_t* debug = NULL;
+    if (ctx->debug_info && !ctx->run) {
+        if (ctx->output_format != FORMAT_ELF && ctx->output_format != FORMAT_ELF_EXEC) {
+            fprintf(stderr, "Warning: -g requires ELF output, no debug information written\n");
+        } else {
+            debug = dwarf_create(ctx->architecture, ctx->input_file);
+            if (!debug || dwarf_build_line_table(debug, program, ctx->input_file) != 0) {
+                fprintf(stderr, "Error: Failed to build debug information\n");
+                dwarf_destroy(debug);
+                jit_release(&image);
+                return -1;
+            }
+        }
+    }
+
+    // Static performance report
+    if (ctx->analyze_uarch &&
+        analyze_program(program, ctx->architecture, ctx->analyze_uarch, stdout) != 0) {
+        dwarf_destroy(debug);
+        jit_release(&image);
+        return -1;
+    }
+
+    int write_result;
+    if (ctx->run) {
+        write_result = run_program(ctx, program, &image);
+    } else {
+        // Write output file
+        if (ctx->debug_mode) {
+            printf("Writing output to '%s'\n", ctx->output_file);
+        }
+        previous = stats_enter(STATS_PHASE_WRITE);
+        write_result = write_output_file(ctx->output_file, program, ctx->output_format,
+                                         ctx->architecture, ctx->input_file, &layout_options, debug);
+        stats_leave(previous);
+    }
+
+    dwarf_destroy(debug);
+    jit_release(&image);
+
+    if (write_result != 0) {
+        fprintf(stderr, ctx->run ? "Error: Failed to run the program\n" : "Error: Failed to write output file\n");
+        return -1;
     }
+    return 0;
+}
+
+static int assemble(assembler_context_t* ctx);
 
-    fclose(output_file);
+// -a a,b,...: program was parsed and encoded for the first target. The
+// others are encoded from the parser's record, unless a constant folded a
+// .text address, whose value differs per target; then each is assembled
+// from the source again.
+static int finish_targets(assembler_context_t* ctx, program_t* program, const fanout_t* fanout) {
+    program_t* programs[ASSEMBLER_MAX_TARGETS] = {program};
+    bool reparse = fanout->text_addresses_read;
+    
+    if (reparse && strcmp(ctx->input_file, "-") == 0) {
+        fprintf(stderr, "Error: Constants use .text addresses, which differ per architecture; "
+                "stdin cannot be read again for each one\n");
+        return -1;
+    }
+    if (reparse && ctx->debug_mode) {
+        printf("Constants use .text addresses; parsing again for each architecture\n");
+    }
+    if (!reparse &&
+        fanout_encode(fanout, program, ctx->targets + 1, ctx->target_count - 1, programs + 1) != 0) {
+        return -1;
+    }
+    
+    int result = 0;
+    for (int i = 0; i < ctx->target_count; i++) {
+        assembler_context_t target = target_context(ctx, i);
+        if (result == 0 && ctx->debug_mode && i > 0) {
+            printf("Target %s\n", architecture_name(target.architecture));
+        }
+        if (result == 0) {
+            result = i == 0 || !reparse ? finish_program(&target, programs[i]) : assemble(&target);
+        }
+        if (i > 0) {
+            fanout_program_destroy(programs[i]);
+        }
+    }
     return result;
 }
 
-int assemble_file(assembler_context_t* ctx) {
-    // Open input file
-    FILE* input_file = fopen(ctx->input_file, "r");
+static int assemble(assembler_context_t* ctx) {
+    // Open input file; - is a duplicate of stdin, so it closes like a file
+    bool from_stdin = strcmp(ctx->input_file, "-") == 0;
+    FILE* input_file = from_stdin ? fdopen(dup(STDIN_FILENO), "r") : fopen(ctx->input_file, "r");
     if (!input_file) {
         fprintf(stderr, "Error: Cannot open input file '%s'\n", ctx->input_file);
         return -1;
@@ -81,48 +293,136 @@ int assemble_file(assembler_context_t* ctx) {
         fclose(input_file);
         return -1;
     }
+    parser->streaming = ctx->stream;
+    parser->pack_data = ctx->pack_data;
+    parser->merge_constants = ctx->merge_constants;
+    
+    // Instructions live until the end of the run, so they come from one
+    // arena released at once; --stream frees each as it goes instead
+    arena_t* arena = NULL;
+    if (!ctx->stream) {
+        arena = arena_create(ctx->huge_arena);
+        if (!arena) {
+            fprintf(stderr, "Error: Out of memory\n");
+            parser_destroy(parser);
+            lexer_destroy(lexer);
+            fclose(input_file);
+            return -1;
+        }
+        parser->arena = arena;
+    }
+    
+    fanout_t fanout;
+    fanout_init(&fanout);
+    if (ctx->target_count > 1) {
+        parser->fanout = &fanout;
+    }
 
     if (ctx->debug_mode) {
         printf("Parsing assembly code...\n");
     }
 
     // Parse the input
-    program_t* program = parser_parse(parser);
+    stats_phase_t previous = stats_enter(STATS_PHASE_PARSE);
+    program_t* program = ctx->pipeline ? pipeline_parse(parser) : parser_parse(parser);
+    stats_leave(previous);
+    
+    int result;
     if (!program) {
         fprintf(stderr, "Error: Parsing failed\n");
         if (parser->has_error) {
             fprintf(stderr, "Parser error: %s\n", parser->error_message);
         }
-        parser_destroy(parser);
-        lexer_destroy(lexer);
-        fclose(input_file);
-        return -1;
-    }
-
-    if (ctx->debug_mode) {
-        printf("Parsed %d instructions\n", program->instruction_count);
-        printf("Code size: %zu bytes\n", program->code_size);
-    }
-
-    // Write output file
-    if (ctx->debug_mode) {
-        printf("Writing output to '%s'\n", ctx->output_file);
+        result = -1;
+    } else if (ctx->target_count > 1) {
+        result = finish_targets(ctx, program, &fanout);
+    } else {
+        result = finish_program(ctx, program);
     }
 
-    int write_result = write_output_file(ctx->output_file, program->code, 
-                                       program->code_size, ctx->output_format, 
-                                       ctx->architecture);
-
     // Cleanup
+    fanout_free(&fanout);
     program_destroy(program);
     parser_destroy(parser);
+    arena_destroy(arena);
     lexer_destroy(lexer);
     fclose(input_file);
+    return result;
+} 
 
-    if (write_result != 0) {
-        fprintf(stderr, "Error: Failed to write output file\n");
-        return -1;
+// --cache: serve the outputs from the cache, or assemble and store them.
+// With several architectures each output has its own entry, and the
+// source is assembled unless all of them hit. --run, --analyze and stdout
+// output always assemble.
+static int assemble_cached(assembler_context_t* ctx) {
+    if (!ctx->cache_dir || ctx->run || ctx->analyze_uarch || strcmp(ctx->output_file, "-") == 0) {
+        return assemble(ctx);
+    }
+    
+    cache_t caches[ASSEMBLER_MAX_TARGETS];
+    bool cached[ASSEMBLER_MAX_TARGETS];
+    int hits = 0;
+    for (int i = 0; i < ctx->target_count; i++) {
+        assembler_context_t target = target_context(ctx, i);
+        cache_t* cache = &caches[i];
+        cache->directory = ctx->cache_dir;
+        cache->max_size = ctx->cache_size;
+        cache->hardlink = ctx->cache_hardlink;
+        cached[i] = cache_init(cache, &target) == 0;
+        if (!cached[i]) continue;
+        
+        int fetched = cache_fetch(cache, target.output_file);
+        if (fetched == 0) {
+            if (ctx->debug_mode) {
+                printf("Cache hit: %s\n", cache->entry_path);
+            }
+            hits++;
+        } else if (fetched < 0) {
+            fprintf(stderr, "Warning: Cannot copy cache entry '%s': %s\n", cache->entry_path, strerror(errno));
+        }
+    }
+    if (hits == ctx->target_count) {
+        return 0;
+    }
+    
+    int result = assemble(ctx);
+    for (int i = 0; i < ctx->target_count && result == 0; i++) {
+        if (cached[i]) {
+            cache_store(&caches[i], ctx->target_outputs[i]);
+        }
     }
+    return result;
+}
 
-    return 0;
-} 
\ No newline at end of file
+// Assemble, collecting per-phase statistics with --stats. They go to
+// stderr so they never mix with an image written to stdout.
+int assemble_file(assembler_context_t* ctx) {
+    if (ctx->link_inputs) {
+        return link_files(ctx);
+    }
+    if (ctx->bench_inputs) {
+        return microbench_run(ctx);
+    }
+    if (!ctx->stats_format) {
+        return assemble_cached(ctx);
+    }
+    
+    stats_t stats;
+    struct stat st;
+    stats_start(&stats);
+    if (stat(ctx->input_file, &st) == 0) {
+        stats.input_bytes = st.st_size;
+    }
+    
+    int result = assemble_cached(ctx);
+    stats_stop(&stats);
+    
+    if (result == 0) {
+        if (!ctx->run && strcmp(ctx->output_file, "-") != 0 &&
+            stat(ctx->output_file, &st) == 0 && S_ISREG(st.st_mode)) {
+            stats.output_bytes = st.st_size;
+        }
+        stats_report(&stats, stderr, strcmp(ctx->stats_format, "json") == 0);
+    }
+    return result;
+}
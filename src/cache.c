@@ -0,0 +1,428 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#include "../include/cache.h"
+
+// --cache: outputs are stored under a 128-bit key and copied back out on a
+// hit. The key covers the input bytes, the options that reach the output,
+// the source name (it is written into ELF symbols and DWARF), the working
+// directory with -g (DWARF comp_dir) and the assembler binary itself, so a
+// rebuilt assembler never serves stale objects. This relies on
+// write_output_file being deterministic: no timestamps, and every byte of
+// padding written explicitly.
+//
+// Entries are written to a temporary file and renamed into place, so
+// readers never see a partial entry and concurrent writers of the same key
+// simply replace each other's identical copies. Hits update the entry's
+// mtime, which eviction uses as the last-use time.
+
+#define CACHE_FORMAT_VERSION 1
+#define EVICT_TARGET_PERCENT 90       // Evict down to this share of max_size
+#define STALE_TEMP_SECONDS 3600       // Leftovers of crashed writers
+
+// XXH64
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const uint8_t* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    return rotl64(acc, 31) * PRIME1;
+}
+
+static uint64_t hash_merge(uint64_t acc, uint64_t value) {
+    acc ^= hash_round(0, value);
+    return acc * PRIME1 + PRIME4;
+}
+
+uint64_t cache_hash(const void* data, size_t length, uint64_t seed) {
+    const uint8_t* p = data;
+    const uint8_t* end = p + length;
+    uint64_t h;
+
+    if (length >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+        do {
+            v1 = hash_round(v1, read64(p));
+            v2 = hash_round(v2, read64(p + 8));
+            v3 = hash_round(v3, read64(p + 16));
+            v4 = hash_round(v4, read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = hash_merge(h, v1);
+        h = hash_merge(h, v2);
+        h = hash_merge(h, v3);
+        h = hash_merge(h, v4);
+    } else {
+        h = seed + PRIME5;
+    }
+    h += length;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= hash_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME1 + PRIME4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * PRIME1;
+        h = rotl64(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * PRIME5;
+        h = rotl64(h, 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+// $XDG_CACHE_HOME/assembler, else ~/.cache/assembler
+const char* cache_default_directory(void) {
+    static char path[PATH_MAX];
+    const char* base = getenv("XDG_CACHE_HOME");
+
+    if (base && *base) {
+        snprintf(path, sizeof(path), "%s/assembler", base);
+    } else {
+        const char* home = getenv("HOME");
+        snprintf(path, sizeof(path), "%s/.cache/assembler", home && *home ? home : "/tmp");
+    }
+    return path;
+}
+
+// Everything besides the input bytes that changes the output
+static size_t describe_options(const assembler_context_t* ctx, char* buffer, size_t size) {
+    struct stat self;
+    char cwd[PATH_MAX] = "";
+
+    if (stat("/proc/self/exe", &self) != 0) {
+        memset(&self, 0, sizeof(self));
+    }
+    if (ctx->debug_info && !getcwd(cwd, sizeof(cwd))) {
+        cwd[0] = '\0';
+    }
+
+    int length = snprintf(buffer, size,
+                          "format-version=%d exe=%llu:%lld.%09ld arch=%d format=%d g=%d "
+                          "align-branches=%d huge-text=%d pack-data=%d merge-constants=%d source=%s cwd=%s",
+                          CACHE_FORMAT_VERSION, (unsigned long long)self.st_size,
+                          (long long)self.st_mtim.tv_sec, self.st_mtim.tv_nsec,
+                          ctx->architecture, ctx->output_format, ctx->debug_info,
+                          ctx->align_branches, ctx->huge_text, ctx->pack_data, ctx->merge_constants,
+                          ctx->input_file, cwd);
+    return length < 0 ? 0 : (size_t)length < size ? (size_t)length : size - 1;
+}
+
+// Two independent hashes of a regular file's contents, or -1
+static int hash_file(const char* path, uint64_t seed, uint64_t key[2]) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    const void* input = "";
+    if (st.st_size > 0) {
+        input = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (input == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+    }
+    key[0] = cache_hash(input, st.st_size, seed);
+    key[1] = cache_hash(input, st.st_size, seed ^ PRIME3);
+    if (st.st_size > 0) {
+        munmap((void*)input, st.st_size);
+    }
+    close(fd);
+    return 0;
+}
+
+// Key the input, and the --profile that orders it; returns -1 if they
+// cannot be read (assemble uncached)
+int cache_init(cache_t* cache, const assembler_context_t* ctx) {
+    char options[2 * PATH_MAX + 256];
+    size_t options_length = describe_options(ctx, options, sizeof(options));
+    uint64_t seed = cache_hash(options, options_length, 0);
+
+    if (ctx->profile_file) {
+        uint64_t profile_key[2];
+        if (hash_file(ctx->profile_file, seed, profile_key) != 0) return -1;
+        seed = profile_key[0];
+    }
+    if (hash_file(ctx->input_file, seed, cache->key) != 0) return -1;
+
+    int length = snprintf(cache->entry_path, sizeof(cache->entry_path), "%s/%02x/%014llx%016llx",
+                          cache->directory, (unsigned)(cache->key[0] >> 56),
+                          (unsigned long long)(cache->key[0] & 0x00FFFFFFFFFFFFFFULL),
+                          (unsigned long long)cache->key[1]);
+    return length > 0 && (size_t)length < sizeof(cache->entry_path) ? 0 : -1;
+}
+
+// mkdir -p
+static int make_directories(const char* path) {
+    char buffer[PATH_MAX];
+    snprintf(buffer, sizeof(buffer), "%s", path);
+
+    for (char* p = buffer + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(buffer, 0777) != 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return mkdir(buffer, 0777) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+// Share extents when the filesystem can (FICLONE, or copy_file_range,
+// which may reflink or copy in the kernel), else copy through a buffer
+static int copy_contents(int to, int from, off_t size) {
+#ifdef FICLONE
+    if (ioctl(to, FICLONE, from) == 0) return 0;
+#endif
+
+    off_t done = 0;
+    while (done < size) {
+        ssize_t copied = copy_file_range(from, NULL, to, NULL, size - done, 0);
+        if (copied <= 0) break;
+        done += copied;
+    }
+    if (done == size) return 0;
+
+    char buffer[65536];
+    if (lseek(from, done, SEEK_SET) < 0 || lseek(to, done, SEEK_SET) < 0) return -1;
+    while (done < size) {
+        ssize_t count = read(from, buffer, sizeof(buffer));
+        if (count <= 0) return -1;
+        for (ssize_t written = 0; written < count; ) {
+            ssize_t n = write(to, buffer + written, count - written);
+            if (n < 0) return -1;
+            written += n;
+        }
+        done += count;
+    }
+    return 0;
+}
+
+// Copy source into a fresh temporary next to target, then rename it over
+// target. The copy keeps the source's executable bits.
+static int copy_replace(const char* source, const char* target, const char* temp_dir) {
+    int from = open(source, O_RDONLY);
+    if (from < 0) return -1;
+
+    struct stat st;
+    if (fstat(from, &st) != 0) {
+        close(from);
+        return -1;
+    }
+
+    char temp[PATH_MAX];
+    if (temp_dir) {
+        snprintf(temp, sizeof(temp), "%s/tmp.XXXXXX", temp_dir);
+    } else {
+        snprintf(temp, sizeof(temp), "%s.XXXXXX", target);
+    }
+    int to = mkstemp(temp);
+    if (to < 0) {
+        close(from);
+        return -1;
+    }
+
+    mode_t mask = umask(0);
+    umask(mask);
+    int result = copy_contents(to, from, st.st_size);
+    if (result == 0 && fchmod(to, (st.st_mode & 0111 ? 0777 : 0666) & ~mask) != 0) result = -1;
+    if (close(to) != 0) result = -1;
+    close(from);
+
+    if (result == 0 && rename(temp, target) != 0) result = -1;
+    if (result != 0) unlink(temp);
+    return result;
+}
+
+// Hard link the entry to a temporary name, then rename it over the output
+static int link_replace(const char* source, const char* target) {
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s.%ld.link", target, (long)getpid());
+
+    unlink(temp);
+    if (link(source, temp) != 0) return -1;
+    if (rename(temp, target) != 0) {
+        unlink(temp);
+        return -1;
+    }
+    return 0;
+}
+
+// Returns 0 on a hit (output written), 1 on a miss, -1 on error
+int cache_fetch(cache_t* cache, const char* output_file) {
+    if (access(cache->entry_path, R_OK) != 0) return 1;
+
+    if (cache->hardlink && link_replace(cache->entry_path, output_file) == 0) {
+        utimensat(AT_FDCWD, cache->entry_path, NULL, 0);
+        return 0;
+    }
+    if (copy_replace(cache->entry_path, output_file, NULL) != 0) {
+        // Evicted between the check and the copy: just assemble
+        return errno == ENOENT ? 1 : -1;
+    }
+
+    utimensat(AT_FDCWD, cache->entry_path, NULL, 0);
+    return 0;
+}
+
+typedef struct {
+    char* path;
+    off_t size;
+    time_t used;
+} cache_entry_t;
+
+static int compare_entries(const void* a, const void* b) {
+    const cache_entry_t* x = a;
+    const cache_entry_t* y = b;
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+static bool is_shard_name(const char* name) {
+    return strlen(name) == 2 && strspn(name, "0123456789abcdef") == 2;
+}
+
+// dir/name into out; false if it does not fit, so no other file is touched
+static bool join_path(char* out, size_t size, const char* dir, const char* name) {
+    int length = snprintf(out, size, "%s/%s", dir, name);
+    return length > 0 && (size_t)length < size;
+}
+
+// Gather every entry with its size and last use; drops stale temporaries
+static int scan_entries(const cache_t* cache, cache_entry_t** entries, int* count, uint64_t* total) {
+    int capacity = 0;
+    time_t now = time(NULL);
+    DIR* top = opendir(cache->directory);
+    if (!top) return -1;
+
+    *entries = NULL;
+    *count = 0;
+    *total = 0;
+
+    struct dirent* shard;
+    while ((shard = readdir(top))) {
+        char path[PATH_MAX];
+        struct stat st;
+
+        if (strncmp(shard->d_name, "tmp.", 4) == 0) {
+            if (!join_path(path, sizeof(path), cache->directory, shard->d_name)) continue;
+            if (stat(path, &st) == 0 && now - st.st_mtime > STALE_TEMP_SECONDS) unlink(path);
+            continue;
+        }
+        if (!is_shard_name(shard->d_name)) continue;
+
+        char shard_path[PATH_MAX];
+        if (!join_path(shard_path, sizeof(shard_path), cache->directory, shard->d_name)) continue;
+        DIR* dir = opendir(shard_path);
+        if (!dir) continue;
+
+        struct dirent* item;
+        while ((item = readdir(dir))) {
+            if (item->d_name[0] == '.') continue;
+            if (!join_path(path, sizeof(path), shard_path, item->d_name)) continue;
+            if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+            if (*count >= capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                cache_entry_t* grown = realloc(*entries, capacity * sizeof(cache_entry_t));
+                if (!grown) break;
+                *entries = grown;
+            }
+            cache_entry_t* entry = &(*entries)[*count];
+            entry->path = strdup(path);
+            if (!entry->path) break;
+            entry->size = st.st_blocks * 512 > st.st_size ? st.st_blocks * 512 : st.st_size;
+            entry->used = st.st_mtime;
+            *total += entry->size;
+            (*count)++;
+        }
+        closedir(dir);
+    }
+    closedir(top);
+    return 0;
+}
+
+// Delete least recently used entries until the cache is under its target.
+// Racing evictions may both unlink an entry; the loser's ENOENT is harmless.
+static void evict(const cache_t* cache) {
+    cache_entry_t* entries;
+    int count;
+    uint64_t total;
+
+    if (scan_entries(cache, &entries, &count, &total) != 0) return;
+
+    if (total > cache->max_size) {
+        uint64_t target = cache->max_size / 100 * EVICT_TARGET_PERCENT;
+        qsort(entries, count, sizeof(cache_entry_t), compare_entries);
+        for (int i = 0; i < count && total > target; i++) {
+            if (unlink(entries[i].path) == 0 || errno == ENOENT) {
+                total -= entries[i].size;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(entries[i].path);
+    }
+    free(entries);
+}
+
+// Add a freshly written output; failures only cost the caching
+int cache_store(cache_t* cache, const char* output_file) {
+    char shard[PATH_MAX];
+    snprintf(shard, sizeof(shard), "%s", cache->entry_path);
+    *strrchr(shard, '/') = '\0';
+
+    if (make_directories(shard) != 0 ||
+        copy_replace(output_file, cache->entry_path, cache->directory) != 0) {
+        fprintf(stderr, "Warning: Cannot store '%s' in the cache at %s: %s\n",
+                output_file, cache->directory, strerror(errno));
+        return -1;
+    }
+
+    evict(cache);
+    return 0;
+}
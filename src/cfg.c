@@ -0,0 +1,708 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "../include/cfg.h"
+#include "../include/layout.h"
+
+// Profile-guided code layout. The profile is a text file of block and edge
+// counts, one entry per line, # starts a comment:
+//
+//   block <location> <count>
+//   edge <from> <to> <count>
+//
+// A location is a label, label+offset or a plain .text offset: the sym+off
+// form perf script prints, so aggregated branch records map onto it
+// directly. Each location selects the block containing it; edges count
+// taken branches and fall-throughs, other edges are ignored.
+//
+// Blocks are chained greedily along their heaviest edges (Pettis and
+// Hansen), the entry block stays first, hot chains follow by weight and
+// never-executed blocks move behind them, to .text.cold. Conditional jumps
+// are inverted where the old target now follows, otherwise a jmp keeps a
+// broken fall-through. A jmp whose target now follows is left out.
+
+#define JUMP_BYTES_MAX 16
+
+// Block containing a code offset; offsets past the end belong to the last
+static int block_at(const cfg_t* cfg, uint64_t offset) {
+    int low = 0;
+    int high = cfg->block_count - 1;
+    int found = 0;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (cfg->blocks[mid].start <= offset) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return found;
+}
+
+// Block starting at a code offset, or -1
+static int block_starting_at(const cfg_t* cfg, uint64_t offset) {
+    int b = block_at(cfg, offset);
+    return cfg->block_count && cfg->blocks[b].start == offset ? b : -1;
+}
+
+// Instruction starting at a code offset, or -1
+static int instruction_at(const program_t* program, uint64_t offset) {
+    int low = 0;
+    int high = program->instruction_count - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        uint64_t address = program->instructions[mid]->address;
+        if (address == offset) return mid;
+        if (address < offset) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    program_t* program;
+    const char** labels;        // First label at each instruction
+} label_scan_t;
+
+static void mark_label(symbol_t* symbol, void* context) {
+    label_scan_t* scan = context;
+
+    if (symbol->type != SYMBOL_LABEL || !symbol->defined || symbol->section != SECTION_TEXT) return;
+    int i = instruction_at(scan->program, symbol->address);
+    if (i >= 0 && !scan->labels[i]) {
+        scan->labels[i] = symbol->name;
+    }
+}
+
+static bool is_unconditional_jump(const instruction_t* instr) {
+    return strcasecmp(instr->mnemonic, "jmp") == 0;
+}
+
+// Whether control can leave a block after this instruction. Calls return,
+// so they do not end blocks here.
+static bool ends_block(const instruction_t* instr) {
+    return is_unconditional_jump(instr) || strcasecmp(instr->mnemonic, "ret") == 0 ||
+           instruction_condition_code(instr) >= 0;
+}
+
+// Block a jmp/jcc branches to, or -1 for extern or indirect targets
+static int branch_target(const cfg_t* cfg, const instruction_t* instr) {
+    if (instr->operand_count != 1 || instr->operands[0].type != OPERAND_LABEL) return -1;
+
+    symbol_t* symbol = symbol_table_lookup(cfg->program->symbols, instr->operands[0].data.label.name);
+    if (!symbol || !symbol->defined || symbol->type != SYMBOL_LABEL ||
+        symbol->binding == SYMBOL_EXTERN || symbol->section != SECTION_TEXT) {
+        return -1;
+    }
+    return block_starting_at(cfg, symbol->address);
+}
+
+cfg_t* cfg_build(program_t* program) {
+    cfg_t* cfg = calloc(1, sizeof(cfg_t));
+    if (!cfg) return NULL;
+    cfg->program = program;
+
+    int count = program->instruction_count;
+    if (count == 0) return cfg;
+
+    const char** labels = calloc(count, sizeof(const char*));
+    cfg->blocks = calloc(count, sizeof(cfg_block_t));
+    if (!labels || !cfg->blocks) {
+        free(labels);
+        cfg_destroy(cfg);
+        return NULL;
+    }
+
+    label_scan_t scan = {program, labels};
+    symbol_table_foreach(program->symbols, mark_label, &scan);
+
+    // Split at labels and after jumps
+    for (int i = 0; i < count; i++) {
+        if (i == 0 || labels[i] || ends_block(program->instructions[i - 1])) {
+            cfg_block_t* block = &cfg->blocks[cfg->block_count++];
+            block->first = i;
+            block->start = program->instructions[i]->address;
+            block->label = labels[i];
+        }
+        cfg->blocks[cfg->block_count - 1].last = i;
+    }
+    free(labels);
+
+    for (int b = 0; b < cfg->block_count; b++) {
+        cfg_block_t* block = &cfg->blocks[b];
+        instruction_t* last = program->instructions[block->last];
+
+        block->end = b + 1 < cfg->block_count ? cfg->blocks[b + 1].start : program->code_size;
+        block->conditional = instruction_condition_code(last) >= 0;
+        block->target = block->conditional || is_unconditional_jump(last) ? branch_target(cfg, last) : -1;
+        block->fallthrough = ends_block(last) && !block->conditional ? -1 :
+                             b + 1 < cfg->block_count ? b + 1 : -1;
+    }
+    return cfg;
+}
+
+void cfg_destroy(cfg_t* cfg) {
+    if (!cfg) return;
+    free(cfg->blocks);
+    free(cfg);
+}
+
+// Code offset of a profile location: label, label+offset or a number.
+// False if it is not in this program's .text.
+static bool parse_location(const cfg_t* cfg, const char* text, uint64_t* offset) {
+    char* end;
+    const program_t* program = cfg->program;
+
+    if (text[0] >= '0' && text[0] <= '9') {
+        *offset = strtoull(text, &end, 0);
+        return *end == '\0' && *offset < program->code_size;
+    }
+
+    char name[256];
+    const char* plus = strchr(text, '+');
+    size_t length = plus ? (size_t)(plus - text) : strlen(text);
+    if (length >= sizeof(name)) return false;
+    memcpy(name, text, length);
+    name[length] = '\0';
+
+    uint64_t delta = 0;
+    if (plus) {
+        delta = strtoull(plus + 1, &end, 0);
+        if (end == plus + 1 || *end != '\0') return false;
+    }
+
+    symbol_t* symbol = symbol_table_lookup(program->symbols, name);
+    if (!symbol || !symbol->defined || symbol->type != SYMBOL_LABEL || symbol->section != SECTION_TEXT) {
+        return false;
+    }
+    *offset = symbol->address + delta;
+    return *offset < program->code_size;
+}
+
+static bool parse_count(const char* text, uint64_t* count) {
+    char* end;
+    if (!text || text[0] < '0' || text[0] > '9') return false;
+    *count = strtoull(text, &end, 0);
+    return *end == '\0';
+}
+
+// Add the counts of a profile to the blocks. Entries naming code outside
+// this program (other objects, libraries) are counted in *unmatched.
+int cfg_read_profile(cfg_t* cfg, const char* path, int* unmatched) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open profile '%s'\n", path);
+        return -1;
+    }
+
+    char* line = NULL;
+    size_t capacity = 0;
+    int line_number = 0;
+    int result = 0;
+    *unmatched = 0;
+
+    while (getline(&line, &capacity, file) != -1) {
+        line_number++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char* fields[5];
+        int field_count = 0;
+        char* save;
+        for (char* field = strtok_r(line, " \t\r\n", &save); field && field_count < 5;
+             field = strtok_r(NULL, " \t\r\n", &save)) {
+            fields[field_count++] = field;
+        }
+        if (field_count == 0) continue;
+
+        bool is_block = strcmp(fields[0], "block") == 0 && field_count == 3;
+        bool is_edge = strcmp(fields[0], "edge") == 0 && field_count == 4;
+        uint64_t count;
+        if ((!is_block && !is_edge) || !parse_count(fields[field_count - 1], &count)) {
+            fprintf(stderr, "Error: %s:%d: Expected 'block <location> <count>' or "
+                    "'edge <from> <to> <count>'\n", path, line_number);
+            result = -1;
+            break;
+        }
+
+        uint64_t from, to;
+        if (!parse_location(cfg, fields[1], &from) || (is_edge && !parse_location(cfg, fields[2], &to))) {
+            (*unmatched)++;
+            continue;
+        }
+
+        cfg_block_t* block = &cfg->blocks[block_at(cfg, from)];
+        if (is_block) {
+            block->count += count;
+            continue;
+        }
+
+        int target = block_at(cfg, to);
+        if (target == block->target) {
+            block->target_count += count;
+        } else if (target == block->fallthrough) {
+            block->fallthrough_count += count;
+        }
+    }
+
+    free(line);
+    fclose(file);
+    if (result != 0) return result;
+
+    // A block runs at least as often as control enters or leaves it
+    uint64_t* incoming = calloc(cfg->block_count ? cfg->block_count : 1, sizeof(uint64_t));
+    if (!incoming) {
+        fprintf(stderr, "Error: Out of memory reading the profile\n");
+        return -1;
+    }
+    for (int b = 0; b < cfg->block_count; b++) {
+        cfg_block_t* block = &cfg->blocks[b];
+        if (block->fallthrough >= 0) incoming[block->fallthrough] += block->fallthrough_count;
+        if (block->target >= 0) incoming[block->target] += block->target_count;
+    }
+    for (int b = 0; b < cfg->block_count; b++) {
+        cfg_block_t* block = &cfg->blocks[b];
+        uint64_t outgoing = block->fallthrough_count + block->target_count;
+        if (block->count < outgoing) block->count = outgoing;
+        if (block->count < incoming[b]) block->count = incoming[b];
+    }
+    free(incoming);
+    return 0;
+}
+
+typedef struct {
+    int from;
+    int to;
+    uint64_t weight;
+    bool fallthrough;
+} cfg_edge_t;
+
+// Heaviest first; on ties keep existing fall-throughs, then code order
+static int compare_edges(const void* a, const void* b) {
+    const cfg_edge_t* x = a;
+    const cfg_edge_t* y = b;
+
+    if (x->weight != y->weight) return x->weight > y->weight ? -1 : 1;
+    if (x->fallthrough != y->fallthrough) return x->fallthrough ? -1 : 1;
+    return x->from - y->from;
+}
+
+static int find_chain(int* leader, int b) {
+    while (leader[b] != b) {
+        leader[b] = leader[leader[b]];
+        b = leader[b];
+    }
+    return b;
+}
+
+typedef struct {
+    int head;
+    uint64_t weight;            // Hottest block of the chain
+} cfg_chain_t;
+
+static int compare_chains(const void* a, const void* b) {
+    const cfg_chain_t* x = a;
+    const cfg_chain_t* y = b;
+
+    if (x->weight != y->weight) return x->weight > y->weight ? -1 : 1;
+    return x->head - y->head;
+}
+
+// Fill order with every block: hot chains, then cold blocks in code order.
+// Returns the number of hot blocks, or -1.
+static int order_blocks(const cfg_t* cfg, int* order) {
+    int n = cfg->block_count;
+    cfg_edge_t* edges = malloc(2 * n * sizeof(cfg_edge_t));
+    cfg_chain_t* chains = malloc(n * sizeof(cfg_chain_t));
+    int* next = malloc(n * sizeof(int));
+    int* previous = malloc(n * sizeof(int));
+    int* leader = malloc(n * sizeof(int));
+    int hot = -1;
+
+    if (!edges || !chains || !next || !previous || !leader) goto cleanup;
+
+    int edge_count = 0;
+    for (int b = 0; b < n; b++) {
+        const cfg_block_t* block = &cfg->blocks[b];
+        next[b] = previous[b] = -1;
+        leader[b] = b;
+        if (block->fallthrough >= 0 && block->fallthrough_count) {
+            edges[edge_count++] = (cfg_edge_t){b, block->fallthrough, block->fallthrough_count, true};
+        }
+        if (block->target >= 0 && block->target_count) {
+            edges[edge_count++] = (cfg_edge_t){b, block->target, block->target_count, false};
+        }
+    }
+    qsort(edges, edge_count, sizeof(cfg_edge_t), compare_edges);
+
+    // Join a chain ending in from to a chain starting with to. The entry
+    // block has to stay at the start of .text.
+    for (int e = 0; e < edge_count; e++) {
+        int from = edges[e].from;
+        int to = edges[e].to;
+        if (to == 0 || next[from] >= 0 || previous[to] >= 0) continue;
+
+        int a = find_chain(leader, from);
+        int b = find_chain(leader, to);
+        if (a == b) continue;
+
+        next[from] = to;
+        previous[to] = from;
+        leader[b] = a;
+    }
+
+    int chain_count = 0;
+    for (int b = 0; b < n; b++) {
+        if (previous[b] >= 0 || (b != 0 && cfg->blocks[b].count == 0)) continue;
+
+        uint64_t weight = 0;
+        for (int c = b; c >= 0; c = next[c]) {
+            if (cfg->blocks[c].count > weight) weight = cfg->blocks[c].count;
+        }
+        chains[chain_count++] = (cfg_chain_t){b, weight};
+    }
+    // The entry chain is chains[0]
+    qsort(chains + 1, chain_count - 1, sizeof(cfg_chain_t), compare_chains);
+
+    hot = 0;
+    for (int c = 0; c < chain_count; c++) {
+        for (int b = chains[c].head; b >= 0; b = next[b]) {
+            order[hot++] = b;
+        }
+    }
+    int placed = hot;
+    for (int b = 1; b < n; b++) {
+        if (cfg->blocks[b].count == 0) order[placed++] = b;
+    }
+
+cleanup:
+    if (hot < 0) fprintf(stderr, "Error: Out of memory ordering blocks\n");
+    free(edges);
+    free(chains);
+    free(next);
+    free(previous);
+    free(leader);
+    return hot;
+}
+
+// Where a block goes and how its fall-through is kept
+typedef struct {
+    uint64_t new_start;
+    bool invert;                // The jcc at the end now branches to the old fall-through
+    uint64_t inverted_field;    // Old offset of that jcc's displacement
+    instruction_t* jump;        // jmp appended to reach the old fall-through, or NULL
+    instruction_t* dropped;     // jmp at the end left out, as its target now follows
+} cfg_placement_t;
+
+// Name of a block, defining a local .L label if it has none. .L names
+// cannot come from source, since . starts a directive.
+static const char* block_label(cfg_t* cfg, int b) {
+    cfg_block_t* block = &cfg->blocks[b];
+    if (block->label) return block->label;
+
+    char name[32];
+    snprintf(name, sizeof(name), ".Lcfg%d", b);
+    symbol_t* symbol = symbol_table_define(cfg->program->symbols, name, SYMBOL_LABEL, block->start);
+    if (!symbol) return NULL;
+    symbol->section = SECTION_TEXT;
+    block->label = symbol->name;
+    return block->label;
+}
+
+// Allocated like the program's own instructions
+static instruction_t* create_jump(program_t* program, const char* label, const instruction_t* after) {
+    instruction_t* jump = instruction_create(program->arena, "jmp");
+    if (!jump) return NULL;
+    if (!instruction_add_label(jump, label)) {
+        instruction_destroy(jump);
+        return NULL;
+    }
+
+    jump->line = after->line;
+    jump->column = after->column;
+    return jump;
+}
+
+// Point a conditional jump at the block it used to fall into
+static bool invert_jump(instruction_t* jcc, const char* label) {
+    char* name = instruction_strdup(jcc, label);
+    if (!name || !instruction_invert_condition(jcc)) {
+        if (name) instruction_free_string(jcc, name);
+        return false;
+    }
+    instruction_free_string(jcc, jcc->operands[0].data.label.name);
+    jcc->operands[0].data.label.name = name;
+    return true;
+}
+
+// New offset of an old code offset: it moves with its block
+static uint64_t map_offset(const cfg_t* cfg, const cfg_placement_t* placements, uint64_t offset) {
+    int b = block_at(cfg, offset);
+    return placements[b].new_start + (offset - cfg->blocks[b].start);
+}
+
+typedef struct {
+    const cfg_t* cfg;
+    const cfg_placement_t* placements;
+} cfg_remap_t;
+
+static void remap_symbol(symbol_t* symbol, void* context) {
+    cfg_remap_t* remap = context;
+
+    if (symbol->type == SYMBOL_LABEL && symbol->defined && symbol->section == SECTION_TEXT) {
+        symbol->address = map_offset(remap->cfg, remap->placements, symbol->address);
+    }
+}
+
+// Decide how every block keeps its fall-through in the new order. Returns
+// the size of the new code, or -1.
+static int64_t plan_fallthroughs(cfg_t* cfg, arch_type_t arch, const int* order, int hot,
+                                 cfg_placement_t* placements, cfg_layout_stats_t* stats) {
+    program_t* program = cfg->program;
+    int n = cfg->block_count;
+    uint64_t position = 0;
+
+    for (int p = 0; p < n; p++) {
+        int b = order[p];
+        cfg_block_t* block = &cfg->blocks[b];
+        cfg_placement_t* place = &placements[b];
+        // .text and .text.cold may end up apart
+        int following = p + 1 < n && p + 1 != hot ? order[p + 1] : -1;
+
+        place->new_start = position;
+        position += block->end - block->start;
+
+        instruction_t* last = program->instructions[block->last];
+        if (!block->conditional && block->target == following && following >= 0 &&
+            is_unconditional_jump(last) && last->address + last->size == block->end) {
+            place->dropped = last;
+            position -= last->size;
+            stats->removed_jumps++;
+            continue;
+        }
+        if (block->fallthrough < 0 || block->fallthrough == following) continue;
+
+        const char* label = block_label(cfg, block->fallthrough);
+        if (!label) return -1;
+
+        if (block->conditional && block->target == following && following >= 0 &&
+            last->address + last->size == block->end && last->fixup_kind == FIXUP_RELATIVE) {
+            place->inverted_field = last->address + last->fixup_offset;
+            if (!invert_jump(last, label)) return -1;
+            place->invert = true;
+            stats->inverted_jumps++;
+            continue;
+        }
+
+        uint8_t scratch[JUMP_BYTES_MAX];
+        place->jump = create_jump(program, label, last);
+        if (!place->jump) return -1;
+        int size = encode_instruction(place->jump, arch, scratch, sizeof(scratch));
+        if (size < 0) {
+            fprintf(stderr, "Error: Cannot encode a jump for this architecture\n");
+            return -1;
+        }
+        position += size;
+        stats->added_jumps++;
+    }
+    return (int64_t)position;
+}
+
+// Rewrite the program in the order of the profile. The first block stays
+// first; blocks the profile never saw go behind program->cold_start.
+int cfg_reorder(cfg_t* cfg, arch_type_t arch, cfg_layout_stats_t* stats) {
+    program_t* program = cfg->program;
+    int n = cfg->block_count;
+    int result = -1;
+
+    memset(stats, 0, sizeof(*stats));
+    if (n == 0) return 0;
+
+    int* order = malloc(n * sizeof(int));
+    cfg_placement_t* placements = calloc(n, sizeof(cfg_placement_t));
+    instruction_t** instructions = NULL;
+    uint8_t* code = NULL;
+    if (!order || !placements) {
+        fprintf(stderr, "Error: Out of memory ordering blocks\n");
+        goto cleanup;
+    }
+
+    int hot = order_blocks(cfg, order);
+    if (hot < 0) goto cleanup;
+    stats->hot_blocks = hot;
+    stats->cold_blocks = n - hot;
+
+    int64_t new_size = plan_fallthroughs(cfg, arch, order, hot, placements, stats);
+    if (new_size < 0) {
+        fprintf(stderr, "Error: Out of memory reordering blocks\n");
+        goto cleanup;
+    }
+
+    int capacity = program->instruction_count + stats->added_jumps;
+    instructions = malloc((capacity ? capacity : 1) * sizeof(instruction_t*));
+    code = malloc(new_size ? new_size : 1);
+    if (!instructions || !code) {
+        fprintf(stderr, "Error: Out of memory reordering blocks\n");
+        goto cleanup;
+    }
+
+    // Copy the blocks; flipped and appended jumps are encoded in place
+    for (int p = 0; p < n; p++) {
+        int b = order[p];
+        cfg_block_t* block = &cfg->blocks[b];
+        cfg_placement_t* place = &placements[b];
+        uint64_t size = block->end - block->start - (place->dropped ? (uint64_t)place->dropped->size : 0);
+
+        memcpy(code + place->new_start, program->code + block->start, size);
+        if (place->invert) {
+            instruction_t* last = program->instructions[block->last];
+            encode_instruction(last, arch, code + place->new_start + (last->address - block->start),
+                               last->size);
+        }
+        if (place->jump) {
+            place->jump->address = place->new_start + size;
+            place->jump->size = encode_instruction(place->jump, arch, code + place->jump->address,
+                                                   JUMP_BYTES_MAX);
+        }
+    }
+
+    // Fixups of dropped jumps go; labels and the other fixups move with
+    // their blocks
+    int fixup_count = 0;
+    for (int i = 0; i < program->fixup_count; i++) {
+        fixup_t* fixup = &program->fixups[i];
+        const instruction_t* dropped = placements[block_at(cfg, fixup->offset)].dropped;
+        if (dropped && fixup->offset >= dropped->address && fixup->offset < dropped->address + dropped->size) {
+            free(fixup->label);
+        } else {
+            program->fixups[fixup_count++] = *fixup;
+        }
+    }
+    program->fixup_count = fixup_count;
+
+    cfg_remap_t remap = {cfg, placements};
+    symbol_table_foreach(program->symbols, remap_symbol, &remap);
+    for (int i = 0; i < program->fixup_count; i++) {
+        fixup_t* fixup = &program->fixups[i];
+        const cfg_placement_t* place = &placements[block_at(cfg, fixup->offset)];
+
+        if (place->invert && fixup->offset == place->inverted_field) {
+            const cfg_block_t* block = &cfg->blocks[block_at(cfg, fixup->offset)];
+            char* label = strdup(cfg->blocks[block->fallthrough].label);
+            if (!label) {
+                fprintf(stderr, "Error: Out of memory reordering blocks\n");
+                goto cleanup;
+            }
+            free(fixup->label);
+            fixup->label = label;
+        }
+        fixup->offset = map_offset(cfg, placements, fixup->offset);
+    }
+    for (int i = 0; i < program->text_distance_count; i++) {
+        text_distance_t* distance = &program->text_distances[i];
+        distance->from = map_offset(cfg, placements, distance->from);
+        distance->to = map_offset(cfg, placements, distance->to);
+    }
+
+    // Instructions in their new address order, appended jumps included
+    int count = 0;
+    for (int p = 0; p < n; p++) {
+        int b = order[p];
+        cfg_block_t* block = &cfg->blocks[b];
+        cfg_placement_t* place = &placements[b];
+
+        for (int i = block->first; i <= block->last; i++) {
+            instruction_t* instr = program->instructions[i];
+            if (instr == place->dropped) continue;
+            instr->address = place->new_start + (instr->address - block->start);
+            instructions[count++] = instr;
+        }
+        if (place->jump) {
+            if (!program_add_fixup(program, place->jump, place->jump->address)) {
+                fprintf(stderr, "Error: Out of memory reordering blocks\n");
+                goto cleanup;
+            }
+            instructions[count++] = place->jump;
+            place->jump = NULL;
+        }
+    }
+
+    for (int b = 0; b < n; b++) {
+        instruction_destroy(placements[b].dropped);
+    }
+    free(program->instructions);
+    program->instructions = instructions;
+    program->instruction_count = count;
+    program->instruction_capacity = capacity;
+    instructions = NULL;
+
+    free(program->code);
+    program->code = code;
+    program->code_size = new_size;
+    program->code_capacity = new_size;
+    code = NULL;
+
+    program->cold_start = hot < n ? placements[order[hot]].new_start : 0;
+    result = 0;
+
+cleanup:
+    if (placements) {
+        for (int b = 0; b < n; b++) {
+            instruction_destroy(placements[b].jump);
+        }
+    }
+    free(order);
+    free(placements);
+    free(instructions);
+    free(code);
+    return result;
+}
+
+// --profile: lay out .text by the counts in path
+int cfg_apply_profile(program_t* program, arch_type_t arch, const char* path, bool verbose) {
+    cfg_t* cfg = cfg_build(program);
+    if (!cfg) {
+        fprintf(stderr, "Error: Out of memory building the control-flow graph\n");
+        return -1;
+    }
+
+    int unmatched;
+    if (cfg_read_profile(cfg, path, &unmatched) != 0) {
+        cfg_destroy(cfg);
+        return -1;
+    }
+    if (unmatched) {
+        fprintf(stderr, "Warning: %d profile entries do not match this program\n", unmatched);
+    }
+
+    bool counted = false;
+    for (int b = 0; b < cfg->block_count && !counted; b++) {
+        counted = cfg->blocks[b].count != 0;
+    }
+    if (!counted) {
+        fprintf(stderr, "Warning: Profile '%s' has no counts for this program, layout unchanged\n", path);
+        cfg_destroy(cfg);
+        return 0;
+    }
+
+    cfg_layout_stats_t stats;
+    int result = cfg_reorder(cfg, arch, &stats);
+    if (result == 0) {
+        result = layout_check_text_distances(program, "--profile");
+    }
+    if (result == 0 && verbose) {
+        printf("Profile layout: %d blocks, %d hot, %d cold; %d jumps inverted, %d added, %d removed\n",
+               cfg->block_count, stats.hot_blocks, stats.cold_blocks,
+               stats.inverted_jumps, stats.added_jumps, stats.removed_jumps);
+    }
+    cfg_destroy(cfg);
+    return result;
+}
@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/data_layout.h"
+
+static int compare_offsets(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Hot before cold, stricter alignment first, then source order
+static int compare_packed(const void* a, const void* b) {
+    const data_item_t* x = *(const data_item_t* const*)a;
+    const data_item_t* y = *(const data_item_t* const*)b;
+
+    if (x->hot != y->hot) return x->hot ? -1 : 1;
+    if (x->alignment != y->alignment) return x->alignment > y->alignment ? -1 : 1;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static bool is_item_label(const symbol_t* symbol, int section) {
+    return symbol->type == SYMBOL_LABEL && symbol->defined && symbol->section == section;
+}
+
+// Items of the first size bytes of a section: one from offset 0 and one
+// from each label, in address order. Returns the count (at least 1), or
+// -1 when out of memory.
+int data_items_collect(const program_t* program, int section, uint64_t size, data_item_t** items_out) {
+    const symbol_table_t* table = program->symbols;
+    uint64_t* starts = malloc(((size_t)table->symbol_count + 1) * sizeof(uint64_t));
+    if (!starts) return -1;
+
+    int count = 0;
+    starts[count++] = 0;
+    for (int i = 0; i < table->symbol_count; i++) {
+        const symbol_t* symbol = &table->symbols[i];
+        if (is_item_label(symbol, section) && symbol->address > 0 && symbol->address < size) {
+            starts[count++] = symbol->address;
+        }
+    }
+    qsort(starts, count, sizeof(uint64_t), compare_offsets);
+
+    data_item_t* items = calloc(count, sizeof(data_item_t));
+    if (!items) {
+        free(starts);
+        return -1;
+    }
+
+    int item_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && starts[i] == starts[i - 1]) continue;
+        items[item_count].start = starts[i];
+        items[item_count].alignment = 1;
+        item_count++;
+    }
+    for (int i = 0; i < item_count; i++) {
+        uint64_t end = i + 1 < item_count ? items[i + 1].start : size;
+        items[i].length = end - items[i].start;
+    }
+    free(starts);
+
+    // An align right before a label belongs to the item it starts; its
+    // padding is dropped from the item before
+    for (int a = 0; a < program->align_count; a++) {
+        const data_align_t* align = &program->aligns[a];
+        if (align->section != section || align->offset > size) continue;
+
+        int i = data_item_find(items, item_count, align->offset);
+        if (align->offset == size) {
+            i = item_count;
+        } else if (items[i].start != align->offset) {
+            continue;
+        } else if (align->alignment > items[i].alignment) {
+            items[i].alignment = align->alignment;
+        }
+        if (i > 0) {
+            data_item_t* before = &items[i - 1];
+            before->length -= align->padding < before->length ? align->padding : before->length;
+        }
+    }
+
+    for (int s = 0; s < table->symbol_count; s++) {
+        const symbol_t* symbol = &table->symbols[s];
+        if (symbol->hot && is_item_label(symbol, section) && symbol->address < size) {
+            items[data_item_find(items, item_count, symbol->address)].hot = true;
+        }
+    }
+
+    *items_out = items;
+    return item_count;
+}
+
+// Item holding offset, by binary search
+int data_item_find(const data_item_t* items, int count, uint64_t offset) {
+    int low = 0;
+    int high = count - 1;
+
+    while (low < high) {
+        int middle = low + (high - low + 1) / 2;
+        if (items[middle].start <= offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+// Index of the first [label + disp] that reads outside the item its label
+// in section starts, or -1 if every one stays inside
+int data_reference_crossing(const program_t* program, int section, uint64_t size,
+                            const data_reference_t* references, int count) {
+    data_item_t* items = NULL;
+    int item_count = 0;
+    int crossing = -1;
+
+    for (int r = 0; r < count && crossing < 0; r++) {
+        const symbol_t* symbol = symbol_table_lookup(program->symbols, references[r].label);
+        if (!symbol || !is_item_label(symbol, section)) continue;
+
+        if (!items) {
+            item_count = data_items_collect(program, section, size, &items);
+            if (item_count < 0) return r; // Out of memory: keep the section as written
+        }
+        const data_item_t* item = &items[data_item_find(items, item_count, symbol->address)];
+        uint64_t target = symbol->address + (uint64_t)references[r].displacement;
+        if (target < item->start || target >= item->start + item->length) {
+            crossing = r;
+        }
+    }
+    free(items);
+    return crossing;
+}
+
+// Lowest set bit of the length: a dq array gets 8, a 16-byte vector 16
+uint64_t data_item_natural_alignment(const data_item_t* item) {
+    uint64_t low = item->length & (0 - item->length);
+    if (low == 0) return 1;
+    return low < DATA_NATURAL_ALIGNMENT ? low : DATA_NATURAL_ALIGNMENT;
+}
+
+void data_items_sort(data_item_t** order, int count) {
+    qsort(order, count, sizeof(data_item_t*), compare_packed);
+}
+
+// Assign offsets in the given order from offset on; returns the end
+uint64_t data_items_place(data_item_t** order, int count, uint64_t offset) {
+    for (int i = 0; i < count; i++) {
+        order[i]->placed = align_up(offset, order[i]->alignment);
+        offset = order[i]->placed + order[i]->length;
+    }
+    return offset;
+}
+
+bool data_layout_pack(program_t* program) {
+    if (program->data_size == 0) return true;
+
+    data_item_t* items;
+    int count = data_items_collect(program, SECTION_DATA, program->data_size, &items);
+    if (count < 0) return false;
+
+    data_item_t** order = malloc((size_t)count * sizeof(data_item_t*));
+    uint8_t* packed = NULL;
+    uint64_t size = 0;
+    if (order) {
+        for (int i = 0; i < count; i++) {
+            uint64_t natural = data_item_natural_alignment(&items[i]);
+            if (natural > items[i].alignment) {
+                items[i].alignment = natural;
+            }
+            order[i] = &items[i];
+        }
+        data_items_sort(order, count);
+        size = data_items_place(order, count, 0);
+        packed = calloc(size ? size : 1, 1);
+    }
+    if (!packed) {
+        free(order);
+        free(items);
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        memcpy(packed + items[i].placed, program->data_section + items[i].start, items[i].length);
+    }
+
+    // Labels follow their item; one at the very end stays at the end
+    symbol_table_t* table = program->symbols;
+    for (int s = 0; s < table->symbol_count; s++) {
+        symbol_t* symbol = &table->symbols[s];
+        if (!is_item_label(symbol, SECTION_DATA)) continue;
+
+        if (symbol->address >= program->data_size) {
+            symbol->address = size;
+        } else {
+            symbol->address = items[data_item_find(items, count, symbol->address)].placed;
+        }
+    }
+
+    program->data_packed = program->data_size > size ? program->data_size - size : 0;
+    free(program->data_section);
+    program->data_section = packed;
+    program->data_size = program->data_capacity = size;
+
+    free(order);
+    free(items);
+    return true;
+}
@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include "dwarf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// DWARF 5 constants (subset used here)
+#define DW_UT_compile 0x01
+#define DW_TAG_compile_unit 0x11
+#define DW_CHILDREN_no 0x00
+#define DW_AT_name 0x03
+#define DW_AT_stmt_list 0x10
+#define DW_AT_low_pc 0x11
+#define DW_AT_high_pc 0x12
+#define DW_AT_language 0x13
+#define DW_AT_comp_dir 0x1b
+#define DW_AT_producer 0x25
+#define DW_FORM_addr 0x01
+#define DW_FORM_data2 0x05
+#define DW_FORM_data4 0x06
+#define DW_FORM_data8 0x07
+#define DW_FORM_string 0x08
+#define DW_FORM_udata 0x0f
+#define DW_FORM_sec_offset 0x17
+#define DW_LANG_Mips_Assembler 0x8001
+#define DW_LNCT_path 0x1
+#define DW_LNCT_directory_index 0x2
+#define DW_LNS_copy 0x01
+#define DW_LNS_advance_pc 0x02
+#define DW_LNS_advance_line 0x03
+#define DW_LNS_set_column 0x05
+#define DW_LNS_const_add_pc 0x08
+#define DW_LNE_end_sequence 0x01
+#define DW_LNE_set_address 0x02
+
+// Line program parameters: the same values GNU as uses, which keep most
+// one-instruction-per-line rows down to a single special opcode
+#define LINE_BASE (-5)
+#define LINE_RANGE 14
+#define OPCODE_BASE 13
+#define MAX_SPECIAL_ADDRESS_ADVANCE ((255 - OPCODE_BASE) / LINE_RANGE)
+
+static const uint8_t standard_opcode_lengths[OPCODE_BASE - 1] = {
+    0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1
+};
+
+static void emit_bytes(dwarf_t* dwarf, dwarf_section_t section, const void* bytes, size_t count) {
+    dwarf_buffer_t* buffer = &dwarf->sections[section];
+    if (dwarf->failed) return;
+
+    if (buffer->size + count > buffer->capacity) {
+        size_t new_capacity = buffer->capacity ? buffer->capacity * 2 : 256;
+        while (new_capacity < buffer->size + count) new_capacity *= 2;
+        uint8_t* new_data = realloc(buffer->data, new_capacity);
+        if (!new_data) {
+            dwarf->failed = true;
+            return;
+        }
+        buffer->data = new_data;
+        buffer->capacity = new_capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, bytes, count);
+    buffer->size += count;
+}
+
+static void emit_u8(dwarf_t* dwarf, dwarf_section_t section, uint8_t value) {
+    emit_bytes(dwarf, section, &value, 1);
+}
+
+// Little-endian fixed-width value
+static void emit_uint(dwarf_t* dwarf, dwarf_section_t section, uint64_t value, int size) {
+    uint8_t bytes[8];
+    for (int i = 0; i < size; i++) {
+        bytes[i] = (uint8_t)(value >> (i * 8));
+    }
+    emit_bytes(dwarf, section, bytes, size);
+}
+
+static void emit_uleb(dwarf_t* dwarf, dwarf_section_t section, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if (value) byte |= 0x80;
+        emit_u8(dwarf, section, byte);
+    } while (value);
+}
+
+static void emit_sleb(dwarf_t* dwarf, dwarf_section_t section, int64_t value) {
+    bool more = true;
+    while (more) {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if ((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40))) {
+            more = false;
+        } else {
+            byte |= 0x80;
+        }
+        emit_u8(dwarf, section, byte);
+    }
+}
+
+static void emit_string(dwarf_t* dwarf, dwarf_section_t section, const char* string) {
+    emit_bytes(dwarf, section, string, strlen(string) + 1);
+}
+
+static void patch_uint(dwarf_t* dwarf, dwarf_section_t section, size_t offset, uint64_t value, int size) {
+    if (dwarf->failed) return;
+    for (int i = 0; i < size; i++) {
+        dwarf->sections[section].data[offset + i] = (uint8_t)(value >> (i * 8));
+    }
+}
+
+// Emit a placeholder field and record the relocation that fills it in
+static void emit_relocated(dwarf_t* dwarf, dwarf_section_t section, int size,
+                           dwarf_target_t target, int64_t addend) {
+    if (dwarf->relocation_count >= dwarf->relocation_capacity) {
+        int new_capacity = dwarf->relocation_capacity ? dwarf->relocation_capacity * 2 : 8;
+        dwarf_relocation_t* new_relocations = realloc(dwarf->relocations,
+                                                      new_capacity * sizeof(dwarf_relocation_t));
+        if (!new_relocations) {
+            dwarf->failed = true;
+            return;
+        }
+        dwarf->relocations = new_relocations;
+        dwarf->relocation_capacity = new_capacity;
+    }
+
+    dwarf_relocation_t* reloc = &dwarf->relocations[dwarf->relocation_count++];
+    reloc->section = section;
+    reloc->offset = dwarf->sections[section].size;
+    reloc->size = size;
+    reloc->target = target;
+    reloc->addend = addend;
+    emit_uint(dwarf, section, 0, size);
+}
+
+// Line program header up to the first opcode. unit_length and
+// header_length are patched by dwarf_finish once the sizes are known.
+static void emit_line_header(dwarf_t* dwarf, const char* source_name, const char* comp_dir) {
+    dwarf_section_t s = DWARF_SECTION_LINE;
+
+    emit_uint(dwarf, s, 0, 4);                       // unit_length
+    emit_uint(dwarf, s, 5, 2);                       // version
+    emit_u8(dwarf, s, dwarf->address_size);
+    emit_u8(dwarf, s, 0);                            // segment_selector_size
+    emit_uint(dwarf, s, 0, 4);                       // header_length
+    emit_u8(dwarf, s, 1);                            // minimum_instruction_length
+    emit_u8(dwarf, s, 1);                            // maximum_operations_per_instruction
+    emit_u8(dwarf, s, 1);                            // default_is_stmt
+    emit_u8(dwarf, s, (uint8_t)LINE_BASE);
+    emit_u8(dwarf, s, LINE_RANGE);
+    emit_u8(dwarf, s, OPCODE_BASE);
+    emit_bytes(dwarf, s, standard_opcode_lengths, sizeof(standard_opcode_lengths));
+
+    // Directory table: entry 0 is the compilation directory
+    emit_u8(dwarf, s, 1);
+    emit_uleb(dwarf, s, DW_LNCT_path);
+    emit_uleb(dwarf, s, DW_FORM_string);
+    emit_uleb(dwarf, s, 1);
+    emit_string(dwarf, s, comp_dir);
+
+    // File table: entry 0 is the primary source file. Entry 1 repeats it
+    // because the state machine's file register starts at 1.
+    emit_u8(dwarf, s, 2);
+    emit_uleb(dwarf, s, DW_LNCT_path);
+    emit_uleb(dwarf, s, DW_FORM_string);
+    emit_uleb(dwarf, s, DW_LNCT_directory_index);
+    emit_uleb(dwarf, s, DW_FORM_udata);
+    emit_uleb(dwarf, s, 2);
+    for (int i = 0; i < 2; i++) {
+        emit_string(dwarf, s, source_name);
+        emit_uleb(dwarf, s, 0);
+    }
+
+    dwarf->program_start = dwarf->sections[s].size;
+}
+
+static void emit_abbreviations(dwarf_t* dwarf) {
+    dwarf_section_t s = DWARF_SECTION_ABBREV;
+    static const uint16_t attributes[][2] = {
+        {DW_AT_stmt_list, DW_FORM_sec_offset},
+        {DW_AT_low_pc, DW_FORM_addr},
+        {DW_AT_high_pc, 0},                 // data4 or data8, by address size
+        {DW_AT_name, DW_FORM_string},
+        {DW_AT_comp_dir, DW_FORM_string},
+        {DW_AT_producer, DW_FORM_string},
+        {DW_AT_language, DW_FORM_data2}
+    };
+
+    emit_uleb(dwarf, s, 1);
+    emit_uleb(dwarf, s, DW_TAG_compile_unit);
+    emit_u8(dwarf, s, DW_CHILDREN_no);
+    for (size_t i = 0; i < sizeof(attributes) / sizeof(attributes[0]); i++) {
+        uint16_t form = attributes[i][1];
+        if (attributes[i][0] == DW_AT_high_pc) {
+            form = dwarf->address_size == 8 ? DW_FORM_data8 : DW_FORM_data4;
+        }
+        emit_uleb(dwarf, s, attributes[i][0]);
+        emit_uleb(dwarf, s, form);
+    }
+    emit_uleb(dwarf, s, 0);
+    emit_uleb(dwarf, s, 0);
+    emit_uleb(dwarf, s, 0);
+}
+
+dwarf_t* dwarf_create(arch_type_t arch, const char* source_name) {
+    dwarf_t* dwarf = calloc(1, sizeof(dwarf_t));
+    if (!dwarf) return NULL;
+
+    dwarf->address_size = (arch == ARCH_X86_64 || arch == ARCH_ARM_64) ? 8 : 4;
+    dwarf->line = 1;
+
+    char* comp_dir = getcwd(NULL, 0);
+    emit_line_header(dwarf, source_name, comp_dir ? comp_dir : ".");
+    free(comp_dir);
+    emit_abbreviations(dwarf);
+
+    if (dwarf->failed) {
+        dwarf_destroy(dwarf);
+        return NULL;
+    }
+    return dwarf;
+}
+
+void dwarf_destroy(dwarf_t* dwarf) {
+    if (!dwarf) return;
+    for (int i = 0; i < DWARF_SECTION_COUNT; i++) {
+        free(dwarf->sections[i].data);
+    }
+    free(dwarf->relocations);
+    free(dwarf);
+}
+
+// Advance the state machine's address and line and append a row, using a
+// single special opcode whenever the deltas fit in one
+static void emit_advance(dwarf_t* dwarf, uint64_t address_delta, int64_t line_delta) {
+    dwarf_section_t s = DWARF_SECTION_LINE;
+
+    if (line_delta < LINE_BASE || line_delta >= LINE_BASE + LINE_RANGE) {
+        emit_u8(dwarf, s, DW_LNS_advance_line);
+        emit_sleb(dwarf, s, line_delta);
+        line_delta = 0;
+    }
+
+    uint64_t line_part = (uint64_t)(line_delta - LINE_BASE) + OPCODE_BASE;
+    if (address_delta > MAX_SPECIAL_ADDRESS_ADVANCE &&
+        address_delta - MAX_SPECIAL_ADDRESS_ADVANCE <= MAX_SPECIAL_ADDRESS_ADVANCE &&
+        line_part + LINE_RANGE * (address_delta - MAX_SPECIAL_ADDRESS_ADVANCE) <= 255) {
+        emit_u8(dwarf, s, DW_LNS_const_add_pc);
+        address_delta -= MAX_SPECIAL_ADDRESS_ADVANCE;
+    }
+
+    if (address_delta <= MAX_SPECIAL_ADDRESS_ADVANCE &&
+        line_part + LINE_RANGE * address_delta <= 255) {
+        emit_u8(dwarf, s, (uint8_t)(line_part + LINE_RANGE * address_delta));
+        return;
+    }
+
+    emit_u8(dwarf, s, DW_LNS_advance_pc);
+    emit_uleb(dwarf, s, address_delta);
+    emit_u8(dwarf, s, (uint8_t)line_part);
+}
+
+// Append a row for an instruction at a .text offset. Rows must arrive in
+// address order; each is encoded immediately so no row table is kept.
+void dwarf_add_row(dwarf_t* dwarf, uint64_t address, int line, int column) {
+    dwarf_section_t s = DWARF_SECTION_LINE;
+
+    if (!dwarf->sequence_started) {
+        emit_u8(dwarf, s, 0);
+        emit_uleb(dwarf, s, 1 + dwarf->address_size);
+        emit_u8(dwarf, s, DW_LNE_set_address);
+        emit_relocated(dwarf, s, dwarf->address_size, dwarf->text_target, (int64_t)address);
+        dwarf->address = address;
+        dwarf->sequence_started = true;
+    }
+
+    if (column != dwarf->column) {
+        emit_u8(dwarf, s, DW_LNS_set_column);
+        emit_uleb(dwarf, s, column);
+        dwarf->column = column;
+    }
+
+    emit_advance(dwarf, address - dwarf->address, (int64_t)line - dwarf->line);
+    dwarf->address = address;
+    dwarf->line = line;
+}
+
+// Close the current sequence at end_address; the state machine starts
+// over for the next one
+static void end_sequence(dwarf_t* dwarf, uint64_t end_address) {
+    dwarf_section_t s = DWARF_SECTION_LINE;
+
+    if (!dwarf->sequence_started) return;
+    if (end_address > dwarf->address) {
+        emit_u8(dwarf, s, DW_LNS_advance_pc);
+        emit_uleb(dwarf, s, end_address - dwarf->address);
+    }
+    emit_u8(dwarf, s, 0);
+    emit_uleb(dwarf, s, 1);
+    emit_u8(dwarf, s, DW_LNE_end_sequence);
+
+    dwarf->sequence_started = false;
+    dwarf->address = 0;
+    dwarf->line = 1;
+    dwarf->column = 0;
+}
+
+// Close the line sequence at end_address and emit the compile unit
+int dwarf_finish(dwarf_t* dwarf, uint64_t end_address, const char* source_name) {
+    dwarf_section_t s = DWARF_SECTION_LINE;
+
+    end_sequence(dwarf, end_address);
+
+    // unit_length excludes itself; header_length counts from after itself
+    patch_uint(dwarf, s, 0, dwarf->sections[s].size - 4, 4);
+    patch_uint(dwarf, s, 8, dwarf->program_start - 12, 4);
+
+    dwarf_section_t info = DWARF_SECTION_INFO;
+    char* comp_dir = getcwd(NULL, 0);
+
+    emit_uint(dwarf, info, 0, 4);                    // unit_length
+    emit_uint(dwarf, info, 5, 2);                    // version
+    emit_u8(dwarf, info, DW_UT_compile);
+    emit_u8(dwarf, info, dwarf->address_size);
+    emit_relocated(dwarf, info, 4, DWARF_TARGET_ABBREV, 0);
+
+    emit_uleb(dwarf, info, 1);                       // Abbreviation code
+    emit_relocated(dwarf, info, 4, DWARF_TARGET_LINE, 0);
+    emit_relocated(dwarf, info, dwarf->address_size, DWARF_TARGET_TEXT, 0);
+    emit_uint(dwarf, info, end_address, dwarf->address_size);
+    emit_string(dwarf, info, source_name);
+    emit_string(dwarf, info, comp_dir ? comp_dir : ".");
+    emit_string(dwarf, info, "Multi-Architecture Assembler");
+    emit_uint(dwarf, info, DW_LANG_Mips_Assembler, 2);
+    free(comp_dir);
+
+    patch_uint(dwarf, info, 0, dwarf->sections[info].size - 4, 4);
+
+    if (dwarf->failed) {
+        fprintf(stderr, "Error: Failed to allocate debug information\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Feed every instruction of the final layout through the line program.
+// Code behind program->cold_start gets a second sequence in .text.cold; the
+// compile unit spans both, which is exact where .text.cold follows .text
+// (executables).
+int dwarf_build_line_table(dwarf_t* dwarf, const program_t* program, const char* source_name) {
+    uint64_t cold = program->cold_start;
+
+    for (int i = 0; i < program->instruction_count; i++) {
+        const instruction_t* instr = program->instructions[i];
+        uint64_t address = instr->address;
+        
+        if (cold && address >= cold) {
+            if (dwarf->text_target != DWARF_TARGET_TEXT_COLD) {
+                end_sequence(dwarf, cold);
+                dwarf->text_target = DWARF_TARGET_TEXT_COLD;
+            }
+            address -= cold;
+        }
+        dwarf_add_row(dwarf, address, instr->line, instr->column);
+    }
+    if (dwarf->text_target == DWARF_TARGET_TEXT_COLD) {
+        end_sequence(dwarf, program->code_size - cold);
+    }
+    return dwarf_finish(dwarf, program->code_size, source_name);
+}
@@ -0,0 +1,816 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include "../include/elf_writer.h"
+#include "../include/output.h"
+#include "../include/dwarf.h"
+#include "../include/rodata.h"
+
+// ELF writer for relocatable objects (ET_REL) and static executables
+// (ET_EXEC). ELF64 objects use RELA relocations; ELF32 (i386) objects use
+// REL with the addend stored in the relocated field, as the i386 psABI
+// requires. With -g the DWARF sections are added as non-allocated
+// sections; their address fields are relocated in objects and filled in
+// directly in executables. Code behind program->cold_start goes to a
+// separate .text.cold section, and merged .rodata strings behind
+// program->rodata_strings to .rodata.str1.1 (SHF_MERGE | SHF_STRINGS).
+
+#define MAX_SECTIONS 16
+#define MAX_SEGMENTS 3
+#define MAX_IOVECS (2 * MAX_SECTIONS + 4)
+
+// Growable byte buffer for string tables, symbols and relocations
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} elf_buffer_t;
+
+typedef struct {
+    const char* name;
+    uint32_t type;
+    uint64_t flags;
+    const void* data;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t align;
+    uint64_t entsize;
+    uint64_t address;     // Load address (executables)
+    uint64_t offset;      // Assigned by the layout pass unless preset
+    uint32_t name_offset; // Offset in .shstrtab
+} elf_section_t;
+
+typedef struct {
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t address;
+    uint64_t file_size;
+    uint64_t memory_size;
+    uint64_t align;
+} elf_segment_t;
+
+typedef struct {
+    bool is64;
+    arch_type_t arch;
+    program_t* program;
+    elf_buffer_t strtab;
+    elf_buffer_t symtab;
+    int symbol_count;
+    uint32_t* symbol_index;   // symtab index of each symbol_table_t entry
+    int next_symbol;          // Position in definition order during symbol_table_foreach
+    uint16_t section_index[SECTION_COUNT];
+    uint16_t cold_index;      // .text.cold, or 0 when .text is not split
+    uint16_t strings_index;   // .rodata.str1.1, or 0 without merged strings
+    uint16_t debug_index[DWARF_SECTION_COUNT];
+    uint32_t section_symbol[MAX_SECTIONS];  // symtab index of each section's STT_SECTION symbol
+    bool failed;
+    
+    elf_section_t sections[MAX_SECTIONS];  // [0] is the null section
+    int section_count;
+    elf_segment_t segments[MAX_SEGMENTS];
+    int segment_count;
+    uint16_t type;
+    uint64_t entry;
+} elf_writer_t;
+
+static bool buffer_append(elf_buffer_t* buffer, const void* data, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity < buffer->size + size) capacity *= 2;
+        
+        uint8_t* grown = realloc(buffer->data, capacity);
+        if (!grown) return false;
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return true;
+}
+
+// Add a NUL-terminated string and return its offset
+static uint32_t string_add(elf_buffer_t* table, const char* str, bool* failed) {
+    uint32_t offset = (uint32_t)table->size;
+    if (!buffer_append(table, str, strlen(str) + 1)) *failed = true;
+    return offset;
+}
+
+static void add_symbol(elf_writer_t* writer, uint32_t name, uint8_t info, uint16_t shndx, uint64_t value) {
+    bool ok;
+    
+    if (writer->is64) {
+        Elf64_Sym sym = {0};
+        sym.st_name = name;
+        sym.st_info = info;
+        sym.st_shndx = shndx;
+        sym.st_value = value;
+        ok = buffer_append(&writer->symtab, &sym, sizeof(sym));
+    } else {
+        Elf32_Sym sym = {0};
+        sym.st_name = name;
+        sym.st_info = info;
+        sym.st_shndx = shndx;
+        sym.st_value = (Elf32_Addr)value;
+        ok = buffer_append(&writer->symtab, &sym, sizeof(sym));
+    }
+    
+    if (!ok) writer->failed = true;
+    writer->symbol_count++;
+}
+
+// Whether a .text offset is in .text.cold
+static bool in_cold_text(const elf_writer_t* writer, uint64_t offset) {
+    return writer->cold_index && offset >= writer->program->cold_start;
+}
+
+// Whether a .rodata offset is in .rodata.str1.1
+static bool in_rodata_strings(const elf_writer_t* writer, uint64_t offset) {
+    return writer->strings_index && offset >= writer->program->rodata_strings;
+}
+
+static void add_label_symbol(elf_writer_t* writer, symbol_t* symbol, uint8_t binding) {
+    uint16_t shndx;
+    uint64_t value = symbol->defined ? symbol->address : 0;
+    
+    if (!symbol->defined) {
+        shndx = SHN_UNDEF;
+    } else if (symbol->type != SYMBOL_LABEL) {
+        shndx = SHN_ABS;
+    } else {
+        shndx = writer->section_index[symbol->section];
+        uint64_t offset = symbol->address - writer->program->section_base[symbol->section];
+        if (symbol->section == SECTION_TEXT && in_cold_text(writer, offset)) {
+            shndx = writer->cold_index;
+            if (writer->type == ET_REL) value -= writer->program->cold_start;
+        } else if (symbol->section == SECTION_RODATA && in_rodata_strings(writer, offset)) {
+            shndx = writer->strings_index;
+            if (writer->type == ET_REL) value -= writer->program->rodata_strings;
+        }
+    }
+    
+    uint32_t name = string_add(&writer->strtab, symbol->name, &writer->failed);
+    writer->symbol_index[writer->next_symbol] = writer->symbol_count;
+    add_symbol(writer, name, ELF64_ST_INFO(binding, STT_NOTYPE), shndx, value);
+}
+
+// Whether relocations name the label itself rather than its section: a
+// linker can only follow a reference into a mergeable section by symbol
+static bool relocated_by_symbol(const elf_writer_t* writer, const symbol_t* symbol) {
+    const program_t* program = writer->program;
+    return symbol->binding != SYMBOL_LOCAL ||
+           (symbol->section == SECTION_RODATA &&
+            in_rodata_strings(writer, symbol->address - program->section_base[SECTION_RODATA]));
+}
+
+// Locals must precede globals in .symtab, so symbols are visited twice.
+// Generated .L labels stay out, as with other assemblers, unless a
+// relocation needs them.
+static void visit_local(symbol_t* symbol, void* context) {
+    elf_writer_t* writer = context;
+    
+    if (symbol->binding == SYMBOL_LOCAL && symbol->defined &&
+        (strncmp(symbol->name, ".L", 2) != 0 || relocated_by_symbol(writer, symbol))) {
+        add_label_symbol(writer, symbol, STB_LOCAL);
+    }
+    writer->next_symbol++;
+}
+
+static void visit_global(symbol_t* symbol, void* context) {
+    elf_writer_t* writer = context;
+    
+    if (symbol->binding != SYMBOL_LOCAL) {
+        add_label_symbol(writer, symbol, STB_GLOBAL);
+    }
+    writer->next_symbol++;
+}
+
+// Relocation type for a fixup, or -1
+static int relocation_type(const elf_writer_t* writer, const fixup_t* fixup) {
+    bool relative = fixup->kind == FIXUP_RELATIVE;
+    
+    if (writer->arch == ARCH_X86_64) {
+        switch (fixup->size) {
+            case 1: return relative ? R_X86_64_PC8 : R_X86_64_8;
+            case 2: return relative ? R_X86_64_PC16 : R_X86_64_16;
+            // Absolute 32-bit address fields are sign-extended in 64-bit mode
+            case 4: return relative ? R_X86_64_PC32 : R_X86_64_32S;
+            case 8: return relative ? R_X86_64_PC64 : R_X86_64_64;
+        }
+    } else if (writer->arch == ARCH_X86_32 || writer->arch == ARCH_X86_16) {
+        switch (fixup->size) {
+            case 1: return relative ? R_386_PC8 : R_386_8;
+            case 2: return relative ? R_386_PC16 : R_386_16;
+            case 4: return relative ? R_386_PC32 : R_386_32;
+        }
+    }
+    return -1;
+}
+
+// Turn every fixup the layout left unresolved into a relocation, for
+// .text or .text.cold
+static int build_relocations(elf_writer_t* writer, elf_buffer_t* relocations,
+                             elf_buffer_t* cold_relocations) {
+    program_t* program = writer->program;
+    symbol_t* symbols = program->symbols->symbols;
+    
+    for (int i = 0; i < program->fixup_count; i++) {
+        fixup_t* fixup = &program->fixups[i];
+        if (fixup->resolved) continue;
+        
+        symbol_t* symbol = symbol_table_lookup(program->symbols, fixup->label);
+        int type = relocation_type(writer, fixup);
+        if (!symbol || type < 0) {
+            fprintf(stderr, "Error: Line %d: Cannot relocate reference to '%s'\n", fixup->line, fixup->label);
+            return -1;
+        }
+        
+        // Local labels are relocated against their section symbol
+        uint32_t symbol_index;
+        int64_t addend = fixup->addend;
+        if (!relocated_by_symbol(writer, symbol)) {
+            uint16_t section = writer->section_index[symbol->section];
+            if (symbol->section == SECTION_TEXT && in_cold_text(writer, symbol->address)) {
+                section = writer->cold_index;
+                addend -= (int64_t)program->cold_start;
+            }
+            symbol_index = writer->section_symbol[section];
+            addend += (int64_t)symbol->address;
+        } else {
+            symbol_index = writer->symbol_index[symbol - symbols];
+        }
+        
+        elf_buffer_t* output = relocations;
+        uint64_t offset = fixup->offset;
+        if (in_cold_text(writer, offset)) {
+            output = cold_relocations;
+            offset -= program->cold_start;
+        }
+        
+        bool ok;
+        if (writer->is64) {
+            Elf64_Rela rela;
+            rela.r_offset = offset;
+            rela.r_info = ELF64_R_INFO(symbol_index, type);
+            rela.r_addend = addend;
+            ok = buffer_append(output, &rela, sizeof(rela));
+        } else {
+            Elf32_Rel rel;
+            rel.r_offset = (Elf32_Addr)offset;
+            rel.r_info = ELF32_R_INFO(symbol_index, type);
+            ok = buffer_append(output, &rel, sizeof(rel));
+            
+            // Implicit addend
+            for (int b = 0; b < fixup->size; b++) {
+                program->code[fixup->offset + b] = (uint8_t)((uint64_t)addend >> (b * 8));
+            }
+        }
+        if (!ok) {
+            fprintf(stderr, "Error: Out of memory building relocations\n");
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void writer_init(elf_writer_t* writer, program_t* program, arch_type_t arch, uint16_t type) {
+    memset(writer, 0, sizeof(*writer));
+    writer->is64 = arch == ARCH_X86_64 || arch == ARCH_ARM_64;
+    writer->arch = arch;
+    writer->program = program;
+    writer->type = type;
+    writer->section_count = 1;
+}
+
+static void writer_destroy(elf_writer_t* writer) {
+    free(writer->symbol_index);
+    free(writer->strtab.data);
+    free(writer->symtab.data);
+}
+
+// Default alignment of a program section, raised by its align directives
+static uint64_t program_alignment(const elf_writer_t* writer, int section, uint64_t alignment) {
+    uint64_t requested = writer->program->section_alignment[section];
+    return requested > alignment ? requested : alignment;
+}
+
+static int add_section(elf_writer_t* writer, const char* name, uint32_t type, uint64_t flags,
+                       const void* data, uint64_t size, uint64_t align, uint64_t entsize) {
+    int index = writer->section_count++;
+    elf_section_t* section = &writer->sections[index];
+    
+    memset(section, 0, sizeof(*section));
+    section->name = name;
+    section->type = type;
+    section->flags = flags;
+    section->data = data;
+    section->size = size;
+    section->align = align;
+    section->entsize = entsize;
+    return index;
+}
+
+// .text, .rodata, .data and .bss, placed at the program's section bases.
+// Code past cold_start goes to .text.cold, right behind .text; .rodata
+// past rodata_strings to .rodata.str1.1, which the linker may merge with
+// the strings of other objects. Empty .rodata sections are left out.
+static void add_program_sections(elf_writer_t* writer) {
+    program_t* program = writer->program;
+    uint64_t cold = program->cold_start;
+    
+    int text = add_section(writer, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+                           program->code, cold ? cold : program->code_size, 16, 0);
+    if (cold) {
+        writer->cold_index = add_section(writer, ".text.cold", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+                                         program->code + cold, program->code_size - cold, 1, 0);
+        writer->sections[writer->cold_index].address =
+            writer->type == ET_EXEC ? program->section_base[SECTION_TEXT] + cold : 0;
+    }
+    uint64_t strings = program->rodata_strings;
+    if (strings) {
+        writer->section_index[SECTION_RODATA] = add_section(writer, ".rodata", SHT_PROGBITS, SHF_ALLOC,
+                                                            program->rodata, strings,
+                                                            program_alignment(writer, SECTION_RODATA,
+                                                                              RODATA_MAX_ALIGNMENT), 0);
+    }
+    if (program->rodata_size > strings) {
+        writer->strings_index = add_section(writer, ".rodata.str1.1", SHT_PROGBITS,
+                                            SHF_ALLOC | SHF_MERGE | SHF_STRINGS, program->rodata + strings,
+                                            program->rodata_size - strings, 1, 1);
+        writer->sections[writer->strings_index].address =
+            writer->type == ET_EXEC ? program->section_base[SECTION_RODATA] + strings : 0;
+        if (!strings) {
+            writer->section_index[SECTION_RODATA] = writer->strings_index;
+        }
+    }
+    int data = add_section(writer, ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE,
+                           program->data_section, program->data_size,
+                           program_alignment(writer, SECTION_DATA, 4), 0);
+    int bss = add_section(writer, ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE,
+                          NULL, program->bss_size, program_alignment(writer, SECTION_BSS, 4), 0);
+    
+    writer->section_index[SECTION_TEXT] = text;
+    writer->section_index[SECTION_DATA] = data;
+    writer->section_index[SECTION_BSS] = bss;
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        if (!writer->section_index[s]) continue;
+        writer->sections[writer->section_index[s]].address =
+            writer->type == ET_EXEC ? program->section_base[s] : 0;
+    }
+}
+
+// .debug_abbrev, .debug_info and .debug_line
+static void add_debug_sections(elf_writer_t* writer, const dwarf_t* debug) {
+    static const char* names[DWARF_SECTION_COUNT] = {".debug_abbrev", ".debug_info", ".debug_line"};
+    
+    for (int s = 0; s < DWARF_SECTION_COUNT; s++) {
+        writer->debug_index[s] = add_section(writer, names[s], SHT_PROGBITS, 0,
+                                             debug->sections[s].data, debug->sections[s].size, 1, 0);
+    }
+}
+
+// ELF section a debug relocation points into
+static uint16_t debug_target_section(const elf_writer_t* writer, dwarf_target_t target) {
+    switch (target) {
+        case DWARF_TARGET_TEXT: return writer->section_index[SECTION_TEXT];
+        case DWARF_TARGET_TEXT_COLD: return writer->cold_index;
+        case DWARF_TARGET_ABBREV: return writer->debug_index[DWARF_SECTION_ABBREV];
+        default: return writer->debug_index[DWARF_SECTION_LINE];
+    }
+}
+
+// Absolute data relocation type of the given width, or -1
+static int data_relocation_type(const elf_writer_t* writer, int size) {
+    switch (writer->arch) {
+        case ARCH_X86_64: return size == 8 ? R_X86_64_64 : R_X86_64_32;
+        case ARCH_ARM_64: return size == 8 ? R_AARCH64_ABS64 : R_AARCH64_ABS32;
+        case ARCH_ARM_32: return size == 4 ? R_ARM_ABS32 : -1;
+        default: return size == 4 ? R_386_32 : -1;
+    }
+}
+
+static void patch_field(uint8_t* field, uint64_t value, int size) {
+    for (int b = 0; b < size; b++) {
+        field[b] = (uint8_t)(value >> (b * 8));
+    }
+}
+
+// Relocations for one debug section, against section symbols. For
+// executables nothing is emitted; the final value is written in place.
+static int build_debug_relocations(elf_writer_t* writer, dwarf_t* debug, dwarf_section_t section,
+                                   elf_buffer_t* relocations) {
+    for (int i = 0; i < debug->relocation_count; i++) {
+        dwarf_relocation_t* reloc = &debug->relocations[i];
+        if (reloc->section != section) continue;
+        
+        uint16_t target = debug_target_section(writer, reloc->target);
+        uint8_t* field = debug->sections[section].data + reloc->offset;
+        if (writer->type == ET_EXEC) {
+            patch_field(field, writer->sections[target].address + reloc->addend, reloc->size);
+            continue;
+        }
+        
+        int type = data_relocation_type(writer, reloc->size);
+        if (type < 0) {
+            fprintf(stderr, "Error: Cannot relocate debug information for this architecture\n");
+            return -1;
+        }
+        
+        bool ok;
+        if (writer->is64) {
+            Elf64_Rela rela;
+            rela.r_offset = reloc->offset;
+            rela.r_info = ELF64_R_INFO(writer->section_symbol[target], type);
+            rela.r_addend = reloc->addend;
+            ok = buffer_append(relocations, &rela, sizeof(rela));
+        } else {
+            Elf32_Rel rel;
+            rel.r_offset = (Elf32_Addr)reloc->offset;
+            rel.r_info = ELF32_R_INFO(writer->section_symbol[target], type);
+            ok = buffer_append(relocations, &rel, sizeof(rel));
+            patch_field(field, (uint64_t)reloc->addend, reloc->size);
+        }
+        if (!ok) {
+            fprintf(stderr, "Error: Out of memory building relocations\n");
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+// .rel[a].<name> applying to section target; sh_link is set once .symtab
+// has an index
+static void add_relocation_section(elf_writer_t* writer, const char* name, uint16_t target,
+                                   const elf_buffer_t* relocations) {
+    if (!relocations->size) return;
+    
+    int rel = add_section(writer, name, writer->is64 ? SHT_RELA : SHT_REL, SHF_INFO_LINK,
+                          relocations->data, relocations->size, writer->is64 ? 8 : 4,
+                          writer->is64 ? sizeof(Elf64_Rela) : sizeof(Elf32_Rel));
+    writer->sections[rel].info = target;
+}
+
+// Symbols: null, file, section symbols, locals, then globals
+static int build_symbols(elf_writer_t* writer, const char* source_name) {
+    program_t* program = writer->program;
+    
+    writer->symbol_index = calloc(program->symbols->symbol_count + 1, sizeof(uint32_t));
+    if (!writer->symbol_index) return -1;
+    
+    string_add(&writer->strtab, "", &writer->failed);
+    add_symbol(writer, 0, 0, SHN_UNDEF, 0);
+    
+    const char* base_name = strrchr(source_name, '/');
+    base_name = base_name ? base_name + 1 : source_name;
+    add_symbol(writer, string_add(&writer->strtab, base_name, &writer->failed),
+               ELF64_ST_INFO(STB_LOCAL, STT_FILE), SHN_ABS, 0);
+    for (int s = 1; s < writer->section_count; s++) {
+        writer->section_symbol[s] = writer->symbol_count;
+        add_symbol(writer, 0, ELF64_ST_INFO(STB_LOCAL, STT_SECTION), s, writer->sections[s].address);
+    }
+    
+    writer->next_symbol = 0;
+    symbol_table_foreach(program->symbols, visit_local, writer);
+    int first_global = writer->symbol_count;
+    writer->next_symbol = 0;
+    symbol_table_foreach(program->symbols, visit_global, writer);
+    
+    if (writer->failed) {
+        fprintf(stderr, "Error: Out of memory building the symbol table\n");
+        return -1;
+    }
+    return first_global;
+}
+
+static void add_symbol_sections(elf_writer_t* writer, int first_global) {
+    int symtab = writer->section_count;
+    int strtab = symtab + 1;
+    
+    for (int s = 1; s < symtab; s++) {
+        if (writer->sections[s].type == SHT_RELA || writer->sections[s].type == SHT_REL) {
+            writer->sections[s].link = symtab;
+        }
+    }
+    
+    add_section(writer, ".symtab", SHT_SYMTAB, 0, writer->symtab.data, writer->symtab.size,
+                writer->is64 ? 8 : 4, writer->is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym));
+    writer->sections[symtab].link = strtab;
+    writer->sections[symtab].info = first_global;
+    add_section(writer, ".strtab", SHT_STRTAB, 0, writer->strtab.data, writer->strtab.size, 1, 0);
+}
+
+static void fill_header(const elf_writer_t* writer, void* buffer, uint64_t shoff, int shstrtab_index) {
+    uint16_t machine;
+    uint32_t flags = 0;
+    switch (writer->arch) {
+        case ARCH_X86_64: machine = EM_X86_64; break;
+        case ARCH_ARM_32: machine = EM_ARM; flags = EF_ARM_EABI_VER5; break;
+        case ARCH_ARM_64: machine = EM_AARCH64; break;
+        default: machine = EM_386; break;
+    }
+    
+    unsigned char ident[EI_NIDENT] = {0};
+    memcpy(ident, ELFMAG, SELFMAG);
+    ident[EI_CLASS] = writer->is64 ? ELFCLASS64 : ELFCLASS32;
+    ident[EI_DATA] = ELFDATA2LSB;
+    ident[EI_VERSION] = EV_CURRENT;
+    ident[EI_OSABI] = ELFOSABI_NONE;
+    
+    if (writer->is64) {
+        Elf64_Ehdr* header = buffer;
+        memset(header, 0, sizeof(*header));
+        memcpy(header->e_ident, ident, EI_NIDENT);
+        header->e_type = writer->type;
+        header->e_machine = machine;
+        header->e_version = EV_CURRENT;
+        header->e_entry = writer->entry;
+        header->e_phoff = writer->segment_count ? sizeof(Elf64_Ehdr) : 0;
+        header->e_shoff = shoff;
+        header->e_flags = flags;
+        header->e_ehsize = sizeof(Elf64_Ehdr);
+        header->e_phentsize = writer->segment_count ? sizeof(Elf64_Phdr) : 0;
+        header->e_phnum = writer->segment_count;
+        header->e_shentsize = sizeof(Elf64_Shdr);
+        header->e_shnum = writer->section_count;
+        header->e_shstrndx = shstrtab_index;
+    } else {
+        Elf32_Ehdr* header = buffer;
+        memset(header, 0, sizeof(*header));
+        memcpy(header->e_ident, ident, EI_NIDENT);
+        header->e_type = writer->type;
+        header->e_machine = machine;
+        header->e_version = EV_CURRENT;
+        header->e_entry = (Elf32_Addr)writer->entry;
+        header->e_phoff = writer->segment_count ? sizeof(Elf32_Ehdr) : 0;
+        header->e_shoff = (Elf32_Off)shoff;
+        header->e_flags = flags;
+        header->e_ehsize = sizeof(Elf32_Ehdr);
+        header->e_phentsize = writer->segment_count ? sizeof(Elf32_Phdr) : 0;
+        header->e_phnum = writer->segment_count;
+        header->e_shentsize = sizeof(Elf32_Shdr);
+        header->e_shnum = writer->section_count;
+        header->e_shstrndx = shstrtab_index;
+    }
+}
+
+static void fill_section_header(const elf_writer_t* writer, void* buffer, const elf_section_t* section) {
+    if (writer->is64) {
+        Elf64_Shdr* sh = buffer;
+        sh->sh_name = section->name_offset;
+        sh->sh_type = section->type;
+        sh->sh_flags = section->flags;
+        sh->sh_addr = section->address;
+        sh->sh_offset = section->offset;
+        sh->sh_size = section->size;
+        sh->sh_link = section->link;
+        sh->sh_info = section->info;
+        sh->sh_addralign = section->align;
+        sh->sh_entsize = section->entsize;
+    } else {
+        Elf32_Shdr* sh = buffer;
+        sh->sh_name = section->name_offset;
+        sh->sh_type = section->type;
+        sh->sh_flags = (Elf32_Word)section->flags;
+        sh->sh_addr = (Elf32_Addr)section->address;
+        sh->sh_offset = (Elf32_Off)section->offset;
+        sh->sh_size = (Elf32_Word)section->size;
+        sh->sh_link = section->link;
+        sh->sh_info = section->info;
+        sh->sh_addralign = (Elf32_Word)section->align;
+        sh->sh_entsize = (Elf32_Word)section->entsize;
+    }
+}
+
+static void fill_program_header(const elf_writer_t* writer, void* buffer, const elf_segment_t* segment) {
+    if (writer->is64) {
+        Elf64_Phdr* ph = buffer;
+        ph->p_type = PT_LOAD;
+        ph->p_flags = segment->flags;
+        ph->p_offset = segment->offset;
+        ph->p_vaddr = segment->address;
+        ph->p_paddr = segment->address;
+        ph->p_filesz = segment->file_size;
+        ph->p_memsz = segment->memory_size;
+        ph->p_align = segment->align;
+    } else {
+        Elf32_Phdr* ph = buffer;
+        ph->p_type = PT_LOAD;
+        ph->p_flags = segment->flags;
+        ph->p_offset = (Elf32_Off)segment->offset;
+        ph->p_vaddr = (Elf32_Addr)segment->address;
+        ph->p_paddr = (Elf32_Addr)segment->address;
+        ph->p_filesz = (Elf32_Word)segment->file_size;
+        ph->p_memsz = (Elf32_Word)segment->memory_size;
+        ph->p_align = (Elf32_Word)segment->align;
+    }
+}
+
+// Add .shstrtab, lay the file out in one pass and hand it to the output
+// layer as one extent list: ELF header, program headers, section contents,
+// section header table
+static int write_image(const char* filename, elf_writer_t* writer) {
+    elf_buffer_t shstrtab = {0};
+    int result = -1;
+    bool failed = false;
+    
+    int shstrtab_index = add_section(writer, ".shstrtab", SHT_STRTAB, 0, NULL, 0, 1, 0);
+    string_add(&shstrtab, "", &failed);
+    for (int s = 1; s < writer->section_count; s++) {
+        writer->sections[s].name_offset = string_add(&shstrtab, writer->sections[s].name, &failed);
+    }
+    writer->sections[shstrtab_index].data = shstrtab.data;
+    writer->sections[shstrtab_index].size = shstrtab.size;
+    if (failed) {
+        fprintf(stderr, "Error: Out of memory building section names\n");
+        goto cleanup;
+    }
+    
+    size_t header_size = writer->is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+    size_t phdr_size = writer->is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    size_t shdr_size = writer->is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+    uint8_t headers[sizeof(Elf64_Ehdr) + MAX_SEGMENTS * sizeof(Elf64_Phdr)];
+    uint8_t section_headers[MAX_SECTIONS * sizeof(Elf64_Shdr)];
+    
+    // Layout pass. Sections with a preset offset (loaded executable
+    // sections) are padded up to it; gaps are zero extents.
+    struct iovec iov[MAX_IOVECS];
+    int iov_count = 0;
+    uint64_t offset = header_size + writer->segment_count * phdr_size;
+    
+    iov[iov_count++] = (struct iovec){headers, offset};
+    for (int s = 1; s < writer->section_count; s++) {
+        elf_section_t* section = &writer->sections[s];
+        uint64_t aligned = section->offset ? section->offset : align_up(offset, section->align);
+        
+        if (section->type == SHT_NOBITS) {
+            section->offset = aligned;
+            continue;
+        }
+        if (aligned > offset) {
+            iov[iov_count++] = (struct iovec){NULL, aligned - offset};
+        }
+        section->offset = aligned;
+        if (section->size) {
+            iov[iov_count++] = (struct iovec){(void*)section->data, section->size};
+        }
+        offset = aligned + section->size;
+    }
+    
+    uint64_t shoff = align_up(offset, writer->is64 ? 8 : 4);
+    if (shoff > offset) {
+        iov[iov_count++] = (struct iovec){NULL, shoff - offset};
+    }
+    
+    memset(section_headers, 0, sizeof(section_headers));
+    for (int s = 1; s < writer->section_count; s++) {
+        fill_section_header(writer, section_headers + s * shdr_size, &writer->sections[s]);
+    }
+    iov[iov_count++] = (struct iovec){section_headers, writer->section_count * shdr_size};
+    
+    fill_header(writer, headers, shoff, shstrtab_index);
+    memset(headers + header_size, 0, writer->segment_count * phdr_size);
+    for (int p = 0; p < writer->segment_count; p++) {
+        fill_program_header(writer, headers + header_size + p * phdr_size, &writer->segments[p]);
+    }
+    
+    result = output_write_image(filename, iov, iov_count, writer->type == ET_EXEC);
+    
+cleanup:
+    free(shstrtab.data);
+    return result;
+}
+
+int elf_write_object(const char* filename, program_t* program, arch_type_t arch, const char* source_name,
+                     dwarf_t* debug) {
+    elf_writer_t writer;
+    elf_buffer_t relocations = {0};
+    elf_buffer_t cold_relocations = {0};
+    elf_buffer_t info_relocations = {0};
+    elf_buffer_t line_relocations = {0};
+    int result = -1;
+    
+    writer_init(&writer, program, arch, ET_REL);
+    add_program_sections(&writer);
+    if (debug) {
+        add_debug_sections(&writer, debug);
+    }
+    
+    int first_global = build_symbols(&writer, source_name);
+    if (first_global < 0 || build_relocations(&writer, &relocations, &cold_relocations) != 0) {
+        goto cleanup;
+    }
+    if (debug &&
+        (build_debug_relocations(&writer, debug, DWARF_SECTION_INFO, &info_relocations) != 0 ||
+         build_debug_relocations(&writer, debug, DWARF_SECTION_LINE, &line_relocations) != 0)) {
+        goto cleanup;
+    }
+    
+    add_relocation_section(&writer, writer.is64 ? ".rela.text" : ".rel.text",
+                           writer.section_index[SECTION_TEXT], &relocations);
+    if (writer.cold_index) {
+        add_relocation_section(&writer, writer.is64 ? ".rela.text.cold" : ".rel.text.cold",
+                               writer.cold_index, &cold_relocations);
+    }
+    if (debug) {
+        add_relocation_section(&writer, writer.is64 ? ".rela.debug_info" : ".rel.debug_info",
+                               writer.debug_index[DWARF_SECTION_INFO], &info_relocations);
+        add_relocation_section(&writer, writer.is64 ? ".rela.debug_line" : ".rel.debug_line",
+                               writer.debug_index[DWARF_SECTION_LINE], &line_relocations);
+    }
+    add_symbol_sections(&writer, first_global);
+    
+    result = write_image(filename, &writer);
+    
+cleanup:
+    free(relocations.data);
+    free(cold_relocations.data);
+    free(info_relocations.data);
+    free(line_relocations.data);
+    writer_destroy(&writer);
+    return result;
+}
+
+uint64_t elf_default_image_base(arch_type_t arch) {
+    switch (arch) {
+        case ARCH_X86_32:
+        case ARCH_X86_16: return 0x08048000;
+        case ARCH_ARM_32: return 0x00010000;
+        default: return 0x00400000;
+    }
+}
+
+// Static executable: a read-only segment for the headers, then .text,
+// .text.cold and .rodata (R+X) and .data/.bss (R+W), all at the addresses
+// layout assigned
+int elf_write_executable(const char* filename, program_t* program, arch_type_t arch, const char* source_name,
+                         const layout_options_t* layout, dwarf_t* debug) {
+    elf_writer_t writer;
+    int result = -1;
+    
+    writer_init(&writer, program, arch, ET_EXEC);
+    add_program_sections(&writer);
+    
+    // Loaded sections sit at image_base + file offset
+    for (int s = 1; s < writer.section_count; s++) {
+        elf_section_t* section = &writer.sections[s];
+        section->offset = section->address - layout->image_base;
+    }
+    
+    symbol_t* entry = symbol_table_lookup(program->symbols, "_start");
+    if (entry && entry->defined && entry->section == SECTION_TEXT) {
+        writer.entry = entry->address;
+    } else {
+        fprintf(stderr, "Warning: Entry symbol '_start' not found, starting at the beginning of .text\n");
+        writer.entry = program->section_base[SECTION_TEXT];
+    }
+    
+    const elf_section_t* text = &writer.sections[writer.section_index[SECTION_TEXT]];
+    const elf_section_t* data = &writer.sections[writer.section_index[SECTION_DATA]];
+    const elf_section_t* bss = &writer.sections[writer.section_index[SECTION_BSS]];
+    
+    writer.segments[writer.segment_count++] = (elf_segment_t){
+        PF_R, 0, layout->image_base, 0, 0, LAYOUT_PAGE_SIZE};
+    uint64_t text_size = program->section_base[SECTION_RODATA] + program->rodata_size - text->address;
+    writer.segments[writer.segment_count++] = (elf_segment_t){
+        PF_R | PF_X, text->offset, text->address, text_size, text_size, layout->text_alignment};
+    if (data->size || bss->size) {
+        uint64_t end = bss->size ? bss->address + bss->size : data->address + data->size;
+        writer.segments[writer.segment_count++] = (elf_segment_t){
+            PF_R | PF_W, data->offset, data->address, data->size, end - data->address, LAYOUT_PAGE_SIZE};
+    }
+    
+    // The first segment maps the ELF and program headers
+    uint64_t headers_size = writer.is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+    headers_size += writer.segment_count * (writer.is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr));
+    writer.segments[0].file_size = headers_size;
+    writer.segments[0].memory_size = headers_size;
+    
+    if (debug) {
+        add_debug_sections(&writer, debug);
+        if (build_debug_relocations(&writer, debug, DWARF_SECTION_INFO, NULL) != 0 ||
+            build_debug_relocations(&writer, debug, DWARF_SECTION_LINE, NULL) != 0) {
+            goto cleanup;
+        }
+    }
+    
+    int first_global = build_symbols(&writer, source_name);
+    if (first_global < 0) {
+        goto cleanup;
+    }
+    add_symbol_sections(&writer, first_global);
+    
+    result = write_image(filename, &writer);
+    
+cleanup:
+    writer_destroy(&writer);
+    return result;
+}
@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/encode_cache.h"
+#include "../include/symbol_table.h"
+
+// Generated code repeats a few instruction forms many times (unrolled
+// loops, spills, the same branch to different labels), so encodings are
+// memoized on a packed signature of the instruction. A colliding form
+// simply replaces the slot.
+
+typedef struct {
+    uint8_t* data;
+    size_t length;
+    bool overflow;
+} key_writer_t;
+
+static void put(key_writer_t* key, const void* bytes, size_t length) {
+    if (key->length + length > ENCODE_CACHE_KEY_BYTES) {
+        key->overflow = true;
+        return;
+    }
+    memcpy(key->data + key->length, bytes, length);
+    key->length += length;
+}
+
+static void put_byte(key_writer_t* key, uint8_t value) {
+    put(key, &value, 1);
+}
+
+// Register infos live in static tables, so the pointer identifies the register
+static void put_register(key_writer_t* key, const register_info_t* reg) {
+    put(key, &reg, sizeof(reg));
+}
+
+// Signature of everything encode_instruction reads, except label names.
+// False if the instruction cannot be cached.
+static bool build_key(const instruction_t* instr, key_writer_t* key) {
+    size_t mnemonic_length = strlen(instr->mnemonic);
+    if (mnemonic_length > ENCODE_CACHE_MNEMONIC) return false;
+
+    put_byte(key, (uint8_t)mnemonic_length);
+    put(key, instr->mnemonic, mnemonic_length);
+    put_byte(key, (uint8_t)instr->operand_count);
+
+    for (int i = 0; i < instr->operand_count; i++) {
+        const operand_t* op = &instr->operands[i];
+        put_byte(key, (uint8_t)op->type);
+
+        switch (op->type) {
+            case OPERAND_REGISTER:
+                put_register(key, op->data.reg.reg_info);
+                break;
+            case OPERAND_IMMEDIATE:
+                put(key, &op->data.imm.value, sizeof(op->data.imm.value));
+                put(key, &op->data.imm.size_bits, sizeof(op->data.imm.size_bits));
+                break;
+            case OPERAND_MEMORY:
+                put_register(key, op->data.mem.base);
+                put_register(key, op->data.mem.index);
+                put(key, &op->data.mem.scale, sizeof(op->data.mem.scale));
+                put(key, &op->data.mem.displacement, sizeof(op->data.mem.displacement));
+                put(key, &op->data.mem.size_bits, sizeof(op->data.mem.size_bits));
+                put_byte(key, op->data.mem.label != NULL);
+                put_byte(key, op->data.mem.relative);
+                break;
+            default:
+                break;
+        }
+
+        put_register(key, op->mask);
+        put_byte(key, op->zeroing);
+        put(key, &op->broadcast, sizeof(op->broadcast));
+    }
+    return !key->overflow;
+}
+
+encode_cache_t* encode_cache_create(arch_type_t arch) {
+    encode_cache_t* cache = calloc(1, sizeof(encode_cache_t));
+    if (!cache) return NULL;
+
+    cache->architecture = arch;
+    return cache;
+}
+
+void encode_cache_destroy(encode_cache_t* cache) {
+    free(cache);
+}
+
+// Label named by a label operand or a memory operand, or NULL
+static const char* operand_label(const operand_t* operand) {
+    switch (operand->type) {
+        case OPERAND_LABEL: return operand->data.label.name;
+        case OPERAND_MEMORY: return operand->data.mem.label;
+        default: return NULL;
+    }
+}
+
+// Record a fresh encoding, unless it cannot be replayed from the key alone
+static void store(encode_cache_entry_t* entry, uint32_t hash, const key_writer_t* key,
+                  const instruction_t* instr, const uint8_t* bytes, int size) {
+    int label_operand = -1;
+
+    if (size > ENCODE_CACHE_MAX_BYTES) return;
+    if (instr->fixup_kind != FIXUP_NONE) {
+        for (int i = 0; i < instr->operand_count; i++) {
+            if (operand_label(&instr->operands[i]) == instr->fixup_label) {
+                label_operand = i;
+            }
+        }
+        if (label_operand < 0) return;
+    }
+
+    entry->hash = hash;
+    entry->key_length = (uint16_t)key->length;
+    memcpy(entry->key, key->data, key->length);
+    entry->size = (uint8_t)size;
+    memcpy(entry->bytes, bytes, size);
+    entry->label_operand = (int8_t)label_operand;
+    entry->fixup_kind = instr->fixup_kind;
+    entry->fixup_offset = (uint8_t)instr->fixup_offset;
+    entry->fixup_size = (uint8_t)instr->fixup_size;
+    entry->fixup_addend = instr->fixup_addend;
+}
+
+static void sample(encode_cache_t* cache, bool hit) {
+    cache->window_hits += hit;
+    if (++cache->window_lookups < ENCODE_CACHE_WINDOW) return;
+
+    if (cache->window_hits * 4 < ENCODE_CACHE_WINDOW) {
+        cache->bypass = ENCODE_CACHE_WINDOW * ENCODE_CACHE_BYPASS;
+    }
+    cache->window_lookups = 0;
+    cache->window_hits = 0;
+}
+
+// encode_instruction through the cache; same results and errors
+int encode_cached(encode_cache_t* cache, instruction_t* instr, uint8_t* output, int max_size) {
+    uint8_t key_data[ENCODE_CACHE_KEY_BYTES];
+    key_writer_t key = {key_data, 0, false};
+
+    if (cache->bypass) {
+        cache->bypass--;
+        cache->misses++;
+        return encode_instruction(instr, cache->architecture, output, max_size);
+    }
+
+    if (!build_key(instr, &key)) {
+        sample(cache, false);
+        cache->misses++;
+        return encode_instruction(instr, cache->architecture, output, max_size);
+    }
+
+    uint32_t hash = hash_bytes((const char*)key.data, key.length);
+    if (hash == 0) hash = 1;
+    encode_cache_entry_t* entry = &cache->entries[hash & (ENCODE_CACHE_SLOTS - 1)];
+
+    if (entry->hash == hash && entry->key_length == key.length && entry->size <= max_size &&
+        memcmp(entry->key, key.data, key.length) == 0) {
+        cache->hits++;
+        sample(cache, true);
+        memcpy(output, entry->bytes, entry->size);
+        instr->fixup_kind = entry->fixup_kind;
+        instr->fixup_offset = entry->fixup_offset;
+        instr->fixup_size = entry->fixup_size;
+        instr->fixup_label = entry->label_operand >= 0 ?
+                             operand_label(&instr->operands[entry->label_operand]) : NULL;
+        instr->fixup_addend = entry->fixup_addend;
+        return entry->size;
+    }
+
+    cache->misses++;
+    sample(cache, false);
+    int size = encode_instruction(instr, cache->architecture, output, max_size);
+    if (size > 0) {
+        store(entry, hash, &key, instr, output, size);
+    }
+    return size;
+}
@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/expression.h"
+#include "../include/pipeline.h"
+#include "../include/fanout.h"
+
+// Constant expressions, folded while parsing. Precedence follows NASM,
+// loosest first:
+//   |   ^   &   << >>   + -   * / // % %%   unary - + ~
+// $ is the current location and $$ the start of the current section.
+// Labels can only be used once defined, since there is a single pass.
+
+typedef bool (*level_parser_t)(parser_t* parser, expression_value_t* result);
+
+static bool parse_or(parser_t* parser, expression_value_t* result);
+
+static token_type_t current_type(parser_t* parser) {
+    return parser->current_token ? parser->current_token->type : TOKEN_EOF;
+}
+
+// A section offset where a number is needed
+static bool require_absolute(parser_t* parser, const expression_value_t* value) {
+    if (value->section != EXPRESSION_ABSOLUTE) {
+        parser_error(parser, "Expression is not a constant");
+        return false;
+    }
+    return true;
+}
+
+// Under --pipeline text addresses are assigned by the encoder thread, so
+// wait for it to catch up before reading one. With several targets the
+// address only holds for the first, whose encoder runs here.
+static bool sync_text_addresses(parser_t* parser) {
+    if (parser->fanout) {
+        parser->fanout->text_addresses_read = true;
+    }
+    if (parser->pipeline && !pipeline_sync(parser->pipeline, parser)) {
+        parser_error(parser, "Encoding stopped");
+        return false;
+    }
+    return true;
+}
+
+static bool parse_symbol_value(parser_t* parser, expression_value_t* result) {
+    const char* name = parser->current_token->value;
+    symbol_t* symbol = symbol_table_lookup(parser->symbol_table, name);
+    char error_msg[256];
+
+    if (!symbol || !symbol->defined || symbol->binding == SYMBOL_EXTERN) {
+        snprintf(error_msg, sizeof(error_msg), "'%s' is not defined before this expression", name);
+        parser_error(parser, error_msg);
+        return false;
+    }
+
+    if (symbol->type == SYMBOL_CONSTANT) {
+        result->value = (int64_t)symbol->address;
+        result->section = EXPRESSION_ABSOLUTE;
+    } else {
+        if (symbol->section == SECTION_TEXT && !sync_text_addresses(parser)) return false;
+        // Reload: syncing may have added symbols
+        symbol = symbol_table_lookup(parser->symbol_table, name);
+        result->value = (int64_t)symbol->address;
+        result->section = symbol->section;
+    }
+    parser_advance(parser);
+    return true;
+}
+
+static bool parse_primary(parser_t* parser, expression_value_t* result) {
+    switch (current_type(parser)) {
+        case TOKEN_NUMBER:
+            result->value = (int64_t)parser->current_token->numeric_value;
+            result->section = EXPRESSION_ABSOLUTE;
+            parser_advance(parser);
+            return true;
+
+        case TOKEN_DOLLAR:
+            if (parser->current_section == SECTION_TEXT && !sync_text_addresses(parser)) return false;
+            result->value = (int64_t)parser->current_address;
+            result->section = parser->current_section;
+            parser_advance(parser);
+            return true;
+
+        case TOKEN_DOUBLE_DOLLAR:
+            result->value = 0;
+            result->section = parser->current_section;
+            parser_advance(parser);
+            return true;
+
+        case TOKEN_IDENTIFIER:
+            return parse_symbol_value(parser, result);
+
+        case TOKEN_LPAREN:
+            parser_advance(parser);
+            if (!parse_or(parser, result)) return false;
+            if (!parser_expect_token(parser, TOKEN_RPAREN)) return false;
+            parser_advance(parser);
+            return true;
+
+        default:
+            parser_error(parser, "Expected a number, symbol, $ or ( in expression");
+            return false;
+    }
+}
+
+static bool parse_unary(parser_t* parser, expression_value_t* result) {
+    token_type_t op = current_type(parser);
+    if (op != TOKEN_MINUS && op != TOKEN_PLUS && op != TOKEN_NOT) {
+        return parse_primary(parser, result);
+    }
+
+    parser_advance(parser);
+    if (!parse_unary(parser, result)) return false;
+    if (op == TOKEN_PLUS) return true;
+    if (!require_absolute(parser, result)) return false;
+
+    result->value = op == TOKEN_MINUS ? (int64_t)(0 - (uint64_t)result->value) : ~result->value;
+    return true;
+}
+
+// .rodata entries move when merged, and .data items under --pack-data, so
+// a distance is only kept if no label lies strictly between its ends;
+// otherwise the section stays as written
+static void check_item_distance(parser_t* parser, int section, uint64_t a, uint64_t b) {
+    uint64_t low = a < b ? a : b;
+    uint64_t high = a < b ? b : a;
+    symbol_table_t* table = parser->symbol_table;
+
+    for (int i = 0; i < table->symbol_count && !parser->pinned[section]; i++) {
+        symbol_t* symbol = &table->symbols[i];
+        if (symbol->type == SYMBOL_LABEL && symbol->defined && symbol->section == section &&
+            symbol->address > low && symbol->address < high) {
+            parser->pinned[section] = true;
+        }
+    }
+}
+
+// .text moves under --align-branches and --profile after this, so the
+// passes that move it check the distance again
+static bool record_text_distance(parser_t* parser, uint64_t to, uint64_t from) {
+    if (to == from) return true;
+
+    if (parser->text_distance_count == parser->text_distance_capacity) {
+        int capacity = parser->text_distance_capacity ? parser->text_distance_capacity * 2 : 16;
+        text_distance_t* distances = realloc(parser->text_distances, capacity * sizeof(text_distance_t));
+        if (!distances) {
+            parser_error(parser, "Out of memory");
+            return false;
+        }
+        parser->text_distances = distances;
+        parser->text_distance_capacity = capacity;
+    }
+
+    parser->text_distances[parser->text_distance_count++] = (text_distance_t){
+        from, to, (int64_t)(to - from), parser->current_token ? parser->current_token->line : 0
+    };
+    return true;
+}
+
+// Operators other than + and - need plain numbers on both sides
+static bool apply_binary(parser_t* parser, token_type_t op, expression_value_t* left,
+                         const expression_value_t* right) {
+    uint64_t a = (uint64_t)left->value;
+    uint64_t b = (uint64_t)right->value;
+
+    if (op == TOKEN_PLUS || op == TOKEN_MINUS) {
+        if (op == TOKEN_PLUS) {
+            if (left->section != EXPRESSION_ABSOLUTE && right->section != EXPRESSION_ABSOLUTE) {
+                parser_error(parser, "Cannot add two addresses");
+                return false;
+            }
+            if (left->section == EXPRESSION_ABSOLUTE) left->section = right->section;
+            left->value = (int64_t)(a + b);
+        } else {
+            if (right->section != EXPRESSION_ABSOLUTE) {
+                if (right->section != left->section) {
+                    parser_error(parser, "Address difference across sections is not a constant");
+                    return false;
+                }
+                if (left->section == SECTION_RODATA || (left->section == SECTION_DATA && parser->pack_data)) {
+                    check_item_distance(parser, left->section, a, b);
+                } else if (left->section == SECTION_TEXT && !record_text_distance(parser, a, b)) {
+                    return false;
+                }
+                left->section = EXPRESSION_ABSOLUTE;
+            }
+            left->value = (int64_t)(a - b);
+        }
+        return true;
+    }
+
+    if (!require_absolute(parser, left) || !require_absolute(parser, right)) return false;
+
+    bool divides = op == TOKEN_DIVIDE || op == TOKEN_SIGNED_DIVIDE ||
+                   op == TOKEN_MODULO || op == TOKEN_SIGNED_MODULO;
+    if (divides && b == 0) {
+        parser_error(parser, "Division by zero");
+        return false;
+    }
+
+    switch (op) {
+        case TOKEN_MULTIPLY:      left->value = (int64_t)(a * b); break;
+        case TOKEN_DIVIDE:        left->value = (int64_t)(a / b); break;
+        case TOKEN_MODULO:        left->value = (int64_t)(a % b); break;
+        case TOKEN_SIGNED_DIVIDE:
+            left->value = (left->value == INT64_MIN && right->value == -1) ? INT64_MIN : left->value / right->value;
+            break;
+        case TOKEN_SIGNED_MODULO:
+            left->value = right->value == -1 ? 0 : left->value % right->value;
+            break;
+        case TOKEN_SHIFT_LEFT:    left->value = b >= 64 ? 0 : (int64_t)(a << b); break;
+        case TOKEN_SHIFT_RIGHT:   left->value = b >= 64 ? 0 : (int64_t)(a >> b); break;
+        case TOKEN_AND:           left->value = (int64_t)(a & b); break;
+        case TOKEN_OR:            left->value = (int64_t)(a | b); break;
+        case TOKEN_XOR:           left->value = (int64_t)(a ^ b); break;
+        default: break;
+    }
+    return true;
+}
+
+// One left-associative level: operand (op operand)*
+static bool parse_level(parser_t* parser, expression_value_t* result, level_parser_t operand,
+                        const token_type_t* ops) {
+    if (!operand(parser, result)) return false;
+
+    for (;;) {
+        token_type_t type = current_type(parser);
+        int i = 0;
+        while (ops[i] != TOKEN_EOF && ops[i] != type) i++;
+        if (ops[i] == TOKEN_EOF) return true;
+
+        expression_value_t right;
+        parser_advance(parser);
+        if (!operand(parser, &right) || !apply_binary(parser, type, result, &right)) return false;
+    }
+}
+
+static bool parse_multiplicative(parser_t* parser, expression_value_t* result) {
+    static const token_type_t ops[] = {TOKEN_MULTIPLY, TOKEN_DIVIDE, TOKEN_SIGNED_DIVIDE,
+                                       TOKEN_MODULO, TOKEN_SIGNED_MODULO, TOKEN_EOF};
+    return parse_level(parser, result, parse_unary, ops);
+}
+
+static bool parse_additive(parser_t* parser, expression_value_t* result) {
+    static const token_type_t ops[] = {TOKEN_PLUS, TOKEN_MINUS, TOKEN_EOF};
+    return parse_level(parser, result, parse_multiplicative, ops);
+}
+
+static bool parse_shift(parser_t* parser, expression_value_t* result) {
+    static const token_type_t ops[] = {TOKEN_SHIFT_LEFT, TOKEN_SHIFT_RIGHT, TOKEN_EOF};
+    return parse_level(parser, result, parse_additive, ops);
+}
+
+static bool parse_and(parser_t* parser, expression_value_t* result) {
+    static const token_type_t ops[] = {TOKEN_AND, TOKEN_EOF};
+    return parse_level(parser, result, parse_shift, ops);
+}
+
+static bool parse_xor(parser_t* parser, expression_value_t* result) {
+    static const token_type_t ops[] = {TOKEN_XOR, TOKEN_EOF};
+    return parse_level(parser, result, parse_and, ops);
+}
+
+static bool parse_or(parser_t* parser, expression_value_t* result) {
+    static const token_type_t ops[] = {TOKEN_OR, TOKEN_EOF};
+    return parse_level(parser, result, parse_xor, ops);
+}
+
+// Whether the current token can only begin a constant expression. A bare
+// identifier is a label reference unless it names a constant or an
+// operator follows it.
+bool expression_starts(parser_t* parser) {
+    switch (current_type(parser)) {
+        case TOKEN_NUMBER:
+        case TOKEN_LPAREN:
+        case TOKEN_MINUS:
+        case TOKEN_PLUS:
+        case TOKEN_NOT:
+        case TOKEN_DOLLAR:
+        case TOKEN_DOUBLE_DOLLAR:
+            return true;
+
+        case TOKEN_IDENTIFIER: {
+            symbol_t* symbol = symbol_table_lookup(parser->symbol_table, parser->current_token->value);
+            if (symbol && symbol->defined && symbol->type == SYMBOL_CONSTANT) return true;
+
+            token_t* next = parser_peek(parser);
+            switch (next ? next->type : TOKEN_EOF) {
+                case TOKEN_PLUS: case TOKEN_MINUS: case TOKEN_MULTIPLY:
+                case TOKEN_DIVIDE: case TOKEN_SIGNED_DIVIDE: case TOKEN_MODULO:
+                case TOKEN_SIGNED_MODULO: case TOKEN_SHIFT_LEFT: case TOKEN_SHIFT_RIGHT:
+                case TOKEN_AND: case TOKEN_OR: case TOKEN_XOR:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        default:
+            return false;
+    }
+}
+
+bool parse_expression(parser_t* parser, expression_value_t* result) {
+    return parse_or(parser, result);
+}
+
+// A full expression that must fold to a number
+bool parse_constant(parser_t* parser, int64_t* value) {
+    expression_value_t result;
+    if (!parse_or(parser, &result) || !require_absolute(parser, &result)) return false;
+    *value = result.value;
+    return true;
+}
+
+// A product of unary terms, e.g. a displacement between + and - in a
+// memory operand
+bool parse_constant_term(parser_t* parser, int64_t* value) {
+    expression_value_t result;
+    if (!parse_multiplicative(parser, &result) || !require_absolute(parser, &result)) return false;
+    *value = result.value;
+    return true;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../include/fanout.h"
+#include "../include/stats.h"
+
+// Multi-target builds. Lexing and parsing produce the same instructions,
+// labels and data for every architecture; only encoding differs. The
+// record of .text items replays what the first target's encoder saw, so
+// each further target only pays for encoding.
+
+// One further target, encoded on its own thread
+typedef struct {
+    const fanout_t* fanout;
+    program_t* program;
+    arch_type_t architecture;
+    pthread_t thread;
+    bool started;
+    int error_line;
+    char error_message[200];
+} fanout_target_t;
+
+void fanout_init(fanout_t* fanout) {
+    memset(fanout, 0, sizeof(*fanout));
+}
+
+void fanout_free(fanout_t* fanout) {
+    free(fanout->items);
+    fanout_init(fanout);
+}
+
+static ir_item_t* next_item(fanout_t* fanout) {
+    if (fanout->item_count >= fanout->item_capacity) {
+        int capacity = fanout->item_capacity ? fanout->item_capacity * 2 : 256;
+        ir_item_t* items = realloc(fanout->items, capacity * sizeof(ir_item_t));
+        if (!items) return NULL;
+        fanout->items = items;
+        fanout->item_capacity = capacity;
+    }
+    return &fanout->items[fanout->item_count++];
+}
+
+bool fanout_record_instruction(fanout_t* fanout, instruction_t* instr, uint64_t repeat) {
+    ir_item_t* item = next_item(fanout);
+    if (!item) return false;
+
+    item->instr = instr;
+    item->repeat = repeat;
+    item->symbol = -1;
+    fanout->instruction_count++;
+    return true;
+}
+
+bool fanout_record_label(fanout_t* fanout, int symbol) {
+    ir_item_t* item = next_item(fanout);
+    if (!item) return false;
+
+    item->instr = NULL;
+    item->repeat = 0;
+    item->symbol = symbol;
+    return true;
+}
+
+// Program for another target: the parsed data and symbols, no code yet
+static program_t* create_target_program(const fanout_t* fanout, const program_t* source,
+                                        arch_type_t arch) {
+    program_t* program = program_create(arch);
+    if (!program) return NULL;
+    program->arena = arena_create(source->arena && source->arena->huge_pages);
+
+    int capacity = fanout->instruction_count ? fanout->instruction_count : 1;
+    instruction_t** instructions = realloc(program->instructions, capacity * sizeof(instruction_t*));
+    if (instructions) {
+        program->instructions = instructions;
+        program->instruction_capacity = capacity;
+    }
+    program->symbols = symbol_table_clone(source->symbols);
+    if (source->data_size) {
+        program->data_section = malloc(source->data_size);
+        if (program->data_section) {
+            memcpy(program->data_section, source->data_section, source->data_size);
+            program->data_size = program->data_capacity = source->data_size;
+        }
+    }
+    if (source->rodata_size) {
+        program->rodata = malloc(source->rodata_size);
+        if (program->rodata) {
+            memcpy(program->rodata, source->rodata, source->rodata_size);
+            program->rodata_size = program->rodata_capacity = source->rodata_size;
+        }
+    }
+    program->rodata_strings = source->rodata_strings;
+    program->rodata_merged = source->rodata_merged;
+    program->data_packed = source->data_packed;
+    memcpy(program->section_alignment, source->section_alignment, sizeof(program->section_alignment));
+    program->bss_size = source->bss_size;
+
+    if (!instructions || !program->arena || !program->symbols || (source->data_size && !program->data_section) ||
+        (source->rodata_size && !program->rodata)) {
+        fanout_program_destroy(program);
+        return NULL;
+    }
+    return program;
+}
+
+static void* target_main(void* argument) {
+    fanout_target_t* target = argument;
+    const fanout_t* fanout = target->fanout;
+    program_t* program = target->program;
+
+    stats_thread_begin(STATS_PHASE_ENCODE);
+    for (int i = 0; i < fanout->item_count; i++) {
+        const ir_item_t* item = &fanout->items[i];
+        if (!item->instr) {
+            program->symbols->symbols[item->symbol].address = program->code_size;
+            continue;
+        }
+
+        instruction_t* instr = instruction_clone(program->arena, item->instr, target->architecture);
+        if (!instr) {
+            target->error_line = item->instr->line;
+            snprintf(target->error_message, sizeof(target->error_message), "Out of memory");
+            break;
+        }
+        program->instructions[program->instruction_count++] = instr;
+
+        if (program_encode(program, instr, target->architecture,
+                           target->error_message, sizeof(target->error_message)) != 0 ||
+            program_repeat_code(program, instr, item->repeat,
+                                target->error_message, sizeof(target->error_message)) != 0) {
+            target->error_line = instr->line;
+            break;
+        }
+    }
+    stats_thread_end();
+
+    // The cache was only needed while encoding
+    encode_cache_destroy(program->encode_cache);
+    program->encode_cache = NULL;
+    return NULL;
+}
+
+// Encode the recorded program for each of targets, concurrently. On
+// success programs[i] holds the result for targets[i], to be released with
+// fanout_program_destroy. Returns 0, or -1 after reporting the first
+// failing target.
+int fanout_encode(const fanout_t* fanout, const program_t* source,
+                  const arch_type_t* targets, int count, program_t** programs) {
+    fanout_target_t* jobs = calloc(count ? count : 1, sizeof(fanout_target_t));
+    if (!jobs) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
+
+    int result = 0;
+    for (int i = 0; i < count && result == 0; i++) {
+        jobs[i].fanout = fanout;
+        jobs[i].architecture = targets[i];
+        jobs[i].program = create_target_program(fanout, source, targets[i]);
+        if (!jobs[i].program) {
+            fprintf(stderr, "Error: Out of memory\n");
+            result = -1;
+        } else if (pthread_create(&jobs[i].thread, NULL, target_main, &jobs[i]) != 0) {
+            fprintf(stderr, "Error: Cannot start the encoder thread for %s\n",
+                    architecture_name(targets[i]));
+            result = -1;
+        } else {
+            jobs[i].started = true;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].started) {
+            pthread_join(jobs[i].thread, NULL);
+        }
+        if (result == 0 && jobs[i].error_message[0]) {
+            fprintf(stderr, "Error: %s: Line %d: %s\n", architecture_name(jobs[i].architecture),
+                    jobs[i].error_line, jobs[i].error_message);
+            result = -1;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (result == 0) {
+            programs[i] = jobs[i].program;
+        } else {
+            fanout_program_destroy(jobs[i].program);
+        }
+    }
+    free(jobs);
+    return result;
+}
+
+// A program from fanout_encode owns its symbol table and arena
+void fanout_program_destroy(program_t* program) {
+    if (!program) return;
+
+    arena_t* arena = program->arena;
+    symbol_table_destroy(program->symbols);
+    program_destroy(program);
+    arena_destroy(arena);
+}
@@ -3,30 +3,74 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <stdarg.h>
 #include "../include/instruction.h"
 #include "../include/lexer.h"
 
 // Register information tables
-static register_info_t x86_64_registers[] = {
+static register_info_t x86_registers[] = {
     // 8-bit registers
-    {"al", 0, 8, ARCH_X86_64}, {"cl", 1, 8, ARCH_X86_64}, {"dl", 2, 8, ARCH_X86_64}, {"bl", 3, 8, ARCH_X86_64},
-    {"ah", 4, 8, ARCH_X86_64}, {"ch", 5, 8, ARCH_X86_64}, {"dh", 6, 8, ARCH_X86_64}, {"bh", 7, 8, ARCH_X86_64},
+    {"al", 0, 8, ARCH_X86_16, 0}, {"cl", 1, 8, ARCH_X86_16, 0}, {"dl", 2, 8, ARCH_X86_16, 0}, {"bl", 3, 8, ARCH_X86_16, 0},
+    {"ah", 4, 8, ARCH_X86_16, REG_FLAG_NO_REX}, {"ch", 5, 8, ARCH_X86_16, REG_FLAG_NO_REX},
+    {"dh", 6, 8, ARCH_X86_16, REG_FLAG_NO_REX}, {"bh", 7, 8, ARCH_X86_16, REG_FLAG_NO_REX},
+    {"spl", 4, 8, ARCH_X86_64, REG_FLAG_REX_REQUIRED}, {"bpl", 5, 8, ARCH_X86_64, REG_FLAG_REX_REQUIRED},
+    {"sil", 6, 8, ARCH_X86_64, REG_FLAG_REX_REQUIRED}, {"dil", 7, 8, ARCH_X86_64, REG_FLAG_REX_REQUIRED},
+    {"r8b", 8, 8, ARCH_X86_64, 0}, {"r9b", 9, 8, ARCH_X86_64, 0}, {"r10b", 10, 8, ARCH_X86_64, 0}, {"r11b", 11, 8, ARCH_X86_64, 0},
+    {"r12b", 12, 8, ARCH_X86_64, 0}, {"r13b", 13, 8, ARCH_X86_64, 0}, {"r14b", 14, 8, ARCH_X86_64, 0}, {"r15b", 15, 8, ARCH_X86_64, 0},
     
     // 16-bit registers
-    {"ax", 0, 16, ARCH_X86_64}, {"cx", 1, 16, ARCH_X86_64}, {"dx", 2, 16, ARCH_X86_64}, {"bx", 3, 16, ARCH_X86_64},
-    {"sp", 4, 16, ARCH_X86_64}, {"bp", 5, 16, ARCH_X86_64}, {"si", 6, 16, ARCH_X86_64}, {"di", 7, 16, ARCH_X86_64},
+    {"ax", 0, 16, ARCH_X86_16, 0}, {"cx", 1, 16, ARCH_X86_16, 0}, {"dx", 2, 16, ARCH_X86_16, 0}, {"bx", 3, 16, ARCH_X86_16, 0},
+    {"sp", 4, 16, ARCH_X86_16, 0}, {"bp", 5, 16, ARCH_X86_16, 0}, {"si", 6, 16, ARCH_X86_16, 0}, {"di", 7, 16, ARCH_X86_16, 0},
+    {"r8w", 8, 16, ARCH_X86_64, 0}, {"r9w", 9, 16, ARCH_X86_64, 0}, {"r10w", 10, 16, ARCH_X86_64, 0}, {"r11w", 11, 16, ARCH_X86_64, 0},
+    {"r12w", 12, 16, ARCH_X86_64, 0}, {"r13w", 13, 16, ARCH_X86_64, 0}, {"r14w", 14, 16, ARCH_X86_64, 0}, {"r15w", 15, 16, ARCH_X86_64, 0},
     
-    // 32-bit registers
-    {"eax", 0, 32, ARCH_X86_64}, {"ecx", 1, 32, ARCH_X86_64}, {"edx", 2, 32, ARCH_X86_64}, {"ebx", 3, 32, ARCH_X86_64},
-    {"esp", 4, 32, ARCH_X86_64}, {"ebp", 5, 32, ARCH_X86_64}, {"esi", 6, 32, ARCH_X86_64}, {"edi", 7, 32, ARCH_X86_64},
+    // 32-bit registers (usable from 16-bit mode through the 0x66/0x67 prefixes)
+    {"eax", 0, 32, ARCH_X86_16, 0}, {"ecx", 1, 32, ARCH_X86_16, 0}, {"edx", 2, 32, ARCH_X86_16, 0}, {"ebx", 3, 32, ARCH_X86_16, 0},
+    {"esp", 4, 32, ARCH_X86_16, 0}, {"ebp", 5, 32, ARCH_X86_16, 0}, {"esi", 6, 32, ARCH_X86_16, 0}, {"edi", 7, 32, ARCH_X86_16, 0},
+    {"r8d", 8, 32, ARCH_X86_64, 0}, {"r9d", 9, 32, ARCH_X86_64, 0}, {"r10d", 10, 32, ARCH_X86_64, 0}, {"r11d", 11, 32, ARCH_X86_64, 0},
+    {"r12d", 12, 32, ARCH_X86_64, 0}, {"r13d", 13, 32, ARCH_X86_64, 0}, {"r14d", 14, 32, ARCH_X86_64, 0}, {"r15d", 15, 32, ARCH_X86_64, 0},
     
     // 64-bit registers
-    {"rax", 0, 64, ARCH_X86_64}, {"rcx", 1, 64, ARCH_X86_64}, {"rdx", 2, 64, ARCH_X86_64}, {"rbx", 3, 64, ARCH_X86_64},
-    {"rsp", 4, 64, ARCH_X86_64}, {"rbp", 5, 64, ARCH_X86_64}, {"rsi", 6, 64, ARCH_X86_64}, {"rdi", 7, 64, ARCH_X86_64},
-    {"r8", 8, 64, ARCH_X86_64}, {"r9", 9, 64, ARCH_X86_64}, {"r10", 10, 64, ARCH_X86_64}, {"r11", 11, 64, ARCH_X86_64},
-    {"r12", 12, 64, ARCH_X86_64}, {"r13", 13, 64, ARCH_X86_64}, {"r14", 14, 64, ARCH_X86_64}, {"r15", 15, 64, ARCH_X86_64},
+    {"rax", 0, 64, ARCH_X86_64, 0}, {"rcx", 1, 64, ARCH_X86_64, 0}, {"rdx", 2, 64, ARCH_X86_64, 0}, {"rbx", 3, 64, ARCH_X86_64, 0},
+    {"rsp", 4, 64, ARCH_X86_64, 0}, {"rbp", 5, 64, ARCH_X86_64, 0}, {"rsi", 6, 64, ARCH_X86_64, 0}, {"rdi", 7, 64, ARCH_X86_64, 0},
+    {"r8", 8, 64, ARCH_X86_64, 0}, {"r9", 9, 64, ARCH_X86_64, 0}, {"r10", 10, 64, ARCH_X86_64, 0}, {"r11", 11, 64, ARCH_X86_64, 0},
+    {"r12", 12, 64, ARCH_X86_64, 0}, {"r13", 13, 64, ARCH_X86_64, 0}, {"r14", 14, 64, ARCH_X86_64, 0}, {"r15", 15, 64, ARCH_X86_64, 0},
     
-    {NULL, 0, 0, 0} // Sentinel
+    // 128-bit vector registers (xmm16-xmm31 need EVEX)
+    {"xmm0", 0, 128, ARCH_X86_16, REG_FLAG_VECTOR}, {"xmm1", 1, 128, ARCH_X86_16, REG_FLAG_VECTOR}, {"xmm2", 2, 128, ARCH_X86_16, REG_FLAG_VECTOR}, {"xmm3", 3, 128, ARCH_X86_16, REG_FLAG_VECTOR},
+    {"xmm4", 4, 128, ARCH_X86_16, REG_FLAG_VECTOR}, {"xmm5", 5, 128, ARCH_X86_16, REG_FLAG_VECTOR}, {"xmm6", 6, 128, ARCH_X86_16, REG_FLAG_VECTOR}, {"xmm7", 7, 128, ARCH_X86_16, REG_FLAG_VECTOR},
+    {"xmm8", 8, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm9", 9, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm10", 10, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm11", 11, 128, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"xmm12", 12, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm13", 13, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm14", 14, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm15", 15, 128, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"xmm16", 16, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm17", 17, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm18", 18, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm19", 19, 128, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"xmm20", 20, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm21", 21, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm22", 22, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm23", 23, 128, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"xmm24", 24, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm25", 25, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm26", 26, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm27", 27, 128, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"xmm28", 28, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm29", 29, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm30", 30, 128, ARCH_X86_64, REG_FLAG_VECTOR}, {"xmm31", 31, 128, ARCH_X86_64, REG_FLAG_VECTOR},
+    
+    // 256-bit vector registers (ymm16-ymm31 need EVEX)
+    {"ymm0", 0, 256, ARCH_X86_16, REG_FLAG_VECTOR}, {"ymm1", 1, 256, ARCH_X86_16, REG_FLAG_VECTOR}, {"ymm2", 2, 256, ARCH_X86_16, REG_FLAG_VECTOR}, {"ymm3", 3, 256, ARCH_X86_16, REG_FLAG_VECTOR},
+    {"ymm4", 4, 256, ARCH_X86_16, REG_FLAG_VECTOR}, {"ymm5", 5, 256, ARCH_X86_16, REG_FLAG_VECTOR}, {"ymm6", 6, 256, ARCH_X86_16, REG_FLAG_VECTOR}, {"ymm7", 7, 256, ARCH_X86_16, REG_FLAG_VECTOR},
+    {"ymm8", 8, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm9", 9, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm10", 10, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm11", 11, 256, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"ymm12", 12, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm13", 13, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm14", 14, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm15", 15, 256, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"ymm16", 16, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm17", 17, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm18", 18, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm19", 19, 256, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"ymm20", 20, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm21", 21, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm22", 22, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm23", 23, 256, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"ymm24", 24, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm25", 25, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm26", 26, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm27", 27, 256, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"ymm28", 28, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm29", 29, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm30", 30, 256, ARCH_X86_64, REG_FLAG_VECTOR}, {"ymm31", 31, 256, ARCH_X86_64, REG_FLAG_VECTOR},
+    
+    // 512-bit vector registers (zmm16-zmm31 need EVEX)
+    {"zmm0", 0, 512, ARCH_X86_16, REG_FLAG_VECTOR}, {"zmm1", 1, 512, ARCH_X86_16, REG_FLAG_VECTOR}, {"zmm2", 2, 512, ARCH_X86_16, REG_FLAG_VECTOR}, {"zmm3", 3, 512, ARCH_X86_16, REG_FLAG_VECTOR},
+    {"zmm4", 4, 512, ARCH_X86_16, REG_FLAG_VECTOR}, {"zmm5", 5, 512, ARCH_X86_16, REG_FLAG_VECTOR}, {"zmm6", 6, 512, ARCH_X86_16, REG_FLAG_VECTOR}, {"zmm7", 7, 512, ARCH_X86_16, REG_FLAG_VECTOR},
+    {"zmm8", 8, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm9", 9, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm10", 10, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm11", 11, 512, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"zmm12", 12, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm13", 13, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm14", 14, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm15", 15, 512, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"zmm16", 16, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm17", 17, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm18", 18, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm19", 19, 512, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"zmm20", 20, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm21", 21, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm22", 22, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm23", 23, 512, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"zmm24", 24, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm25", 25, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm26", 26, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm27", 27, 512, ARCH_X86_64, REG_FLAG_VECTOR},
+    {"zmm28", 28, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm29", 29, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm30", 30, 512, ARCH_X86_64, REG_FLAG_VECTOR}, {"zmm31", 31, 512, ARCH_X86_64, REG_FLAG_VECTOR},
+    
+    // AVX-512 opmask registers
+    {"k0", 0, 64, ARCH_X86_16, REG_FLAG_MASK}, {"k1", 1, 64, ARCH_X86_16, REG_FLAG_MASK}, {"k2", 2, 64, ARCH_X86_16, REG_FLAG_MASK}, {"k3", 3, 64, ARCH_X86_16, REG_FLAG_MASK},
+    {"k4", 4, 64, ARCH_X86_16, REG_FLAG_MASK}, {"k5", 5, 64, ARCH_X86_16, REG_FLAG_MASK}, {"k6", 6, 64, ARCH_X86_16, REG_FLAG_MASK}, {"k7", 7, 64, ARCH_X86_16, REG_FLAG_MASK},
+    
+    {NULL, 0, 0, 0, 0} // Sentinel
 };
 
 static register_info_t* find_register_info(const char* reg_name, arch_type_t arch) {
@@ -36,7 +80,7 @@ static register_info_t* find_register_info(const char* reg_name, arch_type_t arc
         case ARCH_X86_16:
         case ARCH_X86_32:
         case ARCH_X86_64:
-            regs = x86_64_registers;
+            regs = x86_registers;
             break;
         case ARCH_ARM_32:
         case ARCH_ARM_64:
@@ -55,22 +99,47 @@ static register_info_t* find_register_info(const char* reg_name, arch_type_t arc
     return NULL;
 }
 
-instruction_t* instruction_create(const char* mnemonic) {
-    instruction_t* instr = malloc(sizeof(instruction_t));
+register_info_t* register_lookup(const char* reg_name, arch_type_t arch) {
+    return find_register_info(reg_name, arch);
+}
+
+// Copy of text that lives as long as instr: from its arena, else malloc'd
+char* instruction_strdup(const instruction_t* instr, const char* text) {
+    return instr->arena ? arena_strdup(instr->arena, text) : strdup(text);
+}
+
+// Drop a string from instruction_strdup; arena strings go with the arena
+void instruction_free_string(const instruction_t* instr, char* text) {
+    if (!instr->arena) {
+        free(text);
+    }
+}
+
+// From arena when given; such instructions are never freed one by one
+instruction_t* instruction_create(arena_t* arena, const char* mnemonic) {
+    instruction_t* instr = arena ? arena_alloc(arena, sizeof(instruction_t)) : malloc(sizeof(instruction_t));
     if (!instr) return NULL;
     
-    instr->mnemonic = strdup(mnemonic);
+    instr->arena = arena;
+    instr->mnemonic = instruction_strdup(instr, mnemonic);
     if (!instr->mnemonic) {
-        free(instr);
+        if (!arena) free(instr);
         return NULL;
     }
     
     instr->operand_count = 0;
     instr->line = 0;
     instr->column = 0;
+    instr->address = 0;
+    instr->size = 0;
+    instr->fixup_kind = FIXUP_NONE;
+    instr->fixup_offset = 0;
+    instr->fixup_size = 0;
+    instr->fixup_label = NULL;
+    instr->fixup_addend = 0;
     
     // Initialize operands
-    for (int i = 0; i < 3; i++) {
+    for (int i = 0; i < INSTRUCTION_MAX_OPERANDS; i++) {
         instr->operands[i].type = OPERAND_NONE;
     }
     
@@ -78,7 +147,7 @@ instruction_t* instruction_create(const char* mnemonic) {
 }
 
 void instruction_destroy(instruction_t* instr) {
-    if (!instr) return;
+    if (!instr || instr->arena) return;
     
     free(instr->mnemonic);
     
@@ -90,17 +159,83 @@ void instruction_destroy(instruction_t* instr) {
 }
 
 void instruction_add_operand(instruction_t* instr, operand_t* operand) {
-    if (!instr || !operand || instr->operand_count >= 3) return;
+    if (!instr || !operand || instr->operand_count >= INSTRUCTION_MAX_OPERANDS) return;
     
     instr->operands[instr->operand_count] = *operand;
     instr->operand_count++;
 }
 
+// Append a label operand whose name lives with the instruction
+bool instruction_add_label(instruction_t* instr, const char* label_name) {
+    operand_t operand;
+    
+    memset(&operand, 0, sizeof(operand));
+    operand.type = OPERAND_LABEL;
+    operand.data.label.name = instruction_strdup(instr, label_name);
+    if (!operand.data.label.name) return false;
+    
+    instruction_add_operand(instr, &operand);
+    return true;
+}
+
+// Register of the same name in arch's table; tables are per architecture family
+static register_info_t* rebind_register(const register_info_t* reg, arch_type_t arch) {
+    return reg ? find_register_info(reg->name, arch) : NULL;
+}
+
+// Deep copy of a parsed instruction with its registers looked up for arch,
+// ready to be encoded for that target
+instruction_t* instruction_clone(arena_t* arena, const instruction_t* instr, arch_type_t arch) {
+    instruction_t* copy = instruction_create(arena, instr->mnemonic);
+    if (!copy) return NULL;
+    
+    copy->line = instr->line;
+    copy->column = instr->column;
+    
+    for (int i = 0; i < instr->operand_count; i++) {
+        operand_t operand = instr->operands[i];
+        char* name = NULL;
+        
+        operand.mask = rebind_register(operand.mask, arch);
+        switch (operand.type) {
+            case OPERAND_REGISTER:
+                name = operand.data.reg.name = instruction_strdup(copy, operand.data.reg.name);
+                operand.data.reg.reg_info = name ? find_register_info(name, arch) : NULL;
+                break;
+            case OPERAND_MEMORY:
+                operand.data.mem.base = rebind_register(operand.data.mem.base, arch);
+                operand.data.mem.index = rebind_register(operand.data.mem.index, arch);
+                if (operand.data.mem.label) {
+                    name = operand.data.mem.label = instruction_strdup(copy, operand.data.mem.label);
+                }
+                break;
+            case OPERAND_LABEL:
+                name = operand.data.label.name = instruction_strdup(copy, operand.data.label.name);
+                break;
+            default:
+                break;
+        }
+        
+        bool named = operand.type == OPERAND_REGISTER || operand.type == OPERAND_LABEL ||
+                     (operand.type == OPERAND_MEMORY && instr->operands[i].data.mem.label);
+        if (named && !name) {
+            instruction_destroy(copy);
+            return NULL;
+        }
+        copy->operands[copy->operand_count++] = operand;
+    }
+    
+    return copy;
+}
+
 operand_t* operand_create_register(const char* reg_name, arch_type_t arch) {
     operand_t* operand = malloc(sizeof(operand_t));
     if (!operand) return NULL;
     
     operand->type = OPERAND_REGISTER;
+    operand->mask = NULL;
+    operand->zeroing = false;
+    operand->broadcast = 0;
     operand->data.reg.name = strdup(reg_name);
     operand->data.reg.reg_info = find_register_info(reg_name, arch);
     
@@ -117,6 +252,9 @@ operand_t* operand_create_immediate(uint64_t value, int size_bits) {
     if (!operand) return NULL;
     
     operand->type = OPERAND_IMMEDIATE;
+    operand->mask = NULL;
+    operand->zeroing = false;
+    operand->broadcast = 0;
     operand->data.imm.value = value;
     operand->data.imm.size_bits = size_bits;
     
@@ -129,11 +267,16 @@ operand_t* operand_create_memory(register_info_t* base, register_info_t* index,
     if (!operand) return NULL;
     
     operand->type = OPERAND_MEMORY;
+    operand->mask = NULL;
+    operand->zeroing = false;
+    operand->broadcast = 0;
     operand->data.mem.base = base;
     operand->data.mem.index = index;
     operand->data.mem.scale = scale;
     operand->data.mem.displacement = displacement;
     operand->data.mem.size_bits = size_bits;
+    operand->data.mem.label = NULL;
+    operand->data.mem.relative = false;
     
     return operand;
 }
@@ -143,6 +286,9 @@ operand_t* operand_create_label(const char* label_name) {
     if (!operand) return NULL;
     
     operand->type = OPERAND_LABEL;
+    operand->mask = NULL;
+    operand->zeroing = false;
+    operand->broadcast = 0;
     operand->data.label.name = strdup(label_name);
     
     if (!operand->data.label.name) {
@@ -163,279 +309,1185 @@ void operand_destroy(operand_t* operand) {
         case OPERAND_LABEL:
             free(operand->data.label.name);
             break;
+        case OPERAND_MEMORY:
+            free(operand->data.mem.label);
+            break;
         default:
             break;
     }
 }
 
-// Basic x86-64 instruction encoding
-static int encode_x86_mov(instruction_t* instr, uint8_t* output, int max_size) {
-    if (instr->operand_count != 2) return -1;
+const char* encode_error_string(int error) {
+    switch (error) {
+        case ENCODE_ERROR_UNSUPPORTED: return "unsupported instruction or operand combination";
+        case ENCODE_ERROR_BUFFER: return "instruction too long for output buffer";
+        case ENCODE_ERROR_UNKNOWN_REGISTER: return "register cannot be encoded for this architecture";
+        case ENCODE_ERROR_REGISTER_MODE: return "register not available in this mode";
+        case ENCODE_ERROR_OPERAND_SIZE: return "invalid operand size for this mode";
+        case ENCODE_ERROR_ADDRESSING: return "invalid addressing mode for this mode";
+        case ENCODE_ERROR_IMMEDIATE: return "immediate or displacement out of range";
+        default: return "unknown encoding error";
+    }
+}
+
+// Append formatted text, keeping `length` within the buffer
+static void append_text(char* buffer, size_t size, size_t* length, const char* format, ...) {
+    if (*length >= size) return;
     
-    operand_t* dst = &instr->operands[0];
-    operand_t* src = &instr->operands[1];
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer + *length, size - *length, format, args);
+    va_end(args);
     
-    // MOV reg, imm32/64
-    if (dst->type == OPERAND_REGISTER && src->type == OPERAND_IMMEDIATE) {
-        if (dst->data.reg.reg_info && dst->data.reg.reg_info->size_bits == 64) {
-            if (max_size < 10) return -1;
-            
-            // REX.W prefix for 64-bit
-            output[0] = 0x48;
-            
-            // MOV opcode + register encoding
-            output[1] = 0xB8 + dst->data.reg.reg_info->encoding;
-            
-            // Immediate value (little-endian)
-            uint64_t imm = src->data.imm.value;
-            for (int i = 0; i < 8; i++) {
-                output[2 + i] = (imm >> (i * 8)) & 0xFF;
+    if (written > 0) {
+        *length += (size_t)written < size - *length ? (size_t)written : size - *length - 1;
+    }
+}
+
+static void operand_to_string(const operand_t* operand, char* buffer, size_t size, size_t* length) {
+    switch (operand->type) {
+        case OPERAND_REGISTER:
+            append_text(buffer, size, length, "%s", operand->data.reg.name);
+            break;
+        case OPERAND_IMMEDIATE:
+            append_text(buffer, size, length, "0x%llx", (unsigned long long)operand->data.imm.value);
+            break;
+        case OPERAND_LABEL:
+            append_text(buffer, size, length, "%s", operand->data.label.name);
+            break;
+        case OPERAND_MEMORY: {
+            const char* size_name = "";
+            switch (operand->data.mem.size_bits) {
+                case 8: size_name = "byte "; break;
+                case 16: size_name = "word "; break;
+                case 32: size_name = "dword "; break;
+                case 64: size_name = "qword "; break;
+                default: break;
             }
             
-            return 10;
-        } else if (dst->data.reg.reg_info && dst->data.reg.reg_info->size_bits == 32) {
-            if (max_size < 5) return -1;
-            
-            // MOV opcode + register encoding
-            output[0] = 0xB8 + dst->data.reg.reg_info->encoding;
-            
-            // Immediate value (little-endian)
-            uint32_t imm = (uint32_t)src->data.imm.value;
-            for (int i = 0; i < 4; i++) {
-                output[1 + i] = (imm >> (i * 8)) & 0xFF;
+            append_text(buffer, size, length, "%s[%s", size_name, operand->data.mem.relative ? "rel " : "");
+            const char* separator = "";
+            if (operand->data.mem.label) {
+                append_text(buffer, size, length, "%s", operand->data.mem.label);
+                separator = " + ";
             }
-            
-            return 5;
+            if (operand->data.mem.base) {
+                append_text(buffer, size, length, "%s", operand->data.mem.base->name);
+                separator = " + ";
+            }
+            if (operand->data.mem.index) {
+                append_text(buffer, size, length, "%s%s*%d", separator,
+                            operand->data.mem.index->name, operand->data.mem.scale);
+                separator = " + ";
+            }
+            int64_t displacement = operand->data.mem.displacement;
+            if (displacement < 0 && *separator) {
+                append_text(buffer, size, length, " - 0x%llx", (unsigned long long)-displacement);
+            } else if (displacement || !*separator) {
+                append_text(buffer, size, length, "%s0x%llx", separator, (unsigned long long)displacement);
+            }
+            append_text(buffer, size, length, "]");
+            break;
         }
+        default:
+            break;
     }
     
-    // MOV reg, reg
-    if (dst->type == OPERAND_REGISTER && src->type == OPERAND_REGISTER) {
-        if (dst->data.reg.reg_info && src->data.reg.reg_info && 
-            dst->data.reg.reg_info->size_bits == 64) {
-            if (max_size < 3) return -1;
-            
-            // REX.W prefix
-            output[0] = 0x48;
-            
-            // MOV r/m64, r64 opcode
-            output[1] = 0x89;
-            
-            // ModR/M byte: 11 (register mode) + src_reg * 8 + dst_reg
-            output[2] = 0xC0 + (src->data.reg.reg_info->encoding << 3) + 
-                       dst->data.reg.reg_info->encoding;
-            
-            return 3;
+    if (operand->mask) append_text(buffer, size, length, "{%s}", operand->mask->name);
+    if (operand->zeroing) append_text(buffer, size, length, "{z}");
+    if (operand->broadcast) append_text(buffer, size, length, "{1to%d}", operand->broadcast);
+}
+
+// Intel-syntax text of an instruction, for listings and diagnostics
+int instruction_to_string(const instruction_t* instr, char* buffer, size_t size) {
+    size_t length = 0;
+    
+    if (size == 0) return 0;
+    buffer[0] = '\0';
+    
+    append_text(buffer, size, &length, "%s", instr->mnemonic);
+    for (int i = 0; i < instr->operand_count; i++) {
+        append_text(buffer, size, &length, i == 0 ? " " : ", ");
+        operand_to_string(&instr->operands[i], buffer, size, &length);
+    }
+    
+    return (int)length;
+}
+
+// x86 mode rules
+//
+// Each mode has a default operand and address size. Any other size is
+// selected with the 0x66 (operand) and 0x67 (address) prefixes, except
+// 64-bit operands which need REX.W and therefore only exist in 64-bit mode.
+
+static int x86_default_operand_size(arch_type_t mode) {
+    return mode == ARCH_X86_16 ? 16 : 32;
+}
+
+static int x86_default_address_size(arch_type_t mode) {
+    switch (mode) {
+        case ARCH_X86_16: return 16;
+        case ARCH_X86_32: return 32;
+        default: return 64;
+    }
+}
+
+static bool x86_immediate_fits(uint64_t value, int bits) {
+    if (bits >= 64) return true;
+    
+    // Accept both the unsigned and the sign-extended interpretation
+    int64_t signed_value = (int64_t)value;
+    int64_t min = -((int64_t)1 << (bits - 1));
+    int64_t max = ((int64_t)1 << bits) - 1;
+    return signed_value >= min && signed_value <= max;
+}
+
+static bool x86_fits_int8(int64_t value) {
+    return value >= -128 && value <= 127;
+}
+
+// disp8 form of a displacement. EVEX scales disp8 by the memory operand
+// size N (compressed disp8*N); every other encoding uses N = 1.
+static bool x86_disp8(int64_t displacement, int scale, int64_t* disp8) {
+    if (displacement % scale != 0) return false;
+    if (!x86_fits_int8(displacement / scale)) return false;
+    *disp8 = displacement / scale;
+    return true;
+}
+
+static int x86_check_register(register_info_t* reg, arch_type_t mode) {
+    if (!reg) return ENCODE_ERROR_UNKNOWN_REGISTER;
+    if (reg->arch > mode) return ENCODE_ERROR_REGISTER_MODE;
+    return 0;
+}
+
+static bool x86_is_gpr(const register_info_t* reg) {
+    return !(reg->flags & (REG_FLAG_VECTOR | REG_FLAG_MASK));
+}
+
+// One x86 instruction in its decomposed form. Encoders fill this in and
+// x86_emit turns it into prefixes, REX, opcode, ModR/M, SIB, displacement
+// and immediate bytes according to the rules of the target mode.
+typedef struct {
+    int operand_size;            // 16/32/64 select 0x66 or REX.W; 8 or 0 select nothing
+    uint8_t opcode[3];
+    int opcode_length;
+    register_info_t* opcode_reg; // Register encoded in the low opcode bits (+r forms)
+    bool has_modrm;
+    uint8_t reg_field;           // ModR/M.reg as an opcode extension (/digit)
+    register_info_t* reg;        // Register in ModR/M.reg (overrides reg_field)
+    register_info_t* rm_reg;     // Register-direct ModR/M.rm
+    const operand_t* rm_mem;     // Memory ModR/M.rm
+    uint64_t immediate;
+    int immediate_size;          // In bytes
+} x86_encoding_t;
+
+typedef struct {
+    uint8_t modrm;
+    bool has_sib;
+    uint8_t sib;
+    int64_t displacement;
+    int displacement_size;       // In bytes
+    bool address_prefix;
+    uint8_t rex;                 // REX.X/REX.B bits contributed by the address
+    bool rip_relative;           // Displacement counts from the end of the instruction
+} x86_address_t;
+
+// 16-bit ModR/M forms: [bx+si] [bx+di] [bp+si] [bp+di] [si] [di] [bp] [bx]
+static int x86_encode_address16(const operand_t* mem, int disp8_scale, x86_address_t* addr) {
+    register_info_t* base = mem->data.mem.base;
+    register_info_t* index = mem->data.mem.index;
+    bool label = mem->data.mem.label != NULL;
+    int64_t displacement = label ? 0 : mem->data.mem.displacement;
+    
+    if (index && mem->data.mem.scale != 1) return ENCODE_ERROR_ADDRESSING;
+    if (displacement < -32768 || displacement > 65535) return ENCODE_ERROR_IMMEDIATE;
+    
+    // Normalize so that bx/bp is the base and si/di the index
+    if (base && index && (base->encoding == 6 || base->encoding == 7)) {
+        register_info_t* tmp = base;
+        base = index;
+        index = tmp;
+    }
+    if (!base && index) {
+        base = index;
+        index = NULL;
+    }
+    
+    int rm;
+    if (!base) {
+        // Absolute [disp16]
+        addr->modrm = 0x06;
+        addr->displacement = displacement;
+        addr->displacement_size = 2;
+        return 0;
+    }
+    
+    if (index) {
+        bool base_bx = base->encoding == 3;
+        bool base_bp = base->encoding == 5;
+        bool index_si = index->encoding == 6;
+        bool index_di = index->encoding == 7;
+        if (!(base_bx || base_bp) || !(index_si || index_di)) {
+            return ENCODE_ERROR_ADDRESSING;
+        }
+        rm = (base_bp ? 2 : 0) + (index_di ? 1 : 0);
+    } else {
+        switch (base->encoding) {
+            case 6: rm = 4; break; // si
+            case 7: rm = 5; break; // di
+            case 5: rm = 6; break; // bp
+            case 3: rm = 7; break; // bx
+            default: return ENCODE_ERROR_ADDRESSING;
         }
     }
     
-    // MOV reg, [reg] - load from memory
-    if (dst->type == OPERAND_REGISTER && src->type == OPERAND_MEMORY) {
-        if (dst->data.reg.reg_info && dst->data.reg.reg_info->size_bits == 64 &&
-            src->data.mem.base && !src->data.mem.index && src->data.mem.displacement == 0) {
-            if (max_size < 3) return -1;
-            
-            // REX.W prefix
-            output[0] = 0x48;
-            
-            // MOV r64, r/m64 opcode
-            output[1] = 0x8B;
-            
-            // ModR/M byte: 00 (memory mode) + dst_reg * 8 + base_reg
-            output[2] = 0x00 + (dst->data.reg.reg_info->encoding << 3) + 
-                       src->data.mem.base->encoding;
-            
-            return 3;
+    // [bp] has no mod=00 form, it always carries a displacement. A label's
+    // address takes the full field.
+    int64_t disp8;
+    addr->displacement = displacement;
+    if (displacement == 0 && rm != 6 && !label) {
+        addr->modrm = (uint8_t)rm;
+    } else if (!label && x86_disp8(displacement, disp8_scale, &disp8)) {
+        addr->modrm = 0x40 | rm;
+        addr->displacement = disp8;
+        addr->displacement_size = 1;
+    } else {
+        addr->modrm = 0x80 | rm;
+        addr->displacement_size = 2;
+    }
+    return 0;
+}
+
+// 32/64-bit ModR/M and SIB forms
+static int x86_encode_address32(const operand_t* mem, arch_type_t mode, int disp8_scale, x86_address_t* addr) {
+    register_info_t* base = mem->data.mem.base;
+    register_info_t* index = mem->data.mem.index;
+    int scale = mem->data.mem.scale;
+    bool label = mem->data.mem.label != NULL;
+    int64_t displacement = label ? 0 : mem->data.mem.displacement;
+    
+    if (displacement < INT32_MIN || displacement > (int64_t)UINT32_MAX) {
+        return ENCODE_ERROR_IMMEDIATE;
+    }
+    if (mode == ARCH_X86_64 && displacement > INT32_MAX) {
+        return ENCODE_ERROR_IMMEDIATE;
+    }
+    
+    int scale_bits;
+    switch (index ? scale : 1) {
+        case 1: scale_bits = 0; break;
+        case 2: scale_bits = 1; break;
+        case 4: scale_bits = 2; break;
+        case 8: scale_bits = 3; break;
+        default: return ENCODE_ERROR_ADDRESSING;
+    }
+    
+    // The stack pointer cannot be an index
+    if (index && index->encoding == 4) {
+        return ENCODE_ERROR_ADDRESSING;
+    }
+    
+    addr->displacement = displacement;
+    
+    if (!base) {
+        addr->displacement_size = 4;
+        if (index) {
+            addr->modrm = 0x04;
+            addr->has_sib = true;
+            addr->sib = (uint8_t)((scale_bits << 6) | ((index->encoding & 7) << 3) | 5);
+            addr->rex |= (index->encoding & 8) ? 0x02 : 0;
+        } else if (mode == ARCH_X86_64) {
+            // mod=00 rm=101 means RIP-relative in 64-bit mode; use the SIB form
+            addr->modrm = 0x04;
+            addr->has_sib = true;
+            addr->sib = 0x25;
+        } else {
+            addr->modrm = 0x05;
         }
+        return 0;
     }
     
-    // MOV [reg], reg - store to memory
-    if (dst->type == OPERAND_MEMORY && src->type == OPERAND_REGISTER) {
-        if (src->data.reg.reg_info && src->data.reg.reg_info->size_bits == 64 &&
-            dst->data.mem.base && !dst->data.mem.index && dst->data.mem.displacement == 0) {
-            if (max_size < 3) return -1;
-            
-            // REX.W prefix
-            output[0] = 0x48;
-            
-            // MOV r/m64, r64 opcode
-            output[1] = 0x89;
-            
-            // ModR/M byte: 00 (memory mode) + src_reg * 8 + base_reg
-            output[2] = 0x00 + (src->data.reg.reg_info->encoding << 3) + 
-                       dst->data.mem.base->encoding;
-            
-            return 3;
+    int mod;
+    int64_t disp8;
+    if (displacement == 0 && (base->encoding & 7) != 5 && !label) {
+        mod = 0;
+    } else if (!label && x86_disp8(displacement, disp8_scale, &disp8)) {
+        mod = 1;
+        addr->displacement = disp8;
+        addr->displacement_size = 1;
+    } else {
+        mod = 2;
+        addr->displacement_size = 4;
+    }
+    
+    addr->rex |= (base->encoding & 8) ? 0x01 : 0;
+    
+    if (index || (base->encoding & 7) == 4) {
+        int index_bits = index ? (index->encoding & 7) : 4;
+        addr->modrm = (uint8_t)((mod << 6) | 4);
+        addr->has_sib = true;
+        addr->sib = (uint8_t)((scale_bits << 6) | (index_bits << 3) | (base->encoding & 7));
+        if (index && (index->encoding & 8)) {
+            addr->rex |= 0x02;
         }
+    } else {
+        addr->modrm = (uint8_t)((mod << 6) | (base->encoding & 7));
+    }
+    return 0;
+}
+
+// [rel disp], and [label + disp] in 64-bit mode: mod=00 rm=101 counts
+// from the end of the instruction, so the code needs no relocation for
+// where it is loaded. The label's offset is left to its fixup.
+static int x86_encode_rip_relative(const operand_t* mem, arch_type_t mode, x86_address_t* addr) {
+    int64_t displacement = mem->data.mem.label ? 0 : mem->data.mem.displacement;
+    
+    if (mode != ARCH_X86_64 || mem->data.mem.base || mem->data.mem.index) return ENCODE_ERROR_ADDRESSING;
+    if (displacement < INT32_MIN || displacement > INT32_MAX) return ENCODE_ERROR_IMMEDIATE;
+    
+    addr->modrm = 0x05;
+    addr->displacement = displacement;
+    addr->displacement_size = 4;
+    addr->rip_relative = true;
+    return 0;
+}
+
+static int x86_encode_address(const operand_t* mem, arch_type_t mode, int disp8_scale, x86_address_t* addr) {
+    register_info_t* base = mem->data.mem.base;
+    register_info_t* index = mem->data.mem.index;
+    
+    memset(addr, 0, sizeof(*addr));
+    
+    if (mem->data.mem.relative || (mem->data.mem.label && mode == ARCH_X86_64)) {
+        return x86_encode_rip_relative(mem, mode, addr);
+    }
+    
+    // The address size follows the address registers, or the mode default
+    int address_size = x86_default_address_size(mode);
+    if (base || index) {
+        register_info_t* reg = base ? base : index;
+        int result = x86_check_register(reg, mode);
+        if (result < 0) return result;
+        if (!x86_is_gpr(reg) || (index && !x86_is_gpr(index))) return ENCODE_ERROR_ADDRESSING;
+        if (base && index && base->size_bits != index->size_bits) {
+            return ENCODE_ERROR_ADDRESSING;
+        }
+        if (index) {
+            result = x86_check_register(index, mode);
+            if (result < 0) return result;
+        }
+        address_size = reg->size_bits;
+    }
+    
+    if (address_size == 8 || (address_size == 64 && mode != ARCH_X86_64) ||
+        (address_size == 16 && mode == ARCH_X86_64)) {
+        return ENCODE_ERROR_ADDRESSING;
+    }
+    
+    addr->address_prefix = address_size != x86_default_address_size(mode);
+    
+    if (address_size == 16) {
+        return x86_encode_address16(mem, disp8_scale, addr);
+    }
+    return x86_encode_address32(mem, mode, disp8_scale, addr);
+}
+
+// A label in a memory operand leaves the displacement field at offset as
+// a placeholder: relative to the end of the instruction in 64-bit mode,
+// the label's address otherwise
+static void x86_set_address_fixup(instruction_t* instr, const operand_t* mem, const x86_address_t* addr,
+                                  int offset) {
+    if (!mem->data.mem.label) return;
+    
+    instr->fixup_kind = addr->rip_relative ? FIXUP_RELATIVE : FIXUP_ABSOLUTE;
+    instr->fixup_offset = offset;
+    instr->fixup_size = addr->displacement_size;
+    instr->fixup_label = mem->data.mem.label;
+    instr->fixup_addend = mem->data.mem.displacement;
+}
+
+static int x86_emit(instruction_t* instr, const x86_encoding_t* enc, arch_type_t mode, uint8_t* output,
+                    int max_size) {
+    uint8_t bytes[15];
+    int length = 0;
+    uint8_t rex = 0;
+    bool rex_required = false;
+    bool rex_forbidden = false;
+    register_info_t* regs[3] = {enc->opcode_reg, enc->reg, enc->rm_reg};
+    
+    for (int i = 0; i < 3; i++) {
+        if (!regs[i]) continue;
+        int result = x86_check_register(regs[i], mode);
+        if (result < 0) return result;
+        if (!x86_is_gpr(regs[i])) return ENCODE_ERROR_UNSUPPORTED;
+        if (regs[i]->flags & REG_FLAG_REX_REQUIRED) rex_required = true;
+        if (regs[i]->flags & REG_FLAG_NO_REX) rex_forbidden = true;
+    }
+    
+    x86_address_t addr;
+    memset(&addr, 0, sizeof(addr));
+    if (enc->rm_mem) {
+        int result = x86_encode_address(enc->rm_mem, mode, 1, &addr);
+        if (result < 0) return result;
+        rex |= addr.rex;
+    }
+    
+    // Operand size prefixes
+    bool operand_prefix = false;
+    switch (enc->operand_size) {
+        case 16:
+        case 32:
+            operand_prefix = enc->operand_size != x86_default_operand_size(mode);
+            break;
+        case 64:
+            if (mode != ARCH_X86_64) return ENCODE_ERROR_OPERAND_SIZE;
+            rex |= 0x08;
+            break;
+        default:
+            break;
+    }
+    
+    if (enc->reg && (enc->reg->encoding & 8)) rex |= 0x04;
+    if (enc->rm_reg && (enc->rm_reg->encoding & 8)) rex |= 0x01;
+    if (enc->opcode_reg && (enc->opcode_reg->encoding & 8)) rex |= 0x01;
+    
+    if (rex || rex_required) {
+        if (mode != ARCH_X86_64) return ENCODE_ERROR_REGISTER_MODE;
+        if (rex_forbidden) return ENCODE_ERROR_REGISTER_MODE;
+    }
+    
+    if (operand_prefix) bytes[length++] = 0x66;
+    if (addr.address_prefix) bytes[length++] = 0x67;
+    if (rex || rex_required) bytes[length++] = 0x40 | rex;
+    
+    for (int i = 0; i < enc->opcode_length; i++) {
+        bytes[length++] = enc->opcode[i];
+    }
+    if (enc->opcode_reg) {
+        bytes[length - 1] += enc->opcode_reg->encoding & 7;
+    }
+    
+    if (enc->has_modrm) {
+        uint8_t reg_bits = enc->reg ? (enc->reg->encoding & 7) : (enc->reg_field & 7);
+        if (enc->rm_mem) {
+            bytes[length++] = addr.modrm | (uint8_t)(reg_bits << 3);
+            if (addr.has_sib) bytes[length++] = addr.sib;
+            x86_set_address_fixup(instr, enc->rm_mem, &addr, length);
+            for (int i = 0; i < addr.displacement_size; i++) {
+                bytes[length++] = (uint8_t)((uint64_t)addr.displacement >> (i * 8));
+            }
+        } else {
+            bytes[length++] = 0xC0 | (uint8_t)(reg_bits << 3) | (enc->rm_reg->encoding & 7);
+        }
+    }
+    
+    for (int i = 0; i < enc->immediate_size; i++) {
+        bytes[length++] = (uint8_t)(enc->immediate >> (i * 8));
+    }
+    
+    if (length > max_size) return ENCODE_ERROR_BUFFER;
+    memcpy(output, bytes, length);
+    return length;
+}
+
+// Operand size of a register/memory pair, checking that they agree
+static int x86_operand_size(const operand_t* a, const operand_t* b) {
+    int size_a = 0;
+    int size_b = 0;
+    
+    if (a->type == OPERAND_REGISTER) {
+        if (!a->data.reg.reg_info) return ENCODE_ERROR_UNKNOWN_REGISTER;
+        size_a = a->data.reg.reg_info->size_bits;
+    } else if (a->type == OPERAND_MEMORY) {
+        size_a = a->data.mem.size_bits;
     }
     
-    return -1; // Unsupported operand combination
+    if (b && b->type == OPERAND_REGISTER) {
+        if (!b->data.reg.reg_info) return ENCODE_ERROR_UNKNOWN_REGISTER;
+        size_b = b->data.reg.reg_info->size_bits;
+    } else if (b && b->type == OPERAND_MEMORY) {
+        size_b = b->data.mem.size_bits;
+    }
+    
+    if (size_a && size_b && size_a != size_b) return ENCODE_ERROR_OPERAND_SIZE;
+    if (!size_a && !size_b) return ENCODE_ERROR_OPERAND_SIZE;
+    return size_a ? size_a : size_b;
+}
+
+// Place a register or memory operand in ModR/M.rm
+static void x86_set_rm(x86_encoding_t* enc, const operand_t* operand) {
+    enc->has_modrm = true;
+    if (operand->type == OPERAND_REGISTER) {
+        enc->rm_reg = operand->data.reg.reg_info;
+    } else {
+        enc->rm_mem = operand;
+    }
+}
+
+// Immediate field width for an operand size (64-bit operations take a
+// sign-extended imm32)
+static int x86_immediate_size(int operand_size) {
+    return operand_size == 64 ? 4 : operand_size / 8;
+}
+
+// The imm32 of a 64-bit operation is sign-extended, so 0x80000000 would
+// become 0xffffffff80000000; narrower ones take either interpretation
+static bool x86_operand_immediate_fits(uint64_t value, int operand_size) {
+    if (operand_size == 64) {
+        return (int64_t)value >= INT32_MIN && (int64_t)value <= INT32_MAX;
+    }
+    return x86_immediate_fits(value, operand_size);
+}
+
+static int encode_x86_mov(instruction_t* instr, arch_type_t mode, uint8_t* output, int max_size) {
+    if (instr->operand_count != 2) return ENCODE_ERROR_UNSUPPORTED;
+    
+    operand_t* dst = &instr->operands[0];
+    operand_t* src = &instr->operands[1];
+    x86_encoding_t enc;
+    memset(&enc, 0, sizeof(enc));
+    
+    // MOV reg, imm
+    if (dst->type == OPERAND_REGISTER && src->type == OPERAND_IMMEDIATE) {
+        register_info_t* reg = dst->data.reg.reg_info;
+        if (!reg) return ENCODE_ERROR_UNKNOWN_REGISTER;
+        if (!x86_immediate_fits(src->data.imm.value, reg->size_bits)) return ENCODE_ERROR_IMMEDIATE;
+        
+        enc.operand_size = reg->size_bits;
+        enc.opcode[0] = reg->size_bits == 8 ? 0xB0 : 0xB8;
+        enc.opcode_length = 1;
+        enc.opcode_reg = reg;
+        enc.immediate = src->data.imm.value;
+        enc.immediate_size = reg->size_bits / 8;
+        return x86_emit(instr, &enc, mode, output, max_size);
+    }
+    
+    // MOV r/m, imm
+    if (dst->type == OPERAND_MEMORY && src->type == OPERAND_IMMEDIATE) {
+        int size = dst->data.mem.size_bits;
+        if (!size) return ENCODE_ERROR_OPERAND_SIZE;
+        int imm_size = x86_immediate_size(size);
+        if (!x86_operand_immediate_fits(src->data.imm.value, size)) return ENCODE_ERROR_IMMEDIATE;
+        
+        enc.operand_size = size;
+        enc.opcode[0] = size == 8 ? 0xC6 : 0xC7;
+        enc.opcode_length = 1;
+        x86_set_rm(&enc, dst);
+        enc.immediate = src->data.imm.value;
+        enc.immediate_size = imm_size;
+        return x86_emit(instr, &enc, mode, output, max_size);
+    }
+    
+    // MOV r/m, reg
+    if ((dst->type == OPERAND_REGISTER || dst->type == OPERAND_MEMORY) && src->type == OPERAND_REGISTER) {
+        int size = x86_operand_size(dst, src);
+        if (size < 0) return size;
+        
+        enc.operand_size = size;
+        enc.opcode[0] = size == 8 ? 0x88 : 0x89;
+        enc.opcode_length = 1;
+        enc.reg = src->data.reg.reg_info;
+        x86_set_rm(&enc, dst);
+        return x86_emit(instr, &enc, mode, output, max_size);
+    }
+    
+    // MOV reg, r/m
+    if (dst->type == OPERAND_REGISTER && src->type == OPERAND_MEMORY) {
+        int size = x86_operand_size(dst, src);
+        if (size < 0) return size;
+        
+        enc.operand_size = size;
+        enc.opcode[0] = size == 8 ? 0x8A : 0x8B;
+        enc.opcode_length = 1;
+        enc.reg = dst->data.reg.reg_info;
+        x86_set_rm(&enc, src);
+        return x86_emit(instr, &enc, mode, output, max_size);
+    }
+    
+    return ENCODE_ERROR_UNSUPPORTED; // Unsupported operand combination
+}
+
+// LEA reg, m (8D /r) loads the address itself, so the memory operand's
+// size does not matter
+static int encode_x86_lea(instruction_t* instr, arch_type_t mode, uint8_t* output, int max_size) {
+    if (instr->operand_count != 2) return ENCODE_ERROR_UNSUPPORTED;
+    
+    operand_t* dst = &instr->operands[0];
+    operand_t* src = &instr->operands[1];
+    if (dst->type != OPERAND_REGISTER || src->type != OPERAND_MEMORY) return ENCODE_ERROR_UNSUPPORTED;
+    
+    register_info_t* reg = dst->data.reg.reg_info;
+    if (!reg) return ENCODE_ERROR_UNKNOWN_REGISTER;
+    if (reg->size_bits == 8) return ENCODE_ERROR_OPERAND_SIZE;
+    
+    x86_encoding_t enc;
+    memset(&enc, 0, sizeof(enc));
+    enc.operand_size = reg->size_bits;
+    enc.opcode[0] = 0x8D;
+    enc.opcode_length = 1;
+    enc.reg = reg;
+    x86_set_rm(&enc, src);
+    return x86_emit(instr, &enc, mode, output, max_size);
 }
 
 static int encode_x86_nop(instruction_t* instr, uint8_t* output, int max_size) {
-    if (instr->operand_count != 0) return -1;
-    if (max_size < 1) return -1;
+    if (instr->operand_count != 0) return ENCODE_ERROR_UNSUPPORTED;
+    if (max_size < 1) return ENCODE_ERROR_BUFFER;
     
     output[0] = 0x90;
     return 1;
 }
 
 static int encode_x86_ret(instruction_t* instr, uint8_t* output, int max_size) {
-    if (instr->operand_count != 0) return -1;
-    if (max_size < 1) return -1;
+    if (instr->operand_count != 0) return ENCODE_ERROR_UNSUPPORTED;
+    if (max_size < 1) return ENCODE_ERROR_BUFFER;
     
     output[0] = 0xC3;
     return 1;
 }
 
-static int encode_x86_add(instruction_t* instr, uint8_t* output, int max_size) {
-    if (instr->operand_count != 2) return -1;
+static int encode_x86_hlt(instruction_t* instr, uint8_t* output, int max_size) {
+    if (instr->operand_count != 0) return ENCODE_ERROR_UNSUPPORTED;
+    if (max_size < 1) return ENCODE_ERROR_BUFFER;
     
-    operand_t* dst = &instr->operands[0];
-    operand_t* src = &instr->operands[1];
+    output[0] = 0xF4;
+    return 1;
+}
+
+// SYSCALL (0F 05) only exists in 64-bit mode
+static int encode_x86_syscall(instruction_t* instr, arch_type_t mode, uint8_t* output, int max_size) {
+    if (instr->operand_count != 0 || mode != ARCH_X86_64) return ENCODE_ERROR_UNSUPPORTED;
+    if (max_size < 2) return ENCODE_ERROR_BUFFER;
     
-    // ADD reg, imm
-    if (dst->type == OPERAND_REGISTER && src->type == OPERAND_IMMEDIATE) {
-        if (dst->data.reg.reg_info && dst->data.reg.reg_info->size_bits == 64) {
-            if (max_size < 7) return -1;
-            
-            // REX.W prefix for 64-bit
-            output[0] = 0x48;
-            
-            // ADD r/m64, imm32 opcode
-            output[1] = 0x81;
-            
-            // ModR/M byte: 11 (register mode) + 000 (ADD) + dst_reg
-            output[2] = 0xC0 + dst->data.reg.reg_info->encoding;
-            
-            // Immediate value (little-endian, 32-bit)
-            uint32_t imm = (uint32_t)src->data.imm.value;
-            for (int i = 0; i < 4; i++) {
-                output[3 + i] = (imm >> (i * 8)) & 0xFF;
-            }
-            
-            return 7;
-        }
+    output[0] = 0x0F;
+    output[1] = 0x05;
+    return 2;
+}
+
+// INT imm8 (CD ib)
+static int encode_x86_int(instruction_t* instr, uint8_t* output, int max_size) {
+    if (instr->operand_count != 1 || instr->operands[0].type != OPERAND_IMMEDIATE) {
+        return ENCODE_ERROR_UNSUPPORTED;
     }
+    if (instr->operands[0].data.imm.value > 0xFF) return ENCODE_ERROR_IMMEDIATE;
+    if (max_size < 2) return ENCODE_ERROR_BUFFER;
     
-    return -1; // Unsupported operand combination
+    output[0] = 0xCD;
+    output[1] = (uint8_t)instr->operands[0].data.imm.value;
+    return 2;
 }
 
-static int encode_x86_sub(instruction_t* instr, uint8_t* output, int max_size) {
-    if (instr->operand_count != 2) return -1;
+// Two-operand ALU group (ADD, OR, AND, SUB, XOR, CMP). `group` is the
+// /digit used by the 0x80/0x81 immediate forms; the register forms use
+// opcode group * 8 + {0, 1, 2, 3}.
+static int encode_x86_alu(instruction_t* instr, arch_type_t mode, uint8_t* output, int max_size, uint8_t group) {
+    if (instr->operand_count != 2) return ENCODE_ERROR_UNSUPPORTED;
     
     operand_t* dst = &instr->operands[0];
     operand_t* src = &instr->operands[1];
+    x86_encoding_t enc;
+    memset(&enc, 0, sizeof(enc));
     
-    // SUB reg, imm
-    if (dst->type == OPERAND_REGISTER && src->type == OPERAND_IMMEDIATE) {
-        if (dst->data.reg.reg_info && dst->data.reg.reg_info->size_bits == 64) {
-            if (max_size < 7) return -1;
-            
-            // REX.W prefix for 64-bit
-            output[0] = 0x48;
-            
-            // SUB r/m64, imm32 opcode
-            output[1] = 0x81;
-            
-            // ModR/M byte: 11 (register mode) + 101 (SUB) + dst_reg
-            output[2] = 0xE8 + dst->data.reg.reg_info->encoding;
-            
-            // Immediate value (little-endian, 32-bit)
-            uint32_t imm = (uint32_t)src->data.imm.value;
-            for (int i = 0; i < 4; i++) {
-                output[3 + i] = (imm >> (i * 8)) & 0xFF;
-            }
-            
-            return 7;
-        }
+    // ALU r/m, imm
+    if ((dst->type == OPERAND_REGISTER || dst->type == OPERAND_MEMORY) && src->type == OPERAND_IMMEDIATE) {
+        int size = x86_operand_size(dst, NULL);
+        if (size < 0) return size;
+        int imm_size = x86_immediate_size(size);
+        if (!x86_operand_immediate_fits(src->data.imm.value, size)) return ENCODE_ERROR_IMMEDIATE;
+        
+        enc.operand_size = size;
+        enc.opcode[0] = size == 8 ? 0x80 : 0x81;
+        enc.opcode_length = 1;
+        enc.reg_field = group;
+        x86_set_rm(&enc, dst);
+        enc.immediate = src->data.imm.value;
+        enc.immediate_size = imm_size;
+        return x86_emit(instr, &enc, mode, output, max_size);
+    }
+    
+    // ALU r/m, reg
+    if ((dst->type == OPERAND_REGISTER || dst->type == OPERAND_MEMORY) && src->type == OPERAND_REGISTER) {
+        int size = x86_operand_size(dst, src);
+        if (size < 0) return size;
+        
+        enc.operand_size = size;
+        enc.opcode[0] = (uint8_t)(group * 8 + (size == 8 ? 0x00 : 0x01));
+        enc.opcode_length = 1;
+        enc.reg = src->data.reg.reg_info;
+        x86_set_rm(&enc, dst);
+        return x86_emit(instr, &enc, mode, output, max_size);
+    }
+    
+    // ALU reg, r/m
+    if (dst->type == OPERAND_REGISTER && src->type == OPERAND_MEMORY) {
+        int size = x86_operand_size(dst, src);
+        if (size < 0) return size;
+        
+        enc.operand_size = size;
+        enc.opcode[0] = (uint8_t)(group * 8 + (size == 8 ? 0x02 : 0x03));
+        enc.opcode_length = 1;
+        enc.reg = dst->data.reg.reg_info;
+        x86_set_rm(&enc, src);
+        return x86_emit(instr, &enc, mode, output, max_size);
     }
     
-    return -1; // Unsupported operand combination
+    return ENCODE_ERROR_UNSUPPORTED; // Unsupported operand combination
+}
+
+// SSE / AVX / AVX-512 encoding
+//
+// Each opcode is described once; the legacy SSE form is used for the plain
+// mnemonic, and the 'v'-prefixed mnemonic selects VEX or EVEX. EVEX is only
+// used when the operands need it (zmm, xmm16-31/ymm16-31, masking, zeroing,
+// broadcast) or when the opcode has no VEX form, so the shorter VEX
+// encoding wins whenever it is valid.
+
+#define VEC_SSE         0x0001  // Legacy SSE form (mnemonic without 'v')
+#define VEC_VEX         0x0002  // VEX form
+#define VEC_EVEX        0x0004  // EVEX form
+#define VEC_NDS         0x0008  // VEX/EVEX forms take the first source in vvvv
+#define VEC_W1          0x0010  // W1 in both VEX and EVEX forms
+#define VEC_EVEX_W1     0x0020  // W1 in the EVEX form only (VEX form is WIG)
+#define VEC_ELEM64      0x0040  // 64-bit elements (broadcast and scalar size)
+#define VEC_SCALAR      0x0080  // Scalar operation: Tuple1 Scalar, vector length ignored
+#define VEC_MOVE        0x0100  // Has a store form (r/m, reg) using store_opcode
+#define VEC_BCAST       0x0200  // Full-vector tuple: EVEX embedded broadcast allowed
+#define VEC_IMM8        0x0400  // Trailing imm8 operand
+#define VEC_XMM_SOURCE  0x0800  // r/m source is an xmm register or one element (broadcasts)
+
+typedef struct {
+    const char* name;     // Mnemonic without the 'v' prefix
+    uint8_t pp;           // Mandatory prefix: 0 none, 1 0x66, 2 0xF3, 3 0xF2
+    uint8_t map;          // Opcode map: 1 0F, 2 0F38, 3 0F3A
+    uint8_t opcode;
+    uint8_t store_opcode;
+    uint16_t flags;
+} vector_opcode_t;
+
+#define VEC_ALL (VEC_SSE | VEC_VEX | VEC_EVEX)
+#define VEC_PS  (VEC_ALL | VEC_NDS | VEC_BCAST)
+#define VEC_PD  (VEC_ALL | VEC_NDS | VEC_BCAST | VEC_EVEX_W1 | VEC_ELEM64)
+#define VEC_SS  (VEC_ALL | VEC_NDS | VEC_SCALAR)
+#define VEC_SD  (VEC_ALL | VEC_NDS | VEC_SCALAR | VEC_EVEX_W1 | VEC_ELEM64)
+#define VEC_FMA (VEC_VEX | VEC_EVEX | VEC_NDS | VEC_BCAST)
+
+static const vector_opcode_t vector_opcodes[] = {
+    // Moves
+    {"movaps", 0, 1, 0x28, 0x29, VEC_ALL | VEC_MOVE},
+    {"movups", 0, 1, 0x10, 0x11, VEC_ALL | VEC_MOVE},
+    {"movapd", 1, 1, 0x28, 0x29, VEC_ALL | VEC_MOVE | VEC_EVEX_W1},
+    {"movupd", 1, 1, 0x10, 0x11, VEC_ALL | VEC_MOVE | VEC_EVEX_W1},
+    {"movdqa", 1, 1, 0x6F, 0x7F, VEC_SSE | VEC_VEX | VEC_MOVE},
+    {"movdqu", 2, 1, 0x6F, 0x7F, VEC_SSE | VEC_VEX | VEC_MOVE},
+    {"movdqa32", 1, 1, 0x6F, 0x7F, VEC_EVEX | VEC_MOVE},
+    {"movdqa64", 1, 1, 0x6F, 0x7F, VEC_EVEX | VEC_MOVE | VEC_W1},
+    {"movdqu8", 3, 1, 0x6F, 0x7F, VEC_EVEX | VEC_MOVE},
+    {"movdqu16", 3, 1, 0x6F, 0x7F, VEC_EVEX | VEC_MOVE | VEC_W1},
+    {"movdqu32", 2, 1, 0x6F, 0x7F, VEC_EVEX | VEC_MOVE},
+    {"movdqu64", 2, 1, 0x6F, 0x7F, VEC_EVEX | VEC_MOVE | VEC_W1},
+    
+    // Floating point arithmetic
+    {"addps", 0, 1, 0x58, 0, VEC_PS}, {"addpd", 1, 1, 0x58, 0, VEC_PD},
+    {"addss", 2, 1, 0x58, 0, VEC_SS}, {"addsd", 3, 1, 0x58, 0, VEC_SD},
+    {"subps", 0, 1, 0x5C, 0, VEC_PS}, {"subpd", 1, 1, 0x5C, 0, VEC_PD},
+    {"subss", 2, 1, 0x5C, 0, VEC_SS}, {"subsd", 3, 1, 0x5C, 0, VEC_SD},
+    {"mulps", 0, 1, 0x59, 0, VEC_PS}, {"mulpd", 1, 1, 0x59, 0, VEC_PD},
+    {"mulss", 2, 1, 0x59, 0, VEC_SS}, {"mulsd", 3, 1, 0x59, 0, VEC_SD},
+    {"divps", 0, 1, 0x5E, 0, VEC_PS}, {"divpd", 1, 1, 0x5E, 0, VEC_PD},
+    {"divss", 2, 1, 0x5E, 0, VEC_SS}, {"divsd", 3, 1, 0x5E, 0, VEC_SD},
+    {"minps", 0, 1, 0x5D, 0, VEC_PS}, {"minpd", 1, 1, 0x5D, 0, VEC_PD},
+    {"maxps", 0, 1, 0x5F, 0, VEC_PS}, {"maxpd", 1, 1, 0x5F, 0, VEC_PD},
+    {"andps", 0, 1, 0x54, 0, VEC_PS}, {"andpd", 1, 1, 0x54, 0, VEC_PD},
+    {"orps", 0, 1, 0x56, 0, VEC_PS}, {"orpd", 1, 1, 0x56, 0, VEC_PD},
+    {"xorps", 0, 1, 0x57, 0, VEC_PS}, {"xorpd", 1, 1, 0x57, 0, VEC_PD},
+    {"sqrtps", 0, 1, 0x51, 0, VEC_ALL | VEC_BCAST},
+    {"sqrtpd", 1, 1, 0x51, 0, VEC_ALL | VEC_BCAST | VEC_EVEX_W1 | VEC_ELEM64},
+    {"shufps", 0, 1, 0xC6, 0, VEC_PS | VEC_IMM8},
+    
+    // Integer arithmetic
+    {"paddd", 1, 1, 0xFE, 0, VEC_ALL | VEC_NDS | VEC_BCAST},
+    {"paddq", 1, 1, 0xD4, 0, VEC_ALL | VEC_NDS | VEC_BCAST | VEC_EVEX_W1 | VEC_ELEM64},
+    {"psubd", 1, 1, 0xFA, 0, VEC_ALL | VEC_NDS | VEC_BCAST},
+    {"psubq", 1, 1, 0xFB, 0, VEC_ALL | VEC_NDS | VEC_BCAST | VEC_EVEX_W1 | VEC_ELEM64},
+    {"pmulld", 1, 2, 0x40, 0, VEC_ALL | VEC_NDS | VEC_BCAST},
+    {"pand", 1, 1, 0xDB, 0, VEC_SSE | VEC_VEX | VEC_NDS},
+    {"pandd", 1, 1, 0xDB, 0, VEC_EVEX | VEC_NDS | VEC_BCAST},
+    {"pandq", 1, 1, 0xDB, 0, VEC_EVEX | VEC_NDS | VEC_BCAST | VEC_W1 | VEC_ELEM64},
+    {"por", 1, 1, 0xEB, 0, VEC_SSE | VEC_VEX | VEC_NDS},
+    {"pord", 1, 1, 0xEB, 0, VEC_EVEX | VEC_NDS | VEC_BCAST},
+    {"porq", 1, 1, 0xEB, 0, VEC_EVEX | VEC_NDS | VEC_BCAST | VEC_W1 | VEC_ELEM64},
+    {"pxor", 1, 1, 0xEF, 0, VEC_SSE | VEC_VEX | VEC_NDS},
+    {"pxord", 1, 1, 0xEF, 0, VEC_EVEX | VEC_NDS | VEC_BCAST},
+    {"pxorq", 1, 1, 0xEF, 0, VEC_EVEX | VEC_NDS | VEC_BCAST | VEC_W1 | VEC_ELEM64},
+    {"pshufd", 1, 1, 0x70, 0, VEC_ALL | VEC_BCAST | VEC_IMM8},
+    
+    // Fused multiply-add
+    {"fmadd132ps", 1, 2, 0x98, 0, VEC_FMA}, {"fmadd132pd", 1, 2, 0x98, 0, VEC_FMA | VEC_W1 | VEC_ELEM64},
+    {"fmadd213ps", 1, 2, 0xA8, 0, VEC_FMA}, {"fmadd213pd", 1, 2, 0xA8, 0, VEC_FMA | VEC_W1 | VEC_ELEM64},
+    {"fmadd231ps", 1, 2, 0xB8, 0, VEC_FMA}, {"fmadd231pd", 1, 2, 0xB8, 0, VEC_FMA | VEC_W1 | VEC_ELEM64},
+    
+    // Broadcasts
+    {"broadcastss", 1, 2, 0x18, 0, VEC_VEX | VEC_EVEX | VEC_XMM_SOURCE},
+    {"broadcastsd", 1, 2, 0x19, 0, VEC_VEX | VEC_EVEX | VEC_XMM_SOURCE | VEC_EVEX_W1 | VEC_ELEM64},
+    {"pbroadcastd", 1, 2, 0x58, 0, VEC_VEX | VEC_EVEX | VEC_XMM_SOURCE},
+    {"pbroadcastq", 1, 2, 0x59, 0, VEC_VEX | VEC_EVEX | VEC_XMM_SOURCE | VEC_EVEX_W1 | VEC_ELEM64},
+    
+    {NULL, 0, 0, 0, 0, 0} // Sentinel
+};
+
+// Find the opcode for a vector mnemonic; *vex_form is set for 'v' mnemonics
+static const vector_opcode_t* find_vector_opcode(const char* mnemonic, bool* vex_form) {
+    bool has_v = (mnemonic[0] == 'v' || mnemonic[0] == 'V');
+    
+    for (int i = 0; vector_opcodes[i].name; i++) {
+        const vector_opcode_t* op = &vector_opcodes[i];
+        if (has_v && (op->flags & (VEC_VEX | VEC_EVEX)) && strcasecmp(mnemonic + 1, op->name) == 0) {
+            *vex_form = true;
+            return op;
+        }
+        if ((op->flags & VEC_SSE) && strcasecmp(mnemonic, op->name) == 0) {
+            *vex_form = false;
+            return op;
+        }
+    }
+    return NULL;
+}
+
+static int x86_check_vector_register(register_info_t* reg, arch_type_t mode) {
+    int result = x86_check_register(reg, mode);
+    if (result < 0) return result;
+    if (!(reg->flags & REG_FLAG_VECTOR)) return ENCODE_ERROR_OPERAND_SIZE;
+    return 0;
 }
 
-static int encode_x86_cmp(instruction_t* instr, uint8_t* output, int max_size) {
-    if (instr->operand_count != 2) return -1;
+static int encode_x86_vector(instruction_t* instr, const vector_opcode_t* op, bool vex_form,
+                             arch_type_t mode, uint8_t* output, int max_size) {
+    int count = instr->operand_count;
+    uint64_t imm8 = 0;
     
+    if (op->flags & VEC_IMM8) {
+        if (count < 1 || instr->operands[count - 1].type != OPERAND_IMMEDIATE) return ENCODE_ERROR_UNSUPPORTED;
+        imm8 = instr->operands[count - 1].data.imm.value;
+        if (!x86_immediate_fits(imm8, 8)) return ENCODE_ERROR_IMMEDIATE;
+        count--;
+    }
+    
+    // Assign operands to ModR/M.reg, vvvv and ModR/M.rm
     operand_t* dst = &instr->operands[0];
-    operand_t* src = &instr->operands[1];
+    operand_t* reg_op;
+    operand_t* vvvv_op = NULL;
+    operand_t* rm_op;
+    uint8_t opcode = op->opcode;
+    bool three_operand = vex_form && (op->flags & VEC_NDS);
     
-    // CMP reg, imm
-    if (dst->type == OPERAND_REGISTER && src->type == OPERAND_IMMEDIATE) {
-        if (dst->data.reg.reg_info && dst->data.reg.reg_info->size_bits == 64) {
-            if (max_size < 7) return -1;
-            
-            // REX.W prefix for 64-bit
-            output[0] = 0x48;
-            
-            // CMP r/m64, imm32 opcode
-            output[1] = 0x81;
-            
-            // ModR/M byte: 11 (register mode) + 111 (CMP) + dst_reg
-            output[2] = 0xF8 + dst->data.reg.reg_info->encoding;
-            
-            // Immediate value (little-endian, 32-bit)
-            uint32_t imm = (uint32_t)src->data.imm.value;
-            for (int i = 0; i < 4; i++) {
-                output[3 + i] = (imm >> (i * 8)) & 0xFF;
+    if (count != (three_operand ? 3 : 2)) return ENCODE_ERROR_UNSUPPORTED;
+    
+    if ((op->flags & VEC_MOVE) && dst->type == OPERAND_MEMORY) {
+        reg_op = &instr->operands[1];
+        rm_op = dst;
+        opcode = op->store_opcode;
+    } else {
+        reg_op = dst;
+        vvvv_op = three_operand ? &instr->operands[1] : NULL;
+        rm_op = &instr->operands[three_operand ? 2 : 1];
+    }
+    
+    if (reg_op->type != OPERAND_REGISTER) return ENCODE_ERROR_UNSUPPORTED;
+    if (vvvv_op && vvvv_op->type != OPERAND_REGISTER) return ENCODE_ERROR_UNSUPPORTED;
+    if (rm_op->type != OPERAND_REGISTER && rm_op->type != OPERAND_MEMORY) return ENCODE_ERROR_UNSUPPORTED;
+    
+    register_info_t* reg = reg_op->data.reg.reg_info;
+    register_info_t* vvvv = vvvv_op ? vvvv_op->data.reg.reg_info : NULL;
+    register_info_t* rm_reg = rm_op->type == OPERAND_REGISTER ? rm_op->data.reg.reg_info : NULL;
+    
+    int result = x86_check_vector_register(reg, mode);
+    if (result < 0) return result;
+    if (vvvv_op && (result = x86_check_vector_register(vvvv, mode)) < 0) return result;
+    if (rm_op->type == OPERAND_REGISTER && (result = x86_check_vector_register(rm_reg, mode)) < 0) return result;
+    
+    // Vector length follows the register operands; scalar operations ignore it
+    int vector_length = (op->flags & VEC_SCALAR) ? 128 : reg->size_bits;
+    int element_size = (op->flags & VEC_ELEM64) ? 8 : 4;
+    
+    if (!(op->flags & VEC_SCALAR)) {
+        if (vvvv && vvvv->size_bits != vector_length) return ENCODE_ERROR_OPERAND_SIZE;
+        if (rm_reg && rm_reg->size_bits != ((op->flags & VEC_XMM_SOURCE) ? 128 : vector_length)) {
+            return ENCODE_ERROR_OPERAND_SIZE;
+        }
+    } else if (reg->size_bits != 128 || (vvvv && vvvv->size_bits != 128) ||
+               (rm_reg && rm_reg->size_bits != 128)) {
+        return ENCODE_ERROR_OPERAND_SIZE;
+    }
+    
+    // Decorators: the write mask and zeroing go on the destination,
+    // broadcast on the memory source
+    register_info_t* mask = dst->mask;
+    bool zeroing = dst->zeroing;
+    int broadcast = rm_op->type == OPERAND_MEMORY ? rm_op->broadcast : 0;
+    for (int i = 0; i < instr->operand_count; i++) {
+        operand_t* operand = &instr->operands[i];
+        if ((operand != dst && (operand->mask || operand->zeroing)) ||
+            (operand != rm_op && operand->broadcast) ||
+            (operand->type == OPERAND_REGISTER && operand->broadcast)) {
+            return ENCODE_ERROR_UNSUPPORTED;
+        }
+    }
+    if (mask && (!(mask->flags & REG_FLAG_MASK) || mask->encoding == 0)) {
+        return ENCODE_ERROR_UNSUPPORTED; // k0 means "no mask"
+    }
+    if (zeroing && !mask) return ENCODE_ERROR_UNSUPPORTED;
+    if (zeroing && dst->type == OPERAND_MEMORY) {
+        return ENCODE_ERROR_UNSUPPORTED; // Stores only merge-mask, as in GNU as
+    }
+    if (broadcast) {
+        if (!(op->flags & VEC_BCAST) || broadcast * element_size * 8 != vector_length) {
+            return ENCODE_ERROR_OPERAND_SIZE;
+        }
+    }
+    
+    bool needs_evex = vector_length == 512 || mask || broadcast ||
+                      reg->encoding >= 16 || (vvvv && vvvv->encoding >= 16) ||
+                      (rm_reg && rm_reg->encoding >= 16);
+    
+    enum { FORM_SSE, FORM_VEX, FORM_EVEX } form;
+    if (!vex_form) {
+        if (needs_evex || vector_length != 128) return ENCODE_ERROR_OPERAND_SIZE;
+        form = FORM_SSE;
+    } else if (!needs_evex && (op->flags & VEC_VEX)) {
+        form = FORM_VEX;
+    } else if (op->flags & VEC_EVEX) {
+        form = FORM_EVEX;
+    } else {
+        return ENCODE_ERROR_OPERAND_SIZE;
+    }
+    
+    // Memory operand size N for compressed disp8*N
+    int disp8_scale = 1;
+    if (form == FORM_EVEX) {
+        if (broadcast || (op->flags & (VEC_SCALAR | VEC_XMM_SOURCE))) {
+            disp8_scale = element_size;
+        } else {
+            disp8_scale = vector_length / 8;
+        }
+    }
+    
+    x86_address_t addr;
+    memset(&addr, 0, sizeof(addr));
+    if (rm_op->type == OPERAND_MEMORY) {
+        result = x86_encode_address(rm_op, mode, disp8_scale, &addr);
+        if (result < 0) return result;
+    }
+    
+    uint8_t bytes[15];
+    int length = 0;
+    int reg_bits = reg->encoding;
+    int rm_bits = rm_reg ? rm_reg->encoding : 0;
+    bool rex_r = reg_bits & 8;
+    bool rex_x = rm_reg ? false : (addr.rex & 0x02) != 0;
+    bool rex_b = rm_reg ? (rm_bits & 8) != 0 : (addr.rex & 0x01) != 0;
+    int vvvv_bits = vvvv ? vvvv->encoding : 0;
+    bool w = (op->flags & VEC_W1) || (form == FORM_EVEX && (op->flags & VEC_EVEX_W1));
+    static const uint8_t mandatory_prefixes[4] = {0, 0x66, 0xF3, 0xF2};
+    
+    if (addr.address_prefix) bytes[length++] = 0x67;
+    
+    switch (form) {
+        case FORM_SSE: {
+            if (op->pp) bytes[length++] = mandatory_prefixes[op->pp];
+            uint8_t rex = (rex_r ? 0x04 : 0) | (rex_x ? 0x02 : 0) | (rex_b ? 0x01 : 0);
+            if (rex) {
+                if (mode != ARCH_X86_64) return ENCODE_ERROR_REGISTER_MODE;
+                bytes[length++] = 0x40 | rex;
             }
-            
-            return 7;
+            bytes[length++] = 0x0F;
+            if (op->map == 2) bytes[length++] = 0x38;
+            if (op->map == 3) bytes[length++] = 0x3A;
+            break;
         }
+        
+        case FORM_VEX: {
+            uint8_t l_pp = (uint8_t)((~vvvv_bits & 15) << 3) | (vector_length == 256 ? 0x04 : 0) | op->pp;
+            if (!rex_x && !rex_b && !w && op->map == 1) {
+                bytes[length++] = 0xC5;
+                bytes[length++] = (rex_r ? 0 : 0x80) | l_pp;
+            } else {
+                bytes[length++] = 0xC4;
+                bytes[length++] = (rex_r ? 0 : 0x80) | (rex_x ? 0 : 0x40) | (rex_b ? 0 : 0x20) | op->map;
+                bytes[length++] = (w ? 0x80 : 0) | l_pp;
+            }
+            break;
+        }
+        
+        case FORM_EVEX: {
+            // A register in ModR/M.rm takes its fifth bit from EVEX.X
+            bool rex_x_high = rm_reg ? (rm_bits & 16) != 0 : rex_x;
+            int ll = vector_length == 512 ? 2 : (vector_length == 256 ? 1 : 0);
+            bytes[length++] = 0x62;
+            bytes[length++] = (rex_r ? 0 : 0x80) | (rex_x_high ? 0 : 0x40) | (rex_b ? 0 : 0x20) |
+                              ((reg_bits & 16) ? 0 : 0x10) | op->map;
+            bytes[length++] = (w ? 0x80 : 0) | (uint8_t)((~vvvv_bits & 15) << 3) | 0x04 | op->pp;
+            bytes[length++] = (zeroing ? 0x80 : 0) | (uint8_t)(ll << 5) | (broadcast ? 0x10 : 0) |
+                              ((vvvv_bits & 16) ? 0 : 0x08) | (mask ? (mask->encoding & 7) : 0);
+            break;
+        }
+    }
+    
+    if (form != FORM_SSE && mode != ARCH_X86_64 && (rex_r || rex_x || rex_b)) {
+        return ENCODE_ERROR_REGISTER_MODE;
     }
     
-    return -1; // Unsupported operand combination
+    bytes[length++] = opcode;
+    
+    if (rm_op->type == OPERAND_MEMORY) {
+        bytes[length++] = addr.modrm | (uint8_t)((reg_bits & 7) << 3);
+        if (addr.has_sib) bytes[length++] = addr.sib;
+        x86_set_address_fixup(instr, rm_op, &addr, length);
+        for (int i = 0; i < addr.displacement_size; i++) {
+            bytes[length++] = (uint8_t)((uint64_t)addr.displacement >> (i * 8));
+        }
+    } else {
+        bytes[length++] = 0xC0 | (uint8_t)((reg_bits & 7) << 3) | (rm_bits & 7);
+    }
+    
+    if (op->flags & VEC_IMM8) bytes[length++] = (uint8_t)imm8;
+    
+    if (length > max_size) return ENCODE_ERROR_BUFFER;
+    memcpy(output, bytes, length);
+    return length;
+}
+
+// Size of a near branch displacement: rel16 in 16-bit mode, rel32 otherwise
+static int x86_branch_displacement_size(arch_type_t mode) {
+    return mode == ARCH_X86_16 ? 2 : 4;
 }
 
-static int encode_x86_jmp(instruction_t* instr, uint8_t* output, int max_size) {
-    if (instr->operand_count != 1) return -1;
+static int encode_x86_jmp(instruction_t* instr, arch_type_t mode, uint8_t* output, int max_size) {
+    if (instr->operand_count != 1) return ENCODE_ERROR_UNSUPPORTED;
     
     operand_t* target = &instr->operands[0];
     
-    // JMP rel32 (placeholder - actual offset calculation needed)
+    // JMP rel16/rel32 (placeholder - actual offset calculation needed)
     if (target->type == OPERAND_LABEL) {
-        if (max_size < 5) return -1;
+        int disp_size = x86_branch_displacement_size(mode);
+        if (max_size < 1 + disp_size) return ENCODE_ERROR_BUFFER;
         
-        output[0] = 0xE9;  // JMP rel32 opcode
+        output[0] = 0xE9;  // JMP rel opcode
         
-        // Placeholder offset - this should be filled in during linking
-        output[1] = 0x00;
-        output[2] = 0x00;
-        output[3] = 0x00;
-        output[4] = 0x00;
+        // Placeholder offset, patched during label resolution
+        memset(output + 1, 0, disp_size);
+        instr->fixup_kind = FIXUP_RELATIVE;
+        instr->fixup_offset = 1;
+        instr->fixup_size = disp_size;
+        instr->fixup_label = target->data.label.name;
         
-        return 5;
+        return 1 + disp_size;
     }
     
-    return -1;
+    return ENCODE_ERROR_UNSUPPORTED;
 }
 
-static int encode_x86_conditional_jump(instruction_t* instr, uint8_t* output, int max_size, uint8_t opcode) {
-    if (instr->operand_count != 1) return -1;
+static int encode_x86_conditional_jump(instruction_t* instr, arch_type_t mode, uint8_t* output, int max_size, uint8_t opcode) {
+    if (instr->operand_count != 1) return ENCODE_ERROR_UNSUPPORTED;
     
     operand_t* target = &instr->operands[0];
     
-    // Conditional jump rel32 (placeholder)
+    // Conditional jump rel16/rel32 (placeholder)
     if (target->type == OPERAND_LABEL) {
-        if (max_size < 6) return -1;
+        int disp_size = x86_branch_displacement_size(mode);
+        if (max_size < 2 + disp_size) return ENCODE_ERROR_BUFFER;
         
         output[0] = 0x0F;    // Two-byte opcode prefix
         output[1] = opcode;  // Conditional jump opcode
         
-        // Placeholder offset
-        output[2] = 0x00;
-        output[3] = 0x00;
-        output[4] = 0x00;
-        output[5] = 0x00;
+        // Placeholder offset, patched during label resolution
+        memset(output + 2, 0, disp_size);
+        instr->fixup_kind = FIXUP_RELATIVE;
+        instr->fixup_offset = 2;
+        instr->fixup_size = disp_size;
+        instr->fixup_label = target->data.label.name;
         
-        return 6;
+        return 2 + disp_size;
     }
     
+    return ENCODE_ERROR_UNSUPPORTED;
+}
+
+// Conditional jump mnemonics and their 0x0F 0x8x opcodes
+static const struct {
+    const char* mnemonic;
+    uint8_t opcode;
+} x86_condition_codes[] = {
+    {"jo", 0x80}, {"jno", 0x81}, {"jb", 0x82}, {"jc", 0x82}, {"jae", 0x83}, {"jnc", 0x83},
+    {"je", 0x84}, {"jz", 0x84}, {"jne", 0x85}, {"jnz", 0x85}, {"jbe", 0x86}, {"ja", 0x87},
+    {"js", 0x88}, {"jns", 0x89}, {"jl", 0x8C}, {"jge", 0x8D}, {"jle", 0x8E}, {"jg", 0x8F},
+    {NULL, 0}
+};
+
+bool instruction_is_branch(const instruction_t* instr) {
+    if (!instr) return false;
+    
+    return strcasecmp(instr->mnemonic, "jmp") == 0 ||
+           strcasecmp(instr->mnemonic, "call") == 0 ||
+           strcasecmp(instr->mnemonic, "ret") == 0 ||
+           instruction_condition_code(instr) >= 0;
+}
+
+// Condition code (low nibble of the 0x0F 0x8x opcode) of a conditional
+// jump, or -1 for anything else
+int instruction_condition_code(const instruction_t* instr) {
+    if (!instr) return -1;
+    
+    for (int i = 0; x86_condition_codes[i].mnemonic; i++) {
+        if (strcasecmp(instr->mnemonic, x86_condition_codes[i].mnemonic) == 0) {
+            return x86_condition_codes[i].opcode & 0x0F;
+        }
+    }
     return -1;
 }
 
+// Turn a conditional jump into the opposite one (je <-> jne, jl <-> jge,
+// ...): condition codes come in pairs that differ in the low bit. False for
+// anything else.
+bool instruction_invert_condition(instruction_t* instr) {
+    int cc = instruction_condition_code(instr);
+    if (cc < 0) return false;
+    
+    for (int i = 0; x86_condition_codes[i].mnemonic; i++) {
+        if ((x86_condition_codes[i].opcode & 0x0F) == (cc ^ 1)) {
+            char* mnemonic = instruction_strdup(instr, x86_condition_codes[i].mnemonic);
+            if (!mnemonic) return false;
+            instruction_free_string(instr, instr->mnemonic);
+            instr->mnemonic = mnemonic;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Mnemonics encode_instruction dispatches on besides the conditional jumps
+// and vector forms; keep in step with it
+static const char* const x86_basic_mnemonics[] = {
+    "mov", "add", "or", "and", "sub", "xor", "cmp", "lea", "jmp", "nop",
+    "ret", "hlt", "syscall", "int", NULL
+};
+
+// False when encode_instruction would write a NOP placeholder for instr
+bool instruction_has_encoder(const instruction_t* instr, arch_type_t arch) {
+    if (!instr || arch == ARCH_ARM_32 || arch == ARCH_ARM_64) return false;
+    
+    for (int i = 0; x86_basic_mnemonics[i]; i++) {
+        if (strcasecmp(instr->mnemonic, x86_basic_mnemonics[i]) == 0) return true;
+    }
+    bool vex_form;
+    return instruction_condition_code(instr) >= 0 || find_vector_opcode(instr->mnemonic, &vex_form);
+}
+
 int encode_instruction(instruction_t* instr, arch_type_t arch, uint8_t* output, int max_size) {
-    if (!instr || !output || max_size <= 0) return -1;
+    if (!instr || !output || max_size <= 0) return ENCODE_ERROR_BUFFER;
+    
+    instr->fixup_kind = FIXUP_NONE;
+    instr->fixup_addend = 0;
     
     switch (arch) {
         case ARCH_X86_16:
@@ -443,49 +1495,64 @@ int encode_instruction(instruction_t* instr, arch_type_t arch, uint8_t* output,
         case ARCH_X86_64:
             // Basic x86 instruction encoding
             if (strcasecmp(instr->mnemonic, "mov") == 0) {
-                return encode_x86_mov(instr, output, max_size);
+                return encode_x86_mov(instr, arch, output, max_size);
             } else if (strcasecmp(instr->mnemonic, "add") == 0) {
-                return encode_x86_add(instr, output, max_size);
+                return encode_x86_alu(instr, arch, output, max_size, 0);
+            } else if (strcasecmp(instr->mnemonic, "or") == 0) {
+                return encode_x86_alu(instr, arch, output, max_size, 1);
+            } else if (strcasecmp(instr->mnemonic, "and") == 0) {
+                return encode_x86_alu(instr, arch, output, max_size, 4);
             } else if (strcasecmp(instr->mnemonic, "sub") == 0) {
-                return encode_x86_sub(instr, output, max_size);
+                return encode_x86_alu(instr, arch, output, max_size, 5);
+            } else if (strcasecmp(instr->mnemonic, "xor") == 0) {
+                return encode_x86_alu(instr, arch, output, max_size, 6);
             } else if (strcasecmp(instr->mnemonic, "cmp") == 0) {
-                return encode_x86_cmp(instr, output, max_size);
+                return encode_x86_alu(instr, arch, output, max_size, 7);
+            } else if (strcasecmp(instr->mnemonic, "lea") == 0) {
+                return encode_x86_lea(instr, arch, output, max_size);
             } else if (strcasecmp(instr->mnemonic, "jmp") == 0) {
-                return encode_x86_jmp(instr, output, max_size);
-            } else if (strcasecmp(instr->mnemonic, "je") == 0 || strcasecmp(instr->mnemonic, "jz") == 0) {
-                return encode_x86_conditional_jump(instr, output, max_size, 0x84);
-            } else if (strcasecmp(instr->mnemonic, "jne") == 0 || strcasecmp(instr->mnemonic, "jnz") == 0) {
-                return encode_x86_conditional_jump(instr, output, max_size, 0x85);
-            } else if (strcasecmp(instr->mnemonic, "jl") == 0) {
-                return encode_x86_conditional_jump(instr, output, max_size, 0x8C);
-            } else if (strcasecmp(instr->mnemonic, "jle") == 0) {
-                return encode_x86_conditional_jump(instr, output, max_size, 0x8E);
-            } else if (strcasecmp(instr->mnemonic, "jg") == 0) {
-                return encode_x86_conditional_jump(instr, output, max_size, 0x8F);
-            } else if (strcasecmp(instr->mnemonic, "jge") == 0) {
-                return encode_x86_conditional_jump(instr, output, max_size, 0x8D);
+                return encode_x86_jmp(instr, arch, output, max_size);
             } else if (strcasecmp(instr->mnemonic, "nop") == 0) {
                 return encode_x86_nop(instr, output, max_size);
             } else if (strcasecmp(instr->mnemonic, "ret") == 0) {
                 return encode_x86_ret(instr, output, max_size);
-            } else {
-                // Unsupported instruction - output NOP as placeholder
-                if (max_size >= 1) {
-                    output[0] = 0x90;
-                    return 1;
+            } else if (strcasecmp(instr->mnemonic, "hlt") == 0) {
+                return encode_x86_hlt(instr, output, max_size);
+            } else if (strcasecmp(instr->mnemonic, "syscall") == 0) {
+                return encode_x86_syscall(instr, arch, output, max_size);
+            } else if (strcasecmp(instr->mnemonic, "int") == 0) {
+                return encode_x86_int(instr, output, max_size);
+            }
+            
+            for (int i = 0; x86_condition_codes[i].mnemonic; i++) {
+                if (strcasecmp(instr->mnemonic, x86_condition_codes[i].mnemonic) == 0) {
+                    return encode_x86_conditional_jump(instr, arch, output, max_size,
+                                                       x86_condition_codes[i].opcode);
                 }
-                return -1;
             }
-            break;
+            
+            bool vex_form;
+            const vector_opcode_t* vector_op = find_vector_opcode(instr->mnemonic, &vex_form);
+            if (vector_op) {
+                return encode_x86_vector(instr, vector_op, vex_form, arch, output, max_size);
+            }
+            
+            // Unsupported instruction - output NOP as placeholder (see
+            // instruction_has_encoder)
+            if (max_size >= 1) {
+                output[0] = 0x90;
+                return 1;
+            }
+            return ENCODE_ERROR_BUFFER;
             
         case ARCH_ARM_32:
         case ARCH_ARM_64:
             // TODO: Implement ARM instruction encoding
-            return -1;
+            return ENCODE_ERROR_UNSUPPORTED;
             
         default:
-            return -1;
+            return ENCODE_ERROR_UNSUPPORTED;
     }
     
-    return -1;
+    return ENCODE_ERROR_UNSUPPORTED;
 } 
\ No newline at end of file
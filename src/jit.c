@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "../include/jit.h"
+#include "../include/rodata.h"
+
+// In-memory loader for --run. Addresses are fixed before layout: the
+// mapping is reserved first, sized for the worst-case branch padding, and
+// its address becomes the PLACEMENT_MEMORY image base.
+
+static size_t page_align(size_t size) {
+    return (size + LAYOUT_PAGE_SIZE - 1) & ~(size_t)(LAYOUT_PAGE_SIZE - 1);
+}
+
+// Code is only run on the architecture it was assembled for
+bool jit_supports_arch(arch_type_t arch) {
+#if defined(__x86_64__)
+    return arch == ARCH_X86_64;
+#elif defined(__i386__)
+    return arch == ARCH_X86_32;
+#elif defined(__aarch64__)
+    return arch == ARCH_ARM_64;
+#else
+    (void)arch;
+    return false;
+#endif
+}
+
+int jit_reserve(jit_image_t* image, const program_t* program, const layout_options_t* layout) {
+    size_t code_size = program->code_size;
+    if (layout->align_branches) {
+        // Each instruction gains less than one boundary's worth of padding
+        code_size += (size_t)program->instruction_count * layout->branch_boundary;
+    }
+    
+    if (program->rodata_size) {
+        code_size += RODATA_MAX_ALIGNMENT + program->rodata_size;
+    }
+    
+    memset(image, 0, sizeof(*image));
+    image->size = page_align(code_size ? code_size : 1) + page_align(program->data_size + 16 + program->bss_size);
+    
+    void* memory = mmap(NULL, image->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map %zu bytes for the program: %s\n", image->size, strerror(errno));
+        image->size = 0;
+        return -1;
+    }
+    image->memory = memory;
+    return 0;
+}
+
+// Copy the laid-out sections into the reservation and seal .text and
+// .rodata. The entry point is _start, or the start of .text.
+int jit_load(jit_image_t* image, const program_t* program) {
+    uint64_t base = (uint64_t)(uintptr_t)image->memory;
+    uint64_t text = program->section_base[SECTION_TEXT];
+    uint64_t data = program->section_base[SECTION_DATA];
+    
+    if (text != base || data + program->data_size > base + image->size ||
+        program->section_base[SECTION_BSS] + program->bss_size > base + image->size) {
+        fprintf(stderr, "Error: Program does not fit its memory reservation\n");
+        return -1;
+    }
+    
+    memcpy(image->memory, program->code, program->code_size);
+    if (program->rodata_size) {
+        memcpy(image->memory + (program->section_base[SECTION_RODATA] - base), program->rodata,
+               program->rodata_size);
+    }
+    memcpy(image->memory + (data - base), program->data_section, program->data_size);
+    
+    if (mprotect(image->memory, data - base, PROT_READ | PROT_EXEC) != 0) {
+        fprintf(stderr, "Error: Cannot make code executable: %s\n", strerror(errno));
+        return -1;
+    }
+    __builtin___clear_cache((char*)image->memory, (char*)image->memory + program->code_size);
+    
+    symbol_t* entry = symbol_table_lookup(program->symbols, "_start");
+    if (entry && entry->defined && entry->section == SECTION_TEXT) {
+        image->entry = entry->address;
+    } else {
+        image->entry = text;
+    }
+    return 0;
+}
+
+// Call the entry point as `int entry(void)`. Code that exits through a
+// system call never returns here.
+int jit_call(const jit_image_t* image) {
+    int (*entry)(void) = (int (*)(void))(uintptr_t)image->entry;
+    return entry();
+}
+
+void jit_release(jit_image_t* image) {
+    if (image->memory) {
+        munmap(image->memory, image->size);
+    }
+    memset(image, 0, sizeof(*image));
+}
@@ -0,0 +1,430 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "../include/layout.h"
+#include "../include/rodata.h"
+
+#define MAX_INSTRUCTION_LENGTH 15
+#define FLAT_SECTION_ALIGNMENT 4
+
+// Where an instruction ends up after branch padding
+typedef struct {
+    uint64_t new_address;   // Start of the instruction, including added prefixes
+    int nop_padding;        // NOP bytes inserted in front of the instruction
+    int prefix_padding;     // Redundant prefixes added to the instruction
+} placement_t;
+
+// Recommended multi-byte NOPs (Intel SDM, "NOP" instruction)
+static const uint8_t nop_sequences[9][9] = {
+    {0x90},
+    {0x66, 0x90},
+    {0x0F, 0x1F, 0x00},
+    {0x0F, 0x1F, 0x40, 0x00},
+    {0x0F, 0x1F, 0x44, 0x00, 0x00},
+    {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+    {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+    {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00}
+};
+
+void layout_options_init(layout_options_t* options) {
+    options->align_branches = false;
+    options->branch_boundary = 32;
+    options->max_prefix_padding = 5;
+    options->placement = PLACEMENT_FLAT;
+    options->image_base = 0;
+    options->text_alignment = LAYOUT_PAGE_SIZE;
+}
+
+static void write_nops(uint8_t* output, int count, arch_type_t arch) {
+    while (count > 0) {
+        // Multi-byte NOPs assume 32/64-bit ModR/M decoding
+        int length = arch == ARCH_X86_16 ? 1 : (count > 9 ? 9 : count);
+        memcpy(output, nop_sequences[length - 1], length);
+        output += length;
+        count -= length;
+    }
+}
+
+// Macro-fusion rules for Skylake-derived cores: CMP/ADD/SUB fuse with
+// carry, zero, unsigned and signed comparisons; INC/DEC only with zero and
+// signed comparisons; TEST/AND with every condition.
+static bool can_macro_fuse(const instruction_t* head, const instruction_t* jcc) {
+    int cc = instruction_condition_code(jcc);
+    if (cc < 0 || head->operand_count == 0) return false;
+    
+    // Memory-immediate forms do not fuse
+    if (head->operand_count == 2 && head->operands[0].type == OPERAND_MEMORY &&
+        head->operands[1].type == OPERAND_IMMEDIATE) {
+        return false;
+    }
+    
+    bool unsigned_compare = cc >= 0x2 && cc <= 0x7; // jb/jae/je/jne/jbe/ja
+    bool signed_compare = cc >= 0xC;                // jl/jge/jle/jg
+    
+    if (strcasecmp(head->mnemonic, "test") == 0 || strcasecmp(head->mnemonic, "and") == 0) {
+        return true;
+    }
+    if (strcasecmp(head->mnemonic, "cmp") == 0 || strcasecmp(head->mnemonic, "add") == 0 ||
+        strcasecmp(head->mnemonic, "sub") == 0) {
+        return unsigned_compare || signed_compare;
+    }
+    if (strcasecmp(head->mnemonic, "inc") == 0 || strcasecmp(head->mnemonic, "dec") == 0) {
+        return cc == 0x4 || cc == 0x5 || signed_compare;
+    }
+    return false;
+}
+
+// Bytes that must stay within one boundary window starting at instruction
+// `i`: a branch, or a macro-fused pair ending in a conditional branch.
+// Returns 0 when instruction `i` starts no such group.
+static int branch_group_size(program_t* program, int i) {
+    instruction_t* instr = program->instructions[i];
+    
+    if (i + 1 < program->instruction_count) {
+        instruction_t* next = program->instructions[i + 1];
+        if (next->address == instr->address + instr->size && can_macro_fuse(instr, next)) {
+            return instr->size + next->size;
+        }
+    }
+    
+    return instruction_is_branch(instr) ? instr->size : 0;
+}
+
+static bool crosses_boundary(uint64_t start, int size, int boundary) {
+    uint64_t end = start + size;
+    return start / boundary != (end - 1) / boundary || end % boundary == 0;
+}
+
+// Redundant segment prefixes are only harmless in 64-bit mode or on
+// instructions without a memory operand.
+static bool can_prefix_pad(instruction_t* instr, int padding, arch_type_t arch,
+                           const layout_options_t* options) {
+    if (padding > options->max_prefix_padding) return false;
+    if (instr->size + padding > MAX_INSTRUCTION_LENGTH) return false;
+    if (instruction_is_branch(instr)) return false;
+    
+    if (arch != ARCH_X86_64) {
+        for (int i = 0; i < instr->operand_count; i++) {
+            if (instr->operands[i].type == OPERAND_MEMORY) return false;
+        }
+    }
+    return true;
+}
+
+// New address of an old code offset: a label at an instruction start moves
+// to the start of any NOP padding, everything else moves with the
+// instruction (or gap) that contains it.
+static uint64_t map_address(program_t* program, placement_t* placements, uint64_t address) {
+    int low = 0;
+    int high = program->instruction_count - 1;
+    int found = -1;
+    
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (program->instructions[mid]->address <= address) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    
+    if (found < 0) return address;
+    
+    instruction_t* instr = program->instructions[found];
+    placement_t* place = &placements[found];
+    if (address == instr->address) {
+        return place->new_address - place->nop_padding;
+    }
+    return place->new_address + place->prefix_padding + (address - instr->address);
+}
+
+typedef struct {
+    program_t* program;
+    placement_t* placements;
+} symbol_remap_t;
+
+static void remap_symbol(symbol_t* symbol, void* context) {
+    symbol_remap_t* remap = context;
+    
+    if (symbol->type == SYMBOL_LABEL && symbol->defined && symbol->section == SECTION_TEXT) {
+        symbol->address = map_address(remap->program, remap->placements, symbol->address);
+    }
+}
+
+// JCC erratum mitigation: make sure no jump, and no macro-fused cmp+jcc
+// pair, crosses or ends on a branch_boundary. Padding goes in front of the
+// group, so fused pairs stay adjacent, either as segment prefixes on the
+// preceding instruction or as NOPs.
+static int align_branches(program_t* program, arch_type_t arch, const layout_options_t* options) {
+    int count = program->instruction_count;
+    if (count == 0) return 0;
+    
+    placement_t* placements = calloc(count, sizeof(placement_t));
+    if (!placements) {
+        fprintf(stderr, "Error: Out of memory during layout\n");
+        return -1;
+    }
+    
+    int boundary = options->branch_boundary;
+    uint64_t position = program->instructions[0]->address;
+    uint64_t old_end = position;
+    size_t added = 0;
+    
+    for (int i = 0; i < count; i++) {
+        instruction_t* instr = program->instructions[i];
+        position += instr->address - old_end; // Bytes between instructions move along
+        
+        int group = branch_group_size(program, i);
+        if (group > 0 && group <= boundary && crosses_boundary(position, group, boundary)) {
+            int padding = boundary - (int)(position % boundary);
+            instruction_t* previous = i > 0 ? program->instructions[i - 1] : NULL;
+            
+            if (previous && placements[i - 1].prefix_padding == 0 &&
+                can_prefix_pad(previous, padding, arch, options)) {
+                placements[i - 1].prefix_padding = padding;
+            } else {
+                placements[i].nop_padding = padding;
+            }
+            position += padding;
+            added += padding;
+        }
+        
+        placements[i].new_address = position;
+        position += instr->size;
+        old_end = instr->address + instr->size;
+    }
+    
+    if (added == 0) {
+        free(placements);
+        return 0;
+    }
+    
+    size_t new_size = program->code_size + added;
+    uint8_t* code = malloc(new_size ? new_size : 1);
+    if (!code) {
+        free(placements);
+        fprintf(stderr, "Error: Out of memory during layout\n");
+        return -1;
+    }
+    
+    // Copy everything in front of the first instruction unchanged
+    uint64_t first = program->instructions[0]->address;
+    memcpy(code, program->code, first);
+    
+    uint8_t segment_prefix = arch == ARCH_X86_64 ? 0x2E : 0x3E;
+    for (int i = 0; i < count; i++) {
+        instruction_t* instr = program->instructions[i];
+        placement_t* place = &placements[i];
+        uint64_t old_next = i + 1 < count ? program->instructions[i + 1]->address : program->code_size;
+        uint8_t* out = code + place->new_address;
+        
+        write_nops(out - place->nop_padding, place->nop_padding, arch);
+        memset(out, segment_prefix, place->prefix_padding);
+        
+        // The instruction and the bytes up to the next one
+        memcpy(out + place->prefix_padding, program->code + instr->address, old_next - instr->address);
+    }
+    
+    // Labels and fixups move with the code
+    symbol_remap_t remap = {program, placements};
+    symbol_table_foreach(program->symbols, remap_symbol, &remap);
+    for (int i = 0; i < program->fixup_count; i++) {
+        program->fixups[i].offset = map_address(program, placements, program->fixups[i].offset);
+    }
+    if (program->cold_start) {
+        program->cold_start = map_address(program, placements, program->cold_start);
+    }
+    for (int i = 0; i < program->text_distance_count; i++) {
+        text_distance_t* distance = &program->text_distances[i];
+        distance->from = map_address(program, placements, distance->from);
+        distance->to = map_address(program, placements, distance->to);
+    }
+    
+    for (int i = 0; i < count; i++) {
+        program->instructions[i]->address = placements[i].new_address;
+        program->instructions[i]->size += placements[i].prefix_padding;
+    }
+    
+    free(program->code);
+    program->code = code;
+    program->code_size = new_size;
+    program->code_capacity = new_size;
+    
+    free(placements);
+    return layout_check_text_distances(program, "--align-branches");
+}
+
+// A .text distance folded while parsing is in the code already; a pass
+// that changed it has made the output wrong
+int layout_check_text_distances(const program_t* program, const char* pass) {
+    for (int i = 0; i < program->text_distance_count; i++) {
+        const text_distance_t* distance = &program->text_distances[i];
+        int64_t now = (int64_t)(distance->to - distance->from);
+        if (now != distance->distance) {
+            fprintf(stderr, "Error: Line %d: %s moved code inside a .text address difference, "
+                    "folded as %lld bytes while parsing but now %lld\n", distance->line, pass,
+                    (long long)distance->distance, (long long)now);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Whether value fits a size-byte field of this kind
+bool fixup_value_fits(int64_t value, int size, fixup_kind_t kind) {
+    if (size >= 8) return true;
+    
+    int64_t min = -((int64_t)1 << (size * 8 - 1));
+    int64_t max = kind == FIXUP_RELATIVE ? -min - 1 : ((int64_t)1 << (size * 8)) - 1;
+    return value >= min && value <= max;
+}
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// At least the given alignment, or more if an align directive asked for it
+static uint64_t section_alignment(const program_t* program, int section, uint64_t alignment) {
+    return program->section_alignment[section] > alignment ? program->section_alignment[section] : alignment;
+}
+
+// .rodata right behind .text, aligned for its constants; returns where the
+// bytes after it may start
+static uint64_t place_rodata(program_t* program, uint64_t text_end) {
+    uint64_t* base = program->section_base;
+    
+    base[SECTION_RODATA] = program->rodata_size ?
+        align_up(text_end, section_alignment(program, SECTION_RODATA, RODATA_MAX_ALIGNMENT)) : text_end;
+    return base[SECTION_RODATA] + program->rodata_size;
+}
+
+// Assign the load address of every section
+void layout_place_sections(program_t* program, const layout_options_t* options) {
+    uint64_t* base = program->section_base;
+    
+    switch (options->placement) {
+        case PLACEMENT_RELOCATABLE:
+            base[SECTION_TEXT] = base[SECTION_DATA] = base[SECTION_BSS] = base[SECTION_RODATA] = 0;
+            break;
+            
+        case PLACEMENT_FLAT:
+            // .rodata follows .text, then .data and .bss
+            base[SECTION_TEXT] = 0;
+            base[SECTION_DATA] = align_up(place_rodata(program, program->code_size),
+                                          section_alignment(program, SECTION_DATA, FLAT_SECTION_ALIGNMENT));
+            base[SECTION_BSS] = align_up(base[SECTION_DATA] + program->data_size,
+                                         section_alignment(program, SECTION_BSS, FLAT_SECTION_ALIGNMENT));
+            break;
+            
+        case PLACEMENT_EXECUTABLE:
+            // Headers fill the first page (or huge page), .text starts on the
+            // next one with .rodata behind it in the same segment, .data on
+            // the page after that with .bss right behind it.
+            // Addresses equal image_base + file offset, so every segment keeps
+            // its file offset congruent to its address.
+            base[SECTION_TEXT] = options->image_base + options->text_alignment;
+            base[SECTION_DATA] = align_up(place_rodata(program, base[SECTION_TEXT] + program->code_size),
+                                          LAYOUT_PAGE_SIZE);
+            base[SECTION_BSS] = align_up(base[SECTION_DATA] + program->data_size,
+                                         section_alignment(program, SECTION_BSS, 16));
+            break;
+            
+        case PLACEMENT_MEMORY:
+            // Separate pages so .text and .rodata can be made read-only and
+            // executable
+            base[SECTION_TEXT] = options->image_base;
+            base[SECTION_DATA] = align_up(place_rodata(program, base[SECTION_TEXT] + program->code_size),
+                                          LAYOUT_PAGE_SIZE);
+            base[SECTION_BSS] = align_up(base[SECTION_DATA] + program->data_size,
+                                         section_alignment(program, SECTION_BSS, 16));
+            break;
+    }
+}
+
+// Whether two .text offsets lie on different sides of program->cold_start
+static bool crosses_cold_split(const program_t* program, uint64_t a, uint64_t b) {
+    return program->cold_start && (a >= program->cold_start) != (b >= program->cold_start);
+}
+
+static void rebase_symbol(symbol_t* symbol, void* context) {
+    const program_t* program = context;
+    
+    if (symbol->defined && symbol->type == SYMBOL_LABEL) {
+        symbol->address += program->section_base[symbol->section];
+    }
+}
+
+// Patch every label reference in the code section. With `relocatable`,
+// references the linker has to finish (extern symbols, absolute addresses,
+// other sections, jumps between .text and .text.cold) are left unresolved
+// for the object writer.
+int resolve_labels(program_t* program, bool relocatable) {
+    for (int i = 0; i < program->fixup_count; i++) {
+        fixup_t* fixup = &program->fixups[i];
+        symbol_t* symbol = symbol_table_lookup(program->symbols, fixup->label);
+        
+        if (symbol && symbol->binding == SYMBOL_EXTERN) {
+            if (!relocatable) {
+                fprintf(stderr, "Error: Line %d: External symbol '%s' needs a relocatable output format\n",
+                        fixup->line, fixup->label);
+                return -1;
+            }
+            continue;
+        }
+        
+        if (!symbol || !symbol->defined) {
+            fprintf(stderr, "Error: Line %d: Undefined label '%s'\n", fixup->line, fixup->label);
+            return -1;
+        }
+        
+        if (relocatable && symbol->type == SYMBOL_LABEL &&
+            (fixup->kind == FIXUP_ABSOLUTE || symbol->section != SECTION_TEXT ||
+             crosses_cold_split(program, fixup->offset, symbol->address))) {
+            continue;
+        }
+        
+        int64_t value = (int64_t)symbol->address + fixup->addend;
+        if (fixup->kind == FIXUP_RELATIVE) {
+            value -= (int64_t)(program->section_base[SECTION_TEXT] + fixup->offset);
+        }
+        
+        if (!fixup_value_fits(value, fixup->size, fixup->kind)) {
+            fprintf(stderr, "Error: Line %d: Label '%s' out of range\n", fixup->line, fixup->label);
+            return -1;
+        }
+        
+        for (int b = 0; b < fixup->size; b++) {
+            program->code[fixup->offset + b] = (uint8_t)((uint64_t)value >> (b * 8));
+        }
+        fixup->resolved = true;
+    }
+    
+    return 0;
+}
+
+// Final code layout: optional branch alignment, section placement, then
+// label resolution
+int layout_program(program_t* program, arch_type_t arch, const layout_options_t* options) {
+    layout_options_t defaults;
+    if (!options) {
+        layout_options_init(&defaults);
+        options = &defaults;
+    }
+    
+    if (options->align_branches && program->instruction_count > 0) {
+        if (align_branches(program, arch, options) != 0) {
+            return -1;
+        }
+    }
+    
+    layout_place_sections(program, options);
+    if (options->placement != PLACEMENT_RELOCATABLE) {
+        symbol_table_foreach(program->symbols, rebase_symbol, program);
+    }
+    
+    return resolve_labels(program, options->placement == PLACEMENT_RELOCATABLE);
+}
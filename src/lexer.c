@@ -7,7 +7,7 @@
 #include <stdint.h>
 #include "../include/lexer.h"
 
-#define BUFFER_SIZE 4096
+#define BUFFER_SIZE 65536
 
 // x86/x64 registers
 static const char* x86_registers[] = {
@@ -48,8 +48,28 @@ static const char* x86_instructions[] = {
     "jb", "jbe", "js", "jns", "jo", "jno", "jc", "jnc",
     "cmp", "test", "and", "or", "xor", "not", "shl",
     "shr", "sal", "sar", "rol", "ror", "rcl", "rcr",
-    "lea", "nop", "int", "iret", "hlt", "cli", "sti",
+    "lea", "nop", "int", "iret", "hlt", "cli", "sti", "syscall",
     "loop", "loope", "loopz", "loopne", "loopnz",
+    
+    // SSE
+    "movaps", "movups", "movapd", "movupd", "movdqa", "movdqu",
+    "addps", "addpd", "addss", "addsd", "subps", "subpd", "subss", "subsd",
+    "mulps", "mulpd", "mulss", "mulsd", "divps", "divpd", "divss", "divsd",
+    "minps", "minpd", "maxps", "maxpd", "andps", "andpd", "orps", "orpd",
+    "xorps", "xorpd", "sqrtps", "sqrtpd", "shufps",
+    "paddd", "paddq", "psubd", "psubq", "pmulld", "pand", "por", "pxor", "pshufd",
+    
+    // AVX / AVX2 / AVX-512
+    "vmovaps", "vmovups", "vmovapd", "vmovupd", "vmovdqa", "vmovdqu",
+    "vmovdqa32", "vmovdqa64", "vmovdqu8", "vmovdqu16", "vmovdqu32", "vmovdqu64",
+    "vaddps", "vaddpd", "vaddss", "vaddsd", "vsubps", "vsubpd", "vsubss", "vsubsd",
+    "vmulps", "vmulpd", "vmulss", "vmulsd", "vdivps", "vdivpd", "vdivss", "vdivsd",
+    "vminps", "vminpd", "vmaxps", "vmaxpd", "vandps", "vandpd", "vorps", "vorpd",
+    "vxorps", "vxorpd", "vsqrtps", "vsqrtpd", "vshufps",
+    "vpaddd", "vpaddq", "vpsubd", "vpsubq", "vpmulld", "vpand", "vpandd", "vpandq",
+    "vpor", "vpord", "vporq", "vpxor", "vpxord", "vpxorq", "vpshufd",
+    "vfmadd132ps", "vfmadd132pd", "vfmadd213ps", "vfmadd213pd", "vfmadd231ps", "vfmadd231pd",
+    "vbroadcastss", "vbroadcastsd", "vpbroadcastd", "vpbroadcastq",
     NULL
 };
 
@@ -59,6 +79,8 @@ static const char* x86_directives[] = {
     "resb", "resw", "resd", "resq",   // reserve bytes
     "section", "segment",             // section directives
     "global", "extern",               // symbol visibility
+    "equ", "times",                   // constants and repetition
+    "align",                          // data alignment
     NULL
 };
 
@@ -73,19 +95,12 @@ lexer_t* lexer_create(FILE* file) {
         return NULL;
     }
     
+    lexer->buffer_size = 0;
     lexer->position = 0;
     lexer->line = 1;
     lexer->column = 1;
     lexer->eof_reached = false;
     
-    // Read initial buffer
-    size_t bytes_read = fread(lexer->buffer, 1, BUFFER_SIZE, file);
-    lexer->buffer_size = bytes_read;  // Set actual size of data read
-    if (bytes_read < BUFFER_SIZE) {
-        lexer->buffer[bytes_read] = '\0';
-        lexer->eof_reached = true;
-    }
-    
     return lexer;
 }
 
@@ -96,13 +111,35 @@ void lexer_destroy(lexer_t* lexer) {
     }
 }
 
+// xmm0-31, ymm0-31, zmm0-31 and k0-k7
+static bool is_vector_register(const char* str) {
+    const char* digits;
+    int limit;
+    
+    if (strncasecmp(str, "xmm", 3) == 0 || strncasecmp(str, "ymm", 3) == 0 ||
+        strncasecmp(str, "zmm", 3) == 0) {
+        digits = str + 3;
+        limit = 32;
+    } else if (str[0] == 'k' || str[0] == 'K') {
+        digits = str + 1;
+        limit = 8;
+    } else {
+        return false;
+    }
+    
+    // One or two digits, no leading zero
+    if (!isdigit((unsigned char)digits[0])) return false;
+    if (digits[1] && (digits[0] == '0' || !isdigit((unsigned char)digits[1]) || digits[2])) return false;
+    return atoi(digits) < limit;
+}
+
 bool is_register(const char* str) {
     for (int i = 0; x86_registers[i]; i++) {
         if (strcasecmp(str, x86_registers[i]) == 0) {
             return true;
         }
     }
-    return false;
+    return is_vector_register(str);
 }
 
 bool is_instruction(const char* str) {
@@ -123,15 +160,30 @@ bool is_directive(const char* str) {
     return false;
 }
 
+// Read the next chunk of input once the buffer is used up. Tokens are
+// copied out character by character, so a token may span two chunks.
+static bool lexer_fill(lexer_t* lexer) {
+    if (lexer->eof_reached) {
+        return false;
+    }
+    
+    lexer->buffer_size = fread(lexer->buffer, 1, BUFFER_SIZE, lexer->file);
+    lexer->position = 0;
+    if (lexer->buffer_size < BUFFER_SIZE) {
+        lexer->eof_reached = true;
+    }
+    return lexer->buffer_size > 0;
+}
+
 static char lexer_peek(lexer_t* lexer) {
-    if (lexer->position >= lexer->buffer_size) {
+    if (lexer->position >= lexer->buffer_size && !lexer_fill(lexer)) {
         return '\0';
     }
     return lexer->buffer[lexer->position];
 }
 
 static char lexer_advance_char(lexer_t* lexer) {
-    if (lexer->position >= lexer->buffer_size) {
+    if (lexer->position >= lexer->buffer_size && !lexer_fill(lexer)) {
         return '\0';
     }
     
@@ -162,11 +214,12 @@ static void lexer_skip_comment(lexer_t* lexer) {
 }
 
 static token_t* token_create(token_type_t type, const char* value, int line, int column) {
-    token_t* token = malloc(sizeof(token_t));
+    size_t length = value ? strlen(value) + 1 : 0;
+    token_t* token = malloc(sizeof(token_t) + length);
     if (!token) return NULL;
     
     token->type = type;
-    token->value = value ? strdup(value) : NULL;
+    token->value = value ? memcpy(token->text, value, length) : NULL;
     token->line = line;
     token->column = column;
     token->numeric_value = 0;
@@ -175,10 +228,7 @@ static token_t* token_create(token_type_t type, const char* value, int line, int
 }
 
 void token_destroy(token_t* token) {
-    if (token) {
-        free(token->value);
-        free(token);
-    }
+    free(token);
 }
 
 static token_t* lexer_read_string(lexer_t* lexer) {
@@ -198,7 +248,15 @@ static token_t* lexer_read_string(lexer_t* lexer) {
     
     // Determine token type
     token_type_t type = TOKEN_IDENTIFIER;
-    if (is_register(buffer)) {
+    if (strcasecmp(buffer, "byte") == 0) {
+        type = TOKEN_BYTE_PTR;
+    } else if (strcasecmp(buffer, "word") == 0) {
+        type = TOKEN_WORD_PTR;
+    } else if (strcasecmp(buffer, "dword") == 0) {
+        type = TOKEN_DWORD_PTR;
+    } else if (strcasecmp(buffer, "qword") == 0) {
+        type = TOKEN_QWORD_PTR;
+    } else if (is_register(buffer)) {
         type = TOKEN_REGISTER;
     } else if (is_instruction(buffer)) {
         type = TOKEN_INSTRUCTION;
@@ -250,6 +308,42 @@ static token_t* lexer_read_number(lexer_t* lexer) {
     return token;
 }
 
+// Quoted string: '...' or "..." (no escapes, as in NASM)
+static token_t* lexer_read_quoted(lexer_t* lexer) {
+    int start_line = lexer->line;
+    int start_column = lexer->column;
+    char quote = lexer_advance_char(lexer);
+    size_t capacity = 256;
+    size_t pos = 0;
+    char* buffer = malloc(capacity);
+    if (!buffer) return NULL;
+    
+    // Grown as needed: a literal of any length is kept whole
+    while (lexer_peek(lexer) != quote && lexer_peek(lexer) != '\n' && lexer_peek(lexer) != '\0') {
+        if (pos + 1 == capacity) {
+            char* grown = realloc(buffer, capacity * 2);
+            if (!grown) {
+                free(buffer);
+                return NULL;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+        buffer[pos++] = lexer_advance_char(lexer);
+    }
+    buffer[pos] = '\0';
+    
+    token_type_t type = TOKEN_UNKNOWN;
+    if (lexer_peek(lexer) == quote) {
+        lexer_advance_char(lexer); // closing quote
+        type = TOKEN_STRING;
+    }
+    
+    token_t* token = token_create(type, buffer, start_line, start_column);
+    free(buffer);
+    return token;
+}
+
 token_t* lexer_next_token(lexer_t* lexer) {
     lexer_skip_whitespace(lexer);
     
@@ -297,6 +391,62 @@ token_t* lexer_next_token(lexer_t* lexer) {
         case '*':
             lexer_advance_char(lexer);
             return token_create(TOKEN_MULTIPLY, "*", line, column);
+        case '{':
+            lexer_advance_char(lexer);
+            return token_create(TOKEN_LBRACE, "{", line, column);
+        case '}':
+            lexer_advance_char(lexer);
+            return token_create(TOKEN_RBRACE, "}", line, column);
+        case '(':
+            lexer_advance_char(lexer);
+            return token_create(TOKEN_LPAREN, "(", line, column);
+        case ')':
+            lexer_advance_char(lexer);
+            return token_create(TOKEN_RPAREN, ")", line, column);
+        case '&':
+            lexer_advance_char(lexer);
+            return token_create(TOKEN_AND, "&", line, column);
+        case '|':
+            lexer_advance_char(lexer);
+            return token_create(TOKEN_OR, "|", line, column);
+        case '^':
+            lexer_advance_char(lexer);
+            return token_create(TOKEN_XOR, "^", line, column);
+        case '~':
+            lexer_advance_char(lexer);
+            return token_create(TOKEN_NOT, "~", line, column);
+    }
+    
+    // Operators that may be doubled: / //, % %%, $ $$, << and >>
+    if (c == '/' || c == '%' || c == '$' || c == '<' || c == '>') {
+        lexer_advance_char(lexer);
+        bool doubled = lexer_peek(lexer) == c;
+        if (doubled) {
+            lexer_advance_char(lexer);
+        }
+        
+        switch (c) {
+            case '/':
+                return doubled ? token_create(TOKEN_SIGNED_DIVIDE, "//", line, column)
+                               : token_create(TOKEN_DIVIDE, "/", line, column);
+            case '%':
+                return doubled ? token_create(TOKEN_SIGNED_MODULO, "%%", line, column)
+                               : token_create(TOKEN_MODULO, "%", line, column);
+            case '$':
+                return doubled ? token_create(TOKEN_DOUBLE_DOLLAR, "$$", line, column)
+                               : token_create(TOKEN_DOLLAR, "$", line, column);
+            case '<':
+                return doubled ? token_create(TOKEN_SHIFT_LEFT, "<<", line, column)
+                               : token_create(TOKEN_UNKNOWN, "<", line, column);
+            default:
+                return doubled ? token_create(TOKEN_SHIFT_RIGHT, ">>", line, column)
+                               : token_create(TOKEN_UNKNOWN, ">", line, column);
+        }
+    }
+    
+    // Strings
+    if (c == '\'' || c == '"') {
+        return lexer_read_quoted(lexer);
     }
     
     // Numbers
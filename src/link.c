@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../include/link.h"
+#include "../include/lexer.h"
+#include "../include/parser.h"
+#include "../include/layout.h"
+#include "../include/elf_writer.h"
+
+// Linking without object files. Each input is assembled as for -f elf:
+// labels are section-relative and references that need another input or
+// a final address stay as fixups. Inputs are then placed one after another
+// in each section and their global symbols gathered in one table. Last,
+// every input copies its sections into the image and patches its own
+// fixups, in address order. Inputs occupy disjoint ranges, so both passes
+// run on worker threads without locking.
+
+#define LINK_SECTION_ALIGNMENT 16    // Start of each input within a section
+
+typedef struct {
+    const char* path;
+    program_t* program;          // Assembled input, owns its symbols and arena
+    uint64_t offset[SECTION_COUNT]; // Start of this input in each merged section
+    char error[300];             // Set by a worker, reported afterwards
+} link_input_t;
+
+typedef struct link {
+    const assembler_context_t* ctx;
+    link_input_t* inputs;
+    int input_count;
+    int next;                    // Next input for a worker (atomic)
+    void (*step)(struct link* link, link_input_t* input);
+    program_t* image;            // Merged sections and global symbols
+} link_t;
+
+// Resolved fixup, applied once all of an input's are known
+typedef struct {
+    uint64_t offset;             // Field offset in the merged .text
+    uint64_t value;
+    int size;
+} link_patch_t;
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void* worker_main(void* argument) {
+    link_t* link = argument;
+
+    for (;;) {
+        int i = __atomic_fetch_add(&link->next, 1, __ATOMIC_RELAXED);
+        if (i >= link->input_count) break;
+        link->step(link, &link->inputs[i]);
+    }
+    return NULL;
+}
+
+// Apply step to every input, on up to one thread per core. The calling
+// thread works too, so a failed pthread_create only costs parallelism.
+static void run_workers(link_t* link, void (*step)(link_t* link, link_input_t* input)) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = link->input_count < cores ? link->input_count : (int)(cores > 0 ? cores : 1);
+    pthread_t threads[64];
+    int started = 0;
+
+    link->next = 0;
+    link->step = step;
+    for (int i = 1; i < count && started < 64; i++) {
+        if (pthread_create(&threads[started], NULL, worker_main, link) == 0) {
+            started++;
+        }
+    }
+    worker_main(link);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// Print the errors the workers left; returns -1 if there were any
+static int report_errors(const link_t* link) {
+    int result = 0;
+    for (int i = 0; i < link->input_count; i++) {
+        if (link->inputs[i].error[0]) {
+            fprintf(stderr, "Error: %s: %s\n", link->inputs[i].path, link->inputs[i].error);
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// Parse and encode one input, then resolve what it can on its own
+static void assemble_input(link_t* link, link_input_t* input) {
+    const assembler_context_t* ctx = link->ctx;
+
+    FILE* file = fopen(input->path, "r");
+    if (!file) {
+        snprintf(input->error, sizeof(input->error), "Cannot open input file");
+        return;
+    }
+
+    lexer_t* lexer = lexer_create(file);
+    parser_t* parser = lexer ? parser_create(lexer, ctx->architecture) : NULL;
+    arena_t* arena = arena_create(ctx->huge_arena);
+    if (!parser || !arena) {
+        snprintf(input->error, sizeof(input->error), "Out of memory");
+        arena_destroy(arena);
+    } else {
+        parser->arena = arena;
+        parser->pack_data = ctx->pack_data;
+        parser->merge_constants = ctx->merge_constants;
+        input->program = parser_parse(parser);
+        if (!input->program) {
+            snprintf(input->error, sizeof(input->error), "%s",
+                     parser->has_error ? parser->error_message : "Parsing failed");
+            arena_destroy(arena);
+        } else {
+            parser->symbol_table = NULL; // The program keeps the symbols
+
+            layout_options_t options;
+            layout_options_init(&options);
+            options.placement = PLACEMENT_RELOCATABLE;
+            options.align_branches = ctx->align_branches;
+            if (layout_program(input->program, ctx->architecture, &options) != 0) {
+                snprintf(input->error, sizeof(input->error), "Cannot resolve labels");
+            }
+        }
+    }
+
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    fclose(file);
+}
+
+// Address of an input's symbol in the image
+static uint64_t final_address(const link_t* link, const link_input_t* input, const symbol_t* symbol) {
+    if (symbol->type != SYMBOL_LABEL) return symbol->address;
+    return link->image->section_base[symbol->section] + input->offset[symbol->section] + symbol->address;
+}
+
+// Inputs follow each other in every section
+static int create_image(link_t* link, const layout_options_t* options) {
+    uint64_t size[SECTION_COUNT] = {0};
+    uint64_t section_alignment[SECTION_COUNT] = {0};
+    for (int i = 0; i < link->input_count; i++) {
+        link_input_t* input = &link->inputs[i];
+        uint64_t input_size[SECTION_COUNT] = {
+            [SECTION_TEXT] = input->program->code_size,
+            [SECTION_DATA] = input->program->data_size,
+            [SECTION_BSS] = input->program->bss_size,
+            [SECTION_RODATA] = input->program->rodata_size
+        };
+        for (int s = 0; s < SECTION_COUNT; s++) {
+            uint64_t alignment = input->program->section_alignment[s];
+            if (alignment < LINK_SECTION_ALIGNMENT) {
+                alignment = LINK_SECTION_ALIGNMENT;
+            }
+            input->offset[s] = align_up(size[s], alignment);
+            size[s] = input->offset[s] + input_size[s];
+            if (alignment > section_alignment[s]) {
+                section_alignment[s] = alignment;
+            }
+        }
+    }
+
+    program_t* image = program_create(link->ctx->architecture);
+    if (!image) return -1;
+    link->image = image;
+    encode_cache_destroy(image->encode_cache);
+    image->encode_cache = NULL;
+
+    uint8_t* code = realloc(image->code, size[SECTION_TEXT] ? size[SECTION_TEXT] : 1);
+    if (!code) return -1;
+    image->code = code;
+    image->code_size = image->code_capacity = size[SECTION_TEXT];
+    if (size[SECTION_DATA]) {
+        image->data_section = malloc(size[SECTION_DATA]);
+        if (!image->data_section) return -1;
+        image->data_size = image->data_capacity = size[SECTION_DATA];
+    }
+    // Each input merged its own .rodata; the image keeps it all as constants
+    if (size[SECTION_RODATA]) {
+        image->rodata = malloc(size[SECTION_RODATA]);
+        if (!image->rodata) return -1;
+        image->rodata_size = image->rodata_capacity = size[SECTION_RODATA];
+        image->rodata_strings = image->rodata_size;
+    }
+    image->bss_size = size[SECTION_BSS];
+    memcpy(image->section_alignment, section_alignment, sizeof(section_alignment));
+    image->symbols = symbol_table_create(256);
+    if (!image->symbols) return -1;
+
+    layout_place_sections(image, options);
+    return 0;
+}
+
+// Input before `before` that defines name as a global, for error messages
+static const char* global_definer(const link_t* link, int before, const char* name) {
+    for (int i = 0; i < before; i++) {
+        symbol_t* symbol = symbol_table_lookup(link->inputs[i].program->symbols, name);
+        if (symbol && symbol->defined && symbol->binding == SYMBOL_GLOBAL) {
+            return link->inputs[i].path;
+        }
+    }
+    return "another input";
+}
+
+// Globals of every input go into the image's table, where extern
+// references find them. Locals follow for the executable's .symtab,
+// unless another input already took the name.
+static int collect_symbols(link_t* link) {
+    symbol_table_t* table = link->image->symbols;
+
+    for (int pass = 0; pass < 2; pass++) {
+        symbol_binding_t binding = pass == 0 ? SYMBOL_GLOBAL : SYMBOL_LOCAL;
+        for (int i = 0; i < link->input_count; i++) {
+            const link_input_t* input = &link->inputs[i];
+            const symbol_table_t* symbols = input->program->symbols;
+
+            for (int k = 0; k < symbols->symbol_count; k++) {
+                const symbol_t* symbol = &symbols->symbols[k];
+                if (!symbol->defined || symbol->binding != binding) continue;
+
+                if (symbol_table_lookup(table, symbol->name)) {
+                    if (binding == SYMBOL_LOCAL) continue;
+                    fprintf(stderr, "Error: %s: Symbol '%s' is also defined in %s\n", input->path,
+                            symbol->name, global_definer(link, i, symbol->name));
+                    return -1;
+                }
+
+                symbol_t* added = symbol_table_define(table, symbol->name, symbol->type,
+                                                      final_address(link, input, symbol));
+                if (!added) {
+                    fprintf(stderr, "Error: Out of memory\n");
+                    return -1;
+                }
+                added->binding = binding;
+                added->section = symbol->section;
+            }
+        }
+    }
+    return 0;
+}
+
+static int compare_patches(const void* a, const void* b) {
+    const link_patch_t* x = a;
+    const link_patch_t* y = b;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+// Value of a fixup left by the relocatable layout, or false after setting
+// the input's error
+static bool resolve_fixup(link_t* link, link_input_t* input, const fixup_t* fixup, link_patch_t* patch) {
+    program_t* image = link->image;
+    symbol_t* symbol = symbol_table_lookup(input->program->symbols, fixup->label);
+    uint64_t target;
+
+    if (symbol && symbol->defined && symbol->binding != SYMBOL_EXTERN) {
+        target = final_address(link, input, symbol);
+    } else {
+        symbol_t* global = symbol_table_lookup(image->symbols, fixup->label);
+        if (!global || global->binding != SYMBOL_GLOBAL) {
+            snprintf(input->error, sizeof(input->error), "Line %d: Undefined symbol '%s'",
+                     fixup->line, fixup->label);
+            return false;
+        }
+        target = global->address;
+    }
+
+    patch->offset = input->offset[SECTION_TEXT] + fixup->offset;
+    patch->size = fixup->size;
+    int64_t value = (int64_t)target + fixup->addend;
+    if (fixup->kind == FIXUP_RELATIVE) {
+        value -= (int64_t)(image->section_base[SECTION_TEXT] + patch->offset);
+    }
+    if (!fixup_value_fits(value, fixup->size, fixup->kind)) {
+        snprintf(input->error, sizeof(input->error), "Line %d: Symbol '%s' out of range",
+                 fixup->line, fixup->label);
+        return false;
+    }
+    patch->value = (uint64_t)value;
+    return true;
+}
+
+// Copy one input's sections into the image and apply its fixups
+static void place_input(link_t* link, link_input_t* input) {
+    program_t* image = link->image;
+    const program_t* program = input->program;
+    int index = (int)(input - link->inputs);
+    bool last = index + 1 == link->input_count;
+
+    // Padding up to the next input: NOPs in x86 code, zeros elsewhere
+    uint64_t text = input->offset[SECTION_TEXT];
+    uint64_t text_end = last ? image->code_size : input[1].offset[SECTION_TEXT];
+    memcpy(image->code + text, program->code, program->code_size);
+    memset(image->code + text + program->code_size, link->ctx->architecture <= ARCH_X86_64 ? 0x90 : 0,
+           text_end - text - program->code_size);
+
+    uint64_t data = input->offset[SECTION_DATA];
+    uint64_t data_end = last ? image->data_size : input[1].offset[SECTION_DATA];
+    if (data_end > data) {
+        memcpy(image->data_section + data, program->data_section, program->data_size);
+        memset(image->data_section + data + program->data_size, 0, data_end - data - program->data_size);
+    }
+
+    uint64_t rodata = input->offset[SECTION_RODATA];
+    uint64_t rodata_end = last ? image->rodata_size : input[1].offset[SECTION_RODATA];
+    if (rodata_end > rodata) {
+        memcpy(image->rodata + rodata, program->rodata, program->rodata_size);
+        memset(image->rodata + rodata + program->rodata_size, 0, rodata_end - rodata - program->rodata_size);
+    }
+
+    int count = 0;
+    link_patch_t* patches = malloc((program->fixup_count ? program->fixup_count : 1) * sizeof(link_patch_t));
+    if (!patches) {
+        snprintf(input->error, sizeof(input->error), "Out of memory");
+        return;
+    }
+    for (int i = 0; i < program->fixup_count; i++) {
+        if (program->fixups[i].resolved) continue;
+        if (!resolve_fixup(link, input, &program->fixups[i], &patches[count++])) {
+            free(patches);
+            return;
+        }
+    }
+
+    // One pass forward through the code
+    qsort(patches, count, sizeof(link_patch_t), compare_patches);
+    for (int i = 0; i < count; i++) {
+        for (int b = 0; b < patches[i].size; b++) {
+            image->code[patches[i].offset + b] = (uint8_t)(patches[i].value >> (b * 8));
+        }
+    }
+    free(patches);
+}
+
+int link_files(assembler_context_t* ctx) {
+    link_t link = {0};
+    link.ctx = ctx;
+    link.input_count = ctx->link_input_count;
+    link.inputs = calloc(link.input_count, sizeof(link_input_t));
+    if (!link.inputs) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
+    for (int i = 0; i < link.input_count; i++) {
+        link.inputs[i].path = ctx->link_inputs[i];
+    }
+
+    if (ctx->debug_mode) {
+        printf("Assembling %d inputs for linking\n", link.input_count);
+    }
+    run_workers(&link, assemble_input);
+    int result = report_errors(&link);
+
+    layout_options_t options;
+    layout_options_init(&options);
+    options.placement = PLACEMENT_EXECUTABLE;
+    options.image_base = elf_default_image_base(ctx->architecture);
+    options.text_alignment = ctx->huge_text ? LAYOUT_HUGE_PAGE_SIZE : LAYOUT_PAGE_SIZE;
+
+    if (result == 0 && create_image(&link, &options) != 0) {
+        fprintf(stderr, "Error: Out of memory\n");
+        result = -1;
+    }
+    if (result == 0) {
+        result = collect_symbols(&link);
+    }
+    if (result == 0) {
+        run_workers(&link, place_input);
+        result = report_errors(&link);
+    }
+
+    if (result == 0 && ctx->debug_mode) {
+        for (int i = 0; i < link.input_count; i++) {
+            const link_input_t* input = &link.inputs[i];
+            printf("  %s: .text +0x%llx (%zu bytes), .rodata +0x%llx, .data +0x%llx, .bss +0x%llx\n",
+                   input->path, (unsigned long long)input->offset[SECTION_TEXT], input->program->code_size,
+                   (unsigned long long)input->offset[SECTION_RODATA],
+                   (unsigned long long)input->offset[SECTION_DATA],
+                   (unsigned long long)input->offset[SECTION_BSS]);
+        }
+        printf("Writing output to '%s'\n", ctx->output_file);
+    }
+    if (result == 0) {
+        result = elf_write_executable(ctx->output_file, link.image, ctx->architecture,
+                                      link.inputs[0].path, &options, NULL);
+    }
+
+    for (int i = 0; i < link.input_count; i++) {
+        program_t* program = link.inputs[i].program;
+        if (program) {
+            arena_t* arena = program->arena;
+            symbol_table_destroy(program->symbols);
+            program_destroy(program);
+            arena_destroy(arena);
+        }
+    }
+    if (link.image) {
+        symbol_table_destroy(link.image->symbols);
+        program_destroy(link.image);
+    }
+    free(link.inputs);
+    return result;
+}
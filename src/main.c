@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,14 +6,77 @@
 #include "../include/assembler.h"
 #include "../include/lexer.h"
 #include "../include/parser.h"
+#include "../include/analyzer.h"
+#include "../include/jit.h"
+#include "../include/cache.h"
+#include "../include/microbench.h"
+
+// Long options without a short form
+enum {
+    OPTION_ALIGN_BRANCHES = 256,
+    OPTION_ANALYZE,
+    OPTION_HUGE_TEXT,
+    OPTION_RUN,
+    OPTION_PERF_MAP,
+    OPTION_JITDUMP,
+    OPTION_STATS,
+    OPTION_PIPELINE,
+    OPTION_CACHE,
+    OPTION_CACHE_SIZE,
+    OPTION_CACHE_HARDLINK,
+    OPTION_PROFILE,
+    OPTION_STREAM,
+    OPTION_HUGE_ARENA,
+    OPTION_PACK_DATA,
+    OPTION_MERGE_CONSTANTS,
+    OPTION_LINK,
+    OPTION_BENCH,
+    OPTION_BENCH_RUNS,
+    OPTION_BENCH_UNROLL
+};
 
 void print_usage(const char* program_name) {
-    printf("Usage: %s [options] <input_file>\n", program_name);
+    printf("Usage: %s [options] <input_file>   (- reads stdin)\n", program_name);
+    printf("       %s --link [options] <input_file>...\n", program_name);
+    printf("       %s --bench [options] <snippet> [<snippet>]\n", program_name);
     printf("Options:\n");
-    printf("  -a, --arch <arch>     Target architecture (x86_16, x86_32, x86_64, arm_32, arm_64)\n");
-    printf("  -f, --format <format> Output format (elf, pe, bin)\n");
-    printf("  -o, --output <file>   Output file\n");
+    printf("  -a, --arch <arch>     Target architecture (x86_16, x86_32, x86_64, arm_32, arm_64);\n");
+    printf("                        a comma-separated list builds each from one parse\n");
+    printf("  -f, --format <format> Output format (elf, elfexec, pe, bin)\n");
+    printf("  -o, --output <file>   Output file (- for stdout); %%a expands to the architecture\n");
     printf("  -d, --debug           Enable debug mode\n");
+    printf("  -g                    Emit DWARF 5 line information (elf, elfexec)\n");
+    printf("      --align-branches  Pad jumps and fused cmp+jcc pairs off 32-byte boundaries\n");
+    printf("      --analyze[=uarch] Print per-block throughput and latency estimates\n");
+    printf("                        (skylake, zen2; default skylake)\n");
+    printf("      --huge-text       Align the elfexec text segment to 2 MB for huge pages\n");
+    printf("      --profile <file>  Reorder basic blocks by an execution profile and move\n");
+    printf("                        never-executed blocks to .text.cold (x86)\n");
+    printf("      --run             Assemble into memory and call _start instead of writing a file\n");
+    printf("      --perf-map        With --run, write /tmp/perf-<pid>.map for perf\n");
+    printf("      --jitdump[=dir]   With --run, write dir/jit-<pid>.dump for perf inject --jit\n");
+    printf("                        (default dir: .)\n");
+    printf("      --stats[=format]  Print per-phase time, rates, allocations, RSS and hardware\n");
+    printf("                        counters to stderr (text, json; default text)\n");
+    printf("      --pipeline        Lex, parse and encode on three threads\n");
+    printf("      --stream          Free each instruction once encoded, so memory is bounded\n");
+    printf("                        by symbols and output size rather than source size\n");
+    printf("      --huge-arena      Back the instruction arena with 2 MB huge pages\n");
+    printf("      --pack-data       Reorder .data and .rodata items, .hot ones first, then by\n");
+    printf("                        alignment, to cut padding\n");
+    printf("      --merge-constants Keep identical .rodata constants once, not only strings\n");
+    printf("      --link            Assemble every input and link them into one static\n");
+    printf("                        executable (-f elfexec, x86)\n");
+    printf("      --bench           Time each snippet in an unrolled loop on this machine and\n");
+    printf("                        print cycles per copy; two snippets are compared (x86_64)\n");
+    printf("      --bench-runs <n>  Timed runs per snippet (default %d)\n", MICROBENCH_DEFAULT_RUNS);
+    printf("      --bench-unroll <n> Copies of the snippet per loop iteration (default %d)\n",
+           MICROBENCH_DEFAULT_UNROLL);
+    printf("      --cache[=dir]     Reuse outputs of identical inputs and options\n");
+    printf("                        (default dir: $XDG_CACHE_HOME/assembler or ~/.cache/assembler)\n");
+    printf("      --cache-size <n>  Evict least recently used outputs beyond n bytes\n");
+    printf("                        (K/M/G suffixes; default 1G)\n");
+    printf("      --cache-hardlink  Serve cache hits as hard links instead of copies\n");
     printf("  -h, --help            Show this help message\n");
     printf("\nSupported architectures:\n");
     printf("  x86_16   - x86 16-bit mode\n");
@@ -31,20 +95,135 @@ arch_type_t parse_architecture(const char* arch_str) {
     return -1; // Invalid architecture
 }
 
+// -a x86_64,arm_64: the first architecture is the primary target
+static int parse_architecture_list(const char* list, assembler_context_t* ctx) {
+    char* copy = strdup(list);
+    if (!copy) return -1;
+    
+    ctx->target_count = 0;
+    for (char* save = NULL, *name = strtok_r(copy, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        arch_type_t arch = parse_architecture(name);
+        if (arch == -1) {
+            fprintf(stderr, "Error: Invalid architecture '%s'\n", name);
+            free(copy);
+            return -1;
+        }
+        for (int i = 0; i < ctx->target_count; i++) {
+            if (ctx->targets[i] == arch) {
+                fprintf(stderr, "Error: Architecture '%s' given twice\n", name);
+                free(copy);
+                return -1;
+            }
+        }
+        ctx->targets[ctx->target_count++] = arch;
+    }
+    free(copy);
+    
+    if (ctx->target_count == 0) {
+        fprintf(stderr, "Error: Invalid architecture '%s'\n", list);
+        return -1;
+    }
+    ctx->architecture = ctx->targets[0];
+    return 0;
+}
+
+// Output name for one target: every %a becomes the architecture name
+static const char* expand_output(const char* pattern, arch_type_t arch) {
+    const char* name = architecture_name(arch);
+    size_t length = strlen(pattern) + 1;
+    for (const char* p = strstr(pattern, "%a"); p; p = strstr(p + 2, "%a")) {
+        length += strlen(name);
+    }
+    
+    char* output = malloc(length);
+    if (!output) return NULL;
+    
+    char* out = output;
+    for (const char* p = pattern; *p; ) {
+        if (p[0] == '%' && p[1] == 'a') {
+            out = stpcpy(out, name);
+            p += 2;
+        } else {
+            *out++ = *p++;
+        }
+    }
+    *out = '\0';
+    return output;
+}
+
 output_format_t parse_format(const char* format_str) {
     if (strcmp(format_str, "elf") == 0) return FORMAT_ELF;
+    if (strcmp(format_str, "elfexec") == 0) return FORMAT_ELF_EXEC;
     if (strcmp(format_str, "pe") == 0) return FORMAT_PE;
     if (strcmp(format_str, "bin") == 0) return FORMAT_BIN;
     return -1; // Invalid format
 }
 
+// Inverse of parse_format
+static const char* format_name(output_format_t format) {
+    switch (format) {
+        case FORMAT_ELF: return "elf";
+        case FORMAT_PE: return "pe";
+        case FORMAT_BIN: return "bin";
+        case FORMAT_ELF_EXEC: return "elfexec";
+    }
+    return "unknown";
+}
+
+// Byte count with an optional K, M or G suffix
+static int parse_size(const char* text, uint64_t* size) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text) return -1;
+    
+    switch (*end) {
+        case 'k': case 'K': value <<= 10; end++; break;
+        case 'm': case 'M': value <<= 20; end++; break;
+        case 'g': case 'G': value <<= 30; end++; break;
+        default: break;
+    }
+    if (*end != '\0') return -1;
+    
+    *size = value;
+    return 0;
+}
+
 int parse_arguments(int argc, char* argv[], assembler_context_t* ctx) {
     // Initialize defaults
     ctx->architecture = ARCH_X86_64;
+    ctx->targets[0] = ARCH_X86_64;
+    ctx->target_count = 1;
     ctx->output_format = FORMAT_ELF;
     ctx->input_file = NULL;
     ctx->output_file = NULL;
     ctx->debug_mode = false;
+    ctx->debug_info = false;
+    ctx->align_branches = false;
+    ctx->analyze_uarch = NULL;
+    ctx->huge_text = false;
+    ctx->profile_file = NULL;
+    ctx->run = false;
+    ctx->perf_map = false;
+    ctx->jitdump_dir = NULL;
+    ctx->exit_status = 0;
+    ctx->stats_format = NULL;
+    ctx->pipeline = false;
+    ctx->stream = false;
+    ctx->huge_arena = false;
+    ctx->pack_data = false;
+    ctx->merge_constants = false;
+    ctx->link_inputs = NULL;
+    ctx->link_input_count = 0;
+    bool link = false;
+    ctx->bench_inputs = NULL;
+    ctx->bench_input_count = 0;
+    ctx->bench_runs = MICROBENCH_DEFAULT_RUNS;
+    ctx->bench_unroll = MICROBENCH_DEFAULT_UNROLL;
+    bool bench = false;
+    bool format_given = false;
+    ctx->cache_dir = NULL;
+    ctx->cache_size = CACHE_DEFAULT_SIZE;
+    ctx->cache_hardlink = false;
 
     static struct option long_options[] = {
         {"arch", required_argument, 0, 'a'},
@@ -52,23 +231,39 @@ int parse_arguments(int argc, char* argv[], assembler_context_t* ctx) {
         {"output", required_argument, 0, 'o'},
         {"debug", no_argument, 0, 'd'},
         {"help", no_argument, 0, 'h'},
+        {"align-branches", no_argument, 0, OPTION_ALIGN_BRANCHES},
+        {"analyze", optional_argument, 0, OPTION_ANALYZE},
+        {"huge-text", no_argument, 0, OPTION_HUGE_TEXT},
+        {"profile", required_argument, 0, OPTION_PROFILE},
+        {"run", no_argument, 0, OPTION_RUN},
+        {"perf-map", no_argument, 0, OPTION_PERF_MAP},
+        {"jitdump", optional_argument, 0, OPTION_JITDUMP},
+        {"stats", optional_argument, 0, OPTION_STATS},
+        {"pipeline", no_argument, 0, OPTION_PIPELINE},
+        {"stream", no_argument, 0, OPTION_STREAM},
+        {"huge-arena", no_argument, 0, OPTION_HUGE_ARENA},
+        {"pack-data", no_argument, 0, OPTION_PACK_DATA},
+        {"merge-constants", no_argument, 0, OPTION_MERGE_CONSTANTS},
+        {"link", no_argument, 0, OPTION_LINK},
+        {"bench", no_argument, 0, OPTION_BENCH},
+        {"bench-runs", required_argument, 0, OPTION_BENCH_RUNS},
+        {"bench-unroll", required_argument, 0, OPTION_BENCH_UNROLL},
+        {"cache", optional_argument, 0, OPTION_CACHE},
+        {"cache-size", required_argument, 0, OPTION_CACHE_SIZE},
+        {"cache-hardlink", no_argument, 0, OPTION_CACHE_HARDLINK},
         {0, 0, 0, 0}
     };
 
     int option_index = 0;
     int c;
 
-    while ((c = getopt_long(argc, argv, "a:f:o:dh", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "a:f:o:dgh", long_options, &option_index)) != -1) {
         switch (c) {
-            case 'a': {
-                arch_type_t arch = parse_architecture(optarg);
-                if (arch == -1) {
-                    fprintf(stderr, "Error: Invalid architecture '%s'\n", optarg);
+            case 'a':
+                if (parse_architecture_list(optarg, ctx) != 0) {
                     return -1;
                 }
-                ctx->architecture = arch;
                 break;
-            }
             case 'f': {
                 output_format_t format = parse_format(optarg);
                 if (format == -1) {
@@ -76,6 +271,7 @@ int parse_arguments(int argc, char* argv[], assembler_context_t* ctx) {
                     return -1;
                 }
                 ctx->output_format = format;
+                format_given = true;
                 break;
             }
             case 'o':
@@ -84,9 +280,91 @@ int parse_arguments(int argc, char* argv[], assembler_context_t* ctx) {
             case 'd':
                 ctx->debug_mode = true;
                 break;
+            case 'g':
+                ctx->debug_info = true;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 1;
+            case OPTION_ALIGN_BRANCHES:
+                ctx->align_branches = true;
+                break;
+            case OPTION_ANALYZE:
+                ctx->analyze_uarch = optarg ? optarg : "skylake";
+                if (!analyzer_supports_uarch(ctx->analyze_uarch)) {
+                    fprintf(stderr, "Error: Unknown microarchitecture '%s'\n", ctx->analyze_uarch);
+                    return -1;
+                }
+                break;
+            case OPTION_HUGE_TEXT:
+                ctx->huge_text = true;
+                break;
+            case OPTION_PROFILE:
+                ctx->profile_file = optarg;
+                break;
+            case OPTION_RUN:
+                ctx->run = true;
+                break;
+            case OPTION_PERF_MAP:
+                ctx->perf_map = true;
+                break;
+            case OPTION_JITDUMP:
+                ctx->jitdump_dir = optarg ? optarg : ".";
+                break;
+            case OPTION_STATS:
+                ctx->stats_format = optarg ? optarg : "text";
+                if (strcmp(ctx->stats_format, "text") != 0 && strcmp(ctx->stats_format, "json") != 0) {
+                    fprintf(stderr, "Error: Unknown stats format '%s'\n", ctx->stats_format);
+                    return -1;
+                }
+                break;
+            case OPTION_PIPELINE:
+                ctx->pipeline = true;
+                break;
+            case OPTION_STREAM:
+                ctx->stream = true;
+                break;
+            case OPTION_HUGE_ARENA:
+                ctx->huge_arena = true;
+                break;
+            case OPTION_PACK_DATA:
+                ctx->pack_data = true;
+                break;
+            case OPTION_MERGE_CONSTANTS:
+                ctx->merge_constants = true;
+                break;
+            case OPTION_LINK:
+                link = true;
+                break;
+            case OPTION_BENCH:
+                bench = true;
+                break;
+            case OPTION_BENCH_RUNS:
+                ctx->bench_runs = atoi(optarg);
+                if (ctx->bench_runs < 2) {
+                    fprintf(stderr, "Error: --bench-runs needs at least 2 runs\n");
+                    return -1;
+                }
+                break;
+            case OPTION_BENCH_UNROLL:
+                ctx->bench_unroll = atoi(optarg);
+                if (ctx->bench_unroll < 1 || ctx->bench_unroll > MICROBENCH_MAX_UNROLL) {
+                    fprintf(stderr, "Error: --bench-unroll takes 1 to %d copies\n", MICROBENCH_MAX_UNROLL);
+                    return -1;
+                }
+                break;
+            case OPTION_CACHE:
+                ctx->cache_dir = optarg ? optarg : cache_default_directory();
+                break;
+            case OPTION_CACHE_SIZE:
+                if (parse_size(optarg, &ctx->cache_size) != 0) {
+                    fprintf(stderr, "Error: Invalid cache size '%s'\n", optarg);
+                    return -1;
+                }
+                break;
+            case OPTION_CACHE_HARDLINK:
+                ctx->cache_hardlink = true;
+                break;
             case '?':
                 return -1;
             default:
@@ -101,17 +379,111 @@ int parse_arguments(int argc, char* argv[], assembler_context_t* ctx) {
         return -1;
     }
     ctx->input_file = argv[optind];
+    
+    if (link) {
+        ctx->link_inputs = (const char* const*)argv + optind;
+        ctx->link_input_count = argc - optind;
+        if (format_given && ctx->output_format != FORMAT_ELF_EXEC) {
+            fprintf(stderr, "Error: --link writes an executable (-f elfexec)\n");
+            return -1;
+        }
+        ctx->output_format = FORMAT_ELF_EXEC;
+        
+        for (int i = 0; i < ctx->link_input_count; i++) {
+            if (strcmp(ctx->link_inputs[i], "-") == 0) {
+                fprintf(stderr, "Error: --link needs input files, not stdin\n");
+                return -1;
+            }
+        }
+        if (ctx->target_count > 1 || ctx->architecture > ARCH_X86_64) {
+            fprintf(stderr, "Error: --link takes a single x86 architecture\n");
+            return -1;
+        }
+        if (ctx->run || ctx->stream || ctx->pipeline || ctx->profile_file || ctx->analyze_uarch ||
+            ctx->debug_info || ctx->stats_format || ctx->cache_dir) {
+            fprintf(stderr, "Error: --link cannot be combined with --run, --stream, --pipeline, "
+                    "--profile, --analyze, -g, --stats or --cache\n");
+            return -1;
+        }
+    }
+
+    if (bench) {
+        ctx->bench_inputs = (const char* const*)argv + optind;
+        ctx->bench_input_count = argc - optind;
+        if (ctx->bench_input_count > 2) {
+            fprintf(stderr, "Error: --bench compares at most two snippets\n");
+            return -1;
+        }
+        for (int i = 0; i < ctx->bench_input_count; i++) {
+            if (strcmp(ctx->bench_inputs[i], "-") == 0) {
+                fprintf(stderr, "Error: --bench needs snippet files, not stdin\n");
+                return -1;
+            }
+        }
+        if (ctx->target_count > 1 || ctx->architecture != ARCH_X86_64 || !jit_supports_arch(ctx->architecture)) {
+            fprintf(stderr, "Error: --bench needs an x86_64 host and -a x86_64\n");
+            return -1;
+        }
+        if (link || ctx->run || ctx->stream || ctx->pipeline || ctx->profile_file || ctx->analyze_uarch ||
+            ctx->debug_info || ctx->stats_format || ctx->cache_dir) {
+            fprintf(stderr, "Error: --bench cannot be combined with --link, --run, --stream, --pipeline, "
+                    "--profile, --analyze, -g, --stats or --cache\n");
+            return -1;
+        }
+    } else if (ctx->bench_runs != MICROBENCH_DEFAULT_RUNS || ctx->bench_unroll != MICROBENCH_DEFAULT_UNROLL) {
+        fprintf(stderr, "Error: --bench-runs and --bench-unroll require --bench\n");
+        return -1;
+    }
 
-    // Set default output file if not specified
-    if (!ctx->output_file) {
+    if ((ctx->perf_map || ctx->jitdump_dir) && !ctx->run) {
+        fprintf(stderr, "Error: --perf-map and --jitdump require --run\n");
+        return -1;
+    }
+    if (ctx->stream && (ctx->debug_info || ctx->align_branches || ctx->analyze_uarch ||
+                        ctx->profile_file || ctx->jitdump_dir)) {
+        fprintf(stderr, "Error: --stream cannot be combined with -g, --align-branches, --analyze, "
+                "--profile or --jitdump, which need every instruction\n");
+        return -1;
+    }
+    if (ctx->target_count > 1) {
+        if (ctx->run || ctx->stream || ctx->profile_file || ctx->analyze_uarch) {
+            fprintf(stderr, "Error: Several architectures cannot be combined with --run, --stream, "
+                    "--profile or --analyze\n");
+            return -1;
+        }
+        if (ctx->output_file && !strstr(ctx->output_file, "%a")) {
+            fprintf(stderr, "Error: With several architectures the output name needs %%a\n");
+            return -1;
+        }
+        if (!ctx->output_file && strcmp(ctx->input_file, "-") == 0) {
+            fprintf(stderr, "Error: With several architectures and stdin input, give -o with %%a\n");
+            return -1;
+        }
+    }
+    if (ctx->profile_file && ctx->architecture > ARCH_X86_64) {
+        fprintf(stderr, "Error: --profile is only supported for x86 targets\n");
+        return -1;
+    }
+    if (ctx->run && !jit_supports_arch(ctx->architecture)) {
+        fprintf(stderr, "Error: --run needs the host architecture\n");
+        return -1;
+    }
+
+    // Set default output file if not specified; stdin goes to stdout
+    if (!ctx->output_file && strcmp(ctx->input_file, "-") == 0) {
+        ctx->output_file = "-";
+    } else if (!ctx->output_file) {
         const char* input_base = strrchr(ctx->input_file, '/');
         input_base = input_base ? input_base + 1 : ctx->input_file;
         
-        // Remove extension and add new one
-        char* output = malloc(strlen(input_base) + 10);
+        // Remove extension and add new one; one file per architecture
+        char* output = malloc(strlen(input_base) + 13);
         strcpy(output, input_base);
         char* dot = strrchr(output, '.');
         if (dot) *dot = '\0';
+        if (ctx->target_count > 1) {
+            strcat(output, "_%a");
+        }
         
         switch (ctx->output_format) {
             case FORMAT_ELF:
@@ -123,9 +495,21 @@ int parse_arguments(int argc, char* argv[], assembler_context_t* ctx) {
             case FORMAT_BIN:
                 strcat(output, ".bin");
                 break;
+            case FORMAT_ELF_EXEC:
+                // Executables have no extension
+                break;
         }
         ctx->output_file = output;
     }
+    
+    for (int i = 0; i < ctx->target_count; i++) {
+        ctx->target_outputs[i] = expand_output(ctx->output_file, ctx->targets[i]);
+        if (!ctx->target_outputs[i]) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return -1;
+        }
+    }
+    ctx->output_file = ctx->target_outputs[0];
 
     return 0;
 }
@@ -143,16 +527,29 @@ int main(int argc, char* argv[]) {
         printf("Assembler Configuration:\n");
         printf("  Input file: %s\n", ctx.input_file);
         printf("  Output file: %s\n", ctx.output_file);
-        printf("  Architecture: %d\n", ctx.architecture);
-        printf("  Format: %d\n", ctx.output_format);
+        for (int i = 0; i < ctx.target_count; i++) {
+            printf("  Architecture: %s -> %s\n", architecture_name(ctx.targets[i]),
+                   ctx.target_outputs[i]);
+        }
+        printf("  Format: %s\n", format_name(ctx.output_format));
     }
 
     // Assemble the file
     int result = assemble_file(&ctx);
     
-    if (result == 0) {
-        printf("Assembly completed successfully: %s -> %s\n", 
-               ctx.input_file, ctx.output_file);
+    if (result == 0 && ctx.run) {
+        return ctx.exit_status;
+    } else if (result == 0 && ctx.bench_inputs) {
+        // The timings are the output
+    } else if (result == 0) {
+        // stdout carries the output image with -o -
+        if (ctx.link_inputs && strcmp(ctx.output_file, "-") != 0) {
+            printf("Link completed successfully: %d files -> %s\n", ctx.link_input_count, ctx.output_file);
+        }
+        for (int i = 0; i < ctx.target_count && !ctx.link_inputs && strcmp(ctx.output_file, "-") != 0; i++) {
+            printf("Assembly completed successfully: %s -> %s\n", 
+                   ctx.input_file, ctx.target_outputs[i]);
+        }
     } else {
         printf("Assembly failed with error code: %d\n", result);
     }
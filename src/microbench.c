@@ -0,0 +1,474 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include "../include/microbench.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <x86intrin.h>
+#include "../include/lexer.h"
+#include "../include/parser.h"
+#include "../include/layout.h"
+#include "../include/jit.h"
+
+// Snippets are timed in place, the way they would run in a kernel: the
+// harness is ordinary source in this assembler's syntax, so it goes
+// through the same parser, encoder, layout and loader as --run.
+
+#define MICROBENCH_TARGET_TICKS 200000   // Calibrated length of one timed run
+#define MICROBENCH_MAX_ITERATIONS (1ULL << 24)
+#define MICROBENCH_WARMUP_RUNS 5
+#define MICROBENCH_MAX_SNIPPETS 2
+
+// Saved in the harness's .data, restored before it returns
+static const char* const saved_registers[] = {"rbx", "rbp", "r12", "r13", "r14", "r15", "rsp"};
+#define SAVED_REGISTER_COUNT (int)(sizeof(saved_registers) / sizeof(saved_registers[0]))
+
+typedef void (*harness_t)(uint64_t iterations);
+
+// One parsed source with what it needs to stay alive
+typedef struct {
+    FILE* file;
+    lexer_t* lexer;
+    parser_t* parser;
+    arena_t* arena;
+    program_t* program;
+} source_t;
+
+typedef struct {
+    const char* name;
+    char* text;                  // Snippet source; NULL for the empty harness
+    jit_image_t image;
+    double* samples;             // Per copy, less the empty harness
+} snippet_t;
+
+typedef struct {
+    int perf_fd;                 // Core cycle counter, or -1 to read the TSC
+} bench_clock_t;
+
+typedef struct {
+    double mean;
+    double variance;             // Of one sample
+    double median;
+    double min;
+    int count;
+} summary_t;
+
+// Two-sided 95% quantiles of Student's t for 1 to 30 degrees of freedom
+static const double t_quantiles[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static double t_quantile(double degrees) {
+    if (degrees < 1) return t_quantiles[0];
+    if (degrees <= 30) return t_quantiles[(int)degrees - 1];
+    if (degrees <= 60) return 2.000;
+    if (degrees <= 120) return 1.980;
+    return 1.960;
+}
+
+static char* read_text(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open input file '%s'\n", path);
+        return NULL;
+    }
+
+    size_t length = 0;
+    size_t capacity = 4096;
+    char* text = malloc(capacity);
+    while (text) {
+        length += fread(text + length, 1, capacity - length - 1, file);
+        if (length + 1 < capacity) break;
+        capacity *= 2;
+        char* grown = realloc(text, capacity);
+        if (!grown) free(text);
+        text = grown;
+    }
+    fclose(file);
+
+    if (!text) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    text[length] = '\0';
+    return text;
+}
+
+static void source_close(source_t* source) {
+    program_destroy(source->program);
+    parser_destroy(source->parser);
+    arena_destroy(source->arena);
+    lexer_destroy(source->lexer);
+    if (source->file) fclose(source->file);
+    memset(source, 0, sizeof(*source));
+}
+
+// Parse and encode file, which source then owns; errors are reported
+// under name
+static int source_parse(source_t* source, FILE* file, arch_type_t arch, const char* name) {
+    memset(source, 0, sizeof(*source));
+    source->file = file;
+    source->lexer = lexer_create(file);
+    source->parser = source->lexer ? parser_create(source->lexer, arch) : NULL;
+    source->arena = arena_create(false);
+    if (!source->parser || !source->arena) {
+        fprintf(stderr, "Error: Out of memory\n");
+        source_close(source);
+        return -1;
+    }
+
+    source->parser->arena = source->arena;
+    source->program = parser_parse(source->parser);
+    if (!source->program) {
+        fprintf(stderr, "Error: %s: %s\n", name,
+                source->parser->has_error ? source->parser->error_message : "Parsing failed");
+        source_close(source);
+        return -1;
+    }
+    return 0;
+}
+
+static bool is_loop_counter(const register_info_t* reg) {
+    return reg && reg->encoding == 15 && !(reg->flags & (REG_FLAG_VECTOR | REG_FLAG_MASK));
+}
+
+// The snippet on its own, so that errors point at its own lines. It must
+// be code the encoder supports, keep off r15 and, if copied, define
+// nothing twice.
+static int check_snippet(const assembler_context_t* ctx, const snippet_t* snippet) {
+    FILE* file = fopen(snippet->name, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open input file '%s'\n", snippet->name);
+        return -1;
+    }
+
+    source_t source;
+    int result = source_parse(&source, file, ctx->architecture, snippet->name);
+    if (result != 0) return -1;
+
+    program_t* program = source.program;
+    if (program->data_size || program->rodata_size || program->bss_size) {
+        fprintf(stderr, "Error: %s: Snippets are code only; r14 points at %d bytes of scratch memory\n",
+                snippet->name, MICROBENCH_SCRATCH_SIZE);
+        result = -1;
+    }
+
+    symbol_table_t* table = program->symbols;
+    for (int i = 0; i < table->symbol_count && result == 0 && ctx->bench_unroll > 1; i++) {
+        if (table->symbols[i].defined) {
+            fprintf(stderr, "Error: %s: '%s' would be defined in every copy; use --bench-unroll 1\n",
+                    snippet->name, table->symbols[i].name);
+            result = -1;
+        }
+    }
+
+    for (int i = 0; i < program->instruction_count && result == 0; i++) {
+        const instruction_t* instr = program->instructions[i];
+        if (!instruction_has_encoder(instr, ctx->architecture)) {
+            // The encoder writes a NOP in its place, which is what would be timed
+            fprintf(stderr, "Error: %s: Line %d: '%s' is not supported by the encoder\n",
+                    snippet->name, instr->line, instr->mnemonic);
+            result = -1;
+            break;
+        }
+        for (int j = 0; j < instr->operand_count; j++) {
+            const operand_t* operand = &instr->operands[j];
+            bool uses = operand->type == OPERAND_REGISTER ? is_loop_counter(operand->data.reg.reg_info) :
+                        operand->type == OPERAND_MEMORY && (is_loop_counter(operand->data.mem.base) ||
+                                                            is_loop_counter(operand->data.mem.index));
+            if (uses) {
+                fprintf(stderr, "Error: %s: Line %d: r15 holds the loop counter\n", snippet->name, instr->line);
+                result = -1;
+                break;
+            }
+        }
+    }
+
+    source_close(&source);
+    return result;
+}
+
+// Harness source: save registers, run unroll copies of the snippet
+// iterations times (rdi), restore and return
+static FILE* write_harness(const char* text, int unroll) {
+    FILE* file = tmpfile();
+    if (!file) return NULL;
+
+    fprintf(file, "section .text\n");
+    for (int i = 0; i < SAVED_REGISTER_COUNT; i++) {
+        fprintf(file, "    mov [rel __bench_saved + %d], %s\n", i * 8, saved_registers[i]);
+    }
+    fprintf(file, "    mov r15, rdi\n");
+    fprintf(file, "    lea r14, [rel __bench_scratch]\n");
+    fprintf(file, "__bench_loop:\n");
+    for (int i = 0; text && i < unroll; i++) {
+        fprintf(file, "%s\n", text);
+    }
+    fprintf(file, "section .text\n");
+    fprintf(file, "    sub r15, 1\n");
+    fprintf(file, "    jne __bench_loop\n");
+    for (int i = 0; i < SAVED_REGISTER_COUNT; i++) {
+        fprintf(file, "    mov %s, [rel __bench_saved + %d]\n", saved_registers[i], i * 8);
+    }
+    fprintf(file, "    ret\n");
+    fprintf(file, "section .bss\n");
+    fprintf(file, "__bench_saved resq %d\n", SAVED_REGISTER_COUNT);
+    fprintf(file, "__bench_scratch resb %d\n", MICROBENCH_SCRATCH_SIZE);
+
+    if (ferror(file) || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+// Assemble the harness around snippet into executable memory
+static int load_harness(const assembler_context_t* ctx, snippet_t* snippet) {
+    FILE* file = write_harness(snippet->text, ctx->bench_unroll);
+    if (!file) {
+        fprintf(stderr, "Error: Cannot write the harness for '%s': %s\n", snippet->name, strerror(errno));
+        return -1;
+    }
+
+    source_t source;
+    int result = source_parse(&source, file, ctx->architecture, snippet->name);
+    if (result != 0) return -1;
+
+    layout_options_t layout;
+    layout_options_init(&layout);
+    result = jit_reserve(&snippet->image, source.program, &layout);
+    if (result == 0) {
+        layout.placement = PLACEMENT_MEMORY;
+        layout.image_base = (uint64_t)(uintptr_t)snippet->image.memory;
+        result = layout_program(source.program, ctx->architecture, &layout);
+        if (result != 0) {
+            fprintf(stderr, "Error: %s: Layout failed\n", snippet->name);
+        }
+    }
+    if (result == 0) {
+        result = jit_load(&snippet->image, source.program);
+    }
+    if (result == 0 && ctx->debug_mode) {
+        printf("Harness for %s: %zu bytes of code at 0x%llx\n", snippet->name, source.program->code_size,
+               (unsigned long long)snippet->image.entry);
+    }
+
+    source_close(&source);
+    return result;
+}
+
+// Core cycles of this thread, not counting the kernel, if perf allows it
+static void clock_open(bench_clock_t* clock) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    clock->perf_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Fenced on both sides, so the snippet's instructions stay between reads
+static uint64_t clock_read(const bench_clock_t* clock) {
+    uint64_t value = 0;
+
+    _mm_lfence();
+    if (clock->perf_fd >= 0) {
+        if (read(clock->perf_fd, &value, sizeof(value)) != sizeof(value)) value = 0;
+    } else {
+        unsigned int aux;
+        value = __rdtscp(&aux);
+    }
+    _mm_lfence();
+    return value;
+}
+
+static uint64_t time_harness(const bench_clock_t* clock, const snippet_t* snippet, uint64_t iterations) {
+    harness_t harness = (harness_t)(uintptr_t)snippet->image.entry;
+
+    uint64_t start = clock_read(clock);
+    harness(iterations);
+    return clock_read(clock) - start;
+}
+
+// Pin to the CPU we are on; returns it, or -1 if that failed
+static int pin_cpu(void) {
+    int cpu = sched_getcpu();
+    if (cpu < 0) return -1;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0 ? cpu : -1;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static summary_t summarize(const double* samples, int count) {
+    summary_t summary = {0};
+    double* sorted = malloc((size_t)count * sizeof(double));
+
+    summary.count = count;
+    for (int i = 0; i < count; i++) {
+        summary.mean += samples[i] / count;
+    }
+    for (int i = 0; i < count; i++) {
+        summary.variance += (samples[i] - summary.mean) * (samples[i] - summary.mean) / (count - 1);
+    }
+    if (sorted) {
+        memcpy(sorted, samples, (size_t)count * sizeof(double));
+        qsort(sorted, count, sizeof(double), compare_doubles);
+        summary.min = sorted[0];
+        summary.median = count % 2 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+        free(sorted);
+    }
+    return summary;
+}
+
+static void report(const assembler_context_t* ctx, const snippet_t* snippets, int count, const char* unit) {
+    summary_t summaries[MICROBENCH_MAX_SNIPPETS];
+    int runs = ctx->bench_runs;
+
+    for (int s = 0; s < count; s++) {
+        summary_t* x = &summaries[s];
+        *x = summarize(snippets[s].samples, runs);
+        double half = t_quantile(runs - 1) * sqrt(x->variance / runs);
+        printf("%s: %.3f %s per copy, 95%% CI [%.3f, %.3f], median %.3f, min %.3f\n", snippets[s].name,
+               x->mean, unit, x->mean - half, x->mean + half, x->median, x->min);
+    }
+    if (count < 2) return;
+
+    // Welch's interval for the difference of the means
+    const summary_t* a = &summaries[0];
+    const summary_t* b = &summaries[1];
+    double va = a->variance / runs;
+    double vb = b->variance / runs;
+    double difference = b->mean - a->mean;
+    double degrees = va + vb > 0 ? (va + vb) * (va + vb) / (va * va / (runs - 1) + vb * vb / (runs - 1)) : runs - 1;
+    double half = t_quantile(degrees) * sqrt(va + vb);
+
+    printf("%s vs %s: %+.3f %s per copy, 95%% CI [%+.3f, %+.3f]", snippets[1].name, snippets[0].name,
+           difference, unit, difference - half, difference + half);
+    if (a->mean > 0) printf(" (%+.1f%%)", 100 * difference / a->mean);
+    if (difference - half > 0) {
+        printf(": %s is slower\n", snippets[1].name);
+    } else if (difference + half < 0) {
+        printf(": %s is faster\n", snippets[1].name);
+    } else {
+        printf(": no significant difference\n");
+    }
+}
+
+static int measure(const assembler_context_t* ctx, snippet_t* empty, snippet_t* snippets, int count) {
+    bench_clock_t clock;
+    clock_open(&clock);
+    const char* unit = clock.perf_fd >= 0 ? "cycles" : "TSC ticks";
+
+    int cpu = pin_cpu();
+    if (cpu < 0) {
+        fprintf(stderr, "Warning: Cannot pin to one CPU: %s\n", strerror(errno));
+    }
+
+    // Warmup doubles as calibration: every snippet runs long enough that
+    // reading the clock is noise
+    uint64_t iterations = 1;
+    for (;;) {
+        uint64_t shortest = UINT64_MAX;
+        for (int s = 0; s < count; s++) {
+            uint64_t ticks = time_harness(&clock, &snippets[s], iterations);
+            if (ticks < shortest) shortest = ticks;
+        }
+        if (shortest >= MICROBENCH_TARGET_TICKS || iterations >= MICROBENCH_MAX_ITERATIONS) break;
+        iterations *= 2;
+    }
+    for (int r = 0; r < MICROBENCH_WARMUP_RUNS; r++) {
+        time_harness(&clock, empty, iterations);
+        for (int s = 0; s < count; s++) {
+            time_harness(&clock, &snippets[s], iterations);
+        }
+    }
+
+    printf("%d %s per iteration, %llu iterations, %d runs", ctx->bench_unroll,
+           ctx->bench_unroll == 1 ? "copy" : "copies", (unsigned long long)iterations, ctx->bench_runs);
+    if (cpu >= 0) printf(" on CPU %d", cpu);
+    printf(", %s\n", clock.perf_fd >= 0 ? "core cycles from perf_event_open" : "TSC ticks from rdtscp");
+
+    // The empty harness runs next to every sample, and the snippets take
+    // turns going first, so drift affects them alike
+    double copies = (double)iterations * ctx->bench_unroll;
+    for (int r = 0; r < ctx->bench_runs; r++) {
+        double loop = (double)time_harness(&clock, empty, iterations);
+        for (int k = 0; k < count; k++) {
+            int s = r % 2 ? count - 1 - k : k;
+            double ticks = (double)time_harness(&clock, &snippets[s], iterations);
+            snippets[s].samples[r] = (ticks - loop) / copies;
+        }
+    }
+
+    if (clock.perf_fd >= 0) {
+        close(clock.perf_fd);
+    }
+    report(ctx, snippets, count, unit);
+    return 0;
+}
+
+int microbench_run(assembler_context_t* ctx) {
+    snippet_t empty = {.name = "empty harness"};
+    snippet_t snippets[MICROBENCH_MAX_SNIPPETS];
+    int count = ctx->bench_input_count;
+    int result = 0;
+
+    memset(snippets, 0, sizeof(snippets));
+    for (int s = 0; s < count && result == 0; s++) {
+        snippets[s].name = ctx->bench_inputs[s];
+        snippets[s].text = read_text(snippets[s].name);
+        snippets[s].samples = calloc(ctx->bench_runs, sizeof(double));
+        if (!snippets[s].text || !snippets[s].samples) {
+            if (snippets[s].text) fprintf(stderr, "Error: Out of memory\n");
+            result = -1;
+        }
+    }
+    for (int s = 0; s < count && result == 0; s++) {
+        result = check_snippet(ctx, &snippets[s]);
+    }
+    if (result == 0) {
+        result = load_harness(ctx, &empty);
+    }
+    for (int s = 0; s < count && result == 0; s++) {
+        result = load_harness(ctx, &snippets[s]);
+    }
+    if (result == 0) {
+        fflush(stdout);
+        result = measure(ctx, &empty, snippets, count);
+    }
+
+    jit_release(&empty.image);
+    for (int s = 0; s < count; s++) {
+        jit_release(&snippets[s].image);
+        free(snippets[s].text);
+        free(snippets[s].samples);
+    }
+    return result;
+}
+
+#else
+int microbench_run(assembler_context_t* ctx) {
+    (void)ctx;
+    fprintf(stderr, "Error: --bench needs an x86_64 Linux host\n");
+    return -1;
+}
+#endif
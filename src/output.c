@@ -0,0 +1,139 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/output.h"
+
+#define ZERO_CHUNK_SIZE 65536
+
+// Regular files are sized with ftruncate and filled through a shared
+// mapping, so section contents are copied once, straight into the page
+// cache, and zero runs are left as holes. Anything else (stdout, pipes,
+// character devices) is streamed with writev.
+
+static int write_all(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count > IOV_MAX ? IOV_MAX : count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        
+        // Skip what was written, resuming inside a partially written vector
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+static int stream_image(int fd, const struct iovec* extents, int count) {
+    static const uint8_t zeros[ZERO_CHUNK_SIZE];
+    
+    // Zero runs become references to a shared zero block
+    int capacity = count;
+    for (int i = 0; i < count; i++) {
+        if (!extents[i].iov_base) capacity += extents[i].iov_len / ZERO_CHUNK_SIZE;
+    }
+    
+    struct iovec* iov = malloc(capacity * sizeof(struct iovec));
+    if (!iov) return -1;
+    
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (extents[i].iov_base) {
+            iov[n++] = extents[i];
+            continue;
+        }
+        for (size_t left = extents[i].iov_len; left > 0; ) {
+            size_t chunk = left > ZERO_CHUNK_SIZE ? ZERO_CHUNK_SIZE : left;
+            iov[n++] = (struct iovec){(void*)zeros, chunk};
+            left -= chunk;
+        }
+    }
+    
+    int result = write_all(fd, iov, n);
+    free(iov);
+    return result;
+}
+
+static int map_image(int fd, const struct iovec* extents, int count, size_t size) {
+    if (ftruncate(fd, (off_t)size) != 0) return -1;
+    if (size == 0) return 0;
+    
+    uint8_t* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return -1;
+    
+    size_t offset = 0;
+    for (int i = 0; i < count; i++) {
+        if (extents[i].iov_base) {
+            memcpy(map + offset, extents[i].iov_base, extents[i].iov_len);
+        }
+        offset += extents[i].iov_len;
+    }
+    
+    return munmap(map, size);
+}
+
+// Write an output image to `filename` ("-" for stdout)
+int output_write_image(const char* filename, const struct iovec* extents, int count, bool executable) {
+    size_t size = 0;
+    for (int i = 0; i < count; i++) {
+        size += extents[i].iov_len;
+    }
+    
+    bool to_stdout = strcmp(filename, "-") == 0;
+    
+    // Never write through a hard link: the other name may be a --cache entry
+    struct stat existing;
+    if (!to_stdout && lstat(filename, &existing) == 0 && S_ISREG(existing.st_mode) &&
+        existing.st_nlink > 1) {
+        unlink(filename);
+    }
+    
+    int fd = to_stdout ? STDOUT_FILENO : open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open output file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+    
+    struct stat st;
+    int result;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && !to_stdout) {
+        result = map_image(fd, extents, count, size);
+    } else {
+        result = stream_image(fd, extents, count);
+    }
+    
+    if (result != 0) {
+        fprintf(stderr, "Error: Failed to write '%s': %s\n", filename, strerror(errno));
+    }
+    
+    // Executables get 0777 minus the umask, like a linker's output
+    if (result == 0 && executable && !to_stdout) {
+        mode_t mask = umask(0);
+        umask(mask);
+        if (fchmod(fd, 0777 & ~mask) != 0) {
+            fprintf(stderr, "Warning: Cannot make '%s' executable\n", filename);
+        }
+    }
+    
+    if (!to_stdout && close(fd) != 0 && result == 0) {
+        fprintf(stderr, "Error: Failed to write '%s': %s\n", filename, strerror(errno));
+        result = -1;
+    }
+    return result;
+}
@@ -3,10 +3,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <stdint.h>
 #include "../include/parser.h"
+#include "../include/stats.h"
+#include "../include/pipeline.h"
+#include "../include/fanout.h"
+#include "../include/expression.h"
+#include "../include/rodata.h"
+#include "../include/data_layout.h"
 
 #define INITIAL_CAPACITY 256
-#define MAX_CODE_SIZE 65536
+#define INITIAL_CODE_CAPACITY 65536
+#define MAX_INSTRUCTION_BYTES 16
+#define MAX_DATA_ALIGNMENT 4096
+
+static bool parse_times(parser_t* parser, program_t* program);
 
 parser_t* parser_create(lexer_t* lexer, arch_type_t arch) {
     parser_t* parser = malloc(sizeof(parser_t));
@@ -14,12 +25,29 @@ parser_t* parser_create(lexer_t* lexer, arch_type_t arch) {
     
     parser->lexer = lexer;
     parser->current_token = NULL;
+    parser->peek_token = NULL;
     parser->symbol_table = symbol_table_create(256);
     parser->architecture = arch;
     parser->current_address = 0;
-    parser->current_section = 0;
+    parser->current_section = SECTION_TEXT;
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        parser->section_addresses[i] = 0;
+        parser->pinned[i] = false;
+    }
     parser->has_error = false;
     parser->error_message[0] = '\0';
+    parser->pipeline = NULL;
+    parser->fanout = NULL;
+    parser->arena = NULL;
+    parser->pack_data = false;
+    parser->merge_constants = false;
+    parser->streaming = false;
+    parser->text_distances = NULL;
+    parser->text_distance_count = 0;
+    parser->text_distance_capacity = 0;
+    parser->data_references = NULL;
+    parser->data_reference_count = 0;
+    parser->data_reference_capacity = 0;
     
     if (!parser->symbol_table) {
         free(parser);
@@ -38,11 +66,19 @@ void parser_destroy(parser_t* parser) {
     if (parser->current_token) {
         token_destroy(parser->current_token);
     }
+    if (parser->peek_token) {
+        token_destroy(parser->peek_token);
+    }
     
     if (parser->symbol_table) {
         symbol_table_destroy(parser->symbol_table);
     }
     
+    free(parser->text_distances);
+    for (int i = 0; i < parser->data_reference_count; i++) {
+        free(parser->data_references[i].label);
+    }
+    free(parser->data_references);
     free(parser);
 }
 
@@ -73,12 +109,41 @@ bool parser_expect_token(parser_t* parser, token_type_t expected) {
     return true;
 }
 
+// Lexer call, charged to the lex phase under --stats
+static token_t* next_token(parser_t* parser) {
+    if (parser->pipeline) {
+        return pipeline_next_token(parser->pipeline);
+    }
+    
+    stats_phase_t previous = stats_enter(STATS_PHASE_LEX);
+    token_t* token = lexer_next_token(parser->lexer);
+    stats_leave(previous);
+    
+    if (stats_active) {
+        stats_active->tokens++;
+    }
+    return token;
+}
+
 void parser_advance(parser_t* parser) {
     if (parser->current_token) {
         token_destroy(parser->current_token);
     }
     
-    parser->current_token = lexer_next_token(parser->lexer);
+    if (parser->peek_token) {
+        parser->current_token = parser->peek_token;
+        parser->peek_token = NULL;
+    } else {
+        parser->current_token = next_token(parser);
+    }
+}
+
+// Token after the current one, without consuming anything
+token_t* parser_peek(parser_t* parser) {
+    if (!parser->peek_token) {
+        parser->peek_token = next_token(parser);
+    }
+    return parser->peek_token;
 }
 
 static void skip_newlines(parser_t* parser) {
@@ -89,103 +154,276 @@ static void skip_newlines(parser_t* parser) {
     }
 }
 
-operand_t* parse_operand(parser_t* parser) {
-    if (!parser->current_token) return NULL;
+// An identifier in a memory operand that does not name a constant: the
+// operand is addressed from that label
+static bool is_label_reference(parser_t* parser) {
+    token_t* token = parser->current_token;
+    if (!token || token->type != TOKEN_IDENTIFIER) return false;
     
-    switch (parser->current_token->type) {
-        case TOKEN_REGISTER: {
-            // Register operand
-            char* reg_name = strdup(parser->current_token->value);
-            parser_advance(parser);
-            
-            operand_t* operand = operand_create_register(reg_name, parser->architecture);
-            free(reg_name);
-            return operand;
-        }
-        
-        case TOKEN_NUMBER: {
-            // Immediate operand
-            uint64_t value = parser->current_token->numeric_value;
-            parser_advance(parser);
-            
-            return operand_create_immediate(value, 32); // Default to 32-bit
-        }
+    symbol_t* symbol = symbol_table_lookup(parser->symbol_table, token->value);
+    return !symbol || !symbol->defined || symbol->type != SYMBOL_CONSTANT;
+}
+
+// Why --pack-data left a section as written: data_references[crossing]
+// reads outside its label's item, or with crossing -1 an expression
+// measured across labels
+static void warn_not_packed(const parser_t* parser, const char* section, int crossing) {
+    if (crossing < 0) {
+        fprintf(stderr, "Warning: %s is not packed: an expression measures across its labels\n", section);
+        return;
+    }
+    const data_reference_t* reference = &parser->data_references[crossing];
+    fprintf(stderr, "Warning: Line %d: %s is not packed: [%s %c %llu] reads outside the item '%s' starts\n",
+            reference->line, section, reference->label, reference->displacement < 0 ? '-' : '+',
+            (unsigned long long)(reference->displacement < 0 ? 0 - (uint64_t)reference->displacement
+                                                            : (uint64_t)reference->displacement),
+            reference->label);
+}
+
+// Checked once parsing is done, when every item of .rodata and .data is known
+static bool record_data_reference(parser_t* parser, const char* label, int64_t displacement) {
+    if (parser->data_reference_count == parser->data_reference_capacity) {
+        int capacity = parser->data_reference_capacity ? parser->data_reference_capacity * 2 : 16;
+        data_reference_t* references = realloc(parser->data_references, capacity * sizeof(data_reference_t));
+        if (!references) return false;
+        parser->data_references = references;
+        parser->data_reference_capacity = capacity;
+    }
+    
+    char* copy = strdup(label);
+    if (!copy) return false;
+    parser->data_references[parser->data_reference_count++] = (data_reference_t){
+        copy, displacement, parser->current_token ? parser->current_token->line : 0
+    };
+    return true;
+}
+
+// Parse one operand of instr into operand; names are allocated like instr's
+bool parse_operand(parser_t* parser, instruction_t* instr, operand_t* operand) {
+    memset(operand, 0, sizeof(*operand));
+    if (!parser->current_token) return false;
+    
+    if (expression_starts(parser)) {
+        // Immediate operand, folded to a number
+        int64_t value;
+        if (!parse_constant(parser, &value)) return false;
         
+        operand->type = OPERAND_IMMEDIATE;
+        operand->data.imm.value = (uint64_t)value;
+        operand->data.imm.size_bits = 32; // Default to 32-bit
+        return true;
+    }
+    
+    switch (parser->current_token->type) {
+        case TOKEN_REGISTER:
         case TOKEN_IDENTIFIER: {
-            // Label reference
-            char* label_name = strdup(parser->current_token->value);
-            parser_advance(parser);
+            // Register operand or label reference
+            char* name = instruction_strdup(instr, parser->current_token->value);
+            if (!name) {
+                parser_error(parser, "Out of memory");
+                return false;
+            }
             
-            operand_t* operand = operand_create_label(label_name);
-            free(label_name);
-            return operand;
+            if (parser->current_token->type == TOKEN_REGISTER) {
+                operand->type = OPERAND_REGISTER;
+                operand->data.reg.name = name;
+                operand->data.reg.reg_info = register_lookup(name, parser->architecture);
+            } else {
+                operand->type = OPERAND_LABEL;
+                operand->data.label.name = name;
+            }
+            parser_advance(parser);
+            return true;
         }
         
+        case TOKEN_BYTE_PTR:
+        case TOKEN_WORD_PTR:
+        case TOKEN_DWORD_PTR:
+        case TOKEN_QWORD_PTR:
         case TOKEN_LBRACKET: {
-            // Memory operand [base + index*scale + displacement]
+            // Optional size keyword: byte/word/dword/qword [ptr]
+            int size_bits = 0;
+            switch (parser->current_token->type) {
+                case TOKEN_BYTE_PTR: size_bits = 8; break;
+                case TOKEN_WORD_PTR: size_bits = 16; break;
+                case TOKEN_DWORD_PTR: size_bits = 32; break;
+                case TOKEN_QWORD_PTR: size_bits = 64; break;
+                default: break;
+            }
+            if (size_bits) {
+                parser_advance(parser); // consume size keyword
+                if (parser->current_token && parser->current_token->type == TOKEN_IDENTIFIER &&
+                    strcasecmp(parser->current_token->value, "ptr") == 0) {
+                    parser_advance(parser);
+                }
+                if (!parser_expect_token(parser, TOKEN_LBRACKET)) {
+                    return false;
+                }
+            }
+            
+            // Memory operand [rel label + base + index*scale + displacement]
             parser_advance(parser); // consume '['
             
             register_info_t* base = NULL;
             register_info_t* index = NULL;
             int scale = 1;
             int64_t displacement = 0;
+            char* label = NULL;
+            bool relative = false;
             
-            // Parse base register
-            if (parser->current_token && parser->current_token->type == TOKEN_REGISTER) {
-                operand_t* temp_reg = operand_create_register(parser->current_token->value, parser->architecture);
-                if (temp_reg) {
-                    base = temp_reg->data.reg.reg_info;
-                    free(temp_reg->data.reg.name);
-                    free(temp_reg);
-                }
+            // rel, unless it is a label of that name
+            token_t* next = parser->current_token && parser->current_token->type == TOKEN_IDENTIFIER &&
+                            strcasecmp(parser->current_token->value, "rel") == 0 ? parser_peek(parser) : NULL;
+            if (next && next->type != TOKEN_RBRACKET && next->type != TOKEN_PLUS && next->type != TOKEN_MINUS) {
+                relative = true;
                 parser_advance(parser);
             }
             
-            // Parse optional + index*scale or displacement
+            // Parse base, index*scale and +/- displacement terms; each
+            // displacement term is a constant product such as 4*8 or (N+1)
+            bool first_term = true;
             while (parser->current_token && parser->current_token->type != TOKEN_RBRACKET) {
-                if (parser->current_token->type == TOKEN_PLUS) {
+                token_type_t sign = parser->current_token->type;
+                if (first_term && sign != TOKEN_MINUS && sign != TOKEN_PLUS) {
+                    sign = TOKEN_PLUS; // Leading displacement, e.g. [8 + rax]
+                } else if (sign == TOKEN_MINUS || sign == TOKEN_PLUS) {
                     parser_advance(parser);
-                    
-                    if (parser->current_token->type == TOKEN_REGISTER) {
-                        // Index register
-                        operand_t* temp_reg = operand_create_register(parser->current_token->value, parser->architecture);
-                        if (temp_reg) {
-                            index = temp_reg->data.reg.reg_info;
-                            free(temp_reg->data.reg.name);
-                            free(temp_reg);
-                        }
+                } else {
+                    parser_error(parser, "Expected '+', '-' or ']' in memory operand");
+                    instruction_free_string(instr, label);
+                    return false;
+                }
+                first_term = false;
+                
+                if (sign == TOKEN_MINUS) {
+                    int64_t term;
+                    if (!parse_constant_term(parser, &term)) {
+                        instruction_free_string(instr, label);
+                        return false;
+                    }
+                    displacement -= term;
+                } else if (is_label_reference(parser)) {
+                    // The address is taken from the label at encoding time
+                    if (label) {
+                        parser_error(parser, "Only one label can be used in a memory operand");
+                        instruction_free_string(instr, label);
+                        return false;
+                    }
+                    label = instruction_strdup(instr, parser->current_token->value);
+                    if (!label) {
+                        parser_error(parser, "Out of memory");
+                        return false;
+                    }
+                    parser_advance(parser);
+                } else {
+                    if (parser->current_token && parser->current_token->type == TOKEN_REGISTER) {
+                        register_info_t* reg = register_lookup(parser->current_token->value,
+                                                               parser->architecture);
                         parser_advance(parser);
                         
-                        // Check for scale
-                        if (parser->current_token && parser->current_token->type == TOKEN_MULTIPLY) {
+                        // reg*scale is the index, even without a base ([rbx*4 + 8]);
+                        // otherwise the first register is the base, the second the index
+                        bool scaled = parser->current_token &&
+                                      parser->current_token->type == TOKEN_MULTIPLY;
+                        if ((scaled && index) || (!scaled && base && index)) {
+                            parser_error(parser, "Too many registers in memory operand");
+                            instruction_free_string(instr, label);
+                            return false;
+                        }
+                        if (scaled) {
                             parser_advance(parser);
-                            if (parser->current_token && parser->current_token->type == TOKEN_NUMBER) {
-                                scale = (int)parser->current_token->numeric_value;
-                                parser_advance(parser);
+                            if (!parser->current_token || parser->current_token->type != TOKEN_NUMBER) {
+                                parser_error(parser, "Expected scale after '*' in memory operand");
+                                instruction_free_string(instr, label);
+                                return false;
                             }
+                            index = reg;
+                            scale = (int)parser->current_token->numeric_value;
+                            parser_advance(parser);
+                        } else if (!base) {
+                            base = reg;
+                        } else {
+                            index = reg;
                         }
-                    } else if (parser->current_token->type == TOKEN_NUMBER) {
+                    } else {
                         // Displacement
-                        displacement = (int64_t)parser->current_token->numeric_value;
-                        parser_advance(parser);
+                        int64_t term;
+                        if (!parse_constant_term(parser, &term)) {
+                            instruction_free_string(instr, label);
+                            return false;
+                        }
+                        displacement += term;
                     }
-                } else {
-                    parser_advance(parser); // Skip unknown tokens
                 }
             }
             
             if (!parser_expect_token(parser, TOKEN_RBRACKET)) {
-                return NULL;
+                instruction_free_string(instr, label);
+                return false;
+            }
+            if (label && displacement != 0 && !record_data_reference(parser, label, displacement)) {
+                parser_error(parser, "Out of memory");
+                instruction_free_string(instr, label);
+                return false;
             }
             parser_advance(parser); // consume ']'
             
-            return operand_create_memory(base, index, scale, displacement, 64);
+            operand->type = OPERAND_MEMORY;
+            operand->data.mem.base = base;
+            operand->data.mem.index = index;
+            operand->data.mem.scale = scale;
+            operand->data.mem.displacement = displacement;
+            operand->data.mem.size_bits = size_bits;
+            operand->data.mem.label = label;
+            operand->data.mem.relative = relative;
+            return true;
         }
         
         default:
             parser_error(parser, "Invalid operand");
-            return NULL;
+            return false;
+    }
+}
+
+// AVX-512 operand decorators: {k1}..{k7}, {z}, {1toN}
+static bool parse_operand_decorators(parser_t* parser, operand_t* operand) {
+    while (parser->current_token && parser->current_token->type == TOKEN_LBRACE) {
+        parser_advance(parser); // consume '{'
+        
+        token_t* token = parser->current_token;
+        if (token && token->type == TOKEN_REGISTER) {
+            operand->mask = register_lookup(token->value, parser->architecture);
+            if (!operand->mask || !(operand->mask->flags & REG_FLAG_MASK)) {
+                parser_error(parser, "Expected opmask register in decorator");
+                return false;
+            }
+            parser_advance(parser);
+        } else if (token && token->type == TOKEN_IDENTIFIER && strcasecmp(token->value, "z") == 0) {
+            operand->zeroing = true;
+            parser_advance(parser);
+        } else if (token && token->type == TOKEN_NUMBER && token->numeric_value == 1) {
+            // Broadcast {1toN} lexes as the number 1 followed by "toN"
+            parser_advance(parser);
+            token = parser->current_token;
+            if (!token || token->type != TOKEN_IDENTIFIER || strncasecmp(token->value, "to", 2) != 0 ||
+                atoi(token->value + 2) <= 0) {
+                parser_error(parser, "Invalid broadcast decorator");
+                return false;
+            }
+            operand->broadcast = atoi(token->value + 2);
+            parser_advance(parser);
+        } else {
+            parser_error(parser, "Invalid operand decorator");
+            return false;
+        }
+        
+        if (!parser_expect_token(parser, TOKEN_RBRACE)) {
+            return false;
+        }
+        parser_advance(parser); // consume '}'
     }
+    
+    return true;
 }
 
 instruction_t* parse_instruction(parser_t* parser) {
@@ -194,7 +432,7 @@ instruction_t* parse_instruction(parser_t* parser) {
         return NULL;
     }
     
-    instruction_t* instr = instruction_create(parser->current_token->value);
+    instruction_t* instr = instruction_create(parser->arena, parser->current_token->value);
     if (!instr) {
         parser_error(parser, "Failed to create instruction");
         return NULL;
@@ -211,14 +449,25 @@ instruction_t* parse_instruction(parser_t* parser) {
            parser->current_token->type != TOKEN_EOF &&
            parser->current_token->type != TOKEN_COMMENT) {
         
-        operand_t* operand = parse_operand(parser);
-        if (!operand) {
+        if (instr->operand_count == INSTRUCTION_MAX_OPERANDS) {
+            parser_error(parser, "Too many operands");
             instruction_destroy(instr);
             return NULL;
         }
         
-        instruction_add_operand(instr, operand);
-        free(operand); // instruction_add_operand copies the operand
+        operand_t operand;
+        if (!parse_operand(parser, instr, &operand)) {
+            instruction_destroy(instr);
+            return NULL;
+        }
+        
+        // The instruction owns the operand's name from here
+        bool decorated = parse_operand_decorators(parser, &operand);
+        instruction_add_operand(instr, &operand);
+        if (!decorated) {
+            instruction_destroy(instr);
+            return NULL;
+        }
         
         // Check for comma separator
         if (parser->current_token && parser->current_token->type == TOKEN_COMMA) {
@@ -231,29 +480,124 @@ instruction_t* parse_instruction(parser_t* parser) {
     return instr;
 }
 
+static bool is_data_directive(const token_t* token) {
+    static const char* const names[] = {"db", "dw", "dd", "dq", "resb", "resw", "resd", "resq",
+                                        "times", NULL};
+    
+    if (!token || token->type != TOKEN_DIRECTIVE) return false;
+    for (int i = 0; names[i]; i++) {
+        if (strcasecmp(token->value, names[i]) == 0) return true;
+    }
+    return false;
+}
+
+static bool token_is_directive(const token_t* token, const char* name) {
+    return token && token->type == TOKEN_DIRECTIVE && strcasecmp(token->value, name) == 0;
+}
+
+// name equ expression: a constant, usable in later expressions
+static bool parse_equ(parser_t* parser) {
+    char error_msg[256];
+    char* name = strdup(parser->current_token->value);
+    if (!name) {
+        parser_error(parser, "Out of memory");
+        return false;
+    }
+    
+    symbol_t* existing = symbol_table_lookup(parser->symbol_table, name);
+    if (existing && (existing->defined || existing->binding == SYMBOL_EXTERN)) {
+        snprintf(error_msg, sizeof(error_msg), "Symbol '%s' is already %s", name,
+                 existing->defined ? "defined" : "declared extern");
+        parser_error(parser, error_msg);
+        free(name);
+        return false;
+    }
+    
+    parser_advance(parser); // consume name
+    parser_advance(parser); // consume equ
+    
+    int64_t value;
+    bool ok = parse_constant(parser, &value);
+    if (ok && !symbol_table_define(parser->symbol_table, name, SYMBOL_CONSTANT, (uint64_t)value)) {
+        parser_error(parser, "Out of memory");
+        ok = false;
+    }
+    free(name);
+    return ok;
+}
+
 bool parse_label(parser_t* parser) {
     if (!parser->current_token || parser->current_token->type != TOKEN_IDENTIFIER) {
         return false;
     }
     
-    // Look ahead for colon
-    token_t* next_token = lexer_next_token(parser->lexer);
-    bool is_label = (next_token && next_token->type == TOKEN_COLON);
+    // "name:" anywhere, or NASM-style "name db ..." without the colon
+    token_t* next_token = parser_peek(parser);
+    if (token_is_directive(next_token, "equ")) {
+        return parse_equ(parser);
+    }
+    bool has_colon = next_token && next_token->type == TOKEN_COLON;
+    if (!has_colon && !is_data_directive(next_token)) {
+        return false;
+    }
     
-    if (is_label) {
-        // Define label in symbol table
-        symbol_table_define(parser->symbol_table, parser->current_token->value, 
-                          SYMBOL_LABEL, parser->current_address);
-        
-        parser_advance(parser); // consume label name
+    symbol_t* existing = symbol_table_lookup(parser->symbol_table, parser->current_token->value);
+    if (existing && existing->binding == SYMBOL_EXTERN) {
+        char error_msg[256];
+        snprintf(error_msg, sizeof(error_msg), "Label '%s' is declared extern", existing->name);
+        parser_error(parser, error_msg);
+        return false;
+    }
+    
+    // Define label in symbol table
+    symbol_t* symbol = symbol_table_define(parser->symbol_table, parser->current_token->value, 
+                                           SYMBOL_LABEL, parser->current_address);
+    if (!symbol) {
+        parser_error(parser, "Out of memory");
+        return false;
+    }
+    symbol->section = parser->current_section;
+    
+    // Text addresses are only known once the encoder thread gets here
+    if (parser->pipeline && parser->current_section == SECTION_TEXT &&
+        !pipeline_emit_label(parser->pipeline, (int)(symbol - parser->symbol_table->symbols))) {
+        parser_error(parser, "Encoding stopped");
+        return false;
+    }
+    if (parser->fanout && parser->current_section == SECTION_TEXT &&
+        !fanout_record_label(parser->fanout, (int)(symbol - parser->symbol_table->symbols))) {
+        parser_error(parser, "Out of memory");
+        return false;
+    }
+    
+    parser_advance(parser); // consume label name
+    if (has_colon) {
         parser_advance(parser); // consume colon
     }
     
-    if (next_token) {
-        token_destroy(next_token);
+    return true;
+}
+
+static bool switch_section(parser_t* parser, const char* name) {
+    int section;
+    
+    if (strcasecmp(name, "text") == 0) {
+        section = SECTION_TEXT;
+    } else if (strcasecmp(name, "data") == 0) {
+        section = SECTION_DATA;
+    } else if (strcasecmp(name, "bss") == 0) {
+        section = SECTION_BSS;
+    } else if (strcasecmp(name, "rodata") == 0) {
+        section = SECTION_RODATA;
+    } else {
+        return false;
     }
     
-    return is_label;
+    // Each section keeps its own location counter
+    parser->section_addresses[parser->current_section] = parser->current_address;
+    parser->current_section = section;
+    parser->current_address = parser->section_addresses[section];
+    return true;
 }
 
 bool parse_section_directive(parser_t* parser) {
@@ -261,16 +605,22 @@ bool parse_section_directive(parser_t* parser) {
         return false;
     }
     
-    if (strcasecmp(parser->current_token->value, "text") == 0) {
-        parser->current_section = SECTION_TEXT;
+    // ".text" or "section .text"
+    if (strcasecmp(parser->current_token->value, "section") == 0 ||
+        strcasecmp(parser->current_token->value, "segment") == 0) {
         parser_advance(parser);
-        return true;
-    } else if (strcasecmp(parser->current_token->value, "data") == 0) {
-        parser->current_section = SECTION_DATA;
+        
+        token_t* name = parser->current_token;
+        if (!name || (name->type != TOKEN_DIRECTIVE && name->type != TOKEN_IDENTIFIER) ||
+            !switch_section(parser, name->value)) {
+            parser_error(parser, "Unknown section (expected .text, .data, .rodata or .bss)");
+            return false;
+        }
         parser_advance(parser);
         return true;
-    } else if (strcasecmp(parser->current_token->value, "bss") == 0) {
-        parser->current_section = SECTION_BSS;
+    }
+    
+    if (switch_section(parser, parser->current_token->value)) {
         parser_advance(parser);
         return true;
     }
@@ -278,108 +628,585 @@ bool parse_section_directive(parser_t* parser) {
     return false;
 }
 
-data_definition_t* parse_data_definition(parser_t* parser) {
-    if (!parser->current_token || parser->current_token->type != TOKEN_DIRECTIVE) {
-        return NULL;
+// Initialized bytes of .data or .rodata
+typedef struct {
+    uint8_t** bytes;
+    size_t* size;
+    size_t* capacity;
+} data_buffer_t;
+
+static data_buffer_t data_buffer(program_t* program, int section) {
+    if (section == SECTION_RODATA) {
+        return (data_buffer_t){&program->rodata, &program->rodata_size, &program->rodata_capacity};
     }
+    return (data_buffer_t){&program->data_section, &program->data_size, &program->data_capacity};
+}
+
+// Grow a data section by size bytes; returns where they go, or NULL
+static uint8_t* program_reserve_data(data_buffer_t buffer, size_t size) {
+    if (size > SIZE_MAX - *buffer.size) return NULL;
     
-    data_definition_t* data_def = malloc(sizeof(data_definition_t));
-    if (!data_def) return NULL;
+    if (*buffer.size + size > *buffer.capacity) {
+        size_t capacity = *buffer.capacity ? *buffer.capacity : INITIAL_CAPACITY;
+        while (capacity < *buffer.size + size) {
+            if (capacity > SIZE_MAX / 2) return NULL;
+            capacity *= 2;
+        }
+        
+        uint8_t* data = realloc(*buffer.bytes, capacity);
+        if (!data) return NULL;
+        *buffer.bytes = data;
+        *buffer.capacity = capacity;
+    }
     
-    data_def->repeat_count = 1;
+    uint8_t* out = *buffer.bytes + *buffer.size;
+    *buffer.size += size;
+    return out;
+}
+
+// Append initialized bytes to a data section
+static bool program_emit_data(data_buffer_t buffer, const void* bytes, size_t size) {
+    uint8_t* out = program_reserve_data(buffer, size);
+    if (!out) return false;
     
-    // Determine data type from directive
-    if (strcasecmp(parser->current_token->value, "db") == 0) {
-        data_def->type = DATA_BYTE;
-    } else if (strcasecmp(parser->current_token->value, "dw") == 0) {
-        data_def->type = DATA_WORD;
-    } else if (strcasecmp(parser->current_token->value, "dd") == 0) {
-        data_def->type = DATA_DWORD;
-    } else if (strcasecmp(parser->current_token->value, "dq") == 0) {
-        data_def->type = DATA_QWORD;
-    } else if (strcasecmp(parser->current_token->value, "resb") == 0) {
-        data_def->type = DATA_BYTE;
-        data_def->data.byte_value = 0;
-    } else if (strcasecmp(parser->current_token->value, "resw") == 0) {
-        data_def->type = DATA_WORD;
-        data_def->data.word_value = 0;
-    } else if (strcasecmp(parser->current_token->value, "resd") == 0) {
-        data_def->type = DATA_DWORD;
-        data_def->data.dword_value = 0;
-    } else if (strcasecmp(parser->current_token->value, "resq") == 0) {
-        data_def->type = DATA_QWORD;
-        data_def->data.qword_value = 0;
+    if (bytes) {
+        memcpy(out, bytes, size);
     } else {
-        free(data_def);
-        return NULL;
+        memset(out, 0, size);
+    }
+    return true;
+}
+
+// Turn the unit bytes at buffer into count back-to-back copies of them.
+// A unit of one repeated byte is a memset; anything else copies the
+// filled prefix onto the rest, doubling it each time.
+static void replicate(uint8_t* buffer, size_t unit, size_t count) {
+    size_t total = unit * count;
+    size_t same = 1;
+    
+    while (same < unit && buffer[same] == buffer[0]) same++;
+    if (same == unit) {
+        memset(buffer + unit, buffer[0], total - unit);
+        return;
+    }
+    
+    for (size_t done = unit; done < total;) {
+        size_t length = done < total - done ? done : total - done;
+        memcpy(buffer + done, buffer, length);
+        done += length;
+    }
+}
+
+// times for data: the bytes emitted since start become count copies
+static bool program_repeat_data(data_buffer_t buffer, size_t start, uint64_t count) {
+    size_t unit = *buffer.size - start;
+    
+    if (count == 0) {
+        *buffer.size = start;
+        return true;
+    }
+    if (count == 1 || unit == 0) return true;
+    if (count - 1 > SIZE_MAX / unit) return false;
+    
+    if (!program_reserve_data(buffer, unit * (count - 1))) return false;
+    replicate(*buffer.bytes + start, unit, count);
+    return true;
+}
+
+// db/dw/dd/dq value lists and resb/resw/resd/resq reservations
+bool parse_data_definition(parser_t* parser, program_t* program) {
+    if (!parser->current_token || parser->current_token->type != TOKEN_DIRECTIVE) {
+        return false;
+    }
+    
+    // Determine data type from directive
+    static const struct {
+        const char* name;
+        data_type_t type;
+        bool reserve;
+    } directives[] = {
+        {"db", DATA_BYTE, false}, {"dw", DATA_WORD, false},
+        {"dd", DATA_DWORD, false}, {"dq", DATA_QWORD, false},
+        {"resb", DATA_BYTE, true}, {"resw", DATA_WORD, true},
+        {"resd", DATA_DWORD, true}, {"resq", DATA_QWORD, true},
+        {NULL, DATA_BYTE, false}
+    };
+    
+    int d = 0;
+    while (directives[d].name && strcasecmp(parser->current_token->value, directives[d].name) != 0) d++;
+    if (!directives[d].name) {
+        return false;
     }
     
-    bool is_reserve = (strncasecmp(parser->current_token->value, "res", 3) == 0);
+    data_type_t type = directives[d].type;
+    bool is_reserve = directives[d].reserve;
+    size_t unit_size = (size_t)1 << type;
     parser_advance(parser); // consume directive
     
-    // Parse the data value or count
-    if (parser->current_token && parser->current_token->type == TOKEN_NUMBER) {
-        uint64_t value = parser->current_token->numeric_value;
+    if (parser->current_section == SECTION_TEXT) {
+        parser_error(parser, "Data definitions are only supported in .data, .rodata and .bss");
+        return false;
+    }
+    data_buffer_t buffer = data_buffer(program, parser->current_section);
+    
+    if (is_reserve) {
+        int64_t count;
+        if (!expression_starts(parser) && (!parser->current_token || parser->current_token->type != TOKEN_IDENTIFIER)) {
+            parser_error(parser, "Expected count after reservation directive");
+            return false;
+        }
+        if (!parse_constant(parser, &count)) return false;
+        if (count < 0) {
+            parser_error(parser, "Negative reservation count");
+            return false;
+        }
         
-        if (is_reserve) {
-            data_def->repeat_count = value;
+        size_t size = (size_t)count * unit_size;
+        
+        if (parser->current_section == SECTION_BSS) {
+            program->bss_size += size;
+        } else if (!program_emit_data(buffer, NULL, size)) {
+            parser_error(parser, "Out of memory");
+            return false;
+        }
+        parser->current_address += size;
+        return true;
+    }
+    
+    if (parser->current_section == SECTION_BSS) {
+        parser_error(parser, "Initialized data in .bss (use resb/resw/resd/resq)");
+        return false;
+    }
+    
+    // Comma-separated numbers and strings
+    size_t start_size = *buffer.size;
+    do {
+        token_t* token = parser->current_token;
+        
+        if (token && token->type == TOKEN_STRING) {
+            // Strings are padded with zeros to a whole number of units
+            size_t length = strlen(token->value);
+            size_t padded = (length + unit_size - 1) / unit_size * unit_size;
+            if (!program_emit_data(buffer, token->value, length) ||
+                !program_emit_data(buffer, NULL, padded - length)) {
+                parser_error(parser, "Out of memory");
+                return false;
+            }
+            parser_advance(parser);
         } else {
-            switch (data_def->type) {
-                case DATA_BYTE:
-                    data_def->data.byte_value = (uint8_t)value;
-                    break;
-                case DATA_WORD:
-                    data_def->data.word_value = (uint16_t)value;
-                    break;
-                case DATA_DWORD:
-                    data_def->data.dword_value = (uint32_t)value;
-                    break;
-                case DATA_QWORD:
-                    data_def->data.qword_value = value;
-                    break;
+            int64_t constant;
+            if (!expression_starts(parser) && (!token || token->type != TOKEN_IDENTIFIER)) {
+                parser_error(parser, "Expected number or string in data definition");
+                return false;
+            }
+            if (!parse_constant(parser, &constant)) return false;
+            
+            uint64_t value = (uint64_t)constant;
+            uint8_t bytes[8];
+            for (size_t b = 0; b < unit_size; b++) {
+                bytes[b] = (uint8_t)(value >> (b * 8));
+            }
+            if (!program_emit_data(buffer, bytes, unit_size)) {
+                parser_error(parser, "Out of memory");
+                return false;
             }
         }
-        parser_advance(parser);
+        
+        if (!parser->current_token || parser->current_token->type != TOKEN_COMMA) break;
+        parser_advance(parser); // consume comma
+    } while (true);
+    
+    parser->current_address += *buffer.size - start_size;
+    return true;
+}
+
+// global/extern name[, name...]
+bool parse_symbol_declaration(parser_t* parser) {
+    if (!parser->current_token || parser->current_token->type != TOKEN_DIRECTIVE) {
+        return false;
+    }
+    
+    symbol_binding_t binding;
+    if (strcasecmp(parser->current_token->value, "global") == 0) {
+        binding = SYMBOL_GLOBAL;
+    } else if (strcasecmp(parser->current_token->value, "extern") == 0) {
+        binding = SYMBOL_EXTERN;
     } else {
-        free(data_def);
-        return NULL;
+        return false;
     }
+    parser_advance(parser); // consume directive
+    
+    do {
+        if (!parser->current_token || parser->current_token->type != TOKEN_IDENTIFIER) {
+            parser_error(parser, "Expected symbol name");
+            return false;
+        }
+        
+        symbol_t* symbol = symbol_table_lookup(parser->symbol_table, parser->current_token->value);
+        if (binding == SYMBOL_EXTERN && symbol && symbol->defined) {
+            char error_msg[256];
+            snprintf(error_msg, sizeof(error_msg), "Label '%s' is defined and cannot be extern", symbol->name);
+            parser_error(parser, error_msg);
+            return false;
+        }
+        
+        if (!symbol_table_declare(parser->symbol_table, parser->current_token->value, binding)) {
+            parser_error(parser, "Out of memory");
+            return false;
+        }
+        parser_advance(parser);
+        
+        if (!parser->current_token || parser->current_token->type != TOKEN_COMMA) break;
+        parser_advance(parser); // consume comma
+    } while (true);
     
-    return data_def;
+    return true;
 }
 
-void data_definition_destroy(data_definition_t* data_def) {
-    if (data_def) {
-        if (data_def->type == DATA_BYTE && data_def->data.string_value) {
-            // Handle string data later
-            free(data_def->data.string_value);
-        }
-        free(data_def);
+static bool program_add_align(program_t* program, const data_align_t* align) {
+    if (program->align_count == program->align_capacity) {
+        int capacity = program->align_capacity ? program->align_capacity * 2 : 16;
+        data_align_t* aligns = realloc(program->aligns, capacity * sizeof(data_align_t));
+        if (!aligns) return false;
+        program->aligns = aligns;
+        program->align_capacity = capacity;
+    }
+    
+    program->aligns[program->align_count++] = *align;
+    if (align->alignment > program->section_alignment[align->section]) {
+        program->section_alignment[align->section] = align->alignment;
     }
+    return true;
 }
 
-bool parse_directive(parser_t* parser) {
+// align N: zero bytes up to the next multiple of N in .data, .rodata or
+// .bss. The section itself is aligned to its largest N.
+static bool parse_align(parser_t* parser, program_t* program) {
+    parser_advance(parser); // consume directive
+    
+    int64_t alignment;
+    if (!parse_constant(parser, &alignment)) return false;
+    if (alignment <= 0 || (alignment & (alignment - 1)) != 0 || alignment > MAX_DATA_ALIGNMENT) {
+        parser_error(parser, "Alignment must be a power of two up to 4096");
+        return false;
+    }
+    if (parser->current_section == SECTION_TEXT) {
+        parser_error(parser, "align is only supported in .data, .rodata and .bss");
+        return false;
+    }
+    
+    uint64_t mask = (uint64_t)alignment - 1;
+    data_align_t align = {
+        parser->current_section, (parser->current_address + mask) & ~mask, (uint64_t)alignment, 0
+    };
+    align.padding = align.offset - parser->current_address;
+    
+    if (parser->current_section == SECTION_BSS) {
+        program->bss_size += align.padding;
+    } else if (!program_emit_data(data_buffer(program, parser->current_section), NULL, align.padding)) {
+        parser_error(parser, "Out of memory");
+        return false;
+    }
+    if (!program_add_align(program, &align)) {
+        parser_error(parser, "Out of memory");
+        return false;
+    }
+    parser->current_address = align.offset;
+    return true;
+}
+
+// .hot name[, name...]: --pack-data puts these items first in their section
+static bool parse_hot(parser_t* parser) {
+    parser_advance(parser); // consume directive
+    
+    do {
+        if (!parser->current_token || parser->current_token->type != TOKEN_IDENTIFIER) {
+            parser_error(parser, "Expected symbol name");
+            return false;
+        }
+        
+        symbol_t* symbol = symbol_table_lookup(parser->symbol_table, parser->current_token->value);
+        if (!symbol) {
+            symbol = symbol_table_declare(parser->symbol_table, parser->current_token->value, SYMBOL_LOCAL);
+        }
+        if (!symbol) {
+            parser_error(parser, "Out of memory");
+            return false;
+        }
+        symbol->hot = true;
+        parser_advance(parser);
+        
+        if (!parser->current_token || parser->current_token->type != TOKEN_COMMA) break;
+        parser_advance(parser); // consume comma
+    } while (true);
+    
+    return true;
+}
+
+bool parse_directive(parser_t* parser, program_t* program) {
     if (!parser->current_token || parser->current_token->type != TOKEN_DIRECTIVE) {
         return false;
     }
     
-    // Try to parse section directive
-    if (parse_section_directive(parser)) {
+    if (parse_section_directive(parser)) return true;
+    if (parser->has_error) return false;
+    
+    if (parse_symbol_declaration(parser)) return true;
+    if (parser->has_error) return false;
+    
+    if (token_is_directive(parser->current_token, "times")) {
+        return parse_times(parser, program);
+    }
+    if (token_is_directive(parser->current_token, "align")) {
+        return parse_align(parser, program);
+    }
+    if (token_is_directive(parser->current_token, "hot")) {
+        return parse_hot(parser);
+    }
+    
+    return parse_data_definition(parser, program);
+}
+
+// Streaming: a branch back to a .text label already placed has its final
+// displacement, so it is patched now rather than kept as a fixup. False
+// if the reference has to wait for layout.
+static bool patch_backward_reference(program_t* program, instruction_t* instr, uint64_t address) {
+    if (instr->fixup_kind != FIXUP_RELATIVE) return false;
+    
+    symbol_t* symbol = symbol_table_lookup(program->symbols, instr->fixup_label);
+    if (!symbol || !symbol->defined || symbol->type != SYMBOL_LABEL ||
+        symbol->binding == SYMBOL_EXTERN || symbol->section != SECTION_TEXT) {
+        return false;
+    }
+    
+    // Out of range displacements are reported by layout
+    int64_t value = (int64_t)symbol->address + instr->fixup_addend - (int64_t)(address + instr->size);
+    int bits = instr->fixup_size * 8;
+    if (bits < 64 && (value < -((int64_t)1 << (bits - 1)) || value >= ((int64_t)1 << (bits - 1)))) {
+        return false;
+    }
+    
+    uint8_t* field = program->code + address + instr->fixup_offset;
+    for (int b = 0; b < instr->fixup_size; b++) {
+        field[b] = (uint8_t)((uint64_t)value >> (b * 8));
+    }
+    return true;
+}
+
+// Record the label reference of an encoded instruction placed at address
+bool program_add_fixup(program_t* program, instruction_t* instr, uint64_t address) {
+    if (program->patch_backward && patch_backward_reference(program, instr, address)) {
         return true;
     }
     
-    // Try to parse data definition
-    data_definition_t* data_def = parse_data_definition(parser);
-    if (data_def) {
-        // TODO: Add data definition to program
-        data_definition_destroy(data_def);
+    if (program->fixup_count >= program->fixup_capacity) {
+        int capacity = program->fixup_capacity ? program->fixup_capacity * 2 : INITIAL_CAPACITY;
+        fixup_t* fixups = realloc(program->fixups, capacity * sizeof(fixup_t));
+        if (!fixups) return false;
+        program->fixups = fixups;
+        program->fixup_capacity = capacity;
+    }
+    
+    fixup_t* fixup = &program->fixups[program->fixup_count];
+    fixup->label = strdup(instr->fixup_label);
+    if (!fixup->label) return false;
+    
+    fixup->offset = address + instr->fixup_offset;
+    fixup->size = instr->fixup_size;
+    fixup->kind = instr->fixup_kind;
+    fixup->addend = instr->fixup_addend;
+    if (instr->fixup_kind == FIXUP_RELATIVE) {
+        fixup->addend -= (int64_t)(instr->size - instr->fixup_offset);
+    }
+    fixup->line = instr->line;
+    fixup->resolved = false;
+    program->fixup_count++;
+    return true;
+}
+
+// Encode straight into the code buffer at the current end of .text.
+// Returns 0, or -1 with a message in error.
+int program_encode(program_t* program, instruction_t* instr, arch_type_t arch,
+                   char* error, size_t error_size) {
+    if (program->code_size + MAX_INSTRUCTION_BYTES > program->code_capacity) {
+        size_t capacity = program->code_capacity * 2;
+        uint8_t* code = realloc(program->code, capacity);
+        if (!code) {
+            snprintf(error, error_size, "Out of memory");
+            return -1;
+        }
+        program->code = code;
+        program->code_capacity = capacity;
+    }
+    
+    stats_phase_t previous = stats_enter(STATS_PHASE_ENCODE);
+    uint8_t* output = program->code + program->code_size;
+    int bytes_generated = program->encode_cache ?
+                          encode_cached(program->encode_cache, instr, output, MAX_INSTRUCTION_BYTES) :
+                          encode_instruction(instr, arch, output, MAX_INSTRUCTION_BYTES);
+    stats_leave(previous);
+    
+    if (bytes_generated < 0) {
+        snprintf(error, error_size, "Cannot encode '%s': %s",
+                 instr->mnemonic, encode_error_string(bytes_generated));
+        return -1;
+    }
+    
+    instr->address = program->code_size;
+    instr->size = bytes_generated;
+    
+    if (instr->fixup_kind != FIXUP_NONE && !program_add_fixup(program, instr, instr->address)) {
+        snprintf(error, error_size, "Out of memory");
+        return -1;
+    }
+    
+    program->code_size += bytes_generated;
+    return 0;
+}
+
+// times for an instruction: it was just encoded by program_encode; copy
+// its bytes until there are repeat of them, with a fixup for each copy.
+// Returns 0, or -1 with a message in error.
+int program_repeat_code(program_t* program, instruction_t* instr, uint64_t repeat,
+                        char* error, size_t error_size) {
+    size_t unit = instr->size;
+    if (repeat <= 1 || unit == 0) return 0;
+    
+    if (repeat > (SIZE_MAX - MAX_INSTRUCTION_BYTES - instr->address) / unit) {
+        snprintf(error, error_size, "Repeat count too large");
+        return -1;
+    }
+    size_t total = unit * repeat;
+    
+    // Keep room for the next program_encode
+    size_t needed = instr->address + total + MAX_INSTRUCTION_BYTES;
+    if (needed > program->code_capacity) {
+        size_t capacity = program->code_capacity;
+        while (capacity < needed) capacity = capacity > SIZE_MAX / 2 ? needed : capacity * 2;
+        
+        uint8_t* code = realloc(program->code, capacity);
+        if (!code) {
+            snprintf(error, error_size, "Out of memory");
+            return -1;
+        }
+        program->code = code;
+        program->code_capacity = capacity;
+    }
+    
+    replicate(program->code + instr->address, unit, repeat);
+    program->code_size = instr->address + total;
+    
+    if (instr->fixup_kind != FIXUP_NONE) {
+        for (uint64_t k = 1; k < repeat; k++) {
+            if (!program_add_fixup(program, instr, instr->address + k * unit)) {
+                snprintf(error, error_size, "Out of memory");
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Parse an instruction, add it to the program and emit it repeat times
+// (once outside times; not at all for times 0)
+static bool parse_text_instruction(parser_t* parser, program_t* program, uint64_t repeat) {
+    if (parser->current_section != SECTION_TEXT) {
+        parser_error(parser, "Instructions are only supported in .text");
+        return false;
+    }
+    
+    instruction_t* instr = parse_instruction(parser);
+    if (!instr) {
+        return false; // Error occurred
+    }
+    if (repeat == 0) {
+        instruction_destroy(instr);
         return true;
     }
     
-    return false;
+    // Add instruction to program; streamed ones are freed once encoded
+    if (program->streaming) {
+        program->released_instructions++;
+    } else {
+        if (program->instruction_count >= program->instruction_capacity) {
+            program->instruction_capacity *= 2;
+            program->instructions = realloc(program->instructions, 
+                program->instruction_capacity * sizeof(instruction_t*));
+            if (!program->instructions) {
+                instruction_destroy(instr);
+                parser_error(parser, "Out of memory");
+                return false;
+            }
+        }
+        program->instructions[program->instruction_count++] = instr;
+    }
+    if (parser->fanout && !fanout_record_instruction(parser->fanout, instr, repeat)) {
+        parser_error(parser, "Out of memory");
+        return false;
+    }
+    
+    if (parser->pipeline) {
+        if (!pipeline_emit_instruction(parser->pipeline, instr, repeat)) {
+            parser_error(parser, "Encoding stopped");
+            return false;
+        }
+    } else {
+        char error_msg[256];
+        if (program_encode(program, instr, parser->architecture, error_msg, sizeof(error_msg)) != 0 ||
+            program_repeat_code(program, instr, repeat, error_msg, sizeof(error_msg)) != 0) {
+            parser_error(parser, error_msg);
+            if (program->streaming) instruction_destroy(instr);
+            return false;
+        }
+        parser->current_address = program->code_size;
+        if (program->streaming) instruction_destroy(instr);
+    }
+    return true;
 }
 
-program_t* parser_parse(parser_t* parser) {
+// times count <data definition or instruction>: the item is parsed and
+// emitted once, then replicated
+static bool parse_times(parser_t* parser, program_t* program) {
+    parser_advance(parser); // consume times
+    
+    int64_t count;
+    if (!parse_constant(parser, &count)) return false;
+    if (count < 0) {
+        parser_error(parser, "Negative repeat count");
+        return false;
+    }
+    
+    if (parser->current_token && parser->current_token->type == TOKEN_INSTRUCTION) {
+        return parse_text_instruction(parser, program, (uint64_t)count);
+    }
+    if (!is_data_directive(parser->current_token) || token_is_directive(parser->current_token, "times")) {
+        parser_error(parser, "Expected data definition or instruction after times");
+        return false;
+    }
+    
+    uint64_t start_address = parser->current_address;
+    data_buffer_t buffer = data_buffer(program, parser->current_section);
+    size_t start_data = *buffer.size;
+    uint64_t start_bss = program->bss_size;
+    if (!parse_data_definition(parser, program)) return false;
+    
+    uint64_t unit = parser->current_address - start_address;
+    if (unit && (uint64_t)count > UINT64_MAX / unit) {
+        parser_error(parser, "Repeat count too large");
+        return false;
+    }
+    if (parser->current_section == SECTION_BSS) {
+        program->bss_size = start_bss + unit * (uint64_t)count;
+    } else if (!program_repeat_data(buffer, start_data, (uint64_t)count)) {
+        parser_error(parser, "Out of memory");
+        return false;
+    }
+    parser->current_address = start_address + unit * (uint64_t)count;
+    return true;
+}
+
+// Empty program that encodes for arch; symbols is left for the caller to set
+program_t* program_create(arch_type_t arch) {
     program_t* program = malloc(sizeof(program_t));
     if (!program) return NULL;
     
@@ -391,25 +1218,65 @@ program_t* parser_parse(parser_t* parser) {
     
     program->instruction_count = 0;
     program->instruction_capacity = INITIAL_CAPACITY;
-    program->data_definitions = malloc(INITIAL_CAPACITY * sizeof(data_definition_t*));
-    program->data_count = 0;
-    program->data_capacity = INITIAL_CAPACITY;
-    program->symbols = parser->symbol_table;
-    program->code = malloc(MAX_CODE_SIZE);
+    program->fixups = NULL;
+    program->fixup_count = 0;
+    program->fixup_capacity = 0;
+    program->symbols = NULL;
+    program->code = malloc(INITIAL_CODE_CAPACITY);
     program->code_size = 0;
-    program->data_section = malloc(MAX_CODE_SIZE);
+    program->code_capacity = INITIAL_CODE_CAPACITY;
+    program->data_section = NULL;
     program->data_size = 0;
+    program->data_capacity = 0;
+    program->bss_size = 0;
+    program->rodata = NULL;
+    program->rodata_size = 0;
+    program->rodata_capacity = 0;
+    program->rodata_strings = 0;
+    program->rodata_merged = 0;
+    program->data_packed = 0;
+    program->aligns = NULL;
+    program->align_count = 0;
+    program->align_capacity = 0;
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        program->section_base[i] = 0;
+        program->section_alignment[i] = 0;
+    }
+    program->cold_start = 0;
+    program->text_distances = NULL;
+    program->text_distance_count = 0;
     program->current_section = SECTION_TEXT;
+    program->streaming = false;
+    program->patch_backward = false;
+    program->released_instructions = 0;
+    program->arena = NULL;
+    program->encode_cache = encode_cache_create(arch); // Optional
     
-    if (!program->code || !program->data_section || !program->data_definitions) {
+    if (!program->code) {
+        encode_cache_destroy(program->encode_cache);
         free(program->instructions);
-        free(program->data_definitions);
-        free(program->code);
-        free(program->data_section);
         free(program);
         return NULL;
     }
     
+    return program;
+}
+
+program_t* parser_parse(parser_t* parser) {
+    program_t* program = program_create(parser->architecture);
+    if (!program) return NULL;
+    
+    program->symbols = parser->symbol_table;
+    program->arena = parser->arena;
+    program->streaming = parser->streaming;
+    program->patch_backward = parser->streaming && !parser->pipeline;
+    
+    if (parser->pipeline && !pipeline_start_encoder(parser->pipeline, program)) {
+        parser_error(parser, "Cannot start the encoder thread");
+        program_destroy(program);
+        return NULL;
+    }
+    
     // Parse the input
     while (parser->current_token && parser->current_token->type != TOKEN_EOF && !parser->has_error) {
         skip_newlines(parser);
@@ -422,41 +1289,22 @@ program_t* parser_parse(parser_t* parser) {
         if (parse_label(parser)) {
             continue;
         }
+        if (parser->has_error) {
+            break;
+        }
         
         // Try to parse directive
-        if (parse_directive(parser)) {
+        if (parse_directive(parser, program)) {
             continue;
         }
+        if (parser->has_error) {
+            break;
+        }
         
         // Parse instruction
         if (parser->current_token->type == TOKEN_INSTRUCTION) {
-            instruction_t* instr = parse_instruction(parser);
-            if (!instr) {
-                break; // Error occurred
-            }
-            
-            // Add instruction to program
-            if (program->instruction_count >= program->instruction_capacity) {
-                program->instruction_capacity *= 2;
-                program->instructions = realloc(program->instructions, 
-                    program->instruction_capacity * sizeof(instruction_t*));
-                if (!program->instructions) {
-                    instruction_destroy(instr);
-                    break;
-                }
-            }
-            
-            program->instructions[program->instruction_count++] = instr;
-            
-            // Encode instruction
-            uint8_t instruction_bytes[16];
-            int bytes_generated = encode_instruction(instr, parser->architecture, 
-                                                   instruction_bytes, sizeof(instruction_bytes));
-            
-            if (bytes_generated > 0 && program->code_size + bytes_generated <= MAX_CODE_SIZE) {
-                memcpy(program->code + program->code_size, instruction_bytes, bytes_generated);
-                program->code_size += bytes_generated;
-                parser->current_address += bytes_generated;
+            if (!parse_text_instruction(parser, program, 1)) {
+                break;
             }
         } else {
             parser_error(parser, "Unexpected token");
@@ -466,33 +1314,87 @@ program_t* parser_parse(parser_t* parser) {
         skip_newlines(parser);
     }
     
+    // Wait for the encoder; its errors come first in the source
+    if (parser->pipeline) {
+        pipeline_finish_encoder(parser->pipeline, parser);
+    }
+    
+    // Encoding is done; later phases patch the bytes in place
+    if (program->encode_cache) {
+        if (stats_active) {
+            stats_active->encode_cache_hits = program->encode_cache->hits;
+            stats_active->encode_cache_misses = program->encode_cache->misses;
+        }
+        encode_cache_destroy(program->encode_cache);
+        program->encode_cache = NULL;
+    }
+    
     if (parser->has_error) {
         program_destroy(program);
         return NULL;
     }
     
+    program->text_distances = parser->text_distances;
+    program->text_distance_count = parser->text_distance_count;
+    parser->text_distances = NULL;
+    parser->text_distance_count = parser->text_distance_capacity = 0;
+    
+    // A [label + disp] that reads into the next item needs the items in place
+    int rodata_crossing = data_reference_crossing(program, SECTION_RODATA, program->rodata_size,
+                                                  parser->data_references, parser->data_reference_count);
+    if (rodata_crossing >= 0) {
+        parser->pinned[SECTION_RODATA] = true;
+    }
+    if (!rodata_merge(program, parser->pinned[SECTION_RODATA], parser->pack_data, parser->merge_constants)) {
+        parser_error(parser, "Out of memory merging .rodata");
+        program_destroy(program);
+        return NULL;
+    }
+    if (parser->pack_data && parser->pinned[SECTION_RODATA]) {
+        warn_not_packed(parser, ".rodata", rodata_crossing);
+    }
+    
+    int data_crossing = -1;
+    if (parser->pack_data) {
+        data_crossing = data_reference_crossing(program, SECTION_DATA, program->data_size,
+                                                parser->data_references, parser->data_reference_count);
+    }
+    if (data_crossing >= 0) {
+        parser->pinned[SECTION_DATA] = true;
+    }
+    if (parser->pack_data && parser->pinned[SECTION_DATA]) {
+        warn_not_packed(parser, ".data", data_crossing);
+    } else if (parser->pack_data && !data_layout_pack(program)) {
+        parser_error(parser, "Out of memory packing .data");
+        program_destroy(program);
+        return NULL;
+    }
+    
     return program;
 }
 
 void program_destroy(program_t* program) {
     if (!program) return;
     
+    // Arena instructions go with the arena
     if (program->instructions) {
-        for (int i = 0; i < program->instruction_count; i++) {
+        for (int i = 0; i < program->instruction_count && !program->arena; i++) {
             instruction_destroy(program->instructions[i]);
         }
         free(program->instructions);
     }
     
-    if (program->data_definitions) {
-        for (int i = 0; i < program->data_count; i++) {
-            data_definition_destroy(program->data_definitions[i]);
-        }
-        free(program->data_definitions);
+    for (int i = 0; i < program->fixup_count; i++) {
+        free(program->fixups[i].label);
     }
+    free(program->fixups);
     
     free(program->code);
     free(program->data_section);
+    free(program->rodata);
+    free(program->aligns);
+    free(program->text_distances);
+    encode_cache_destroy(program->encode_cache);
     // Note: Don't destroy symbol_table here as it's owned by parser
     free(program);
 } 
\ No newline at end of file
@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "../include/perf_jit.h"
+
+// Symbol information for code placed in memory by --run, in the two
+// formats perf understands: /tmp/perf-<pid>.map (symbols only) and the
+// jitdump stream (symbols, code bytes and line numbers), which
+// `perf inject --jit` turns into per-function ELF images. A function
+// starts at a .text label and runs to the next one.
+
+#define JITDUMP_MAGIC 0x4A695444  // "JiTD"
+#define JITDUMP_VERSION 1
+#define JIT_CODE_LOAD 0
+#define JIT_CODE_DEBUG_INFO 2
+#define JIT_CODE_CLOSE 3
+
+typedef struct {
+    const char* name;
+    uint64_t start;
+    uint64_t size;
+    int order;                    // Definition order, to keep the first alias
+} jit_function_t;
+
+typedef struct {
+    jit_function_t* functions;
+    int count;
+} function_list_t;
+
+static void collect_label(symbol_t* symbol, void* context) {
+    function_list_t* list = context;
+    
+    if (symbol->defined && symbol->type == SYMBOL_LABEL && symbol->section == SECTION_TEXT) {
+        list->functions[list->count].name = symbol->name;
+        list->functions[list->count].start = symbol->address;
+        list->functions[list->count].order = list->count;
+        list->count++;
+    }
+}
+
+static int compare_functions(const void* a, const void* b) {
+    const jit_function_t* x = a;
+    const jit_function_t* y = b;
+    if (x->start != y->start) return x->start < y->start ? -1 : 1;
+    return x->order - y->order;
+}
+
+// Split .text at its labels. Code before the first label is not reported.
+static int collect_functions(const program_t* program, function_list_t* list) {
+    list->count = 0;
+    list->functions = malloc((program->symbols->symbol_count + 1) * sizeof(jit_function_t));
+    if (!list->functions) {
+        fprintf(stderr, "Error: Out of memory collecting functions\n");
+        return -1;
+    }
+    
+    // Labels come in definition order, which a global declared early or
+    // --profile reordering can make differ from address order
+    symbol_table_foreach(program->symbols, collect_label, list);
+    qsort(list->functions, list->count, sizeof(jit_function_t), compare_functions);
+    
+    // Aliases keep the first name
+    int count = 0;
+    for (int i = 0; i < list->count; i++) {
+        if (count > 0 && list->functions[count - 1].start == list->functions[i].start) continue;
+        list->functions[count++] = list->functions[i];
+    }
+    list->count = count;
+    
+    uint64_t end = program->section_base[SECTION_TEXT] + program->code_size;
+    for (int i = 0; i < list->count; i++) {
+        uint64_t next = i + 1 < list->count ? list->functions[i + 1].start : end;
+        list->functions[i].size = next - list->functions[i].start;
+    }
+    return 0;
+}
+
+int perf_map_write(const program_t* program) {
+    function_list_t list;
+    char path[64];
+    
+    if (collect_functions(program, &list) != 0) {
+        return -1;
+    }
+    
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    FILE* file = fopen(path, "a");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open '%s': %s\n", path, strerror(errno));
+        free(list.functions);
+        return -1;
+    }
+    
+    for (int i = 0; i < list.count; i++) {
+        if (list.functions[i].size == 0) continue;
+        fprintf(file, "%llx %llx %s\n", (unsigned long long)list.functions[i].start,
+                (unsigned long long)list.functions[i].size, list.functions[i].name);
+    }
+    
+    int result = fclose(file) == 0 ? 0 : -1;
+    if (result != 0) {
+        fprintf(stderr, "Error: Failed to write '%s'\n", path);
+    }
+    free(list.functions);
+    return result;
+}
+
+// jitdump timestamps must use the clock perf records with (perf record -k mono)
+static uint64_t timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void write_u32(FILE* file, uint32_t value) {
+    fwrite(&value, sizeof(value), 1, file);
+}
+
+static void write_u64(FILE* file, uint64_t value) {
+    fwrite(&value, sizeof(value), 1, file);
+}
+
+static void write_record_header(FILE* file, uint32_t id, uint32_t size) {
+    write_u32(file, id);
+    write_u32(file, size);
+    write_u64(file, timestamp());
+}
+
+jitdump_t* jitdump_open(const char* directory, arch_type_t arch) {
+    char path[PATH_MAX];
+    
+    jitdump_t* dump = calloc(1, sizeof(jitdump_t));
+    if (!dump) return NULL;
+    
+    switch (arch) {
+        case ARCH_X86_64: dump->machine = EM_X86_64; break;
+        case ARCH_ARM_32: dump->machine = EM_ARM; break;
+        case ARCH_ARM_64: dump->machine = EM_AARCH64; break;
+        default: dump->machine = EM_386; break;
+    }
+    
+    snprintf(path, sizeof(path), "%s/jit-%d.dump", directory, (int)getpid());
+    dump->file = fopen(path, "w+");
+    if (!dump->file) {
+        fprintf(stderr, "Error: Cannot create '%s': %s\n", path, strerror(errno));
+        free(dump);
+        return NULL;
+    }
+    
+    // File header
+    write_u32(dump->file, JITDUMP_MAGIC);
+    write_u32(dump->file, JITDUMP_VERSION);
+    write_u32(dump->file, 40);
+    write_u32(dump->file, dump->machine);
+    write_u32(dump->file, 0);
+    write_u32(dump->file, (uint32_t)getpid());
+    write_u64(dump->file, timestamp());
+    write_u64(dump->file, 0);
+    fflush(dump->file);
+    
+    // perf finds the dump through this executable mapping of it
+    dump->marker_size = sysconf(_SC_PAGESIZE);
+    dump->marker = mmap(NULL, dump->marker_size, PROT_READ | PROT_EXEC, MAP_PRIVATE,
+                        fileno(dump->file), 0);
+    if (dump->marker == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map '%s': %s\n", path, strerror(errno));
+        fclose(dump->file);
+        free(dump);
+        return NULL;
+    }
+    
+    return dump;
+}
+
+// Line table for one function: one entry per instruction
+static void write_debug_info(jitdump_t* dump, const program_t* program, const jit_function_t* function,
+                             const char* source_name) {
+    uint64_t text = program->section_base[SECTION_TEXT];
+    size_t name_size = strlen(source_name) + 1;
+    uint64_t entries = 0;
+    
+    for (int i = 0; i < program->instruction_count; i++) {
+        uint64_t address = text + program->instructions[i]->address;
+        if (address >= function->start && address < function->start + function->size) entries++;
+    }
+    if (entries == 0) return;
+    
+    write_record_header(dump->file, JIT_CODE_DEBUG_INFO,
+                        16 + 16 + entries * (16 + name_size));
+    write_u64(dump->file, function->start);
+    write_u64(dump->file, entries);
+    for (int i = 0; i < program->instruction_count; i++) {
+        const instruction_t* instr = program->instructions[i];
+        uint64_t address = text + instr->address;
+        if (address < function->start || address >= function->start + function->size) continue;
+        
+        write_u64(dump->file, address);
+        write_u32(dump->file, (uint32_t)instr->line);
+        write_u32(dump->file, 0);  // Discriminator
+        fwrite(source_name, 1, name_size, dump->file);
+    }
+}
+
+// JIT_CODE_DEBUG_INFO then JIT_CODE_LOAD for every function. The code
+// must already be at its final address.
+int jitdump_write_program(jitdump_t* dump, const program_t* program, const char* source_name) {
+    function_list_t list;
+    char full_path[PATH_MAX];
+    
+    if (collect_functions(program, &list) != 0) {
+        return -1;
+    }
+    if (realpath(source_name, full_path)) {
+        source_name = full_path;
+    }
+    
+    uint32_t pid = (uint32_t)getpid();
+    uint32_t tid = (uint32_t)syscall(SYS_gettid);
+    uint64_t text = program->section_base[SECTION_TEXT];
+    
+    for (int i = 0; i < list.count; i++) {
+        const jit_function_t* function = &list.functions[i];
+        if (function->size == 0) continue;
+        
+        write_debug_info(dump, program, function, source_name);
+        
+        size_t name_size = strlen(function->name) + 1;
+        write_record_header(dump->file, JIT_CODE_LOAD, 16 + 40 + name_size + function->size);
+        write_u32(dump->file, pid);
+        write_u32(dump->file, tid);
+        write_u64(dump->file, function->start);  // vma
+        write_u64(dump->file, function->start);  // code_addr
+        write_u64(dump->file, function->size);
+        write_u64(dump->file, dump->code_index++);
+        fwrite(function->name, 1, name_size, dump->file);
+        fwrite(program->code + (function->start - text), 1, function->size, dump->file);
+    }
+    
+    free(list.functions);
+    if (fflush(dump->file) != 0 || ferror(dump->file)) {
+        fprintf(stderr, "Error: Failed to write the jitdump file\n");
+        return -1;
+    }
+    return 0;
+}
+
+void jitdump_close(jitdump_t* dump) {
+    if (!dump) return;
+    write_record_header(dump->file, JIT_CODE_CLOSE, 16);
+    munmap(dump->marker, dump->marker_size);
+    fclose(dump->file);
+    free(dump);
+}
@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/pipeline.h"
+#include "../include/stats.h"
+
+// --pipeline: lexing, parsing and encoding run as three threads. Text
+// addresses depend on encoded sizes, so the parser sends label definitions
+// down the IR ring with the instructions and the encoder assigns them. The
+// encoder only records the addresses; they are written to the symbol table
+// after it is joined, or while it is idle in pipeline_sync, since the parser
+// keeps adding symbols meanwhile.
+
+// Blocking ring access; time spent stalled is charged to the wait phase
+static void* wait_write(ring_t* ring) {
+    void* slot = ring_try_write(ring);
+    if (!slot) {
+        stats_phase_t previous = stats_enter(STATS_PHASE_WAIT);
+        slot = ring_write(ring);
+        stats_leave(previous);
+    }
+    return slot;
+}
+
+static void* wait_read(ring_t* ring) {
+    void* slot = ring_try_read(ring);
+    if (!slot) {
+        stats_phase_t previous = stats_enter(STATS_PHASE_WAIT);
+        slot = ring_read(ring);
+        stats_leave(previous);
+    }
+    return slot;
+}
+
+static void* lexer_main(void* argument) {
+    pipeline_t* pipeline = argument;
+    bool done = false;
+
+    stats_thread_begin(STATS_PHASE_LEX);
+    while (!done) {
+        token_block_t* block = wait_write(&pipeline->tokens);
+        if (!block) break; // Parser stopped early
+
+        block->count = 0;
+        while (block->count < PIPELINE_TOKEN_BLOCK && !done) {
+            token_t* token = lexer_next_token(pipeline->lexer);
+            block->tokens[block->count++] = token;
+            done = !token || token->type == TOKEN_EOF;
+        }
+        if (stats_active) {
+            stats_active->tokens += block->count;
+        }
+        ring_publish(&pipeline->tokens);
+    }
+    stats_thread_end();
+    return NULL;
+}
+
+static bool record_label(pipeline_t* pipeline, int symbol) {
+    if (pipeline->label_count >= pipeline->label_capacity) {
+        int capacity = pipeline->label_capacity ? pipeline->label_capacity * 2 : 256;
+        label_address_t* labels = realloc(pipeline->labels, capacity * sizeof(label_address_t));
+        if (!labels) return false;
+        pipeline->labels = labels;
+        pipeline->label_capacity = capacity;
+    }
+
+    pipeline->labels[pipeline->label_count].symbol = symbol;
+    pipeline->labels[pipeline->label_count].address = pipeline->program->code_size;
+    pipeline->label_count++;
+    return true;
+}
+
+static void* encoder_main(void* argument) {
+    pipeline_t* pipeline = argument;
+    bool done = false;
+    bool failed = false;
+
+    stats_thread_begin(STATS_PHASE_ENCODE);
+    while (!done && !failed) {
+        ir_block_t* block = wait_read(&pipeline->ir);
+        if (!block) break;
+
+        for (int i = 0; i < block->count && !failed; i++) {
+            ir_item_t* item = &block->items[i];
+            if (item->instr) {
+                if (program_encode(pipeline->program, item->instr, pipeline->architecture,
+                                   pipeline->error_message, sizeof(pipeline->error_message)) != 0 ||
+                    program_repeat_code(pipeline->program, item->instr, item->repeat,
+                                        pipeline->error_message, sizeof(pipeline->error_message)) != 0) {
+                    pipeline->error_line = item->instr->line;
+                    failed = true;
+                }
+                if (pipeline->program->streaming) {
+                    instruction_destroy(item->instr);
+                }
+            } else if (!record_label(pipeline, item->symbol)) {
+                snprintf(pipeline->error_message, sizeof(pipeline->error_message), "Out of memory");
+                failed = true;
+            }
+        }
+        done = block->last;
+        ring_release(&pipeline->ir);
+    }
+
+    // Unblocks a parser waiting for IR space
+    if (failed) {
+        __atomic_store_n(&pipeline->encoder_failed, 1, __ATOMIC_RELEASE);
+    }
+    stats_thread_end();
+    return NULL;
+}
+
+token_t* pipeline_next_token(pipeline_t* pipeline) {
+    // Past EOF the lexer thread no longer touches the lexer
+    if (pipeline->tokens_done) {
+        return lexer_next_token(pipeline->lexer);
+    }
+
+    if (!pipeline->token_block) {
+        pipeline->token_block = wait_read(&pipeline->tokens);
+        if (!pipeline->token_block) return NULL;
+        pipeline->token_index = 0;
+    }
+
+    token_t* token = pipeline->token_block->tokens[pipeline->token_index++];
+    if (pipeline->token_index == pipeline->token_block->count) {
+        ring_release(&pipeline->tokens);
+        pipeline->token_block = NULL;
+    }
+    if (!token || token->type == TOKEN_EOF) {
+        pipeline->tokens_done = true;
+    }
+    return token;
+}
+
+bool pipeline_start_encoder(pipeline_t* pipeline, program_t* program) {
+    pipeline->program = program;
+    if (pthread_create(&pipeline->encoder_thread, NULL, encoder_main, pipeline) != 0) {
+        return false;
+    }
+    pipeline->encoder_running = true;
+    return true;
+}
+
+// Next free item in the IR block being filled; NULL once the encoder failed
+static ir_item_t* next_item(pipeline_t* pipeline) {
+    if (!pipeline->ir_block) {
+        pipeline->ir_block = wait_write(&pipeline->ir);
+        if (!pipeline->ir_block) return NULL;
+        pipeline->ir_block->count = 0;
+        pipeline->ir_block->last = false;
+    }
+    return &pipeline->ir_block->items[pipeline->ir_block->count++];
+}
+
+static void item_added(pipeline_t* pipeline) {
+    if (pipeline->ir_block->count == PIPELINE_IR_BLOCK) {
+        ring_publish(&pipeline->ir);
+        pipeline->ir_block = NULL;
+    }
+}
+
+bool pipeline_emit_instruction(pipeline_t* pipeline, instruction_t* instr, uint64_t repeat) {
+    ir_item_t* item = next_item(pipeline);
+    if (!item) return false;
+
+    item->instr = instr;
+    item->repeat = repeat;
+    item->symbol = -1;
+    item_added(pipeline);
+    return true;
+}
+
+bool pipeline_emit_label(pipeline_t* pipeline, int symbol) {
+    ir_item_t* item = next_item(pipeline);
+    if (!item) return false;
+
+    item->instr = NULL;
+    item->repeat = 0;
+    item->symbol = symbol;
+    item_added(pipeline);
+    return true;
+}
+
+// Write the label addresses and .text size the encoder has produced back
+// into the parser. Only safe while the encoder is idle or joined.
+static void apply_labels(pipeline_t* pipeline, parser_t* parser) {
+    for (int i = pipeline->labels_applied; i < pipeline->label_count; i++) {
+        parser->symbol_table->symbols[pipeline->labels[i].symbol].address = pipeline->labels[i].address;
+    }
+    pipeline->labels_applied = pipeline->label_count;
+
+    parser->section_addresses[SECTION_TEXT] = pipeline->program->code_size;
+    if (parser->current_section == SECTION_TEXT) {
+        parser->current_address = pipeline->program->code_size;
+    }
+}
+
+// Flush the IR block being filled and wait until the encoder has consumed
+// everything, so $ and .text labels have their addresses. Used by constant
+// expressions; false if the encoder failed.
+bool pipeline_sync(pipeline_t* pipeline, parser_t* parser) {
+    if (!pipeline->encoder_running) return true;
+
+    if (pipeline->ir_block) {
+        ring_publish(&pipeline->ir);
+        pipeline->ir_block = NULL;
+    }
+
+    stats_phase_t previous = stats_enter(STATS_PHASE_WAIT);
+    bool drained = ring_drain(&pipeline->ir);
+    stats_leave(previous);
+    if (!drained) return false;
+
+    apply_labels(pipeline, parser);
+    return true;
+}
+
+// Flush the last IR block, wait for the encoder and apply its results. An
+// encoder error replaces any parser error: everything the encoder saw came
+// earlier in the source.
+void pipeline_finish_encoder(pipeline_t* pipeline, parser_t* parser) {
+    if (!pipeline->encoder_running) return;
+
+    ir_block_t* block = pipeline->ir_block;
+    if (!block) {
+        block = wait_write(&pipeline->ir);
+        if (block) block->count = 0;
+    }
+    if (block) {
+        block->last = true;
+        ring_publish(&pipeline->ir);
+        pipeline->ir_block = NULL;
+    }
+
+    pthread_join(pipeline->encoder_thread, NULL);
+    pipeline->encoder_running = false;
+
+    if (pipeline->encoder_failed) {
+        parser->has_error = true;
+        snprintf(parser->error_message, sizeof(parser->error_message), "Line %d: %s",
+                 pipeline->error_line, pipeline->error_message);
+        return;
+    }
+
+    apply_labels(pipeline, parser);
+}
+
+// Tokens the parser never consumed
+static void discard_tokens(pipeline_t* pipeline) {
+    token_block_t* block = pipeline->token_block;
+    int index = pipeline->token_index;
+
+    if (!block) {
+        block = ring_try_read(&pipeline->tokens);
+        index = 0;
+    }
+    while (block) {
+        for (int i = index; i < block->count; i++) {
+            token_destroy(block->tokens[i]);
+        }
+        ring_release(&pipeline->tokens);
+        block = ring_try_read(&pipeline->tokens);
+        index = 0;
+    }
+}
+
+program_t* pipeline_parse(parser_t* parser) {
+    pipeline_t pipeline;
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.lexer = parser->lexer;
+    pipeline.architecture = parser->architecture;
+
+    if (!ring_init(&pipeline.tokens, PIPELINE_RING_SLOTS, sizeof(token_block_t), &pipeline.stop_lexing) ||
+        !ring_init(&pipeline.ir, PIPELINE_RING_SLOTS, sizeof(ir_block_t), &pipeline.encoder_failed)) {
+        ring_free(&pipeline.tokens);
+        parser_error(parser, "Out of memory");
+        return NULL;
+    }
+
+    if (pthread_create(&pipeline.lexer_thread, NULL, lexer_main, &pipeline) != 0) {
+        ring_free(&pipeline.tokens);
+        ring_free(&pipeline.ir);
+        parser_error(parser, "Cannot start the lexer thread");
+        return NULL;
+    }
+
+    parser->pipeline = &pipeline;
+    program_t* program = parser_parse(parser);
+    parser->pipeline = NULL;
+
+    __atomic_store_n(&pipeline.stop_lexing, 1, __ATOMIC_RELEASE);
+    pthread_join(pipeline.lexer_thread, NULL);
+    discard_tokens(&pipeline);
+
+    free(pipeline.labels);
+    ring_free(&pipeline.tokens);
+    ring_free(&pipeline.ir);
+    return program;
+}
@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include "../include/ring.h"
+
+// Head and tail only ever increase; unsigned wraparound keeps head - tail
+// correct. Each index is stored by one thread with release semantics and
+// loaded by the other with acquire, which orders the slot contents.
+
+bool ring_init(ring_t* ring, uint32_t capacity, size_t slot_size, const int* cancel) {
+    memset(ring, 0, sizeof(*ring));
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) return false;
+
+    ring->slots = malloc((size_t)capacity * slot_size);
+    if (!ring->slots) return false;
+    ring->slot_size = slot_size;
+    ring->mask = capacity - 1;
+    ring->cancel = cancel;
+    return true;
+}
+
+void ring_free(ring_t* ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+static void* slot_at(ring_t* ring, uint32_t index) {
+    return ring->slots + (size_t)(index & ring->mask) * ring->slot_size;
+}
+
+// Spin briefly, then yield, then sleep: a stalled stage should not hold a
+// core the other stages could use
+static void backoff(unsigned attempt) {
+    if (attempt < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else if (attempt < 1024) {
+        sched_yield();
+    } else {
+        struct timespec delay = {0, 50000};
+        nanosleep(&delay, NULL);
+    }
+}
+
+static bool cancelled(const ring_t* ring) {
+    return ring->cancel && __atomic_load_n(ring->cancel, __ATOMIC_ACQUIRE);
+}
+
+void* ring_try_write(ring_t* ring) {
+    uint32_t head = ring->head;
+    if (head - ring->cached_tail > ring->mask) {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - ring->cached_tail > ring->mask) return NULL;
+    }
+    return slot_at(ring, head);
+}
+
+// Wait for a free slot; NULL if the ring was cancelled
+void* ring_write(ring_t* ring) {
+    for (unsigned attempt = 0;; attempt++) {
+        void* slot = ring_try_write(ring);
+        if (slot) return slot;
+        if (cancelled(ring)) return NULL;
+        backoff(attempt);
+    }
+}
+
+void ring_publish(ring_t* ring) {
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+// Producer: wait until the consumer has released every published slot.
+// False if the ring was cancelled first.
+bool ring_drain(ring_t* ring) {
+    for (unsigned attempt = 0;; attempt++) {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (ring->cached_tail == ring->head) return true;
+        if (cancelled(ring)) return false;
+        backoff(attempt);
+    }
+}
+
+void* ring_try_read(ring_t* ring) {
+    uint32_t tail = ring->tail;
+    if (tail == ring->cached_head) {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == ring->cached_head) return NULL;
+    }
+    return slot_at(ring, tail);
+}
+
+// Wait for a published slot; NULL if the ring was cancelled
+void* ring_read(ring_t* ring) {
+    for (unsigned attempt = 0;; attempt++) {
+        void* slot = ring_try_read(ring);
+        if (slot) return slot;
+        if (cancelled(ring)) return NULL;
+        backoff(attempt);
+    }
+}
+
+void ring_release(ring_t* ring) {
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
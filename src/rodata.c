@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/rodata.h"
+#include "../include/data_layout.h"
+
+typedef struct {
+    data_item_t item;
+    bool string;
+    uint32_t hash;
+    int home;                   // Entry holding the bytes; itself if it survives
+    uint64_t delta;             // Offset of this entry inside home
+} rodata_entry_t;
+
+// A string for the tail sort: its last character is end[-1]
+typedef struct {
+    const uint8_t* end;
+    uint64_t length;            // Without the NUL
+    int entry;
+} tail_key_t;
+
+// Order by the reversed text, so a string sorts right before the strings
+// it is a suffix of
+static int compare_tails(const void* a, const void* b) {
+    const tail_key_t* x = a;
+    const tail_key_t* y = b;
+    uint64_t common = x->length < y->length ? x->length : y->length;
+
+    for (uint64_t i = 1; i <= common; i++) {
+        if (x->end[-(int64_t)i] != y->end[-(int64_t)i]) {
+            return x->end[-(int64_t)i] < y->end[-(int64_t)i] ? -1 : 1;
+        }
+    }
+    return x->length < y->length ? -1 : x->length > y->length;
+}
+
+// Text ending in its only NUL. Binary constants that happen to end in a
+// zero byte keep their alignment.
+static bool is_string(const uint8_t* bytes, uint64_t length) {
+    if (length == 0 || bytes[length - 1] != 0) return false;
+
+    for (uint64_t i = 0; i + 1 < length; i++) {
+        uint8_t c = bytes[i];
+        if ((c < 0x20 || c > 0x7e) && c != '\t' && c != '\n' && c != '\r' && c < 0x80) return false;
+    }
+    return true;
+}
+
+// One entry per item, except that an item a constant runs into without
+// an align in between joins that constant's entry: a table with labels
+// inside stays whole.
+// Strings need no alignment. Constants keep the one they had, up to
+// RODATA_MAX_ALIGNMENT or what align asked for; when packed their size
+// decides instead.
+static int collect_entries(program_t* program, bool pack, rodata_entry_t** entries_out) {
+    data_item_t* items;
+    int item_count = data_items_collect(program, SECTION_RODATA, program->rodata_size, &items);
+    if (item_count < 0) return -1;
+
+    rodata_entry_t* entries = calloc(item_count, sizeof(rodata_entry_t));
+    if (!entries) {
+        free(items);
+        return -1;
+    }
+
+    int count = 0;
+    bool after_constant = false;
+    for (int i = 0; i < item_count; i++) {
+        const data_item_t* item = &items[i];
+        bool string = item->alignment == 1 && is_string(program->rodata + item->start, item->length);
+        rodata_entry_t* last = count > 0 ? &entries[count - 1] : NULL;
+
+        if (last && after_constant && item->alignment == 1 && last->item.start + last->item.length == item->start) {
+            last->item.length += item->length;
+            last->item.hot |= item->hot;
+        } else {
+            entries[count] = (rodata_entry_t){.item = *item, .string = string, .home = count};
+            count++;
+        }
+        after_constant = !string;
+    }
+
+    for (int i = 0; i < count; i++) {
+        rodata_entry_t* entry = &entries[i];
+        data_item_t* item = &entry->item;
+        const uint8_t* bytes = program->rodata + item->start;
+
+        entry->hash = hash_bytes((const char*)bytes, item->length);
+        if (entry->string) continue;
+
+        uint64_t kept;
+        if (pack) {
+            kept = data_item_natural_alignment(item);
+        } else {
+            // Lowest set bit of the offset, so 0 gets the maximum
+            uint64_t low = item->start & (0 - item->start);
+            kept = low && low < RODATA_MAX_ALIGNMENT ? low : RODATA_MAX_ALIGNMENT;
+        }
+        if (kept > item->alignment) {
+            item->alignment = kept;
+        }
+    }
+
+    free(items);
+    *entries_out = entries;
+    return count;
+}
+
+// Entries with identical bytes share the first one. It takes the strictest
+// alignment among them, and is hot if any of them is. Constants are only
+// merged when asked for.
+static bool merge_duplicates(program_t* program, rodata_entry_t* entries, int count, bool constants) {
+    uint32_t slot_count = 16;
+    while (slot_count < (uint32_t)count * 2) slot_count *= 2;
+    int* slots = malloc(slot_count * sizeof(int));
+    if (!slots) return false;
+    memset(slots, -1, slot_count * sizeof(int));
+
+    for (int i = 0; i < count; i++) {
+        rodata_entry_t* entry = &entries[i];
+        uint32_t slot = entry->hash & (slot_count - 1);
+        if (!entry->string && !constants) continue;
+
+        while (slots[slot] >= 0) {
+            rodata_entry_t* other = &entries[slots[slot]];
+            if (other->hash == entry->hash && other->item.length == entry->item.length &&
+                memcmp(program->rodata + other->item.start, program->rodata + entry->item.start,
+                       entry->item.length) == 0) {
+                break;
+            }
+            slot = (slot + 1) & (slot_count - 1);
+        }
+
+        if (slots[slot] < 0) {
+            slots[slot] = i;
+            continue;
+        }
+        data_item_t* survivor = &entries[slots[slot]].item;
+        entry->home = slots[slot];
+        if (entry->item.alignment > survivor->alignment) {
+            survivor->alignment = entry->item.alignment;
+        }
+        survivor->hot |= entry->item.hot;
+    }
+
+    free(slots);
+    return true;
+}
+
+// A surviving string that is a suffix of another lives in that one's tail
+static bool merge_tails(program_t* program, rodata_entry_t* entries, int count) {
+    tail_key_t* keys = malloc((size_t)count * sizeof(tail_key_t));
+    if (!keys) return false;
+
+    int key_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (!entries[i].string || entries[i].home != i) continue;
+        const data_item_t* item = &entries[i].item;
+        keys[key_count++] = (tail_key_t){program->rodata + item->start + item->length - 1, item->length - 1, i};
+    }
+    qsort(keys, key_count, sizeof(tail_key_t), compare_tails);
+
+    // Right to left, so the longer string has found its home already
+    for (int k = key_count - 2; k >= 0; k--) {
+        tail_key_t* shorter = &keys[k];
+        tail_key_t* longer = &keys[k + 1];
+        if (shorter->length > longer->length ||
+            memcmp(shorter->end - shorter->length, longer->end - shorter->length, shorter->length) != 0) {
+            continue;
+        }
+
+        rodata_entry_t* entry = &entries[shorter->entry];
+        rodata_entry_t* target = &entries[longer->entry];
+        entry->home = target->home;
+        entry->delta = target->delta + (longer->length - shorter->length);
+    }
+
+    free(keys);
+    return true;
+}
+
+// Offset of an entry after merging
+static uint64_t final_offset(const rodata_entry_t* entries, int index) {
+    uint64_t offset = 0;
+
+    while (entries[index].home != index) {
+        offset += entries[index].delta;
+        index = entries[index].home;
+    }
+    return offset + entries[index].item.placed;
+}
+
+// Entry holding offset, by binary search
+static int find_entry(const rodata_entry_t* entries, int count, uint64_t offset) {
+    int low = 0;
+    int high = count - 1;
+
+    while (low < high) {
+        int middle = low + (high - low + 1) / 2;
+        if (entries[middle].item.start <= offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+bool rodata_merge(program_t* program, bool pinned, bool pack, bool constants) {
+    if (program->rodata_size == 0) {
+        program->rodata_strings = 0;
+        return true;
+    }
+    if (pinned) {
+        program->rodata_strings = program->rodata_size;
+        return true;
+    }
+
+    rodata_entry_t* entries;
+    int count = collect_entries(program, pack, &entries);
+    if (count < 0) return false;
+
+    uint8_t* merged = NULL;
+    data_item_t** order = malloc((size_t)count * sizeof(data_item_t*));
+    bool ok = order && merge_duplicates(program, entries, count, constants) && merge_tails(program, entries, count);
+
+    // Constants in source order, or packed, then the strings
+    uint64_t size = 0;
+    if (ok) {
+        int constants = 0;
+        for (int i = 0; i < count; i++) {
+            if (entries[i].home == i && !entries[i].string) order[constants++] = &entries[i].item;
+        }
+        if (pack) {
+            data_items_sort(order, constants);
+        }
+        size = program->rodata_strings = data_items_place(order, constants, 0);
+
+        int strings = 0;
+        for (int i = 0; i < count; i++) {
+            if (entries[i].home == i && entries[i].string) order[strings++] = &entries[i].item;
+        }
+        size = data_items_place(order, strings, size);
+
+        merged = calloc(size ? size : 1, 1);
+        ok = merged != NULL;
+    }
+    if (ok) {
+        for (int i = 0; i < count; i++) {
+            const data_item_t* item = &entries[i].item;
+            if (entries[i].home == i) {
+                memcpy(merged + item->placed, program->rodata + item->start, item->length);
+            }
+        }
+
+        // Labels follow their entry, at the same distance from its start;
+        // one at the very end stays at the end
+        symbol_table_t* table = program->symbols;
+        for (int i = 0; i < table->symbol_count; i++) {
+            symbol_t* symbol = &table->symbols[i];
+            if (symbol->type != SYMBOL_LABEL || !symbol->defined || symbol->section != SECTION_RODATA) continue;
+
+            if (symbol->address >= program->rodata_size) {
+                symbol->address = size;
+            } else {
+                int entry = find_entry(entries, count, symbol->address);
+                symbol->address = final_offset(entries, entry) + (symbol->address - entries[entry].item.start);
+            }
+        }
+
+        program->rodata_merged = program->rodata_size > size ? program->rodata_size - size : 0;
+        free(program->rodata);
+        program->rodata = merged;
+        program->rodata_size = program->rodata_capacity = size;
+    }
+
+    free(order);
+    free(entries);
+    return ok;
+}
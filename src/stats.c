@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "../include/stats.h"
+
+// Per-phase statistics for --stats. Time is charged to whichever phase is
+// current, so lexing and encoding (entered from inside the parser) are not
+// counted twice. Reading the hardware counters is a system call, so they
+// are only sampled when a top-level phase starts or ends. Lexing and
+// encoding are therefore included in the parse counters.
+//
+// The current phase is per thread, so under --pipeline the lexer and
+// encoder threads charge their own time and allocations while the main
+// thread parses. Only the main thread enters top-level phases.
+
+stats_t* stats_active = NULL;
+
+static __thread stats_phase_t current_phase;
+static __thread double last_switch;
+
+static const char* phase_names[STATS_PHASE_COUNT] = {
+    "other", "lex", "parse", "encode", "resolve", "write", "wait"
+};
+
+static const char* counter_names[STATS_COUNTER_COUNT] = {
+    "cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+// Counting allocator hook: glibc lets the executable interpose malloc and
+// forward to the real implementation
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static void count_allocation(size_t bytes) {
+    if (stats_active) {
+        stats_phase_data_t* phase = &stats_active->phases[current_phase];
+        phase->malloc_calls++;
+        phase->malloc_bytes += bytes;
+    }
+}
+
+void* malloc(size_t size) {
+    count_allocation(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    count_allocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    count_allocation(size);
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_maxrss;
+}
+
+static bool is_top_level(stats_phase_t phase) {
+    return phase != STATS_PHASE_LEX && phase != STATS_PHASE_ENCODE && phase != STATS_PHASE_WAIT;
+}
+
+#ifdef __linux__
+static void open_counters(stats_t* stats) {
+    static const uint64_t configs[STATS_COUNTER_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.disabled = stats->counter_fd < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, stats->counter_fd, 0);
+        if (fd < 0) continue;
+        if (stats->counter_fd < 0) stats->counter_fd = fd;
+        stats->counter_fds[i] = fd;
+        stats->counter_present[i] = true;
+    }
+
+    if (stats->counter_fd >= 0) {
+        ioctl(stats->counter_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+// Add the counts since the last sample to the current top-level phase
+static void sample_counters(stats_t* stats) {
+    uint64_t buffer[1 + STATS_COUNTER_COUNT];
+
+    if (stats->counter_fd < 0 || read(stats->counter_fd, buffer, sizeof(buffer)) <= 0) {
+        return;
+    }
+
+    // Group members are reported in the order they were opened
+    uint64_t* value = &buffer[1];
+    for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+        if (!stats->counter_present[i]) continue;
+        stats->phases[stats->counter_phase].counters[i] += *value - stats->counter_last[i];
+        stats->counter_last[i] = *value++;
+    }
+}
+
+static void close_counters(stats_t* stats) {
+    for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+        if (stats->counter_present[i]) close(stats->counter_fds[i]);
+    }
+}
+#else
+static void open_counters(stats_t* stats) { (void)stats; }
+static void sample_counters(stats_t* stats) { (void)stats; }
+static void close_counters(stats_t* stats) { (void)stats; }
+#endif
+
+// Every stage can stall at once, so wait time is the one shared total
+static void charge_time(stats_t* stats, double time) {
+    if (current_phase == STATS_PHASE_WAIT) {
+        __atomic_add_fetch(&stats->wait_ns, (uint64_t)((time - last_switch) * 1e9), __ATOMIC_RELAXED);
+    } else {
+        stats->phases[current_phase].seconds += time - last_switch;
+    }
+    last_switch = time;
+}
+
+static void switch_phase(stats_t* stats, stats_phase_t phase) {
+    charge_time(stats, now());
+
+    if (is_top_level(phase) && phase != stats->counter_phase) {
+        sample_counters(stats);
+        stats->phases[stats->counter_phase].rss_kb = peak_rss_kb();
+        stats->counter_phase = phase;
+    }
+    current_phase = phase;
+}
+
+void stats_start(stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->counter_fd = -1;
+    open_counters(stats);
+    current_phase = STATS_PHASE_NONE;
+    last_switch = now();
+    stats_active = stats;
+}
+
+void stats_stop(stats_t* stats) {
+    switch_phase(stats, STATS_PHASE_NONE);
+    stats->peak_rss_kb = peak_rss_kb();
+    close_counters(stats);
+    stats_active = NULL;
+}
+
+// Make phase current; returns the phase to restore with stats_leave
+stats_phase_t stats_enter(stats_phase_t phase) {
+    if (!stats_active) return STATS_PHASE_NONE;
+
+    stats_phase_t previous = current_phase;
+    switch_phase(stats_active, phase);
+    return previous;
+}
+
+void stats_leave(stats_phase_t previous) {
+    if (stats_active) {
+        switch_phase(stats_active, previous);
+    }
+}
+
+// Worker threads start in a nested phase and never touch the counters
+void stats_thread_begin(stats_phase_t phase) {
+    current_phase = phase;
+    last_switch = now();
+}
+
+void stats_thread_end(void) {
+    if (stats_active) {
+        charge_time(stats_active, now());
+    }
+    current_phase = STATS_PHASE_NONE;
+}
+
+// Bytes a phase works through: the output for write, else the input
+static uint64_t phase_bytes(const stats_t* stats, int phase) {
+    return phase == STATS_PHASE_WRITE ? stats->output_bytes : stats->input_bytes;
+}
+
+static double rate(uint64_t amount, double seconds) {
+    return seconds > 0 ? amount / seconds : 0;
+}
+
+static bool counters_available(const stats_t* stats) {
+    return stats->counter_fd >= 0;
+}
+
+static void report_text(const stats_t* stats, FILE* out) {
+    fprintf(out, "Statistics: %llu bytes in, %llu bytes out, %llu tokens, %llu instructions\n",
+            (unsigned long long)stats->input_bytes, (unsigned long long)stats->output_bytes,
+            (unsigned long long)stats->tokens, (unsigned long long)stats->instructions);
+    fprintf(out, "  %-8s %10s %9s %9s %9s %9s %10s %9s\n", "phase", "time ms", "MB/s",
+            "Mtok/s", "Minstr/s", "mallocs", "alloc KB", "RSS KB");
+
+    for (int p = STATS_PHASE_LEX; p < STATS_PHASE_WAIT; p++) {
+        const stats_phase_data_t* phase = &stats->phases[p];
+        fprintf(out, "  %-8s %10.3f %9.1f ", phase_names[p], phase->seconds * 1e3,
+                rate(phase_bytes(stats, p), phase->seconds) / 1e6);
+        if (p == STATS_PHASE_LEX) {
+            fprintf(out, "%9.2f ", rate(stats->tokens, phase->seconds) / 1e6);
+        } else {
+            fprintf(out, "%9s ", "-");
+        }
+        fprintf(out, "%9.2f %9llu %10.1f ", rate(stats->instructions, phase->seconds) / 1e6,
+                (unsigned long long)phase->malloc_calls, phase->malloc_bytes / 1024.0);
+        if (is_top_level(p)) {
+            fprintf(out, "%9ld\n", phase->rss_kb);
+        } else {
+            fprintf(out, "%9s\n", "-");
+        }
+    }
+
+    if (counters_available(stats)) {
+        fprintf(out, "  %-8s %14s %14s %6s %14s %14s\n", "counters", "cycles", "instructions", "IPC",
+                "cache misses", "branch misses");
+        for (int p = STATS_PHASE_PARSE; p < STATS_PHASE_COUNT; p++) {
+            if (!is_top_level(p)) continue;
+            const uint64_t* counters = stats->phases[p].counters;
+            fprintf(out, "  %-8s %14llu %14llu %6.2f %14llu %14llu\n", phase_names[p],
+                    (unsigned long long)counters[STATS_COUNTER_CYCLES],
+                    (unsigned long long)counters[STATS_COUNTER_INSTRUCTIONS],
+                    counters[STATS_COUNTER_CYCLES] ?
+                        (double)counters[STATS_COUNTER_INSTRUCTIONS] / counters[STATS_COUNTER_CYCLES] : 0,
+                    (unsigned long long)counters[STATS_COUNTER_CACHE_MISSES],
+                    (unsigned long long)counters[STATS_COUNTER_BRANCH_MISSES]);
+        }
+        fprintf(out, "  (parse counters include lexing and encoding)\n");
+    } else {
+        fprintf(out, "  Hardware counters unavailable\n");
+    }
+    uint64_t lookups = stats->encode_cache_hits + stats->encode_cache_misses;
+    if (lookups) {
+        fprintf(out, "  Encode cache: %llu hits, %llu misses (%.1f%% hit rate)\n",
+                (unsigned long long)stats->encode_cache_hits, (unsigned long long)stats->encode_cache_misses,
+                100.0 * stats->encode_cache_hits / lookups);
+    }
+    if (stats->wait_ns) {
+        fprintf(out, "  Pipeline stalls: %.3f ms across all stages\n", stats->wait_ns / 1e6);
+    }
+    fprintf(out, "  Peak RSS: %ld KB\n", stats->peak_rss_kb);
+}
+
+static void report_json(const stats_t* stats, FILE* out) {
+    fprintf(out, "{\"input_bytes\":%llu,\"output_bytes\":%llu,\"tokens\":%llu,\"instructions\":%llu,"
+            "\"encode_cache_hits\":%llu,\"encode_cache_misses\":%llu,"
+            "\"peak_rss_kb\":%ld,\"wait_seconds\":%.9f,\"phases\":{",
+            (unsigned long long)stats->input_bytes, (unsigned long long)stats->output_bytes,
+            (unsigned long long)stats->tokens, (unsigned long long)stats->instructions,
+            (unsigned long long)stats->encode_cache_hits, (unsigned long long)stats->encode_cache_misses,
+            stats->peak_rss_kb, stats->wait_ns / 1e9);
+
+    for (int p = STATS_PHASE_LEX; p < STATS_PHASE_WAIT; p++) {
+        const stats_phase_data_t* phase = &stats->phases[p];
+        fprintf(out, "%s\"%s\":{\"seconds\":%.9f,\"bytes_per_second\":%.0f,", p > STATS_PHASE_LEX ? "," : "",
+                phase_names[p], phase->seconds, rate(phase_bytes(stats, p), phase->seconds));
+        if (p == STATS_PHASE_LEX) {
+            fprintf(out, "\"tokens_per_second\":%.0f,", rate(stats->tokens, phase->seconds));
+        }
+        fprintf(out, "\"instructions_per_second\":%.0f,\"malloc_calls\":%llu,\"malloc_bytes\":%llu",
+                rate(stats->instructions, phase->seconds),
+                (unsigned long long)phase->malloc_calls, (unsigned long long)phase->malloc_bytes);
+
+        if (is_top_level(p)) {
+            fprintf(out, ",\"peak_rss_kb\":%ld,\"counters\":", phase->rss_kb);
+            if (counters_available(stats)) {
+                fprintf(out, "{");
+                for (int c = 0; c < STATS_COUNTER_COUNT; c++) {
+                    fprintf(out, "%s\"%s\":", c ? "," : "", counter_names[c]);
+                    if (stats->counter_present[c]) {
+                        fprintf(out, "%llu", (unsigned long long)phase->counters[c]);
+                    } else {
+                        fprintf(out, "null");
+                    }
+                }
+                fprintf(out, "}");
+            } else {
+                fprintf(out, "null");
+            }
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "}}\n");
+}
+
+void stats_report(const stats_t* stats, FILE* out, bool json) {
+    if (json) {
+        report_json(stats, out);
+    } else {
+        report_text(stats, out);
+    }
+}
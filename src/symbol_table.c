@@ -5,35 +5,82 @@
 #include <strings.h>
 #include "../include/symbol_table.h"
 
-#define DEFAULT_BUCKET_COUNT 256
+#define DEFAULT_CAPACITY 256
 
-unsigned int hash_string(const char* str) {
-    unsigned int hash = 5381;
-    int c;
+// Grow the index when it is more than 7/8 full
+#define MAX_LOAD_NUMERATOR 7
+#define MAX_LOAD_DENOMINATOR 8
+
+static uint64_t hash_mix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    uint64_t product = a * b;
+    return product ^ (product >> 29) ^ (b * 0x9e3779b97f4a7c15ULL);
+#endif
+}
+
+// Word-at-a-time multiply-fold hash (wyhash style)
+uint32_t hash_bytes(const char* data, size_t length) {
+    const uint64_t k0 = 0xa0761d6478bd642fULL;
+    const uint64_t k1 = 0xe7037ed1a0b428dbULL;
+    uint64_t seed = k0 ^ length;
     
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+    while (length >= 16) {
+        uint64_t a, b;
+        memcpy(&a, data, 8);
+        memcpy(&b, data + 8, 8);
+        seed = hash_mix(a ^ k1, b ^ seed);
+        data += 16;
+        length -= 16;
     }
     
-    return hash;
+    uint64_t a = 0, b = 0;
+    if (length > 8) {
+        memcpy(&a, data, 8);
+        memcpy(&b, data + 8, length - 8);
+    } else {
+        memcpy(&a, data, length);
+    }
+    
+    uint64_t hash = hash_mix(hash_mix(a ^ k1, b ^ seed), k1 ^ length);
+    uint32_t folded = (uint32_t)(hash ^ (hash >> 32));
+    return folded ? folded : 1; // 0 marks an empty slot
+}
+
+unsigned int hash_string(const char* str) {
+    return hash_bytes(str, strlen(str));
 }
 
-symbol_table_t* symbol_table_create(int bucket_count) {
-    if (bucket_count <= 0) {
-        bucket_count = DEFAULT_BUCKET_COUNT;
+symbol_table_t* symbol_table_create(int initial_capacity) {
+    if (initial_capacity <= 0) {
+        initial_capacity = DEFAULT_CAPACITY;
     }
     
     symbol_table_t* table = malloc(sizeof(symbol_table_t));
     if (!table) return NULL;
     
-    table->buckets = calloc(bucket_count, sizeof(symbol_t*));
-    if (!table->buckets) {
+    // Smallest power of two that holds the initial capacity under the load limit
+    uint32_t slot_count = 16;
+    while ((uint64_t)slot_count * MAX_LOAD_NUMERATOR < (uint64_t)initial_capacity * MAX_LOAD_DENOMINATOR) {
+        slot_count <<= 1;
+    }
+    
+    table->symbols = malloc(initial_capacity * sizeof(symbol_t));
+    table->slots = calloc(slot_count, sizeof(symbol_slot_t));
+    table->names = arena_create(false);
+    if (!table->symbols || !table->slots || !table->names) {
+        free(table->symbols);
+        free(table->slots);
+        arena_destroy(table->names);
         free(table);
         return NULL;
     }
     
-    table->bucket_count = bucket_count;
     table->symbol_count = 0;
+    table->symbol_capacity = initial_capacity;
+    table->slot_mask = slot_count - 1;
     
     return table;
 }
@@ -41,74 +88,172 @@ symbol_table_t* symbol_table_create(int bucket_count) {
 void symbol_table_destroy(symbol_table_t* table) {
     if (!table) return;
     
-    for (int i = 0; i < table->bucket_count; i++) {
-        symbol_t* symbol = table->buckets[i];
-        while (symbol) {
-            symbol_t* next = symbol->next;
-            free(symbol->name);
-            free(symbol);
-            symbol = next;
+    arena_destroy(table->names);
+    free(table->symbols);
+    free(table->slots);
+    free(table);
+}
+
+// Robin Hood insertion: an entry that is further from its home slot than the
+// resident takes the slot, and the resident continues probing
+static void insert_slot(symbol_slot_t* slots, uint32_t mask, symbol_slot_t entry) {
+    uint32_t position = entry.hash & mask;
+    uint32_t distance = 0;
+    
+    while (slots[position].hash) {
+        uint32_t resident_distance = (position - (slots[position].hash & mask)) & mask;
+        if (resident_distance < distance) {
+            symbol_slot_t displaced = slots[position];
+            slots[position] = entry;
+            entry = displaced;
+            distance = resident_distance;
         }
+        position = (position + 1) & mask;
+        distance++;
     }
     
-    free(table->buckets);
-    free(table);
+    slots[position] = entry;
+}
+
+static bool grow_slots(symbol_table_t* table) {
+    uint32_t old_count = table->slot_mask + 1;
+    uint32_t new_count = old_count * 2;
+    symbol_slot_t* slots = calloc(new_count, sizeof(symbol_slot_t));
+    if (!slots) return false;
+    
+    // Rehash from the cached hashes; names are never touched
+    for (uint32_t i = 0; i < old_count; i++) {
+        if (table->slots[i].hash) {
+            insert_slot(slots, new_count - 1, table->slots[i]);
+        }
+    }
+    
+    free(table->slots);
+    table->slots = slots;
+    table->slot_mask = new_count - 1;
+    return true;
+}
+
+static symbol_t* find_symbol(symbol_table_t* table, const char* name, uint32_t hash) {
+    uint32_t mask = table->slot_mask;
+    uint32_t position = hash & mask;
+    uint32_t distance = 0;
+    
+    while (table->slots[position].hash) {
+        const symbol_slot_t* slot = &table->slots[position];
+        
+        // Every entry past this point is closer to its home than we would be
+        if (((position - (slot->hash & mask)) & mask) < distance) break;
+        
+        if (slot->hash == hash) {
+            symbol_t* symbol = &table->symbols[slot->index];
+            if (strcmp(symbol->name, name) == 0) return symbol;
+        }
+        position = (position + 1) & mask;
+        distance++;
+    }
+    
+    return NULL;
 }
 
 symbol_t* symbol_table_lookup(symbol_table_t* table, const char* name) {
     if (!table || !name) return NULL;
     
-    unsigned int hash = hash_string(name);
-    int bucket = hash % table->bucket_count;
+    return find_symbol(table, name, hash_string(name));
+}
+
+// Append a new symbol; the caller has checked that the name is not present
+static symbol_t* add_symbol(symbol_table_t* table, const char* name, uint32_t hash) {
+    if ((uint64_t)(table->symbol_count + 1) * MAX_LOAD_DENOMINATOR >
+        (uint64_t)(table->slot_mask + 1) * MAX_LOAD_NUMERATOR) {
+        if (!grow_slots(table)) return NULL;
+    }
+    
+    if (table->symbol_count == table->symbol_capacity) {
+        int capacity = table->symbol_capacity * 2;
+        symbol_t* symbols = realloc(table->symbols, capacity * sizeof(symbol_t));
+        if (!symbols) return NULL;
+        table->symbols = symbols;
+        table->symbol_capacity = capacity;
+    }
     
-    symbol_t* symbol = table->buckets[bucket];
-    while (symbol) {
-        if (strcmp(symbol->name, name) == 0) {
-            return symbol;
+    char* copy = arena_strdup(table->names, name);
+    if (!copy) return NULL;
+    
+    symbol_t* symbol = &table->symbols[table->symbol_count];
+    symbol->name = copy;
+    symbol->type = SYMBOL_LABEL;
+    symbol->binding = SYMBOL_LOCAL;
+    symbol->address = 0;
+    symbol->defined = false;
+    symbol->hot = false;
+    symbol->section = 0; // Default section
+    symbol->hash = hash;
+    
+    // Insert into hash table
+    symbol_slot_t slot = {hash, (uint32_t)table->symbol_count};
+    insert_slot(table->slots, table->slot_mask, slot);
+    table->symbol_count++;
+    
+    return symbol;
+}
+
+// Copy of a table with the same symbols at the same indices
+symbol_table_t* symbol_table_clone(const symbol_table_t* table) {
+    symbol_table_t* copy = symbol_table_create(table->symbol_count);
+    if (!copy) return NULL;
+    
+    for (int i = 0; i < table->symbol_count; i++) {
+        const symbol_t* symbol = &table->symbols[i];
+        symbol_t* added = add_symbol(copy, symbol->name, symbol->hash);
+        if (!added) {
+            symbol_table_destroy(copy);
+            return NULL;
         }
-        symbol = symbol->next;
+        
+        char* name = added->name;
+        *added = *symbol;
+        added->name = name;
     }
     
-    return NULL;
+    return copy;
 }
 
 symbol_t* symbol_table_define(symbol_table_t* table, const char* name, 
                              symbol_type_t type, uint64_t address) {
     if (!table || !name) return NULL;
     
-    // Check if symbol already exists
-    symbol_t* existing = symbol_table_lookup(table, name);
-    if (existing) {
-        // Update existing symbol
-        existing->type = type;
-        existing->address = address;
-        existing->defined = true;
-        return existing;
-    }
-    
-    // Create new symbol
-    symbol_t* symbol = malloc(sizeof(symbol_t));
-    if (!symbol) return NULL;
+    size_t length = strlen(name);
+    uint32_t hash = hash_bytes(name, length);
     
-    symbol->name = strdup(name);
-    if (!symbol->name) {
-        free(symbol);
-        return NULL;
+    // Update an existing (possibly only declared) symbol or create a new one
+    symbol_t* symbol = find_symbol(table, name, hash);
+    if (!symbol) {
+        symbol = add_symbol(table, name, hash);
+        if (!symbol) return NULL;
     }
     
     symbol->type = type;
     symbol->address = address;
     symbol->defined = true;
-    symbol->section = 0; // Default section
+    return symbol;
+}
+
+// Record a global/extern declaration; the symbol may be defined before or after
+symbol_t* symbol_table_declare(symbol_table_t* table, const char* name,
+                              symbol_binding_t binding) {
+    if (!table || !name) return NULL;
     
-    // Insert into hash table
-    unsigned int hash = hash_string(name);
-    int bucket = hash % table->bucket_count;
+    size_t length = strlen(name);
+    uint32_t hash = hash_bytes(name, length);
     
-    symbol->next = table->buckets[bucket];
-    table->buckets[bucket] = symbol;
-    table->symbol_count++;
+    symbol_t* symbol = find_symbol(table, name, hash);
+    if (!symbol) {
+        symbol = add_symbol(table, name, hash);
+        if (!symbol) return NULL;
+    }
     
+    symbol->binding = binding;
     return symbol;
 }
 
@@ -117,6 +262,31 @@ bool symbol_table_is_defined(symbol_table_t* table, const char* name) {
     return symbol && symbol->defined;
 }
 
+void symbol_table_foreach(symbol_table_t* table, symbol_visitor_t visitor, void* context) {
+    if (!table || !visitor) return;
+    
+    // Definition order
+    for (int i = 0; i < table->symbol_count; i++) {
+        visitor(&table->symbols[i], context);
+    }
+}
+
+static void print_symbol(symbol_t* symbol, void* context) {
+    (void)context;
+    
+    const char* type_str;
+    switch (symbol->type) {
+        case SYMBOL_LABEL: type_str = "LABEL"; break;
+        case SYMBOL_CONSTANT: type_str = "CONST"; break;
+        case SYMBOL_VARIABLE: type_str = "VAR"; break;
+        default: type_str = "UNKNOWN"; break;
+    }
+    
+    printf("%-20s %-10s 0x%014lx %-8s\n", 
+           symbol->name, type_str, symbol->address,
+           symbol->defined ? "YES" : "NO");
+}
+
 void symbol_table_print(symbol_table_t* table) {
     if (!table) return;
     
@@ -124,22 +294,5 @@ void symbol_table_print(symbol_table_t* table) {
     printf("%-20s %-10s %-16s %-8s\n", "Name", "Type", "Address", "Defined");
     printf("%-20s %-10s %-16s %-8s\n", "----", "----", "-------", "-------");
     
-    for (int i = 0; i < table->bucket_count; i++) {
-        symbol_t* symbol = table->buckets[i];
-        while (symbol) {
-            const char* type_str;
-            switch (symbol->type) {
-                case SYMBOL_LABEL: type_str = "LABEL"; break;
-                case SYMBOL_CONSTANT: type_str = "CONST"; break;
-                case SYMBOL_VARIABLE: type_str = "VAR"; break;
-                default: type_str = "UNKNOWN"; break;
-            }
-            
-            printf("%-20s %-10s 0x%014lx %-8s\n", 
-                   symbol->name, type_str, symbol->address,
-                   symbol->defined ? "YES" : "NO");
-            
-            symbol = symbol->next;
-        }
-    }
+    symbol_table_foreach(table, print_symbol, NULL);
 } 
\ No newline at end of file